@@ -32,6 +32,71 @@
 // used to step through the attributes when enumerating events
 static int attr_idx;
 
+/** @class  hash_event_name
+ *  @brief  hash of an event name, for the native event name_hash
+ */
+
+static unsigned int hash_event_name(const char *name) {
+
+  unsigned int hash = 2166136261U;
+
+  while (*name) {
+     hash ^= (unsigned char)*name++;
+     hash *= 16777619U;
+  }
+  return hash;
+}
+
+/** @class  add_name_to_hash
+ *  @brief  makes a native event findable by its allocated_name
+ *
+ *  @param[in] nevt_idx
+ *             -- index of the entry in the native event table
+ *  @param[in] event_table
+ *             -- native_event_table structure
+ *
+ *  The hash is grown (and rebuilt from the events already in the
+ *  table) so there are at least as many buckets as events.
+ *  Must be called with NAMELIB_LOCK held.
+ */
+
+static void add_name_to_hash(int nevt_idx,
+                             struct native_event_table_t *event_table) {
+
+  int i, new_size, *new_hash;
+  unsigned int bucket;
+
+  if (nevt_idx >= event_table->name_hash_size) {
+     new_size = event_table->name_hash_size;
+     if (new_size == 0) new_size = NATIVE_EVENT_CHUNK;
+     while (new_size <= nevt_idx) new_size *= 2;
+
+     new_hash = malloc(new_size * sizeof(int));
+     if (new_hash == NULL) {
+        /* keep the old buckets, chains just get longer */
+        SUBDBG("Could not grow name_hash to %d entries\n", new_size);
+        if (event_table->name_hash == NULL) return;
+     } else {
+        for (i = 0; i < new_size; i++) {
+           new_hash[i] = -1;
+        }
+        free(event_table->name_hash);
+        event_table->name_hash = new_hash;
+        event_table->name_hash_size = new_size;
+
+        for (i = 0; i < event_table->num_native_events; i++) {
+           bucket = hash_event_name(event_table->native_events[i].allocated_name) % new_size;
+           event_table->native_events[i].name_next = event_table->name_hash[bucket];
+           event_table->name_hash[bucket] = i;
+        }
+     }
+  }
+
+  bucket = hash_event_name(event_table->native_events[nevt_idx].allocated_name) % event_table->name_hash_size;
+  event_table->native_events[nevt_idx].name_next = event_table->name_hash[bucket];
+  event_table->name_hash[bucket] = nevt_idx;
+}
+
 /** @class  find_existing_event
  *  @brief  looks up an event, returns it if it exists
  *
@@ -52,26 +117,23 @@ static int find_existing_event(char *name,
 
   _papi_hwi_lock( NAMELIB_LOCK );
 
-  for(i=0;i<event_table->num_native_events;i++) {
-    // Most names passed in will contain the pmu name, so first we compare to the allocated name (it has pmu name on front)
-    if (!strcmp(name,event_table->native_events[i].allocated_name)) {
-      SUBDBG("Found allocated_name: %s, libpfm4_idx: %#x, papi_event_code: %#x\n", 
-         event_table->native_events[i].allocated_name, event_table->native_events[i].libpfm4_idx, event_table->native_events[i].papi_event_code);
-      event=i;
-      break;
-    }
-    // some callers have an event name without the pmu name on the front, so we also compare to the base name (just the event name part)
-    if (!strcmp(name,event_table->native_events[i].base_name)) {
-      int nameLen = strlen(event_table->native_events[i].base_name);
-      // the name we are looking for must be the same length as this event table entry name for them to match
-      if (strlen(name) != nameLen + strlen(event_table->native_events[i].mask_string) + 1) {
-        continue;
+  // the names passed in are compared to the allocated name (it has pmu name on front)
+  if (event_table->name_hash != NULL) {
+    i = event_table->name_hash[hash_event_name(name) % event_table->name_hash_size];
+    for( ; i >= 0; i = event_table->native_events[i].name_next) {
+      if (!strcmp(name,event_table->native_events[i].allocated_name)) {
+        SUBDBG("Found allocated_name: %s, libpfm4_idx: %#x, papi_event_code: %#x\n", 
+           event_table->native_events[i].allocated_name, event_table->native_events[i].libpfm4_idx, event_table->native_events[i].papi_event_code);
+        event=i;
+        break;
       }
-      if(!strcmp(name+nameLen+1, event_table->native_events[i].mask_string)) {
-          SUBDBG("Found base_name: %s, mask_string: %s, libpfm4_idx: %#x, papi_event_code: %#x\n",
-            event_table->native_events[i].base_name, event_table->native_events[i].mask_string , event_table->native_events[i].libpfm4_idx, event_table->native_events[i].papi_event_code);
-          event=i;
-          break;
+    }
+  } else {
+    // no hash (could not allocate it), search the whole table
+    for(i=0;i<event_table->num_native_events;i++) {
+      if (!strcmp(name,event_table->native_events[i].allocated_name)) {
+        event=i;
+        break;
       }
     }
   }
@@ -82,6 +144,85 @@ static int find_existing_event(char *name,
 }
 
 
+/** @class  set_code_to_ntv_idx
+ *  @brief  remembers which native event table entry a papi event code uses
+ *
+ *  @param[in] papi_event_code
+ *             -- papi event code of the native event
+ *  @param[in] nevt_idx
+ *             -- index of the entry in the native event table
+ *  @param[in] event_table
+ *             -- native_event_table structure
+ *
+ *  Must be called with NAMELIB_LOCK held.
+ */
+
+static void set_code_to_ntv_idx(int papi_event_code, int nevt_idx,
+                                struct native_event_table_t *event_table) {
+
+  int i, code_idx, new_size;
+  int *new_table;
+
+  if (papi_event_code < 0) return;
+
+  code_idx = papi_event_code & PAPI_NATIVE_AND_MASK;
+
+  if (code_idx >= event_table->code_to_idx_size) {
+     new_size = event_table->code_to_idx_size;
+     if (new_size == 0) new_size = NATIVE_EVENT_CHUNK;
+     while (new_size <= code_idx) new_size *= 2;
+
+     new_table = realloc(event_table->code_to_idx, new_size * sizeof(int));
+     if (new_table == NULL) {
+        /* lookups will fall back to scanning the table */
+        SUBDBG("Could not grow code_to_idx to %d entries\n", new_size);
+        return;
+     }
+     for (i = event_table->code_to_idx_size; i < new_size; i++) {
+        new_table[i] = -1;
+     }
+     event_table->code_to_idx = new_table;
+     event_table->code_to_idx_size = new_size;
+  }
+
+  event_table->code_to_idx[code_idx] = nevt_idx;
+}
+
+/** @class  _pe_libpfm4_code_to_ntv_idx
+ *  @brief  finds the native event table entry used by a papi event code
+ *
+ *  @param[in] papi_event_code
+ *             -- papi event code of the native event
+ *  @param[in] event_table
+ *             -- native_event_table structure
+ *
+ *  @returns index into event_table->native_events or PAPI_ENOEVNT
+ */
+
+int _pe_libpfm4_code_to_ntv_idx(unsigned int papi_event_code,
+                                struct native_event_table_t *event_table) {
+
+  int i, code_idx;
+
+  code_idx = papi_event_code & PAPI_NATIVE_AND_MASK;
+
+  if ((code_idx < event_table->code_to_idx_size) &&
+      (event_table->code_to_idx[code_idx] >= 0)) {
+     return event_table->code_to_idx[code_idx];
+  }
+
+  /* not indexed (allocation failed earlier), search for it */
+  for (i = event_table->num_native_events - 1; i >= 0; i--) {
+     if (event_table->native_events[i].papi_event_code ==
+         (int)papi_event_code) {
+        return i;
+     }
+  }
+
+  return PAPI_ENOEVNT;
+}
+
+
 static int pmu_is_present_and_right_type(pfm_pmu_info_t *pinfo, int type) {
 //   SUBDBG("ENTER: pinfo: %p, pinfo->is_present: %d, pinfo->type: %#x, type: %#x\n", pinfo, pinfo->is_present, pinfo->type, type);
   if (!pinfo->is_present) {
@@ -129,6 +270,7 @@ static struct native_event_t *allocate_native_event(char *name, int libpfm4_inde
   int nevt_idx;
   int event_num;
   int encode_failed=0;
+  int new_event_code;
 
   pfm_err_t ret;
   char *event_string=NULL;
@@ -168,6 +310,14 @@ static struct native_event_t *allocate_native_event(char *name, int libpfm4_inde
 
   SUBDBG("event_num: %d, nevt_idx: %d, ntv_evt: %p\n", event_num, nevt_idx, ntv_evt);
 
+  // an event resolved by an earlier process comes from the cache, libpfm4 is not needed
+  if (_papi_libpfm4_cache_lookup(name, ntv_evt, event_table) == PAPI_OK) {
+     libpfm4_index = ntv_evt->libpfm4_idx;
+     ntv_evt->component=_pe_libpfm4_get_cidx();
+     ntv_evt->users=0;
+     goto publish;
+  }
+
   /* clear the argument and attribute structures */
   memset(&perf_arg,0,sizeof(pfm_perf_encode_arg_t));
   memset(&(ntv_evt->attr),0,sizeof(struct perf_event_attr));
@@ -357,12 +507,19 @@ static struct native_event_t *allocate_native_event(char *name, int libpfm4_inde
 		free (msk_ptr);
 	}
 
+	// the cache file is missing this one
+	if (encode_failed == 0) {
+		event_table->cache.stale = 1;
+	}
+
+publish:
 	// create a papi table for this native event, put the index into the event sets array of native events into the papi table
-	int new_event_code = _papi_hwi_native_to_eventcode(_pe_libpfm4_get_cidx(), libpfm4_index, nevt_idx, ntv_evt->allocated_name);
+	new_event_code = _papi_hwi_native_to_eventcode(_pe_libpfm4_get_cidx(), libpfm4_index, nevt_idx, ntv_evt->allocated_name);
 	_papi_hwi_set_papi_event_string((const char *)ntv_evt->allocated_name);
 	_papi_hwi_set_papi_event_code(new_event_code, 1);
 
 	ntv_evt->papi_event_code=new_event_code;
+	set_code_to_ntv_idx(new_event_code, nevt_idx, event_table);
 
 	SUBDBG("Using %#x as index for %s\n", ntv_evt->libpfm4_idx, fullname);
 	SUBDBG("num_native_events: %d, allocated_native_events: %d\n", event_table->num_native_events, event_table->allocated_native_events);
@@ -373,6 +530,11 @@ static struct native_event_t *allocate_native_event(char *name, int libpfm4_inde
 		ntv_evt->attr.config1, ntv_evt->attr.config2, ntv_evt->attr.type,
 		ntv_evt->attr.exclude_user, ntv_evt->attr.exclude_kernel, ntv_evt->attr.exclude_guest);
 
+  // new events have to be findable by name from now on
+  if (event_num < 0) {
+     add_name_to_hash(nevt_idx, event_table);
+  }
+
   /* If we've used all of the allocated native events, then allocate more room */
   if (event_table->num_native_events >=
       event_table->allocated_native_events-1) {
@@ -1011,6 +1173,9 @@ _pe_libpfm4_shutdown(papi_vector_t *my_vector,
 	  }
   }
 
+  /* anything resolved since init goes to the cache file */
+  _papi_libpfm4_cache_close(event_table);
+
   /* clean out and free the native events structure */
   _papi_hwi_lock( NAMELIB_LOCK );
 
@@ -1029,6 +1194,14 @@ _pe_libpfm4_shutdown(papi_vector_t *my_vector,
 
   free(event_table->native_events);
 
+  free(event_table->code_to_idx);
+  event_table->code_to_idx=NULL;
+  event_table->code_to_idx_size=0;
+
+  free(event_table->name_hash);
+  event_table->name_hash=NULL;
+  event_table->name_hash_size=0;
+
   _papi_hwi_unlock( NAMELIB_LOCK );
 
   SUBDBG("EXIT: PAPI_OK\n");
@@ -1136,16 +1309,23 @@ _pe_libpfm4_init(papi_vector_t *my_vector, int cidx,
                                    event_table->default_pmu.num_fixed_cntrs;
 
    SUBDBG( "num_counters: %d\n", my_vector->cmp_info.num_cntrs );
+
+   /* events resolved by an earlier process need not go through libpfm4 */
+   _papi_libpfm4_cache_open(my_vector, event_table);
    
    /* Setup presets, only if Component 0 */
    if (cidx==0) {
       retval = _papi_load_preset_table( (char *)event_table->default_pmu.name, 
 				     event_table->default_pmu.pmu, cidx );
       if ( retval ) {
+         _papi_libpfm4_cache_close(event_table);
          return retval;
       }
    }
 
+   /* keep what the presets resolved for the processes that come next */
+   _papi_libpfm4_cache_save(event_table);
+
    return PAPI_OK;
 }
 
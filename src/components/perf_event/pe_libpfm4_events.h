@@ -28,3 +28,6 @@ int _pe_libpfm4_ntv_code_to_info(unsigned int EventCode,
 		       struct native_event_table_t *event_table);
 
 int _pe_libpfm4_get_cidx(void);
+
+int _pe_libpfm4_code_to_ntv_idx(unsigned int papi_event_code,
+		       struct native_event_table_t *event_table);
@@ -31,6 +31,9 @@
 #include <sys/utsname.h>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <pthread.h>
 
 /* PAPI-specific includes */
 #include "papi.h"
@@ -53,6 +56,7 @@
 #include "linux-context.h"
 
 #include "perf_event_lib.h"
+#include "perf_helpers.h"
 
 /* Defines for ctx->state */
 #define PERF_EVENTS_OPENED  0x01
@@ -80,19 +84,13 @@ _pe_libpfm4_get_cidx() {
 
 #define WAKEUP_MODE_COUNTER_OVERFLOW 0
 #define WAKEUP_MODE_PROFILING 1
-
-/* The kernel developers say to never use a refresh value of 0        */
-/* See https://lkml.org/lkml/2011/5/24/172                            */
-/* However, on some platforms (like Power) a value of 1 does not work */
-/* We're still tracking down why this happens.                        */
-
-#if defined(__powerpc__)
-#define PAPI_REFRESH_VALUE 0
-#else
-#define PAPI_REFRESH_VALUE 1
-#endif
+#define WAKEUP_MODE_DRAIN 2
 
 static int _pe_set_domain( hwd_control_state_t *ctl, int domain);
+static int drain_add( pe_control_t *ctl, int evt_idx );
+static void drain_remove( pe_event_info_t *pe );
+static void drain_activate( pe_control_t *ctl, int active );
+static void drain_shutdown( void );
 
 /* Check for processor support */
 /* Can be used for generic checking, though in general we only     */
@@ -575,6 +573,13 @@ tune_up_fd( pe_control_t *ctl, int evt_idx )
    void *buf_addr;
    int fd = ctl->events[evt_idx].event_fd;
 
+   /* Events set up with PAPI_sample() are polled, and the drain */
+   /* thread waits on the fd itself: no signals for either.       */
+   if ( ( ctl->events[evt_idx].sample_fields ) ||
+	( ctl->events[evt_idx].wakeup_mode == WAKEUP_MODE_DRAIN ) ) {
+      goto map_buffer;
+   }
+
    /* Register that we would like a SIGIO notification when a mmap'd page */
    /* becomes full.                                                       */
    ret = fcntl( fd, F_SETFL, O_ASYNC | O_NONBLOCK );
@@ -589,14 +594,6 @@ tune_up_fd( pe_control_t *ctl, int evt_idx )
    ret=fcntl_setown_fd(fd);
    if (ret!=PAPI_OK) return ret;
 
-   /* Set FD_CLOEXEC.  Otherwise if we do an exec with an overflow */
-   /* running, the overflow handler will continue into the exec()'d*/
-   /* process and kill it because no signal handler is set up.     */
-   ret=fcntl(fd, F_SETFD, FD_CLOEXEC);
-   if (ret) {
-      return PAPI_ESYS;
-   }
-
    /* when you explicitely declare that you want a particular signal,  */
    /* even with you use the default signal, the kernel will send more  */
    /* information concerning the event to the signal handler.          */
@@ -612,6 +609,15 @@ tune_up_fd( pe_control_t *ctl, int evt_idx )
       return PAPI_ESYS;
    }
 
+map_buffer:
+   /* Set FD_CLOEXEC.  Otherwise if we do an exec with an overflow */
+   /* running, the overflow handler will continue into the exec()'d*/
+   /* process and kill it because no signal handler is set up.     */
+   ret=fcntl(fd, F_SETFD, FD_CLOEXEC);
+   if (ret) {
+      return PAPI_ESYS;
+   }
+
    /* mmap() the sample buffer */
    buf_addr = mmap( NULL, ctl->events[evt_idx].nr_mmap_pages * getpagesize(),
 		    PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
@@ -629,18 +635,194 @@ tune_up_fd( pe_control_t *ctl, int evt_idx )
    ctl->events[evt_idx].tail = 0;
    ctl->events[evt_idx].mask = ( ctl->events[evt_idx].nr_mmap_pages - 1 ) *
                                getpagesize() - 1;
+   ctl->events[evt_idx].sample_pos = 0;
+   ctl->events[evt_idx].lost = 0;
+
+   if ( ctl->events[evt_idx].wakeup_mode == WAKEUP_MODE_DRAIN ) {
+      return drain_add( ctl, evt_idx );
+   }
+
+   return PAPI_OK;
+}
+
+/* Can the events in this control state be read with rdpmc?           */
+/* The counters have to belong to the calling thread (rdpmc reads the */
+/* counter of whatever is running on the current cpu), must not be    */
+/* multiplexed or inherited, and must not be sampling.                */
+static int
+rdpmc_usable( pe_control_t *ctl )
+{
+   int i;
+
+   if ( !_perf_event_vector.cmp_info.fast_counter_read ) return 0;
+
+   if ( ( ctl->granularity != PAPI_GRN_THR ) || ( ctl->tid != 0 ) ||
+        ctl->multiplexed || ctl->inherit || ctl->overflow ) {
+      return 0;
+   }
+
+   for( i = 0; i < ctl->num_events; i++ ) {
+      if ( ( ctl->events[i].cpu != -1 ) ||
+	   ( ctl->attrs[i].sample_period ) ) {
+	 return 0;
+      }
+   }
+
+   return 1;
+}
+
+/* Map the control page of an event so it can be read with rdpmc */
+static int
+map_rdpmc_page( pe_control_t *ctl, int evt_idx )
+{
+   void *buf_addr;
+   int fd = ctl->events[evt_idx].event_fd;
+
+   buf_addr = mmap( NULL, getpagesize(), PROT_READ, MAP_SHARED, fd, 0 );
+   if ( buf_addr == MAP_FAILED ) {
+      SUBDBG( "mmap of rdpmc page for fd %d failed: %s\n",
+	      fd, strerror( errno ) );
+      return PAPI_ESYS;
+   }
+
+   ctl->events[evt_idx].mmap_buf = buf_addr;
+   ctl->events[evt_idx].nr_mmap_pages = 1;
+
+   return PAPI_OK;
+}
+
+
+
+/* Make room for num events in the per-event arrays of a control   */
+/* state.  They are grown by doubling, so an EventSet only pays for */
+/* the events it actually has.  Open events are carried over.       */
+static int
+resize_pe_control( pe_control_t *ctl, int num )
+{
+   int max;
+   char *block;
+   pe_event_info_t *events;
+   long long *counts;
+   struct perf_event_attr *attrs;
+
+   if ( num <= ctl->max_events ) return PAPI_OK;
+
+   if ( num > PERF_EVENT_MAX_MPX_COUNTERS ) return PAPI_ECOUNT;
+
+   max = ctl->max_events ? ctl->max_events : PERF_EVENT_MIN_CTL_EVENTS;
+   while ( max < num ) max *= 2;
+   if ( max > PERF_EVENT_MAX_MPX_COUNTERS ) max = PERF_EVENT_MAX_MPX_COUNTERS;
+
+   /* one block, carved up into the three arrays */
+   block = papi_calloc( ( size_t ) max, sizeof ( pe_event_info_t ) +
+			sizeof ( long long ) +
+			sizeof ( struct perf_event_attr ) );
+   if ( block == NULL ) return PAPI_ENOMEM;
+
+   events = ( pe_event_info_t * ) block;
+   counts = ( long long * ) ( events + max );
+   attrs = ( struct perf_event_attr * ) ( counts + max );
+
+   if ( ctl->max_events ) {
+      memcpy( events, ctl->events,
+	      ctl->max_events * sizeof ( pe_event_info_t ) );
+      memcpy( counts, ctl->counts, ctl->max_events * sizeof ( long long ) );
+      memcpy( attrs, ctl->attrs,
+	      ctl->max_events * sizeof ( struct perf_event_attr ) );
+      papi_free( ctl->events );
+   }
+
+   SUBDBG( "control state %p now has room for %d events\n", ctl, max );
+
+   ctl->events = events;
+   ctl->counts = counts;
+   ctl->attrs = attrs;
+   ctl->max_events = max;
 
    return PAPI_OK;
 }
 
+/* Release the per-event arrays, the events must be closed */
+static void
+free_pe_control( pe_control_t *ctl )
+{
+   if ( ctl->max_events ) {
+      papi_free( ctl->events );
+   }
+   if ( ctl->sample_buf ) {
+      papi_free( ctl->sample_buf );
+   }
+   ctl->sample_buf = NULL;
+   ctl->sample_buf_size = 0;
+   ctl->events = NULL;
+   ctl->counts = NULL;
+   ctl->attrs = NULL;
+   ctl->max_events = 0;
+}
+
+/* Set up the attr of an event that leads a group */
+static void
+set_group_leader( pe_control_t *ctl, int evt_idx )
+{
+   ctl->attrs[evt_idx].pinned = !ctl->multiplexed;
+   ctl->attrs[evt_idx].disabled = 1;
+   ctl->events[evt_idx].group_leader_fd = -1;
+   ctl->attrs[evt_idx].read_format = get_read_format(ctl->multiplexed,
+							   ctl->inherit, 1 );
+}
+
+/* Set up the attr of an event that joins the group led by leader_idx */
+static void
+set_group_member( pe_control_t *ctl, int evt_idx, int leader_idx )
+{
+   ctl->attrs[evt_idx].pinned = 0;
+   ctl->attrs[evt_idx].disabled = 0;
+   ctl->events[evt_idx].group_leader_fd = ctl->events[leader_idx].event_fd;
+   ctl->attrs[evt_idx].read_format = get_read_format(ctl->multiplexed,
+							   ctl->inherit, 0 );
+}
+
+/* How many events go into each group when we are multiplexing.     */
+/* A group is scheduled all-or-nothing so there is no point making  */
+/* it larger than the number of counters; the NMI watchdog steals   */
+/* one of them.  If the group can not be read with FORMAT_GROUP we  */
+/* fall back to one event per group.                                */
+static int
+get_max_mpx_group_size( pe_control_t *ctl )
+{
+   int size;
+
+   if ( !ctl->multiplexed ) return ctl->num_events;
+
+   if ( bug_format_group() || ctl->inherit ) return 1;
 
+   size = _perf_event_vector.cmp_info.num_cntrs - nmi_watchdog_active;
+   if ( size < 1 ) size = 1;
 
-/* Open all events in the control state */
+   return size;
+}
+
+/* Open a single event, its attr and group leader must be set up */
+static int
+open_pe_event( pe_control_t *ctl, int evt_idx, long pid )
+{
+   return sys_perf_event_open( &ctl->attrs[evt_idx],
+			       pid,
+			       ctl->events[evt_idx].cpu,
+			       ctl->events[evt_idx].group_leader_fd,
+			       0 /* flags */ );
+}
+
+/* Open the events in the control state from position start on.       */
+/* Events before start are already open; new events join their groups. */
 static int
-open_pe_events( pe_context_t *ctx, pe_control_t *ctl )
+open_pe_events( pe_context_t *ctx, pe_control_t *ctl, int start )
 {
 
-   int i, ret = PAPI_OK;
+   int i, g, ret = PAPI_OK;
+   int max_group_size, num_groups = 0;
+   int leaders[PERF_EVENT_MAX_MPX_COUNTERS];
+   int group_sizes[PERF_EVENT_MAX_MPX_COUNTERS];
    long pid;
 
    if (ctl->granularity==PAPI_GRN_SYS) {
@@ -650,39 +832,69 @@ open_pe_events( pe_context_t *ctx, pe_control_t *ctl )
       pid = ctl->tid;
    }
 
-   for( i = 0; i < ctl->num_events; i++ ) {
+   max_group_size = get_max_mpx_group_size( ctl );
+
+   /* Find the groups of the events that are already open */
+   for( i = 0; i < start; i++ ) {
+      if ( ctl->events[i].group_leader_fd == -1 ) {
+	 leaders[num_groups] = i;
+	 group_sizes[num_groups] = 1;
+	 num_groups++;
+      } else {
+	 for( g = 0; g < num_groups; g++ ) {
+	    if ( ctl->events[leaders[g]].event_fd ==
+		 ctl->events[i].group_leader_fd ) {
+	       group_sizes[g]++;
+	       break;
+	    }
+	 }
+      }
+   }
+
+   for( i = start; i < ctl->num_events; i++ ) {
 
       ctl->events[i].event_opened=0;
+      ctl->events[i].event_fd=-1;
 
       /* set up the attr structure.  We don't set up all fields here */
       /* as some have already been set up previously.                */
 
-      /* group leader (event 0) is special                */
-      /* If we're multiplexed, everyone is a group leader */
-      if (( i == 0 ) || (ctl->multiplexed)) {
-         ctl->events[i].attr.pinned = !ctl->multiplexed;
-	 ctl->events[i].attr.disabled = 1;
-	 ctl->events[i].group_leader_fd=-1;
-         ctl->events[i].attr.read_format = get_read_format(ctl->multiplexed, 
-							   ctl->inherit, 
-							   !ctl->multiplexed );
-      } else {
-	 ctl->events[i].attr.pinned=0;
-	 ctl->events[i].attr.disabled = 0;
-	 ctl->events[i].group_leader_fd=ctl->events[0].event_fd;
-         ctl->events[i].attr.read_format = get_read_format(ctl->multiplexed, 
-							   ctl->inherit, 
-							   0 );
+      /* If we're multiplexed, pack the events first-fit into the   */
+      /* groups opened so far.  The kernel validates that a group   */
+      /* can be scheduled when a member is added, so a failed open  */
+      /* just means "try the next group".  The kernel rotates the   */
+      /* groups; each one is read with a single read().             */
+      if ( ctl->multiplexed ) {
+	 for( g = 0; g < num_groups; g++ ) {
+	    if ( group_sizes[g] >= max_group_size ) continue;
+
+	    set_group_member( ctl, i, leaders[g] );
+	    ctl->events[i].event_fd = open_pe_event( ctl, i, pid );
+	    if ( ctl->events[i].event_fd != -1 ) {
+	       group_sizes[g]++;
+	       break;
+	    }
+	    SUBDBG("event #%d does not fit group led by #%d\n",
+		   i, leaders[g]);
+	 }
+      }
+      /* group leader (event 0) is special */
+      else if ( i != 0 ) {
+	 set_group_member( ctl, i, 0 );
+	 ctl->events[i].event_fd = open_pe_event( ctl, i, pid );
       }
 
-
-      /* try to open */
-      ctl->events[i].event_fd = sys_perf_event_open( &ctl->events[i].attr, 
-						     pid,
-						     ctl->events[i].cpu,
-			       ctl->events[i].group_leader_fd,
-						     0 /* flags */
-						     );
+      /* start a new group */
+      if ( ( ctl->events[i].event_fd == -1 ) &&
+	   ( ( i == 0 ) || ( ctl->multiplexed ) ) ) {
+	 set_group_leader( ctl, i );
+	 ctl->events[i].event_fd = open_pe_event( ctl, i, pid );
+	 if ( ctl->events[i].event_fd != -1 ) {
+	    leaders[num_groups] = i;
+	    group_sizes[num_groups] = 1;
+	    num_groups++;
+	 }
+      }
 
             /* Try to match Linux errors to PAPI errors */
       if ( ctl->events[i].event_fd == -1 ) {
@@ -698,7 +910,7 @@ open_pe_events( pe_context_t *ctx, pe_control_t *ctl )
               " group_leader/fd: %d, event_fd: %d,"
               " read_format: %"PRIu64"\n",
 	      pid, ctl->events[i].cpu, ctl->events[i].group_leader_fd,
-	      ctl->events[i].event_fd, ctl->events[i].attr.read_format);
+	      ctl->events[i].event_fd, ctl->attrs[i].read_format);
 
 
       /* in many situations the kernel will indicate we opened fine */
@@ -724,19 +936,35 @@ open_pe_events( pe_context_t *ctx, pe_control_t *ctl )
    /* Now that we've successfully opened all of the events, do whatever  */
    /* "tune-up" is needed to attach the mmap'd buffers, signal handlers, */
    /* and so on.                                                         */
+   ctl->rdpmc = rdpmc_usable( ctl );
+
    for ( i = 0; i < ctl->num_events; i++ ) {
 
+      /* Events that were already open only need their rdpmc page */
+      if ( i < start ) {
+	 if ( ( ctl->rdpmc ) && ( ctl->events[i].mmap_buf == NULL ) &&
+	      ( map_rdpmc_page( ctl, i ) != PAPI_OK ) ) {
+	    ctl->rdpmc = 0;
+	 }
+	 continue;
+      }
+
+      /* Make sure this is NULL so close_pe_events works right */
+      ctl->events[i].mmap_buf = NULL;
+
       /* If sampling is enabled, hook up signal handler */
-      if ((ctl->events[i].attr.sample_period)  &&  (ctl->events[i].nr_mmap_pages > 0)) {
+      if ((ctl->attrs[i].sample_period)  &&  (ctl->events[i].nr_mmap_pages > 0)) {
 	 ret = tune_up_fd( ctl, i );
 	 if ( ret != PAPI_OK ) {
 	    /* All of the fds are open, so we need to clean up all of them */
 	    i = ctl->num_events;
 	    goto open_pe_cleanup;
 	 }
-      } else {
-	 /* Make sure this is NULL so close_pe_events works right */
-	 ctl->events[i].mmap_buf = NULL;
+      } else if ( ctl->rdpmc ) {
+	 /* If we cannot map the page just use read() for this set */
+	 if ( map_rdpmc_page( ctl, i ) != PAPI_OK ) {
+	    ctl->rdpmc = 0;
+	 }
       }
    }
 
@@ -749,8 +977,14 @@ open_pe_cleanup:
    /* We encountered an error, close up the fds we successfully opened.  */
    /* We go backward in an attempt to close group leaders last, although */
    /* That's probably not strictly necessary.                            */
-   while ( i > 0 ) {
+   while ( i > start ) {
       i--;
+      drain_remove( &ctl->events[i] );
+      if ( ctl->events[i].mmap_buf ) {
+	 munmap( ctl->events[i].mmap_buf,
+		 ctl->events[i].nr_mmap_pages * getpagesize() );
+	 ctl->events[i].mmap_buf = NULL;
+      }
       if (ctl->events[i].event_fd>=0) {
 	 close( ctl->events[i].event_fd );
 	 ctl->events[i].event_opened=0;
@@ -760,6 +994,66 @@ open_pe_cleanup:
    return ret;
 }
 
+/* Re-arrange the opened events so the members of each group follow */
+/* their leader, keeping the order in which they joined the group    */
+/* (which is the order the kernel returns their values in).          */
+/* The new positions are reported back through ni_position.          */
+static int
+order_pe_groups( pe_control_t *ctl, NativeInfo_t *native, int count )
+{
+   int i, j, pos = 0;
+   int new_pos[PERF_EVENT_MAX_MPX_COUNTERS];
+   pe_event_info_t *sorted;
+   struct perf_event_attr *sorted_attrs;
+
+   sorted = papi_malloc( ctl->num_events * ( sizeof ( pe_event_info_t ) +
+					     sizeof ( struct perf_event_attr ) ) );
+   if ( sorted == NULL ) {
+      return PAPI_ENOMEM;
+   }
+   sorted_attrs = ( struct perf_event_attr * ) ( sorted + ctl->num_events );
+
+   for( i = 0; i < ctl->num_events; i++ ) {
+      if ( ctl->events[i].group_leader_fd != -1 ) continue;
+
+      new_pos[i] = pos;
+      memcpy( &sorted_attrs[pos], &ctl->attrs[i],
+	      sizeof ( struct perf_event_attr ) );
+      memcpy( &sorted[pos++], &ctl->events[i], sizeof ( pe_event_info_t ) );
+
+      for( j = i + 1; j < ctl->num_events; j++ ) {
+	 if ( ctl->events[j].group_leader_fd == ctl->events[i].event_fd ) {
+	    new_pos[j] = pos;
+	    memcpy( &sorted_attrs[pos], &ctl->attrs[j],
+		    sizeof ( struct perf_event_attr ) );
+	    memcpy( &sorted[pos++], &ctl->events[j],
+		    sizeof ( pe_event_info_t ) );
+	 }
+      }
+   }
+
+   if ( pos != ctl->num_events ) {
+      PAPIERROR( "Lost track of group members: %d of %d",
+		 pos, ctl->num_events );
+      papi_free( sorted );
+      return PAPI_EBUG;
+   }
+
+   memcpy( ctl->events, sorted, ctl->num_events * sizeof ( pe_event_info_t ) );
+   memcpy( ctl->attrs, sorted_attrs,
+	   ctl->num_events * sizeof ( struct perf_event_attr ) );
+   papi_free( sorted );
+
+   for( i = 0; i < count; i++ ) {
+      if ( native[i].ni_position < 0 ) continue;
+      native[i].ni_position = new_pos[native[i].ni_position];
+      SUBDBG( "native[%d] is now at position %d\n",
+	      i, native[i].ni_position );
+   }
+
+   return PAPI_OK;
+}
+
 /* Close all of the opened events */
 static int
 close_pe_events( pe_context_t *ctx, pe_control_t *ctl )
@@ -779,6 +1073,7 @@ close_pe_events( pe_context_t *ctx, pe_control_t *ctl )
       if (ctl->events[i].event_opened) {
 
          if (ctl->events[i].group_leader_fd!=-1) {
+            drain_remove( &ctl->events[i] );
             if ( ctl->events[i].mmap_buf ) {
 	       if ( munmap ( ctl->events[i].mmap_buf,
 		             ctl->events[i].nr_mmap_pages * getpagesize() ) ) {
@@ -786,6 +1081,7 @@ close_pe_events( pe_context_t *ctx, pe_control_t *ctl )
 			     ctl->events[i].event_fd, strerror( errno ) );
 	          return PAPI_ESYS;
 	       }
+	       ctl->events[i].mmap_buf = NULL;
 	    }
 
             if ( close( ctl->events[i].event_fd ) ) {
@@ -809,6 +1105,7 @@ close_pe_events( pe_context_t *ctx, pe_control_t *ctl )
       if (ctl->events[i].event_opened) {
 
          if (ctl->events[i].group_leader_fd==-1) {
+            drain_remove( &ctl->events[i] );
             if ( ctl->events[i].mmap_buf ) {
 	       if ( munmap ( ctl->events[i].mmap_buf,
 		             ctl->events[i].nr_mmap_pages * getpagesize() ) ) {
@@ -816,6 +1113,7 @@ close_pe_events( pe_context_t *ctx, pe_control_t *ctl )
 			     ctl->events[i].event_fd, strerror( errno ) );
 	          return PAPI_ESYS;
 	       }
+	       ctl->events[i].mmap_buf = NULL;
 	    }
 
 
@@ -924,6 +1222,83 @@ _pe_write( hwd_context_t *ctx, hwd_control_state_t *ctl,
     return PAPI_ENOSUPP;
 }
 
+/* Scale a multiplexed count by the fraction of time it was running */
+static long long
+scale_count( long long count, long long enabled, long long running )
+{
+   long long scale;
+
+   if (running == enabled) {
+      /* No scaling needed */
+      return count;
+   }
+
+   if (running && enabled) {
+      /* Scale factor of 100 to avoid overflows when computing */
+      /*enabled/running */
+      scale = (enabled * 100LL) / running;
+      scale = scale * count;
+      scale = scale / 100LL;
+      return scale;
+   }
+
+   /* This should not happen, but Phil reports it sometime does. */
+   SUBDBG("perf_event kernel bug(?) count, enabled, "
+	  "running: %lld, %lld, %lld\n",
+	  count, enabled, running);
+
+   return count;
+}
+
+/* Keep the unscaled count and times of a multiplexed event, and the */
+/* rate it had since the previous read for PAPI_read_mpx()'s error    */
+static void
+mpx_stats_update( pe_event_info_t *pe, long long raw,
+		  long long enabled, long long running )
+{
+   double rate, delta;
+
+   if ( running > pe->running ) {
+      rate = ( double ) ( raw - pe->raw ) / ( double ) ( running - pe->running );
+      pe->rate_n++;
+      delta = rate - pe->rate_mean;
+      pe->rate_mean += delta / ( double ) pe->rate_n;
+      pe->rate_m2 += delta * ( rate - pe->rate_mean );
+   }
+
+   pe->raw = raw;
+   pe->enabled = enabled;
+   pe->running = running;
+}
+
+/* PERF_EVENT_IOC_RESET leaves the times alone, so remember where */
+/* they were before a multiplexed set starts counting again       */
+static void
+mpx_stats_start( pe_control_t *pe_ctl )
+{
+   long long papi_pe_buffer[READ_BUFFER_SIZE];
+   pe_event_info_t *pe;
+   int i, ret;
+
+   for ( i = 0; i < pe_ctl->num_events; i++ ) {
+      pe = &pe_ctl->events[i];
+      pe->raw = pe->enabled = pe->running = 0;
+      pe->base_enabled = pe->base_running = 0;
+      pe->rate_n = 0;
+      pe->rate_mean = pe->rate_m2 = 0.0;
+
+      if ( pe->group_leader_fd != -1 ) continue;
+
+      ret = read( pe->event_fd, papi_pe_buffer, sizeof ( papi_pe_buffer ) );
+      if ( ret < ( signed ) ( 3 * sizeof ( long long ) ) ) {
+	 SUBDBG( "could not read the times of fd %d\n", pe->event_fd );
+	 continue;
+      }
+      pe->base_enabled = papi_pe_buffer[1];
+      pe->base_running = papi_pe_buffer[2];
+   }
+}
+
 /*
  * perf_event provides a complicated read interface.
  *  the info returned by read() varies depending on whether
@@ -945,11 +1320,27 @@ _pe_read( hwd_context_t *ctx, hwd_control_state_t *ctl,
 	SUBDBG("ENTER: ctx: %p, ctl: %p, events: %p, flags: %#x\n", ctx, ctl, events, flags);
 
    ( void ) flags;			 /*unused */
-   int i, ret = -1;
+   int i, j, k, ret = -1;
    pe_context_t *pe_ctx = ( pe_context_t *) ctx;
    pe_control_t *pe_ctl = ( pe_control_t *) ctl;
    long long papi_pe_buffer[READ_BUFFER_SIZE];
-   long long tot_time_running, tot_time_enabled, scale;
+   long long tot_time_running, tot_time_enabled;
+
+   /* Fast path: read the counters from user space with rdpmc.  If any */
+   /* event is not currently on a counter (index 0, e.g. a software    */
+   /* event or a stopped set) we fall back to the read() paths below.  */
+   if ( pe_ctl->rdpmc ) {
+      for ( i = 0; i < pe_ctl->num_events; i++ ) {
+	 if ( mmap_read_self( pe_ctl->events[i].mmap_buf,
+			      &pe_ctl->counts[i], NULL, NULL ) ) {
+	    break;
+	 }
+      }
+      if ( i == pe_ctl->num_events ) {
+	 *events = pe_ctl->counts;
+	 return PAPI_OK;
+      }
+   }
 
    /* On kernels before 2.6.33 the TOTAL_TIME_ENABLED and TOTAL_TIME_RUNNING */
    /* fields are always 0 unless the counter is disabled.  So if we are on   */
@@ -979,11 +1370,16 @@ _pe_read( hwd_context_t *ctx, hwd_control_state_t *ctl,
    /* Handle case where we are multiplexing */
    if (pe_ctl->multiplexed) {
 
-      /* currently we handle multiplexing by having individual events */
-      /* so we read from each in turn.                                */
+      /* Multiplexed events are split in groups, the kernel schedules  */
+      /* each group as a whole so one read() of the group leader gives */
+      /* the counts of all members along with the group's times.       */
 
       for ( i = 0; i < pe_ctl->num_events; i++ ) {
 
+	 long long *values, nr;
+
+	 if ( pe_ctl->events[i].group_leader_fd != -1 ) continue;
+
          ret = read( pe_ctl->events[i].event_fd, papi_pe_buffer,
 		    sizeof ( papi_pe_buffer ) );
          if ( ret == -1 ) {
@@ -991,7 +1387,7 @@ _pe_read( hwd_context_t *ctx, hwd_control_state_t *ctl,
 	    return PAPI_ESYS;
 	 }
 
-	 /* We should read 3 64-bit values from the counter */
+	 /* We should read at least 3 64-bit values from the counter */
 	 if (ret<(signed)(3*sizeof(long long))) {
 	    PAPIERROR("Error!  short read");
 	    return PAPI_ESYS;
@@ -1003,33 +1399,51 @@ _pe_read( hwd_context_t *ctx, hwd_control_state_t *ctl,
          SUBDBG("read: %lld %lld %lld\n",papi_pe_buffer[0],
 	        papi_pe_buffer[1],papi_pe_buffer[2]);
 
-         tot_time_enabled = papi_pe_buffer[1];
-         tot_time_running = papi_pe_buffer[2];
-
-         SUBDBG("count[%d] = (papi_pe_buffer[%d] %lld * "
-		"tot_time_enabled %lld) / tot_time_running %lld\n",
-		i, 0,papi_pe_buffer[0],
-		tot_time_enabled,tot_time_running);
-
-         if (tot_time_running == tot_time_enabled) {
-	    /* No scaling needed */
-	    pe_ctl->counts[i] = papi_pe_buffer[0];
-         } else if (tot_time_running && tot_time_enabled) {
-	    /* Scale factor of 100 to avoid overflows when computing */
-	    /*enabled/running */
-
-	    scale = (tot_time_enabled * 100LL) / tot_time_running;
-	    scale = scale * papi_pe_buffer[0];
-	    scale = scale / 100LL;
-	    pe_ctl->counts[i] = scale;
+	 if ( pe_ctl->attrs[i].read_format & PERF_FORMAT_GROUP ) {
+	    /* nr, time_enabled, time_running, value[nr] */
+	    nr = papi_pe_buffer[0];
+	    tot_time_enabled = papi_pe_buffer[1];
+	    tot_time_running = papi_pe_buffer[2];
+	    values = &papi_pe_buffer[3];
+
+	    if (( nr < 1 ) ||
+		( ret < (signed)((3+nr)*sizeof(long long)) )) {
+	       PAPIERROR("Error!  Wrong number of events in group");
+	       return PAPI_ESYS;
+	    }
 	 } else {
-	   /* This should not happen, but Phil reports it sometime does. */
-	    SUBDBG("perf_event kernel bug(?) count, enabled, "
-		   "running: %lld, %lld, %lld\n",
-		   papi_pe_buffer[0],tot_time_enabled,
-		   tot_time_running);
+	    /* value, time_enabled, time_running */
+	    nr = 1;
+	    tot_time_enabled = papi_pe_buffer[1];
+	    tot_time_running = papi_pe_buffer[2];
+	    values = &papi_pe_buffer[0];
+	 }
+
+	 /* Values come back in the order the members joined the group, */
+	 /* which is their order in events[].  The groups are normally   */
+	 /* contiguous so this walk stops right after the last member.   */
+	 for ( j = 0, k = i; ( j < nr ) && ( k < pe_ctl->num_events ); k++ ) {
+	    if (( k != i ) && ( pe_ctl->events[k].group_leader_fd !=
+				pe_ctl->events[i].event_fd )) {
+	       continue;
+	    }
+
+	    SUBDBG("count[%d] = (value %lld * "
+		   "tot_time_enabled %lld) / tot_time_running %lld\n",
+		   k, values[j], tot_time_enabled, tot_time_running);
+
+	    pe_ctl->counts[k] = scale_count( values[j],
+					     tot_time_enabled,
+					     tot_time_running );
+	    mpx_stats_update( &pe_ctl->events[k], values[j],
+			      tot_time_enabled - pe_ctl->events[i].base_enabled,
+			      tot_time_running - pe_ctl->events[i].base_running );
+	    j++;
+	 }
 
-	    pe_ctl->counts[i] = papi_pe_buffer[0];
+	 if ( j != nr ) {
+	    PAPIERROR("Error!  Wrong number of events in group");
+	    return PAPI_ESYS;
 	 }
       }
    }
@@ -1155,6 +1569,10 @@ _pe_start( hwd_context_t *ctx, hwd_control_state_t *ctl )
       return ret;
    }
 
+   if ( pe_ctl->multiplexed ) {
+      mpx_stats_start( pe_ctl );
+   }
+
    /* Enable all of the group leaders                */
    /* All group leaders have a group_leader_fd of -1 */
    for( i = 0; i < pe_ctl->num_events; i++ ) {
@@ -1177,6 +1595,8 @@ _pe_start( hwd_context_t *ctx, hwd_control_state_t *ctl )
       return PAPI_EBUG;
    }
 
+   drain_activate( pe_ctl, 1 );
+
    pe_ctx->state |= PERF_EVENTS_RUNNING;
 
    return PAPI_OK;
@@ -1207,75 +1627,47 @@ _pe_stop( hwd_context_t *ctx, hwd_control_state_t *ctl )
       }
    }
 
+   drain_activate( pe_ctl, 0 );
+
    pe_ctx->state &= ~PERF_EVENTS_RUNNING;
 
 	SUBDBG( "EXIT:\n");
    return PAPI_OK;
 }
 
-/* This function clears the current contents of the control structure and
-   updates it with whatever resources are allocated for all the native events
-   in the native info structure array. */
-
-int
-_pe_update_control_state( hwd_control_state_t *ctl,
-			       NativeInfo_t *native,
-			       int count, hwd_context_t *ctx )
+/* Set up the attr of an event from the native event table entry   */
+/* behind a PAPI native event code, applying the EventSet settings. */
+static int
+setup_pe_event( pe_context_t *pe_ctx, pe_control_t *pe_ctl,
+		NativeInfo_t *native, pe_event_info_t *evt,
+		struct perf_event_attr *attr )
 {
-   SUBDBG( "ENTER: ctl: %p, native: %p, count: %d, ctx: %p\n", ctl, native, count, ctx);
-	int i;
-	int j;
-	int ret;
-	int skipped_events=0;
 	struct native_event_t *ntv_evt;
-   pe_context_t *pe_ctx = ( pe_context_t *) ctx;
-   pe_control_t *pe_ctl = ( pe_control_t *) ctl;
-
-   /* close all of the existing fds and start over again */
-   /* In theory we could have finer-grained control and know if             */
-   /* things were changed, but it's easier to tear things down and rebuild. */
-   close_pe_events( pe_ctx, pe_ctl );
-
-   /* Calling with count==0 should be OK, it's how things are deallocated */
-   /* when an eventset is destroyed.                                      */
-   if ( count == 0 ) {
-      SUBDBG( "EXIT: Called with count == 0\n" );
-      return PAPI_OK;
-   }
 
-   /* set up all the events */
-   for( i = 0; i < count; i++ ) {
-      if ( native ) {
 			// get the native event pointer used for this papi event
-			int ntv_idx = _papi_hwi_get_ntv_idx((unsigned)(native[i].ni_papi_code));
+			int ntv_idx = _papi_hwi_get_ntv_idx((unsigned)(native->ni_papi_code));
 			if (ntv_idx < -1) {
-				SUBDBG("papi_event_code: %#x known by papi but not by the component\n", native[i].ni_papi_code);
-				continue;
+				SUBDBG("papi_event_code: %#x known by papi but not by the component\n", native->ni_papi_code);
+				return PAPI_ENOEVNT;
 			}
 			// if native index is -1, then we have an event without a mask and need to find the right native index to use
 			if (ntv_idx == -1) {
 				// find the native event index we want by matching for the right papi event code
-				for (j=0 ; j<pe_ctx->event_table->num_native_events ; j++) {
-					if (pe_ctx->event_table->native_events[j].papi_event_code == native[i].ni_papi_code) {
-						ntv_idx = j;
-					}
-				}
+				ntv_idx = _pe_libpfm4_code_to_ntv_idx(native->ni_papi_code, pe_ctx->event_table);
 			}
 
 			// if native index is still negative, we did not find event we wanted so just return error
 			if (ntv_idx < 0) {
-				SUBDBG("papi_event_code: %#x not found in native event tables\n", native[i].ni_papi_code);
-				continue;
+				SUBDBG("papi_event_code: %#x not found in native event tables\n", native->ni_papi_code);
+				return PAPI_ENOEVNT;
 			}
 
 			// this native index is positive so there was a mask with the event, the ntv_idx identifies which native event to use
 			ntv_evt = (struct native_event_t *)(&(pe_ctx->event_table->native_events[ntv_idx]));
 			SUBDBG("ntv_evt: %p\n", ntv_evt);
 
-			SUBDBG("i: %d, pe_ctx->event_table->num_native_events: %d\n", i, pe_ctx->event_table->num_native_events);
-
 	    	// Move this events hardware config values and other attributes to the perf_events attribute structure
-			memcpy (&pe_ctl->events[i].attr, &ntv_evt->attr, sizeof(perf_event_attr_t));
+			memcpy (attr, &ntv_evt->attr, sizeof(perf_event_attr_t));
 
 			// may need to update the attribute structure with information from event set level domain settings (values set by PAPI_set_domain)
 			// only done if the event mask which controls each counting domain was not provided
@@ -1283,12 +1675,12 @@ _pe_update_control_state( hwd_control_state_t *ctl,
 			// get pointer to allocated name, will be NULL when adding preset events to event set
 			char *aName = ntv_evt->allocated_name;
 			if ((aName == NULL)  ||  (strstr(aName, ":u=") == NULL)) {
-				SUBDBG("set exclude_user attribute from eventset level domain flags, encode: %d, eventset: %d\n", pe_ctl->events[i].attr.exclude_user, !(pe_ctl->domain & PAPI_DOM_USER));
-				pe_ctl->events[i].attr.exclude_user = !(pe_ctl->domain & PAPI_DOM_USER);
+				SUBDBG("set exclude_user attribute from eventset level domain flags, encode: %d, eventset: %d\n", attr->exclude_user, !(pe_ctl->domain & PAPI_DOM_USER));
+				attr->exclude_user = !(pe_ctl->domain & PAPI_DOM_USER);
 			}
 			if ((aName == NULL)  ||  (strstr(aName, ":k=") == NULL)) {
-				SUBDBG("set exclude_kernel attribute from eventset level domain flags, encode: %d, eventset: %d\n", pe_ctl->events[i].attr.exclude_kernel, !(pe_ctl->domain & PAPI_DOM_KERNEL));
-				pe_ctl->events[i].attr.exclude_kernel = !(pe_ctl->domain & PAPI_DOM_KERNEL);
+				SUBDBG("set exclude_kernel attribute from eventset level domain flags, encode: %d, eventset: %d\n", attr->exclude_kernel, !(pe_ctl->domain & PAPI_DOM_KERNEL));
+				attr->exclude_kernel = !(pe_ctl->domain & PAPI_DOM_KERNEL);
 			}
 
 			// libpfm4 supports mh (monitor host) and mg (monitor guest) event masks
@@ -1298,77 +1690,291 @@ _pe_update_control_state( hwd_control_state_t *ctl,
 			// if that can be figured out then there should probably be code here to set some perf_events attributes based on what was set in a PAPI_set_domain call
 			// the code sample below is one possibility
 //			if (strstr(ntv_evt->allocated_name, ":mg=") == NULL) {
-//				SUBDBG("set exclude_hv attribute from eventset level domain flags, encode: %d, eventset: %d\n", pe_ctl->events[i].attr.exclude_hv, !(pe_ctl->domain & PAPI_DOM_SUPERVISOR));
-//				pe_ctl->events[i].attr.exclude_hv = !(pe_ctl->domain & PAPI_DOM_SUPERVISOR);
+//				SUBDBG("set exclude_hv attribute from eventset level domain flags, encode: %d, eventset: %d\n", attr->exclude_hv, !(pe_ctl->domain & PAPI_DOM_SUPERVISOR));
+//				attr->exclude_hv = !(pe_ctl->domain & PAPI_DOM_SUPERVISOR);
 //			}
 
 
 			// set the cpu number provided with an event mask if there was one (will be -1 if mask not provided)
-			pe_ctl->events[i].cpu = ntv_evt->cpu;
+			evt->cpu = ntv_evt->cpu;
 			// if cpu event mask not provided, then set the cpu to use to what may have been set on call to PAPI_set_opt (will still be -1 if not called)
-			if (pe_ctl->events[i].cpu == -1) {
-				pe_ctl->events[i].cpu = pe_ctl->cpu;
+			if (evt->cpu == -1) {
+				evt->cpu = pe_ctl->cpu;
 			}
-      } else {
-    	  // This case happens when called from _pe_set_overflow and _pe_ctl
-          // Those callers put things directly into the pe_ctl structure so it is already set for the open call
-      }
 
       // Copy the inherit flag into the attribute block that will be passed to the kernel
-      pe_ctl->events[i].attr.inherit = pe_ctl->inherit;
-
-      /* Set the position in the native structure */
-      /* We just set up events linearly           */
-      if ( native ) {
-    	  native[i].ni_position = i;
-    	  SUBDBG( "&native[%d]: %p, ni_papi_code: %#x, ni_event: %#x, ni_position: %d, ni_owners: %d\n",
-			i, &(native[i]), native[i].ni_papi_code, native[i].ni_event, native[i].ni_position, native[i].ni_owners);
-      }
-   }
-
-	if (count <= skipped_events) {
-		SUBDBG("EXIT: No events to count, they all contained invalid umasks\n");
-		return PAPI_ENOEVNT;
-	}
+      attr->inherit = pe_ctl->inherit;
 
-   pe_ctl->num_events = count - skipped_events;
+      evt->papi_event_code = native->ni_papi_code;
+      evt->sample_fields = 0;
 
-   /* actually open the events */
-   /* (why is this a separate function?) */
-   ret = open_pe_events( pe_ctx, pe_ctl );
-   if ( ret != PAPI_OK ) {
-      SUBDBG("EXIT: open_pe_events returned: %d\n", ret);
-      /* Restore values ? */
-      return ret;
-   }
+      return PAPI_OK;
+}
 
-   SUBDBG( "EXIT: PAPI_OK\n" );
-   return PAPI_OK;
+/* Do the events already open for this control state count the same   */
+/* thing as a freshly set up event?  Only the fields that come from the */
+/* native event or the EventSet settings matter here.                   */
+static int
+same_pe_event( pe_event_info_t *a, struct perf_event_attr *a_attr,
+	       pe_event_info_t *b, struct perf_event_attr *b_attr )
+{
+   return ( a->papi_event_code == b->papi_event_code ) &&
+	  ( a->cpu == b->cpu ) &&
+	  ( a_attr->type == b_attr->type ) &&
+	  ( a_attr->config == b_attr->config ) &&
+	  ( a_attr->config1 == b_attr->config1 ) &&
+	  ( a_attr->config2 == b_attr->config2 ) &&
+	  ( a_attr->exclude_user == b_attr->exclude_user ) &&
+	  ( a_attr->exclude_kernel == b_attr->exclude_kernel ) &&
+	  ( a_attr->exclude_hv == b_attr->exclude_hv ) &&
+	  ( a_attr->precise_ip == b_attr->precise_ip ) &&
+	  ( a_attr->inherit == b_attr->inherit );
 }
 
-/* Set various options on a control state */
-int
-_pe_ctl( hwd_context_t *ctx, int code, _papi_int_option_t *option )
+/* Bring the open events in line with a new native event list without  */
+/* reopening the events that did not change: removed events are closed, */
+/* the remaining ones are compacted in place and new ones are opened    */
+/* into the existing groups.                                            */
+/*                                                                      */
+/* Returns PAPI_ECNFLCT if the change needs a full rebuild (a group     */
+/* leader went away, or sampling is set up), and nothing is touched.    */
+static int
+update_pe_events( pe_context_t *pe_ctx, pe_control_t *pe_ctl,
+		  NativeInfo_t *native, int count )
 {
-   int ret;
-   pe_context_t *pe_ctx = ( pe_context_t *) ctx;
-   pe_control_t *pe_ctl = NULL;
+   int i, k, ret, kept = 0, start;
+   int matched[PERF_EVENT_MAX_MPX_COUNTERS];
+   int new_idx[PERF_EVENT_MAX_MPX_COUNTERS];
+   pe_event_info_t evt;
+   struct perf_event_attr attr;
 
-   switch ( code ) {
-      case PAPI_MULTIPLEX:
-	   pe_ctl = ( pe_control_t * ) ( option->multiplex.ESI->ctl_state );
-	   ret = check_permissions( pe_ctl->tid, pe_ctl->cpu, pe_ctl->domain,
-				    pe_ctl->granularity,
-				    1, pe_ctl->inherit );
-           if (ret != PAPI_OK) {
-	      return ret;
-	   }
+   if ( pe_ctl->overflow ) return PAPI_ECNFLCT;
 
-	   /* looks like we are allowed, so set multiplexed attribute */
-	   pe_ctl->multiplexed = 1;
-	   ret = _pe_update_control_state( pe_ctl, NULL,
-						pe_ctl->num_events, pe_ctx );
-	   if (ret != PAPI_OK) {
+   for( i = 0; i < pe_ctl->num_events; i++ ) {
+      if ( !pe_ctl->events[i].event_opened ) return PAPI_ECNFLCT;
+      if ( pe_ctl->events[i].sample_fields ) return PAPI_ECNFLCT;
+      matched[i] = -1;
+   }
+
+   /* Match the requested events with the ones already open */
+   for( k = 0; k < count; k++ ) {
+      native[k].ni_position = -1;
+
+      memset( &evt, 0, sizeof ( evt ) );
+      memset( &attr, 0, sizeof ( attr ) );
+      if ( setup_pe_event( pe_ctx, pe_ctl, &native[k],
+			   &evt, &attr ) != PAPI_OK ) {
+	 return PAPI_ECNFLCT;
+      }
+
+      for( i = 0; i < pe_ctl->num_events; i++ ) {
+	 if ( ( matched[i] == -1 ) &&
+	      ( same_pe_event( &evt, &attr,
+			       &pe_ctl->events[i], &pe_ctl->attrs[i] ) ) ) {
+	    matched[i] = k;
+	    kept++;
+	    break;
+	 }
+      }
+   }
+
+   /* Closing a group leader would break up its group */
+   for( i = 0; i < pe_ctl->num_events; i++ ) {
+      if ( ( matched[i] == -1 ) &&
+	   ( pe_ctl->events[i].group_leader_fd == -1 ) &&
+	   ( kept > 0 ) ) {
+	 return PAPI_ECNFLCT;
+      }
+   }
+   if ( kept == 0 ) return PAPI_ECNFLCT;
+
+   /* Close the events that were removed and compact the rest, */
+   /* keeping their order so groups read back the same way.     */
+   for( i = 0, start = 0; i < pe_ctl->num_events; i++ ) {
+      if ( matched[i] == -1 ) {
+	 SUBDBG( "closing removed event %d (fd %d)\n",
+		 i, pe_ctl->events[i].event_fd );
+	 if ( pe_ctl->events[i].mmap_buf ) {
+	    munmap( pe_ctl->events[i].mmap_buf,
+		    pe_ctl->events[i].nr_mmap_pages * getpagesize() );
+	    pe_ctl->events[i].mmap_buf = NULL;
+	 }
+	 close( pe_ctl->events[i].event_fd );
+	 pe_ctl->events[i].event_opened = 0;
+	 continue;
+      }
+      if ( start != i ) {
+	 memcpy( &pe_ctl->events[start], &pe_ctl->events[i],
+		 sizeof ( pe_event_info_t ) );
+	 memcpy( &pe_ctl->attrs[start], &pe_ctl->attrs[i],
+		 sizeof ( struct perf_event_attr ) );
+      }
+      new_idx[start] = matched[i];
+      native[matched[i]].ni_position = start;
+      start++;
+   }
+   pe_ctl->num_events = start;
+
+   /* Append the new events */
+   for( k = 0; k < count; k++ ) {
+      if ( native[k].ni_position != -1 ) continue;
+
+      i = pe_ctl->num_events;
+      memset( &pe_ctl->events[i], 0, sizeof ( pe_event_info_t ) );
+      memset( &pe_ctl->attrs[i], 0, sizeof ( struct perf_event_attr ) );
+      setup_pe_event( pe_ctx, pe_ctl, &native[k],
+		      &pe_ctl->events[i], &pe_ctl->attrs[i] );
+      new_idx[i] = k;
+      native[k].ni_position = i;
+      pe_ctl->num_events++;
+   }
+
+   SUBDBG( "kept %d events, opening %d new ones\n",
+	   start, pe_ctl->num_events - start );
+
+   if ( pe_ctl->num_events > start ) {
+      ret = open_pe_events( pe_ctx, pe_ctl, start );
+      if ( ret != PAPI_OK ) {
+	 /* forget the new events, the old ones are still good */
+	 for( i = start; i < pe_ctl->num_events; i++ ) {
+	    native[new_idx[i]].ni_position = -1;
+	 }
+	 pe_ctl->num_events = start;
+	 return ret;
+      }
+   }
+
+   if ( pe_ctl->multiplexed ) {
+      return order_pe_groups( pe_ctl, native, count );
+   }
+
+   return PAPI_OK;
+}
+
+/* This function updates the control structure with whatever resources  */
+/* are allocated for all the native events in the native info structure */
+/* array.  Events that are already open are kept when possible.          */
+
+int
+_pe_update_control_state( hwd_control_state_t *ctl,
+			       NativeInfo_t *native,
+			       int count, hwd_context_t *ctx )
+{
+   SUBDBG( "ENTER: ctl: %p, native: %p, count: %d, ctx: %p\n", ctl, native, count, ctx);
+	int i;
+	int ret;
+	int skipped_events=0;
+   pe_context_t *pe_ctx = ( pe_context_t *) ctx;
+   pe_control_t *pe_ctl = ( pe_control_t *) ctl;
+
+   if ( count > 0 ) {
+      ret = resize_pe_control( pe_ctl, count );
+      if ( ret != PAPI_OK ) {
+	 SUBDBG( "EXIT: resize_pe_control returned: %d\n", ret );
+	 return ret;
+      }
+   }
+
+   /* Adding or removing events one at a time is the common case, */
+   /* only open and close what changed.                           */
+   if ( ( native ) && ( count > 0 ) && ( pe_ctl->num_events > 0 ) ) {
+      ret = update_pe_events( pe_ctx, pe_ctl, native, count );
+      if ( ret != PAPI_ECNFLCT ) {
+	 SUBDBG( "EXIT: update_pe_events returned: %d\n", ret );
+	 return ret;
+      }
+   }
+
+   /* close all of the existing fds and start over again */
+   close_pe_events( pe_ctx, pe_ctl );
+
+   /* Calling with count==0 should be OK, it's how things are deallocated */
+   /* when an eventset is destroyed.                                      */
+   if ( count == 0 ) {
+      free_pe_control( pe_ctl );
+      SUBDBG( "EXIT: Called with count == 0\n" );
+      return PAPI_OK;
+   }
+
+   /* set up all the events */
+   for( i = 0; i < count; i++ ) {
+      if ( native ) {
+	 if ( setup_pe_event( pe_ctx, pe_ctl, &native[i],
+			      &pe_ctl->events[i],
+			      &pe_ctl->attrs[i] ) != PAPI_OK ) {
+	    continue;
+	 }
+      } else {
+    	  // This case happens when called from _pe_set_overflow and _pe_ctl
+          // Those callers put things directly into the pe_ctl structure so it is already set for the open call
+
+          // Copy the inherit flag into the attribute block that will be passed to the kernel
+          pe_ctl->attrs[i].inherit = pe_ctl->inherit;
+      }
+
+      /* Set the position in the native structure */
+      /* We just set up events linearly           */
+      if ( native ) {
+    	  native[i].ni_position = i;
+    	  SUBDBG( "&native[%d]: %p, ni_papi_code: %#x, ni_event: %#x, ni_position: %d, ni_owners: %d\n",
+			i, &(native[i]), native[i].ni_papi_code, native[i].ni_event, native[i].ni_position, native[i].ni_owners);
+      }
+   }
+
+	if (count <= skipped_events) {
+		SUBDBG("EXIT: No events to count, they all contained invalid umasks\n");
+		return PAPI_ENOEVNT;
+	}
+
+   pe_ctl->num_events = count - skipped_events;
+
+   /* actually open the events */
+   /* (why is this a separate function?) */
+   ret = open_pe_events( pe_ctx, pe_ctl, 0 );
+   if ( ret != PAPI_OK ) {
+      SUBDBG("EXIT: open_pe_events returned: %d\n", ret);
+      /* Restore values ? */
+      return ret;
+   }
+
+   /* Multiplexed groups were packed first-fit, move the members of */
+   /* each group next to each other and tell PAPI where they went.  */
+   if ( native && pe_ctl->multiplexed ) {
+      ret = order_pe_groups( pe_ctl, native, count );
+      if ( ret != PAPI_OK ) {
+	 close_pe_events( pe_ctx, pe_ctl );
+	 SUBDBG("EXIT: order_pe_groups returned: %d\n", ret);
+	 return ret;
+      }
+   }
+
+   SUBDBG( "EXIT: PAPI_OK\n" );
+   return PAPI_OK;
+}
+
+/* Set various options on a control state */
+int
+_pe_ctl( hwd_context_t *ctx, int code, _papi_int_option_t *option )
+{
+   int ret;
+   pe_context_t *pe_ctx = ( pe_context_t *) ctx;
+   pe_control_t *pe_ctl = NULL;
+
+   switch ( code ) {
+      case PAPI_MULTIPLEX:
+	   pe_ctl = ( pe_control_t * ) ( option->multiplex.ESI->ctl_state );
+	   ret = check_permissions( pe_ctl->tid, pe_ctl->cpu, pe_ctl->domain,
+				    pe_ctl->granularity,
+				    1, pe_ctl->inherit );
+           if (ret != PAPI_OK) {
+	      return ret;
+	   }
+
+	   /* looks like we are allowed, so set multiplexed attribute */
+	   pe_ctl->multiplexed = 1;
+	   ret = _pe_update_control_state( pe_ctl, NULL,
+						pe_ctl->num_events, pe_ctx );
+	   if (ret != PAPI_OK) {
 	      pe_ctl->multiplexed = 0;
 	   }
 	   return ret;
@@ -1687,9 +2293,9 @@ _pe_init_component( int cidx )
    /* Run Vendor-specific fixups */
    pe_vendor_fixups(_papi_hwd[cidx]);
 
-   /* Detect if we can use rdpmc (or equivalent) */
-   /* We currently do not use rdpmc as it is slower in tests */
-   /* than regular read (as of Linux 3.5)                    */
+   /* Detect if we can use rdpmc (or equivalent)              */
+   /* Self-monitoring EventSets read their counters from user  */
+   /* space when this is set; PAPI_DISABLE_RDPMC turns it off. */
    retval=_pe_detect_rdpmc(_papi_hwd[cidx]->cmp_info.default_domain);
    if (retval < 0 ) {
       strncpy(_papi_hwd[cidx]->cmp_info.disabled_reason,
@@ -1697,6 +2303,9 @@ _pe_init_component( int cidx )
 
        return retval;
     }
+   if ( !PE_HAVE_RDPMC || getenv( "PAPI_DISABLE_RDPMC" ) ) {
+      retval = 0;
+   }
    _papi_hwd[cidx]->cmp_info.fast_counter_read = retval;
 
    /* Run the libpfm4-specific setup */
@@ -1724,6 +2333,8 @@ _pe_init_component( int cidx )
 int
 _pe_shutdown_component( void ) {
 
+  drain_shutdown();
+
   /* deallocate our event table */
   _pe_libpfm4_shutdown(&_perf_event_vector, &perf_native_event_table);
 
@@ -1780,7 +2391,7 @@ static uint64_t
 mmap_read_head( pe_event_info_t *pe )
 {
   struct perf_event_mmap_page *pc = pe->mmap_buf;
-  int head;
+  uint64_t head;
 
   if ( pc == NULL ) {
     PAPIERROR( "perf_event_mmap_page is NULL" );
@@ -1819,11 +2430,39 @@ typedef union event_union {
   struct lost_event lost;
 } perf_sample_event_t;
 
+/* Return the record at offset old of the data area.  A record that     */
+/* straddles the end of the buffer is copied into copy; the header is   */
+/* always inside due to u64 alignment of the output.                    */
+static perf_sample_event_t *
+mmap_read_record( pe_event_info_t *pe, unsigned char *data, uint64_t old,
+		  perf_sample_event_t *copy )
+{
+  perf_sample_event_t *event = ( perf_sample_event_t * ) 
+    & data[old & pe->mask];
+  size_t size = event->header.size;
+
+  if ( ( old & pe->mask ) + size != ( ( old + size ) & pe->mask ) ) {
+    uint64_t offset = old;
+    uint64_t len = min( sizeof ( *event ), size ), cpy;
+    void *dst = copy;
+
+    do {
+      cpy = min( pe->mask + 1 - ( offset & pe->mask ), len );
+      memcpy( dst, &data[offset & pe->mask], cpy );
+      offset += cpy;
+      dst = ((unsigned char*)dst) + cpy;
+      len -= cpy;
+    } while ( len );
+
+    event = copy;
+  }
+  return event;
+}
+
 /* Should re-write with comments if we ever figure out what's */
 /* going on here.                                             */
 static void
-mmap_read( int cidx, ThreadInfo_t **thr, pe_event_info_t *pe, 
-           int profile_index )
+mmap_read( EventSetInfo_t *ESI, pe_event_info_t *pe, int profile_index )
 {
   uint64_t head = mmap_read_head( pe );
   uint64_t old = pe->tail;
@@ -1839,36 +2478,18 @@ mmap_read( int cidx, ThreadInfo_t **thr, pe_event_info_t *pe,
   }
 
   for( ; old != head; ) {
-    perf_sample_event_t *event = ( perf_sample_event_t * ) 
-      & data[old & pe->mask];
     perf_sample_event_t event_copy;
-    size_t size = event->header.size;
+    perf_sample_event_t *event = mmap_read_record( pe, data, old,
+						   &event_copy );
 
-    /* Event straddles the mmap boundary -- header should always */
-    /* be inside due to u64 alignment of output.                 */
-    if ( ( old & pe->mask ) + size != ( ( old + size ) & pe->mask ) ) {
-      uint64_t offset = old;
-      uint64_t len = min( sizeof ( *event ), size ), cpy;
-      void *dst = &event_copy;
-
-      do {
-	cpy = min( pe->mask + 1 - ( offset & pe->mask ), len );
-	memcpy( dst, &data[offset & pe->mask], cpy );
-	offset += cpy;
-	dst = ((unsigned char*)dst) + cpy;
-	len -= cpy;
-      } while ( len );
-
-      event = &event_copy;
-    }
-    old += size;
+    old += event->header.size;
 
     SUBDBG( "event->type = %08x\n", event->header.type );
     SUBDBG( "event->size = %d\n", event->header.size );
 
     switch ( event->header.type ) {
     case PERF_RECORD_SAMPLE:
-      _papi_hwi_dispatch_profile( ( *thr )->running_eventset[cidx],
+      _papi_hwi_dispatch_profile( ESI,
 				  ( caddr_t ) ( unsigned long ) event->ip.ip, 
 				  0, profile_index );
       break;
@@ -1878,6 +2499,7 @@ mmap_read( int cidx, ThreadInfo_t **thr, pe_event_info_t *pe,
                       " events were lost.\n"
                       "Loss was recorded when counter id %#"PRIx64 
 	      " overflowed.\n", event->lost.lost, event->lost.id );
+      pe->lost += event->lost.lost;
       break;
 
     default:
@@ -1935,13 +2557,349 @@ process_smpl_buf( int evt_idx, ThreadInfo_t **thr, int cidx )
 
   ctl= (*thr)->running_eventset[cidx]->ctl_state;
 
-  mmap_read( cidx, thr, 
+  mmap_read( ( *thr )->running_eventset[cidx],
 	     &(ctl->events[evt_idx]),
 	     profile_index );
 
   return PAPI_OK;
 }
 
+
+/* Background draining of profile sample buffers (PAPI_PROFIL_DRAIN).   */
+/* Instead of a signal per sample on the profiled thread, the kernel    */
+/* wakes one process wide thread up once a buffer is half full, and it */
+/* empties the buffers of all threads in batches.  The thread only      */
+/* touches a buffer while its EventSet runs; PAPI does not change the   */
+/* profile setup of a running EventSet, so only the buffer itself needs */
+/* to be protected, by drain_lock.                                      */
+
+#define PE_DRAIN_BATCH 64
+#define PE_DRAIN_STOP  ( ~( uint64_t ) 0 )
+
+typedef struct {
+  EventSetInfo_t *esi;            /* EventSet profiled, NULL if free      */
+  int evt_idx;                    /* position of the event in the set     */
+  int active;                     /* EventSet is running                  */
+  uint32_t gen;                   /* tells stale epoll events apart       */
+  pe_event_info_t pe;             /* the buffer, owned by the drain code  */
+} pe_drain_slot_t;
+
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t drain_thread;
+static int drain_started = 0;
+static int drain_epfd = -1;
+static int drain_stopfd = -1;
+static pe_drain_slot_t *drain_slots = NULL;
+static int drain_num_slots = 0;
+
+/* Empty one buffer, called with drain_lock held */
+static void
+drain_slot( pe_drain_slot_t *slot )
+{
+  int flags, profile_index;
+  unsigned native_index;
+
+  if ( find_profile_index( slot->esi, slot->evt_idx, &flags,
+			   &native_index, &profile_index ) != PAPI_OK ) {
+    return;
+  }
+
+  mmap_read( slot->esi, &slot->pe, profile_index );
+}
+
+static void *
+drain_thread_main( void *arg )
+{
+  struct epoll_event ev[PE_DRAIN_BATCH];
+  pe_drain_slot_t *slot;
+  uint32_t idx, gen;
+  int i, n;
+
+  ( void ) arg;
+
+  while ( 1 ) {
+    n = epoll_wait( drain_epfd, ev, PE_DRAIN_BATCH, -1 );
+    if ( n < 0 ) {
+      if ( errno == EINTR ) continue;
+      PAPIERROR( "epoll_wait in the drain thread failed: %s",
+		 strerror( errno ) );
+      return NULL;
+    }
+
+    pthread_mutex_lock( &drain_lock );
+    for ( i = 0; i < n; i++ ) {
+      if ( ev[i].data.u64 == PE_DRAIN_STOP ) {
+	pthread_mutex_unlock( &drain_lock );
+	return NULL;
+      }
+      idx = ( uint32_t ) ev[i].data.u64;
+      gen = ( uint32_t ) ( ev[i].data.u64 >> 32 );
+      if ( idx >= ( uint32_t ) drain_num_slots ) continue;
+
+      slot = &drain_slots[idx];
+      if ( ( slot->esi == NULL ) || ( slot->gen != gen ) ||
+	   ( !slot->active ) ) {
+	continue;
+      }
+      drain_slot( slot );
+    }
+    pthread_mutex_unlock( &drain_lock );
+  }
+
+  return NULL;
+}
+
+/* Start the drain thread, called with drain_lock held */
+static int
+drain_start( void )
+{
+  struct epoll_event ev;
+  sigset_t all, old;
+  int ret;
+
+  drain_epfd = epoll_create1( EPOLL_CLOEXEC );
+  if ( drain_epfd < 0 ) {
+    PAPIERROR( "epoll_create1 failed: %s", strerror( errno ) );
+    return PAPI_ESYS;
+  }
+
+  drain_stopfd = eventfd( 0, EFD_CLOEXEC );
+  if ( drain_stopfd < 0 ) {
+    PAPIERROR( "eventfd failed: %s", strerror( errno ) );
+    close( drain_epfd );
+    drain_epfd = -1;
+    return PAPI_ESYS;
+  }
+
+  memset( &ev, 0, sizeof ( ev ) );
+  ev.events = EPOLLIN;
+  ev.data.u64 = PE_DRAIN_STOP;
+  if ( epoll_ctl( drain_epfd, EPOLL_CTL_ADD, drain_stopfd, &ev ) < 0 ) {
+    PAPIERROR( "epoll_ctl failed: %s", strerror( errno ) );
+    ret = PAPI_ESYS;
+    goto drain_start_cleanup;
+  }
+
+  /* The drain thread must never take the application's signals, */
+  /* in particular not the ones PAPI itself uses.                */
+  sigfillset( &all );
+  pthread_sigmask( SIG_SETMASK, &all, &old );
+  ret = pthread_create( &drain_thread, NULL, drain_thread_main, NULL );
+  pthread_sigmask( SIG_SETMASK, &old, NULL );
+  if ( ret ) {
+    PAPIERROR( "pthread_create of the drain thread failed: %s",
+	       strerror( ret ) );
+    ret = PAPI_ESYS;
+    goto drain_start_cleanup;
+  }
+
+  SUBDBG( "drain thread started, epoll fd %d\n", drain_epfd );
+  drain_started = 1;
+
+  return PAPI_OK;
+
+drain_start_cleanup:
+  close( drain_stopfd );
+  close( drain_epfd );
+  drain_stopfd = -1;
+  drain_epfd = -1;
+  return ret;
+}
+
+/* Stop the drain thread, at component shutdown */
+static void
+drain_shutdown( void )
+{
+  uint64_t one = 1;
+
+  if ( !drain_started ) return;
+
+  if ( write( drain_stopfd, &one, sizeof ( one ) ) != sizeof ( one ) ) {
+    PAPIERROR( "could not stop the drain thread: %s", strerror( errno ) );
+  } else {
+    pthread_join( drain_thread, NULL );
+  }
+
+  close( drain_stopfd );
+  close( drain_epfd );
+  drain_stopfd = -1;
+  drain_epfd = -1;
+  drain_started = 0;
+
+  papi_free( drain_slots );
+  drain_slots = NULL;
+  drain_num_slots = 0;
+}
+
+/* Hand the freshly mapped buffer of an event over to the drain thread */
+static int
+drain_add( pe_control_t *ctl, int evt_idx )
+{
+  pe_event_info_t *pe = &ctl->events[evt_idx];
+  pe_drain_slot_t *slots;
+  struct epoll_event ev;
+  int i, ret, num;
+
+  if ( ctl->drain_esi == NULL ) return PAPI_EBUG;
+
+  pthread_mutex_lock( &drain_lock );
+
+  if ( !drain_started ) {
+    ret = drain_start(  );
+    if ( ret != PAPI_OK ) {
+      pthread_mutex_unlock( &drain_lock );
+      return ret;
+    }
+  }
+
+  for ( i = 0; i < drain_num_slots; i++ ) {
+    if ( drain_slots[i].esi == NULL ) break;
+  }
+  if ( i == drain_num_slots ) {
+    num = drain_num_slots ? drain_num_slots * 2 : 16;
+    slots = papi_realloc( drain_slots, num * sizeof ( pe_drain_slot_t ) );
+    if ( slots == NULL ) {
+      pthread_mutex_unlock( &drain_lock );
+      return PAPI_ENOMEM;
+    }
+    memset( slots + drain_num_slots, 0,
+	    ( num - drain_num_slots ) * sizeof ( pe_drain_slot_t ) );
+    drain_slots = slots;
+    drain_num_slots = num;
+  }
+
+  drain_slots[i].esi = ctl->drain_esi;
+  drain_slots[i].evt_idx = evt_idx;
+  drain_slots[i].active = 0;
+  drain_slots[i].gen++;
+  drain_slots[i].pe = *pe;
+
+  memset( &ev, 0, sizeof ( ev ) );
+  ev.events = EPOLLIN;
+  ev.data.u64 = ( ( uint64_t ) drain_slots[i].gen << 32 ) | ( uint32_t ) i;
+  if ( epoll_ctl( drain_epfd, EPOLL_CTL_ADD, pe->event_fd, &ev ) < 0 ) {
+    PAPIERROR( "epoll_ctl(ADD) of fd %d failed: %s",
+	       pe->event_fd, strerror( errno ) );
+    drain_slots[i].esi = NULL;
+    pthread_mutex_unlock( &drain_lock );
+    return PAPI_ESYS;
+  }
+
+  pe->drain_slot = i + 1;
+
+  pthread_mutex_unlock( &drain_lock );
+
+  SUBDBG( "fd %d is drained in the background, slot %d\n",
+	  pe->event_fd, i );
+
+  return PAPI_OK;
+}
+
+/* Take a buffer away from the drain thread, before it is unmapped */
+static void
+drain_remove( pe_event_info_t *pe )
+{
+  if ( !pe->drain_slot ) return;
+
+  pthread_mutex_lock( &drain_lock );
+  epoll_ctl( drain_epfd, EPOLL_CTL_DEL, pe->event_fd, NULL );
+  drain_slots[pe->drain_slot - 1].esi = NULL;
+  drain_slots[pe->drain_slot - 1].active = 0;
+  pthread_mutex_unlock( &drain_lock );
+
+  pe->drain_slot = 0;
+}
+
+/* Let the drain thread at the buffers of a control state, or stop it */
+static void
+drain_activate( pe_control_t *ctl, int active )
+{
+  int i;
+
+  for ( i = 0; i < ctl->num_events; i++ ) {
+    if ( ctl->events[i].drain_slot ) {
+      pthread_mutex_lock( &drain_lock );
+      drain_slots[ctl->events[i].drain_slot - 1].active = active;
+      pthread_mutex_unlock( &drain_lock );
+    }
+  }
+}
+
+/* Empty the buffer of a drained event, once its EventSet stopped */
+static void
+drain_flush( pe_event_info_t *pe )
+{
+  pthread_mutex_lock( &drain_lock );
+  drain_slot( &drain_slots[pe->drain_slot - 1] );
+  pthread_mutex_unlock( &drain_lock );
+}
+
+/*
+ * Hand the overflows recorded since the last signal to the overflow
+ * handler, oldest first.  Signals are not queued, so several records can
+ * have piled up by the time one is delivered; every one of them is
+ * dispatched with its own IP.  Records the kernel had no room for are
+ * counted in pe->lost, see _pe_overflow_lost().
+ *
+ * The fourth parameter of _papi_hwi_dispatch_overflow_signal() is
+ * supposed to be a vector of bits indicating the overflowed hardware
+ * counters, but the actual hardware counters used are not exposed to the
+ * PAPI user (the kernel event dispatcher hides that info).  We set the bit
+ * of the event's position in the array instead.
+ */
+static void
+overflow_read( _papi_hwi_context_t *hw_context, ThreadInfo_t **thr,
+	       int evt_idx, int cidx )
+{
+  pe_control_t *ctl = ( *thr )->running_eventset[cidx]->ctl_state;
+  pe_event_info_t *pe = &( ctl->events[evt_idx] );
+  unsigned char *data = ( ( unsigned char * ) pe->mmap_buf ) + getpagesize(  );
+  uint64_t head = mmap_read_head( pe );
+  uint64_t old = pe->tail;
+
+  for( ; old != head; ) {
+    perf_sample_event_t event_copy;
+    perf_sample_event_t *event = mmap_read_record( pe, data, old,
+						   &event_copy );
+
+    if ( event->header.size == 0 ) {
+      PAPIERROR( "corrupt overflow record at %" PRIu64, old );
+      old = head;
+      break;
+    }
+    old += event->header.size;
+
+    switch ( event->header.type ) {
+    case PERF_RECORD_SAMPLE:
+      _papi_hwi_dispatch_overflow_signal( ( void * ) hw_context,
+					  ( caddr_t ) ( unsigned long )
+					  event->ip.ip,
+					  NULL, ( 1 << evt_idx ), 0,
+					  thr, cidx );
+      break;
+
+    case PERF_RECORD_LOST:
+      pe->lost += event->lost.lost;
+      break;
+
+    default:
+      SUBDBG( "skipping record type %d\n", event->header.type );
+      break;
+    }
+
+    /* the handler may have stopped the EventSet, drop the rest */
+    if ( ( *thr )->running_eventset[cidx] == NULL ) {
+      old = head;
+      break;
+    }
+  }
+
+  /* all reads of the records have to be done before the tail moves */
+  __sync_synchronize(  );
+  pe->tail = old;
+  mmap_write_tail( pe, old );
+}
+
 /*
  * This function is used when hardware overflows are working or when
  * software overflows are forced
@@ -2013,81 +2971,18 @@ _pe_dispatch_timer( int n, hwd_siginfo_t *info, void *uc)
     return;
   }
         
-  if (ioctl( fd, PERF_EVENT_IOC_DISABLE, NULL ) == -1 ) {
-      PAPIERROR("ioctl(PERF_EVENT_IOC_DISABLE) failed");
-  }
-
+  /* The counter is never stopped for an overflow: no event_limit is  */
+  /* set with PERF_EVENT_IOC_REFRESH, so the kernel keeps it running   */
+  /* and only queues a record and a signal per overflow.  That saves   */
+  /* two ioctls per sample and counts the events the handler itself    */
+  /* causes too.                                                       */
   if ( ( thread->running_eventset[cidx]->state & PAPI_PROFILING ) && 
        !( thread->running_eventset[cidx]->profile.flags & 
 	  PAPI_PROFIL_FORCE_SW ) ) {
     process_smpl_buf( found_evt_idx, &thread, cidx );
   }
   else {
-    uint64_t ip;
-    unsigned int head;
-    pe_event_info_t *pe = &(ctl->events[found_evt_idx]);
-    unsigned char *data = ((unsigned char*)pe->mmap_buf) + getpagesize(  );
-
-    /*
-     * Read up the most recent IP from the sample in the mmap buffer.  To
-     * do this, we make the assumption that all of the records in the
-     * mmap buffer are the same size, and that they all contain the IP as
-     * their only record element.  This means that we can use the
-     * data_head element from the user page and move backward one record
-     * from that point and read the data.  Since we don't actually need
-     * to access the header of the record, we can just subtract 8 (size
-     * of the IP) from data_head and read up that word from the mmap
-     * buffer.  After we subtract 8, we account for mmap buffer wrapping
-     * by AND'ing this offset with the buffer mask.
-     */
-    head = mmap_read_head( pe );
-
-    if ( head == 0 ) {
-      PAPIERROR( "Attempting to access memory which may be inaccessable" );
-      return;
-    }
-    ip = *( uint64_t * ) ( data + ( ( head - 8 ) & pe->mask ) );
-    /*
-     * Update the tail to the current head pointer. 
-     *
-     * Note: that if we were to read the record at the tail pointer,
-     * rather than the one at the head (as you might otherwise think
-     * would be natural), we could run into problems.  Signals don't
-     * stack well on Linux, particularly if not using RT signals, and if
-     * they come in rapidly enough, we can lose some.  Overtime, the head
-     * could catch up to the tail and monitoring would be stopped, and
-     * since no more signals are coming in, this problem will never be
-     * resolved, resulting in a complete loss of overflow notification
-     * from that point on.  So the solution we use here will result in
-     * only the most recent IP value being read every time there are two
-     * or more samples in the buffer (for that one overflow signal).  But
-     * the handler will always bring up the tail, so the head should
-     * never run into the tail.
-     */
-    mmap_write_tail( pe, head );
-
-    /*
-     * The fourth parameter is supposed to be a vector of bits indicating
-     * the overflowed hardware counters, but it's not really clear that
-     * it's useful, because the actual hardware counters used are not
-     * exposed to the PAPI user.  For now, I'm just going to set the bit
-     * that indicates which event register in the array overflowed.  The
-     * result is that the overflow vector will not be identical to the
-     * perfmon implementation, and part of that is due to the fact that
-     * which hardware register is actually being used is opaque at the
-     * user level (the kernel event dispatcher hides that info).
-     */
-
-    _papi_hwi_dispatch_overflow_signal( ( void * ) &hw_context,
-					( caddr_t ) ( unsigned long ) ip,
-					NULL, ( 1 << found_evt_idx ), 0,
-					&thread, cidx );
-
-  }
-
-  /* Restart the counters */
-  if (ioctl( fd, PERF_EVENT_IOC_REFRESH, PAPI_REFRESH_VALUE ) == -1) {
-    PAPIERROR( "overflow refresh failed", 0 );
+    overflow_read( &hw_context, &thread, found_evt_idx, cidx );
   }
 }
 
@@ -2108,7 +3003,11 @@ _pe_stop_profiling( ThreadInfo_t *thread, EventSetInfo_t *ESI )
   for ( i = 0; i < ctl->num_events; i++ ) {
     /* Use the mmap_buf field as an indicator of this fd being used for */
     /* profiling.                                                       */
-    if ( ctl->events[i].mmap_buf ) {
+    if ( ctl->events[i].drain_slot ) {
+      drain_flush( &ctl->events[i] );
+      continue;
+    }
+    if ( ( ctl->events[i].mmap_buf ) && ( !ctl->events[i].sample_fields ) ) {
       /* Process any remaining samples in the sample buffer */
       ret = process_smpl_buf( i, &thread, cidx );
       if ( ret ) {
@@ -2146,13 +3045,13 @@ _pe_set_overflow( EventSetInfo_t *ESI, int EventIndex, int threshold )
 
   if ( threshold == 0 ) {
     /* If this counter isn't set to overflow, it's an error */
-    if ( ctl->events[evt_idx].attr.sample_period == 0 ) {
+    if ( ctl->attrs[evt_idx].sample_period == 0 ) {
     	SUBDBG("EXIT: PAPI_EINVAL, Tried to clear sample threshold when it was not set\n");
     	return PAPI_EINVAL;
     }
   }
 
-  ctl->events[evt_idx].attr.sample_period = threshold;
+  ctl->attrs[evt_idx].sample_period = threshold;
 
   /*
    * Note that the wakeup_mode field initially will be set to zero
@@ -2165,7 +3064,16 @@ _pe_set_overflow( EventSetInfo_t *ESI, int EventIndex, int threshold )
   case WAKEUP_MODE_PROFILING:
     /* Setting wakeup_events to special value zero means issue a */
     /* wakeup (signal) on every mmap page overflow.              */
-    ctl->events[evt_idx].attr.wakeup_events = 0;
+    ctl->attrs[evt_idx].wakeup_events = 0;
+    break;
+
+  case WAKEUP_MODE_DRAIN:
+    /* Wake the drain thread up when the buffer is half full,      */
+    /* rather than on every sample.  The IP is all a profile needs. */
+    ctl->attrs[evt_idx].watermark = 1;
+    ctl->attrs[evt_idx].wakeup_watermark =
+      ( ctl->events[evt_idx].nr_mmap_pages - 1 ) * getpagesize() / 2;
+    ctl->attrs[evt_idx].sample_type = PERF_SAMPLE_IP;
     break;
 
   case WAKEUP_MODE_COUNTER_OVERFLOW:
@@ -2173,9 +3081,9 @@ _pe_set_overflow( EventSetInfo_t *ESI, int EventIndex, int threshold )
 
     /* Setting wakeup_events to one means issue a wakeup on every */
     /* counter overflow (not mmap page overflow).                 */
-    ctl->events[evt_idx].attr.wakeup_events = 1;
+    ctl->attrs[evt_idx].wakeup_events = 1;
     /* We need the IP to pass to the overflow handler */
-    ctl->events[evt_idx].attr.sample_type = PERF_SAMPLE_IP;
+    ctl->attrs[evt_idx].sample_type = PERF_SAMPLE_IP;
     /* one for the user page, and two to take IP samples */
     ctl->events[evt_idx].nr_mmap_pages = 1 + 2;
     break;
@@ -2188,7 +3096,7 @@ _pe_set_overflow( EventSetInfo_t *ESI, int EventIndex, int threshold )
 
   /* Check for non-zero sample period */
   for ( i = 0; i < ctl->num_events; i++ ) {
-    if ( ctl->events[evt_idx].attr.sample_period ) {
+    if ( ctl->attrs[evt_idx].sample_period ) {
       found_non_zero_sample_period = 1;
       break;
     }
@@ -2243,13 +3151,17 @@ _pe_set_profile( EventSetInfo_t *ESI, int EventIndex, int threshold )
 	    ( uint64_t ) ctl->events[evt_idx].nr_mmap_pages *
 	    getpagesize(  ) );
 
+    drain_remove( &ctl->events[evt_idx] );
     if ( ctl->events[evt_idx].mmap_buf ) {
       munmap( ctl->events[evt_idx].mmap_buf,
 	      ctl->events[evt_idx].nr_mmap_pages * getpagesize() );
     }
     ctl->events[evt_idx].mmap_buf = NULL;
     ctl->events[evt_idx].nr_mmap_pages = 0;
-    ctl->events[evt_idx].attr.sample_type &= ~PERF_SAMPLE_IP;
+    ctl->attrs[evt_idx].sample_type &= ~PERF_SAMPLE_IP;
+    ctl->events[evt_idx].wakeup_mode = WAKEUP_MODE_COUNTER_OVERFLOW;
+    ctl->attrs[evt_idx].watermark = 0;
+    ctl->attrs[evt_idx].wakeup_watermark = 0;
     ret = _pe_set_overflow( ESI, EventIndex, threshold );
     /* ??? #warning "This should be handled somewhere else" */
     ESI->state &= ~( PAPI_OVERFLOWING );
@@ -2277,7 +3189,14 @@ _pe_set_profile( EventSetInfo_t *ESI, int EventIndex, int threshold )
   /* wrapping of the mapped pages.                                         */
 
   ctl->events[evt_idx].nr_mmap_pages = (1+8);
-  ctl->events[evt_idx].attr.sample_type |= PERF_SAMPLE_IP;
+  ctl->attrs[evt_idx].sample_type |= PERF_SAMPLE_IP;
+
+  /* The drain thread empties the buffer in batches, give it more room */
+  if ( ESI->profile.flags & PAPI_PROFIL_DRAIN ) {
+    ctl->events[evt_idx].wakeup_mode = WAKEUP_MODE_DRAIN;
+    ctl->events[evt_idx].nr_mmap_pages = (1+64);
+    ctl->drain_esi = ESI;
+  }
 
   ret = _pe_set_overflow( ESI, EventIndex, threshold );
   if ( ret != PAPI_OK ) return ret;
@@ -2285,6 +3204,241 @@ _pe_set_profile( EventSetInfo_t *ESI, int EventIndex, int threshold )
   return PAPI_OK;
 }
 
+/* Set up an event to leave samples in its mmap buffer for PAPI_sample_next() */
+int
+_pe_set_sample( EventSetInfo_t *ESI, int EventIndex, int threshold, int fields )
+{
+  pe_context_t *ctx;
+  pe_control_t *ctl = ( pe_control_t *) ( ESI->ctl_state );
+  struct perf_event_attr *attr;
+  int evt_idx;
+
+  ctx = ( pe_context_t *) ( ESI->master->context[ctl->cidx] );
+  evt_idx = ESI->EventInfoArray[EventIndex].pos[0];
+  if ( evt_idx < 0 ) return PAPI_EINVAL;
+
+  attr = &ctl->attrs[evt_idx];
+
+  if ( threshold == 0 ) {
+    if ( !ctl->events[evt_idx].sample_fields ) return PAPI_EINVAL;
+
+    attr->sample_period = 0;
+    attr->sample_type = 0;
+    ctl->events[evt_idx].nr_mmap_pages = 0;
+    ctl->events[evt_idx].sample_fields = 0;
+  } else {
+    /* The overflow code owns the sample period of this event */
+    if ( ( attr->sample_period ) && ( !ctl->events[evt_idx].sample_fields ) )
+      return PAPI_ECNFLCT;
+
+    attr->sample_period = threshold;
+    attr->sample_type = 0;
+    if ( fields & PAPI_SAMPLE_IP ) attr->sample_type |= PERF_SAMPLE_IP;
+    if ( fields & PAPI_SAMPLE_TID ) attr->sample_type |= PERF_SAMPLE_TID;
+    if ( fields & PAPI_SAMPLE_TIME ) attr->sample_type |= PERF_SAMPLE_TIME;
+    if ( fields & PAPI_SAMPLE_ADDR ) attr->sample_type |= PERF_SAMPLE_ADDR;
+    if ( fields & PAPI_SAMPLE_CPU ) attr->sample_type |= PERF_SAMPLE_CPU;
+    if ( fields & PAPI_SAMPLE_PERIOD ) attr->sample_type |= PERF_SAMPLE_PERIOD;
+    if ( fields & PAPI_SAMPLE_READ ) attr->sample_type |= PERF_SAMPLE_READ;
+    if ( fields & PAPI_SAMPLE_CALLCHAIN )
+      attr->sample_type |= PERF_SAMPLE_CALLCHAIN;
+
+    /* Nobody is woken up, the buffer is drained by polling. */
+    /* One control page plus a power of 2 data pages.        */
+    attr->wakeup_events = 0;
+    ctl->events[evt_idx].nr_mmap_pages = 1 + 16;
+    ctl->events[evt_idx].sample_fields = fields;
+  }
+
+  /* Reopen the events with the new attrs */
+  return _pe_update_control_state( ctl, NULL, ctl->num_events, ctx );
+}
+
+/* Decode the next sample of an event.  The record is left in the mmap */
+/* buffer and sample points into it, unless it wraps around the end of  */
+/* the buffer in which case it is copied to ctl->sample_buf first.      */
+/* Returns 1 if a sample was decoded, 0 if there are none left.         */
+int
+_pe_sample_next( hwd_control_state_t *ctl, int evt_idx, PAPI_sample_t *sample )
+{
+  pe_control_t *pe_ctl = ( pe_control_t *) ctl;
+  pe_event_info_t *pe;
+  struct perf_event_attr *attr;
+  struct perf_event_header *header;
+  unsigned char *data;
+  const uint64_t *p;
+  uint64_t head, size, offset, len, cpy;
+  unsigned char *dst;
+  void *buf;
+
+  if ( ( evt_idx < 0 ) || ( evt_idx >= pe_ctl->num_events ) ) return PAPI_EINVAL;
+
+  pe = &pe_ctl->events[evt_idx];
+  attr = &pe_ctl->attrs[evt_idx];
+  if ( ( !pe->sample_fields ) || ( pe->mmap_buf == NULL ) ) return PAPI_EINVAL;
+
+  head = mmap_read_head( pe );
+  data = ( ( unsigned char * ) pe->mmap_buf ) + getpagesize(  );
+
+  while ( pe->sample_pos != head ) {
+    /* The header itself never wraps, records are u64 aligned */
+    header = ( struct perf_event_header * ) &data[pe->sample_pos & pe->mask];
+    size = header->size;
+
+    if ( ( pe->sample_pos & pe->mask ) + size > pe->mask + 1 ) {
+      if ( size > pe_ctl->sample_buf_size ) {
+	buf = papi_realloc( pe_ctl->sample_buf, size );
+	if ( buf == NULL ) return PAPI_ENOMEM;
+	pe_ctl->sample_buf = buf;
+	pe_ctl->sample_buf_size = size;
+      }
+      offset = pe->sample_pos;
+      len = size;
+      dst = pe_ctl->sample_buf;
+      do {
+	cpy = min( pe->mask + 1 - ( offset & pe->mask ), len );
+	memcpy( dst, &data[offset & pe->mask], cpy );
+	offset += cpy;
+	dst += cpy;
+	len -= cpy;
+      } while ( len );
+      header = pe_ctl->sample_buf;
+    }
+    pe->sample_pos += size;
+
+    if ( header->type == PERF_RECORD_LOST ) {
+      pe->lost += ( ( struct lost_event * ) header )->lost;
+      continue;
+    }
+    if ( header->type != PERF_RECORD_SAMPLE ) continue;
+
+    /* The fields come in the order of the PERF_SAMPLE_* bits */
+    memset( sample, 0, sizeof ( *sample ) );
+    sample->fields = pe->sample_fields;
+    sample->lost = pe->lost;
+    p = ( const uint64_t * ) ( header + 1 );
+
+    if ( attr->sample_type & PERF_SAMPLE_IP ) {
+      sample->ip = *p++;
+    }
+    if ( attr->sample_type & PERF_SAMPLE_TID ) {
+      sample->pid = ( ( const uint32_t * ) p )[0];
+      sample->tid = ( ( const uint32_t * ) p )[1];
+      p++;
+    }
+    if ( attr->sample_type & PERF_SAMPLE_TIME ) {
+      sample->time = *p++;
+    }
+    if ( attr->sample_type & PERF_SAMPLE_ADDR ) {
+      sample->addr = *p++;
+    }
+    if ( attr->sample_type & PERF_SAMPLE_CPU ) {
+      sample->cpu = ( ( const uint32_t * ) p )[0];
+      p++;
+    }
+    if ( attr->sample_type & PERF_SAMPLE_PERIOD ) {
+      sample->period = *p++;
+    }
+    if ( attr->sample_type & PERF_SAMPLE_READ ) {
+      /* Same layout as read() of the fd */
+      if ( attr->read_format & PERF_FORMAT_GROUP ) {
+	sample->nr_values = ( int ) *p++;
+      } else {
+	sample->nr_values = 1;
+	sample->values = ( const unsigned long long * ) p++;
+      }
+      if ( attr->read_format & PERF_FORMAT_TOTAL_TIME_ENABLED ) {
+	sample->time_enabled = *p++;
+      }
+      if ( attr->read_format & PERF_FORMAT_TOTAL_TIME_RUNNING ) {
+	sample->time_running = *p++;
+      }
+      if ( attr->read_format & PERF_FORMAT_GROUP ) {
+	sample->values = ( const unsigned long long * ) p;
+	p += sample->nr_values;
+      }
+    }
+    if ( attr->sample_type & PERF_SAMPLE_CALLCHAIN ) {
+      sample->nr_ips = ( int ) *p++;
+      sample->ips = ( const unsigned long long * ) p;
+      p += sample->nr_ips;
+    }
+
+    return 1;
+  }
+
+  return PAPI_OK;
+}
+
+/* Let the kernel reuse the space of the samples decoded so far */
+int
+_pe_sample_release( hwd_control_state_t *ctl, int evt_idx )
+{
+  pe_control_t *pe_ctl = ( pe_control_t *) ctl;
+  pe_event_info_t *pe;
+
+  if ( ( evt_idx < 0 ) || ( evt_idx >= pe_ctl->num_events ) ) return PAPI_EINVAL;
+
+  pe = &pe_ctl->events[evt_idx];
+  if ( ( !pe->sample_fields ) || ( pe->mmap_buf == NULL ) ) return PAPI_EINVAL;
+
+  /* all reads of the records have to be done before the tail moves */
+  __sync_synchronize(  );
+  pe->tail = pe->sample_pos;
+  mmap_write_tail( pe, pe->tail );
+
+  return PAPI_OK;
+}
+
+/* What the last read of a multiplexed event scaled its count by */
+int
+_pe_read_mpx( hwd_control_state_t *ctl, int evt_idx, PAPI_mpx_value_t *value )
+{
+  pe_control_t *pe_ctl = ( pe_control_t *) ctl;
+  pe_event_info_t *pe;
+
+  if ( ( evt_idx < 0 ) || ( evt_idx >= pe_ctl->num_events ) ) return PAPI_EINVAL;
+
+  /* not multiplexed, so the count needed no scaling */
+  if ( !pe_ctl->multiplexed ) return PAPI_OK;
+
+  pe = &pe_ctl->events[evt_idx];
+  value->raw = pe->raw;
+  value->enabled = pe->enabled;
+  value->running = pe->running;
+  value->scale = ( pe->running > 0 ) ?
+    ( double ) pe->enabled / ( double ) pe->running : 0.0;
+  value->std_error = _papi_hwi_mpx_std_error( pe->rate_n, pe->rate_m2,
+					      pe->enabled, pe->running );
+
+  return PAPI_OK;
+}
+
+/* Samples of an overflowing or profiled event the kernel dropped */
+/* because its buffer was full                                   */
+int
+_pe_overflow_lost( hwd_control_state_t *ctl, int evt_idx, long long *lost )
+{
+  pe_control_t *pe_ctl = ( pe_control_t *) ctl;
+  pe_event_info_t *pe;
+
+  if ( ( evt_idx < 0 ) || ( evt_idx >= pe_ctl->num_events ) ) return PAPI_EINVAL;
+
+  pe = &pe_ctl->events[evt_idx];
+  if ( pe->mmap_buf == NULL ) return PAPI_EINVAL;
+
+  /* a drained buffer is read through the drain thread's copy */
+  if ( pe->drain_slot ) {
+    pthread_mutex_lock( &drain_lock );
+    *lost = drain_slots[pe->drain_slot - 1].pe.lost;
+    pthread_mutex_unlock( &drain_lock );
+  }
+  else {
+    *lost = pe->lost;
+  }
+
+  return PAPI_OK;
+}
 
 /* Our component vector */
 
@@ -2340,6 +3494,11 @@ papi_vector_t _perf_event_vector = {
   .reset =                 _pe_reset,
   .set_overflow =          _pe_set_overflow,
   .set_profile =           _pe_set_profile,
+  .set_sample =            _pe_set_sample,
+  .sample_next =           _pe_sample_next,
+  .sample_release =        _pe_sample_release,
+  .overflow_lost =         _pe_overflow_lost,
+  .read_mpx =              _pe_read_mpx,
   .stop_profiling =        _pe_stop_profiling,
   .write =                 _pe_write,
 
@@ -4,6 +4,10 @@
 /* you run out of fds                                           */
 #define PERF_EVENT_MAX_MPX_COUNTERS 192
 
+/* The per-event arrays of a control state start this large and */
+/* are doubled as events are added, up to the maximum above.    */
+#define PERF_EVENT_MIN_CTL_EVENTS 4
+
 /* We really don't need fancy definitions for these */
 
 typedef struct
@@ -16,8 +20,20 @@ typedef struct
   uint64_t tail;                  /* current read location in mmap buffer */
   uint64_t mask;                  /* mask used for wrapping the pages     */
   int cpu;                        /* cpu associated with this event       */
-  struct perf_event_attr attr;    /* perf_event config structure          */
   unsigned int wakeup_mode;       /* wakeup mode when sampling            */
+  int papi_event_code;            /* native event this was set up from    */
+  int sample_fields;              /* PAPI_SAMPLE_* fields, when sampling  */
+  uint64_t sample_pos;            /* next record for PAPI_sample_next()   */
+  long long lost;                 /* samples the kernel dropped           */
+  int drain_slot;                 /* drain thread slot + 1, 0 if none     */
+  /* multiplexed events only, all relative to the last start */
+  long long raw;                  /* unscaled count at the last read      */
+  long long enabled;              /* group time enabled at the last read  */
+  long long running;              /* group time running at the last read  */
+  long long base_enabled;         /* leaders: times the group had before  */
+  long long base_running;         /*   it was started                     */
+  long long rate_n;               /* reads with new running time, and the */
+  double rate_mean, rate_m2;      /*   spread of the rate between them    */
 } pe_event_info_t;
 
 
@@ -29,11 +45,20 @@ typedef struct {
   unsigned int overflow;          /* overflow enable                   */
   unsigned int inherit;           /* inherit enable                    */
   unsigned int overflow_signal;   /* overflow signal                   */
+  unsigned int rdpmc;             /* counters are read from user space */
   int cidx;                       /* current component                 */
   int cpu;                        /* which cpu to measure              */
   pid_t tid;                      /* thread we are monitoring          */
-  pe_event_info_t events[PERF_EVENT_MAX_MPX_COUNTERS];
-  long long counts[PERF_EVENT_MAX_MPX_COUNTERS];
+  int max_events;                 /* room in the per-event arrays      */
+  /* The per-event state is kept as separate arrays, all indexed */
+  /* like events[]: what start/stop/read touch stays compact and */
+  /* the large perf_event_attr is only looked at to open events. */
+  pe_event_info_t *events;        /* fds and mmap buffers              */
+  long long *counts;              /* values returned by read           */
+  struct perf_event_attr *attrs;  /* perf_event config structures      */
+  void *sample_buf;               /* copy of a sample that wrapped     */
+  size_t sample_buf_size;         /* size of sample_buf                */
+  EventSetInfo_t *drain_esi;      /* EventSet profiled by drain thread */
 } pe_control_t;
 
 
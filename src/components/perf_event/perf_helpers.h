@@ -0,0 +1,128 @@
+/*
+* File:    perf_helpers.h
+*
+* Helpers for reading perf_event counters directly from user space,
+* through the perf_event_mmap_page the kernel exports for each event.
+*/
+
+#ifndef _PERF_HELPERS_H
+#define _PERF_HELPERS_H
+
+/* Compiler barrier; the mmap page is protected by a sequence lock that */
+/* the kernel updates, we only need to stop the compiler from moving    */
+/* our loads outside of the lock/retry window.                          */
+#define pe_barrier() asm volatile("" ::: "memory")
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#define PE_HAVE_RDPMC 1
+
+static inline unsigned long long
+pe_rdtsc( void )
+{
+   unsigned int low, high;
+
+   asm volatile( "rdtsc" : "=a" ( low ), "=d" ( high ) );
+
+   return low | ( ( unsigned long long ) high ) << 32;
+}
+
+static inline unsigned long long
+pe_rdpmc( unsigned int counter )
+{
+   unsigned int low, high;
+
+   asm volatile( "rdpmc" : "=a" ( low ), "=d" ( high ) : "c" ( counter ) );
+
+   return low | ( ( unsigned long long ) high ) << 32;
+}
+
+#else
+
+#define PE_HAVE_RDPMC 0
+
+static inline unsigned long long
+pe_rdtsc( void )
+{
+   return 0;
+}
+
+static inline unsigned long long
+pe_rdpmc( unsigned int counter )
+{
+   ( void ) counter;
+   return 0;
+}
+
+#endif
+
+/* Read the count of a self-monitored event from its mmap page.          */
+/* This follows the protocol documented in include/linux/perf_event.h:   */
+/* sample everything between two reads of pc->lock and retry if the      */
+/* kernel updated the page in the meantime.                              */
+/*                                                                       */
+/* Returns 0 on success.  Returns -1 if the event is not currently on a  */
+/* hardware counter (pc->index == 0), in which case the caller has to    */
+/* fall back to a read() of the fd.                                      */
+/*                                                                       */
+/* enabled and running may be NULL if the caller does not need them.     */
+static inline int
+mmap_read_self( void *addr, long long *count,
+		unsigned long long *enabled, unsigned long long *running )
+{
+   struct perf_event_mmap_page *pc = addr;
+   uint32_t seq, time_mult = 0, time_shift = 0, index, width;
+   uint64_t time_enabled, time_running, time_offset = 0, cyc = 0;
+   uint64_t quot, rem, delta = 0;
+   int64_t pmc, value;
+
+   do {
+      seq = pc->lock;
+      pe_barrier();
+
+      time_enabled = pc->time_enabled;
+      time_running = pc->time_running;
+
+      if ( ( time_enabled != time_running ) && ( pc->cap_user_time ) ) {
+	 cyc = pe_rdtsc();
+	 time_mult = pc->time_mult;
+	 time_shift = pc->time_shift;
+	 time_offset = pc->time_offset;
+      }
+
+      index = pc->index;
+      value = pc->offset;
+
+      if ( PE_HAVE_RDPMC && pc->cap_usr_rdpmc && index ) {
+	 width = pc->pmc_width;
+	 pmc = pe_rdpmc( index - 1 );
+	 /* sign extend the raw counter to 64 bits */
+	 pmc <<= 64 - width;
+	 pmc >>= 64 - width;
+	 value += pmc;
+      }
+
+      pe_barrier();
+   } while ( pc->lock != seq );
+
+   if ( !index ) {
+      return -1;
+   }
+
+   /* time_enabled/time_running are only updated at context switch, */
+   /* so account for the time we have been running since then.      */
+   if ( time_mult ) {
+      quot = cyc >> time_shift;
+      rem = cyc & ( ( ( uint64_t ) 1 << time_shift ) - 1 );
+      delta = time_offset + quot * time_mult +
+	      ( ( rem * time_mult ) >> time_shift );
+   }
+
+   *count = value;
+   if ( enabled ) *enabled = time_enabled + delta;
+   if ( running ) *running = time_running + delta;
+
+   return 0;
+}
+
+#endif /* _PERF_HELPERS_H */
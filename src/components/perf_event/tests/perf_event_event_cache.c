@@ -0,0 +1,137 @@
+/*
+ * This tests the on-disk native event cache (PAPI_EVENT_CACHE)
+ *
+ * The first initialization resolves some native events and writes the
+ * cache, the second one has to find the same events in it.
+ */
+
+#include <dirent.h>
+#include <unistd.h>
+
+#include "papi_test.h"
+
+#define MAX_EVENTS 32
+
+static int
+cache_files( const char *dir )
+{
+   DIR *d;
+   struct dirent *ent;
+   int files = 0;
+
+   d = opendir( dir );
+   if ( d == NULL ) return 0;
+   while ( ( ent = readdir( d ) ) != NULL ) {
+      if ( strstr( ent->d_name, ".cache" ) != NULL ) files++;
+   }
+   closedir( d );
+   return files;
+}
+
+static void
+remove_cache( const char *dir )
+{
+   DIR *d;
+   struct dirent *ent;
+   char path[PATH_MAX];
+
+   d = opendir( dir );
+   if ( d != NULL ) {
+      while ( ( ent = readdir( d ) ) != NULL ) {
+	 if ( ent->d_name[0] == '.' ) continue;
+	 snprintf( path, sizeof ( path ), "%s/%s", dir, ent->d_name );
+	 unlink( path );
+      }
+      closedir( d );
+   }
+   rmdir( dir );
+}
+
+int main( int argc, char **argv ) {
+
+   int retval, i, num_events = 0, code;
+   int cidx;
+   char dir[] = "/tmp/papi_event_cacheXXXXXX";
+   char names[MAX_EVENTS][PAPI_MAX_STR_LEN];
+   PAPI_event_info_t first[MAX_EVENTS], info;
+   const PAPI_component_info_t *cmpinfo;
+
+   /* Set TESTS_QUIET variable */
+   tests_quiet( argc, argv );
+
+   if ( mkdtemp( dir ) == NULL ) {
+      test_fail( __FILE__, __LINE__, "mkdtemp", PAPI_ESYS );
+   }
+   setenv( "PAPI_EVENT_CACHE", dir, 1 );
+
+   /* Init the PAPI library */
+   retval = PAPI_library_init( PAPI_VER_CURRENT );
+   if ( retval != PAPI_VER_CURRENT ) {
+      test_fail( __FILE__, __LINE__, "PAPI_library_init", retval );
+   }
+
+   cidx = PAPI_get_component_index( "perf_event" );
+   cmpinfo = PAPI_get_component_info( cidx );
+   if ( cidx < 0 || cmpinfo == NULL || cmpinfo->disabled ) {
+      remove_cache( dir );
+      test_skip( __FILE__, __LINE__, "perf_event component not available", 0 );
+   }
+
+   /* resolve the first events of every pmu, and keep what they were */
+   code = PAPI_NATIVE_MASK;
+   retval = PAPI_enum_cmp_event( &code, PAPI_ENUM_FIRST, cidx );
+   while ( retval == PAPI_OK && num_events < MAX_EVENTS ) {
+      if ( PAPI_get_event_info( code, &first[num_events] ) == PAPI_OK ) {
+	 strcpy( names[num_events], first[num_events].symbol );
+	 num_events++;
+      }
+      retval = PAPI_enum_cmp_event( &code, PAPI_ENUM_EVENTS, cidx );
+   }
+
+   if ( num_events == 0 ) {
+      remove_cache( dir );
+      test_skip( __FILE__, __LINE__, "No native events", 0 );
+   }
+
+   PAPI_shutdown(  );
+
+   if ( cache_files( dir ) == 0 ) {
+      remove_cache( dir );
+      test_fail( __FILE__, __LINE__, "No cache file written", 1 );
+   }
+
+   /* this time around the names come from the cache */
+   retval = PAPI_library_init( PAPI_VER_CURRENT );
+   if ( retval != PAPI_VER_CURRENT ) {
+      remove_cache( dir );
+      test_fail( __FILE__, __LINE__, "PAPI_library_init", retval );
+   }
+
+   for ( i = 0; i < num_events; i++ ) {
+      retval = PAPI_event_name_to_code( names[i], &code );
+      if ( retval != PAPI_OK ) {
+	 remove_cache( dir );
+	 test_fail( __FILE__, __LINE__, names[i], retval );
+      }
+      retval = PAPI_get_event_info( code, &info );
+      if ( retval != PAPI_OK ) {
+	 remove_cache( dir );
+	 test_fail( __FILE__, __LINE__, "PAPI_get_event_info", retval );
+      }
+      if ( !TESTS_QUIET ) {
+	 printf( "%-50s %s\n", names[i], info.long_descr );
+      }
+      if ( strcmp( info.symbol, first[i].symbol ) ||
+	   strcmp( info.long_descr, first[i].long_descr ) ) {
+	 remove_cache( dir );
+	 test_fail( __FILE__, __LINE__, "Cached event differs", 1 );
+      }
+   }
+
+   PAPI_shutdown(  );
+   remove_cache( dir );
+
+   test_pass( __FILE__, NULL, 0 );
+
+   return 0;
+}
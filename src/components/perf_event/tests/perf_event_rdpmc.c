@@ -0,0 +1,107 @@
+/*
+ * This tests reading counters through the rdpmc fast path.
+ * The results should match what a read() of the same event returns.
+ */
+
+#include "papi_test.h"
+
+#include "event_name_lib.h"
+
+#define NUM_READS 10000
+
+int main( int argc, char **argv ) {
+
+   char *instructions_event=NULL;
+   char event_name[BUFSIZ];
+
+   int retval, i, cidx;
+   int EventSet = PAPI_NULL;
+   long long values[1], last, start_time, stop_time;
+   const PAPI_component_info_t *cmpinfo;
+
+   /* Set TESTS_QUIET variable */
+   tests_quiet( argc, argv );
+
+   /* Init the PAPI library */
+   retval = PAPI_library_init( PAPI_VER_CURRENT );
+   if ( retval != PAPI_VER_CURRENT ) {
+      test_fail( __FILE__, __LINE__, "PAPI_library_init", retval );
+   }
+
+   cidx = PAPI_get_component_index( "perf_event" );
+   if ( cidx < 0 ) {
+      test_skip( __FILE__, __LINE__, "perf_event component not found", 0 );
+   }
+
+   cmpinfo = PAPI_get_component_info( cidx );
+   if ( !cmpinfo->fast_counter_read ) {
+      test_skip( __FILE__, __LINE__, "rdpmc not available", 0 );
+   }
+
+   /* Get a relevant event name */
+   instructions_event=get_instructions_event(event_name, BUFSIZ);
+   if (instructions_event==NULL) {
+      test_skip( __FILE__, __LINE__,
+                "No instructions event definition for this arch",
+		 PAPI_ENOSUPP );
+   }
+
+   retval = PAPI_create_eventset(&EventSet);
+   if (retval != PAPI_OK) {
+      test_fail(__FILE__, __LINE__, "PAPI_create_eventset",retval);
+   }
+
+   retval = PAPI_add_named_event(EventSet, instructions_event);
+   if (retval != PAPI_OK) {
+      test_fail(__FILE__, __LINE__, "PAPI_add_named_event", retval);
+   }
+
+   retval = PAPI_start( EventSet );
+   if ( retval != PAPI_OK ) {
+      test_fail( __FILE__, __LINE__, "PAPI_start", retval );
+   }
+
+   do_flops( NUM_FLOPS );
+
+   /* Values read while running should never go backwards */
+   last = 0;
+   start_time = PAPI_get_real_nsec();
+   for( i = 0; i < NUM_READS; i++ ) {
+      retval = PAPI_read( EventSet, values );
+      if ( retval != PAPI_OK ) {
+         test_fail( __FILE__, __LINE__, "PAPI_read", retval );
+      }
+      if ( values[0] < last ) {
+         test_fail( __FILE__, __LINE__, "count went backwards", 0 );
+      }
+      last = values[0];
+   }
+   stop_time = PAPI_get_real_nsec();
+
+   retval = PAPI_stop( EventSet, values );
+   if ( retval != PAPI_OK ) {
+      test_fail( __FILE__, __LINE__, "PAPI_stop", retval );
+   }
+
+   if ( !TESTS_QUIET ) {
+      printf("Event: %s\n",instructions_event);
+      printf("Average PAPI_read(): %lld ns\n",
+             (stop_time-start_time)/NUM_READS);
+      printf("Last running value: %lld, stopped value: %lld\n",
+             last, values[0]);
+   }
+
+   /* The stopped value comes from read(), it has to cover the */
+   /* last value we read from user space.                      */
+   if ( values[0] < last ) {
+      test_fail( __FILE__, __LINE__, "rdpmc value larger than read()", 0 );
+   }
+
+   if ( last < NUM_FLOPS ) {
+      test_fail( __FILE__, __LINE__, "instruction count too low", 0 );
+   }
+
+   test_pass( __FILE__, NULL, 0 );
+
+   return 0;
+}
@@ -0,0 +1,127 @@
+/*
+ * This tests collecting samples with PAPI_sample() and reading
+ * them back with PAPI_sample_next(), while the EventSet runs.
+ */
+
+#include <unistd.h>
+
+#include "papi_test.h"
+
+#include "event_name_lib.h"
+
+#define SAMPLE_PERIOD 100000
+
+int main( int argc, char **argv ) {
+
+   char *instructions_event=NULL;
+   char event_name[BUFSIZ];
+
+   int retval, code, i, cidx, samples = 0;
+   int EventSet = PAPI_NULL;
+   long long values[1], lost = 0;
+   unsigned long long last_time = 0;
+   PAPI_sample_t sample;
+
+   /* Set TESTS_QUIET variable */
+   tests_quiet( argc, argv );
+
+   /* Init the PAPI library */
+   retval = PAPI_library_init( PAPI_VER_CURRENT );
+   if ( retval != PAPI_VER_CURRENT ) {
+      test_fail( __FILE__, __LINE__, "PAPI_library_init", retval );
+   }
+
+   cidx = PAPI_get_component_index( "perf_event" );
+   if ( ( cidx < 0 ) || ( PAPI_get_component_info( cidx )->disabled ) ) {
+      test_skip( __FILE__, __LINE__, "perf_event component not available", 0 );
+   }
+
+   /* Get a relevant event name */
+   instructions_event=get_instructions_event(event_name, BUFSIZ);
+   if (instructions_event==NULL) {
+      test_skip( __FILE__, __LINE__,
+                "No instructions event definition for this arch",
+		 PAPI_ENOSUPP );
+   }
+
+   retval = PAPI_create_eventset(&EventSet);
+   if (retval != PAPI_OK) {
+      test_fail(__FILE__, __LINE__, "PAPI_create_eventset",retval);
+   }
+
+   retval = PAPI_add_named_event(EventSet, instructions_event);
+   if (retval != PAPI_OK) {
+      test_fail(__FILE__, __LINE__, "PAPI_add_named_event", retval);
+   }
+
+   retval = PAPI_event_name_to_code( instructions_event, &code );
+   if (retval != PAPI_OK) {
+      test_fail(__FILE__, __LINE__, "PAPI_event_name_to_code", retval);
+   }
+
+   retval = PAPI_sample( EventSet, code, SAMPLE_PERIOD,
+			 PAPI_SAMPLE_IP | PAPI_SAMPLE_TID | PAPI_SAMPLE_TIME );
+   if ( retval == PAPI_ECMP || retval == PAPI_ENOSUPP ) {
+      test_skip( __FILE__, __LINE__, "PAPI_sample", retval );
+   }
+   if ( retval != PAPI_OK ) {
+      test_fail( __FILE__, __LINE__, "PAPI_sample", retval );
+   }
+
+   retval = PAPI_start( EventSet );
+   if ( retval != PAPI_OK ) {
+      test_fail( __FILE__, __LINE__, "PAPI_start", retval );
+   }
+
+   /* Drain the buffer in between, like a real consumer would */
+   for( i = 0; i < 10; i++ ) {
+      do_flops( NUM_FLOPS );
+
+      while ( ( retval = PAPI_sample_next( EventSet, code, &sample ) ) == 1 ) {
+	 if ( sample.pid != ( unsigned int ) getpid() ) {
+	    test_fail( __FILE__, __LINE__, "sample pid", 0 );
+	 }
+	 if ( sample.time < last_time ) {
+	    test_fail( __FILE__, __LINE__, "sample time went backwards", 0 );
+	 }
+	 if ( sample.ip == 0 ) {
+	    test_fail( __FILE__, __LINE__, "sample ip", 0 );
+	 }
+	 last_time = sample.time;
+	 lost = sample.lost;
+	 samples++;
+      }
+      if ( retval != PAPI_OK ) {
+	 test_fail( __FILE__, __LINE__, "PAPI_sample_next", retval );
+      }
+
+      retval = PAPI_sample_release( EventSet, code );
+      if ( retval != PAPI_OK ) {
+	 test_fail( __FILE__, __LINE__, "PAPI_sample_release", retval );
+      }
+   }
+
+   retval = PAPI_stop( EventSet, values );
+   if ( retval != PAPI_OK ) {
+      test_fail( __FILE__, __LINE__, "PAPI_stop", retval );
+   }
+
+   if ( !TESTS_QUIET ) {
+      printf("Event: %s\n",instructions_event);
+      printf("Count: %lld, samples: %d, lost: %lld\n",
+	     values[0], samples, lost);
+   }
+
+   if ( samples == 0 ) {
+      test_fail( __FILE__, __LINE__, "no samples", 0 );
+   }
+
+   retval = PAPI_sample( EventSet, code, 0, 0 );
+   if ( retval != PAPI_OK ) {
+      test_fail( __FILE__, __LINE__, "PAPI_sample off", retval );
+   }
+
+   test_pass( __FILE__, NULL, 0 );
+
+   return 0;
+}
@@ -326,6 +326,65 @@ check_scheduability( pe_context_t *ctx, pe_control_t *ctl)
 }
 
 
+/* Make room for num events in the per-event arrays of a control   */
+/* state, growing them by doubling.  The events must be closed.     */
+static int
+resize_pe_control( pe_control_t *ctl, int num )
+{
+   int max;
+   char *block;
+   pe_event_info_t *events;
+   long long *counts;
+   struct perf_event_attr *attrs;
+
+   if ( num <= ctl->max_events ) return PAPI_OK;
+
+   if ( num > PERF_EVENT_MAX_MPX_COUNTERS ) return PAPI_ECOUNT;
+
+   max = ctl->max_events ? ctl->max_events : PERF_EVENT_MIN_CTL_EVENTS;
+   while ( max < num ) max *= 2;
+   if ( max > PERF_EVENT_MAX_MPX_COUNTERS ) max = PERF_EVENT_MAX_MPX_COUNTERS;
+
+   /* one block, carved up into the three arrays */
+   block = papi_calloc( ( size_t ) max, sizeof ( pe_event_info_t ) +
+			sizeof ( long long ) +
+			sizeof ( struct perf_event_attr ) );
+   if ( block == NULL ) return PAPI_ENOMEM;
+
+   events = ( pe_event_info_t * ) block;
+   counts = ( long long * ) ( events + max );
+   attrs = ( struct perf_event_attr * ) ( counts + max );
+
+   /* keep the set up done by _peu_ctl, the events are reopened from it */
+   if ( ctl->max_events ) {
+      memcpy( events, ctl->events,
+	      ctl->max_events * sizeof ( pe_event_info_t ) );
+      memcpy( attrs, ctl->attrs,
+	      ctl->max_events * sizeof ( struct perf_event_attr ) );
+      papi_free( ctl->events );
+   }
+
+   ctl->events = events;
+   ctl->counts = counts;
+   ctl->attrs = attrs;
+   ctl->max_events = max;
+
+   return PAPI_OK;
+}
+
+/* Release the per-event arrays, the events must be closed */
+static void
+free_pe_control( pe_control_t *ctl )
+{
+   if ( ctl->max_events ) {
+      papi_free( ctl->events );
+   }
+   ctl->events = NULL;
+   ctl->counts = NULL;
+   ctl->attrs = NULL;
+   ctl->max_events = 0;
+}
+
 /* Open all events in the control state */
 static int
 open_pe_events( pe_context_t *ctx, pe_control_t *ctl )
@@ -375,31 +434,31 @@ open_pe_events( pe_context_t *ctx, pe_control_t *ctl )
       /* group leader (event 0) is special                */
       /* If we're multiplexed, everyone is a group leader */
       if (( i == 0 ) || (ctl->multiplexed)) {
-         ctl->events[i].attr.pinned = !ctl->multiplexed;
-	 ctl->events[i].attr.disabled = 1;
+         ctl->attrs[i].pinned = !ctl->multiplexed;
+	 ctl->attrs[i].disabled = 1;
 	 ctl->events[i].group_leader_fd=-1;
-         ctl->events[i].attr.read_format = get_read_format(ctl->multiplexed,
+         ctl->attrs[i].read_format = get_read_format(ctl->multiplexed,
 							   ctl->inherit,
 							   !ctl->multiplexed );
       } else {
-	 ctl->events[i].attr.pinned=0;
-	 ctl->events[i].attr.disabled = 0;
+	 ctl->attrs[i].pinned=0;
+	 ctl->attrs[i].disabled = 0;
 	 ctl->events[i].group_leader_fd=ctl->events[0].event_fd,
-         ctl->events[i].attr.read_format = get_read_format(ctl->multiplexed,
+         ctl->attrs[i].read_format = get_read_format(ctl->multiplexed,
 							   ctl->inherit,
 							   0 );
       }
 #else
-             ctl->events[i].attr.pinned = !ctl->multiplexed;
-         	 ctl->events[i].attr.disabled = 1;
+             ctl->attrs[i].pinned = !ctl->multiplexed;
+         	 ctl->attrs[i].disabled = 1;
          	 ctl->inherit = 1;
          	 ctl->events[i].group_leader_fd=-1;
-             ctl->events[i].attr.read_format = get_read_format(ctl->multiplexed, ctl->inherit, 0 );
+             ctl->attrs[i].read_format = get_read_format(ctl->multiplexed, ctl->inherit, 0 );
 #endif
 
 
       /* try to open */
-      ctl->events[i].event_fd = sys_perf_event_open( &ctl->events[i].attr,
+      ctl->events[i].event_fd = sys_perf_event_open( &ctl->attrs[i],
 						     pid,
 						     ctl->events[i].cpu,
 			       ctl->events[i].group_leader_fd,
@@ -420,7 +479,7 @@ open_pe_events( pe_context_t *ctx, pe_control_t *ctl )
               " group_leader/fd: %d, event_fd: %d,"
               " read_format: %"PRIu64"\n",
 	      pid, ctl->events[i].cpu, ctl->events[i].group_leader_fd,
-	      ctl->events[i].event_fd, ctl->events[i].attr.read_format);
+	      ctl->events[i].event_fd, ctl->attrs[i].read_format);
 
       ctl->events[i].event_opened=1;
    }
@@ -723,10 +782,16 @@ _peu_update_control_state( hwd_control_state_t *ctl,
    /* Calling with count==0 should be OK, it's how things are deallocated */
    /* when an eventset is destroyed.                                      */
    if ( count == 0 ) {
+      free_pe_control( pe_ctl );
       SUBDBG( "Called with count == 0\n" );
       return PAPI_OK;
    }
 
+   ret = resize_pe_control( pe_ctl, count );
+   if ( ret != PAPI_OK ) {
+      return ret;
+   }
+
    /* set up all the events */
    for( i = 0; i < count; i++ ) {
       if ( native ) {
@@ -760,7 +825,7 @@ _peu_update_control_state( hwd_control_state_t *ctl,
 			SUBDBG("i: %d, pe_ctx->event_table->num_native_events: %d\n", i, pe_ctx->event_table->num_native_events);
 
 	    	// Move this events hardware config values and other attributes to the perf_events attribute structure
-			memcpy (&pe_ctl->events[i].attr, &ntv_evt->attr, sizeof(perf_event_attr_t));
+			memcpy (&pe_ctl->attrs[i], &ntv_evt->attr, sizeof(perf_event_attr_t));
 
 			// may need to update the attribute structure with information from event set level domain settings (values set by PAPI_set_domain)
 			// only done if the event mask which controls each counting domain was not provided
@@ -768,12 +833,12 @@ _peu_update_control_state( hwd_control_state_t *ctl,
 			// get pointer to allocated name, will be NULL when adding preset events to event set
 			char *aName = ntv_evt->allocated_name;
 			if ((aName == NULL)  ||  (strstr(aName, ":u=") == NULL)) {
-				SUBDBG("set exclude_user attribute from eventset level domain flags, encode: %d, eventset: %d\n", pe_ctl->events[i].attr.exclude_user, !(pe_ctl->domain & PAPI_DOM_USER));
-				pe_ctl->events[i].attr.exclude_user = !(pe_ctl->domain & PAPI_DOM_USER);
+				SUBDBG("set exclude_user attribute from eventset level domain flags, encode: %d, eventset: %d\n", pe_ctl->attrs[i].exclude_user, !(pe_ctl->domain & PAPI_DOM_USER));
+				pe_ctl->attrs[i].exclude_user = !(pe_ctl->domain & PAPI_DOM_USER);
 			}
 			if ((aName == NULL)  ||  (strstr(aName, ":k=") == NULL)) {
-				SUBDBG("set exclude_kernel attribute from eventset level domain flags, encode: %d, eventset: %d\n", pe_ctl->events[i].attr.exclude_kernel, !(pe_ctl->domain & PAPI_DOM_KERNEL));
-				pe_ctl->events[i].attr.exclude_kernel = !(pe_ctl->domain & PAPI_DOM_KERNEL);
+				SUBDBG("set exclude_kernel attribute from eventset level domain flags, encode: %d, eventset: %d\n", pe_ctl->attrs[i].exclude_kernel, !(pe_ctl->domain & PAPI_DOM_KERNEL));
+				pe_ctl->attrs[i].exclude_kernel = !(pe_ctl->domain & PAPI_DOM_KERNEL);
 			}
 
 			// set the cpu number provided with an event mask if there was one (will be -1 if mask not provided)
@@ -788,7 +853,7 @@ _peu_update_control_state( hwd_control_state_t *ctl,
       }
 
       // Copy the inherit flag into the attribute block that will be passed to the kernel
-      pe_ctl->events[i].attr.inherit = pe_ctl->inherit;
+      pe_ctl->attrs[i].inherit = pe_ctl->inherit;
 
       /* Set the position in the native structure */
       /* We just set up events linearly           */
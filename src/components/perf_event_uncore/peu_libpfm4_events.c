@@ -122,6 +122,7 @@ static struct native_event_t *allocate_native_event(char *name, int libpfm4_inde
   int nevt_idx;
   int event_num;
   int encode_failed=0;
+  int new_event_code;
 
   pfm_err_t ret;
   char *event_string=NULL;
@@ -161,6 +162,14 @@ static struct native_event_t *allocate_native_event(char *name, int libpfm4_inde
 
   SUBDBG("event_num: %d, nevt_idx: %d, ntv_evt: %p\n", event_num, nevt_idx, ntv_evt);
 
+  // an event resolved by an earlier process comes from the cache, libpfm4 is not needed
+  if (_papi_libpfm4_cache_lookup(name, ntv_evt, event_table) == PAPI_OK) {
+     libpfm4_index = ntv_evt->libpfm4_idx;
+     ntv_evt->component=_peu_libpfm4_get_cidx();
+     ntv_evt->users=0;
+     goto publish;
+  }
+
   /* clear the argument and attribute structures */
   memset(&perf_arg,0,sizeof(pfm_perf_encode_arg_t));
   memset(&(ntv_evt->attr),0,sizeof(struct perf_event_attr));
@@ -351,8 +360,14 @@ static struct native_event_t *allocate_native_event(char *name, int libpfm4_inde
 		free (msk_ptr);
 	}
 
+	// the cache file is missing this one
+	if (encode_failed == 0) {
+		event_table->cache.stale = 1;
+	}
+
+publish:
 	// create a papi table for this native event, put the index into the event sets array of native events into the papi table
-	int new_event_code = _papi_hwi_native_to_eventcode(_peu_libpfm4_get_cidx(), libpfm4_index, nevt_idx, ntv_evt->allocated_name);
+	new_event_code = _papi_hwi_native_to_eventcode(_peu_libpfm4_get_cidx(), libpfm4_index, nevt_idx, ntv_evt->allocated_name);
 	_papi_hwi_set_papi_event_string((const char *)ntv_evt->allocated_name);
 	_papi_hwi_set_papi_event_code(new_event_code, 1);
 
@@ -999,6 +1014,9 @@ _peu_libpfm4_shutdown(papi_vector_t *my_vector,
 	  }
   }
 
+  /* anything resolved since init goes to the cache file */
+  _papi_libpfm4_cache_close(event_table);
+
   /* clean out and free the native events structure */
   _papi_hwi_lock( NAMELIB_LOCK );
 
@@ -1093,6 +1111,9 @@ _peu_libpfm4_init(papi_vector_t *my_vector,
 
    SUBDBG( "num_counters: %d\n", my_vector->cmp_info.num_cntrs );
 
+   /* events resolved by an earlier process need not go through libpfm4 */
+   _papi_libpfm4_cache_open(my_vector, event_table);
+
    return PAPI_OK;
 }
 
@@ -302,6 +302,28 @@ _papi_hwi_initialize_cpu( CpuInfo_t **dest, unsigned int cpu_num )
    return PAPI_OK;
 }
 
+/* Set up the context of a component initialized after these cpus were */
+int
+_papi_hwi_init_cpu_component( int cidx )
+{
+   APIDBG("Entry: cidx: %d\n", cidx);
+
+   CpuInfo_t *cpu;
+   int retval = PAPI_OK;
+
+   _papi_hwi_lock( CPUS_LOCK );
+
+   for ( cpu = _papi_hwi_cpu_head; cpu != NULL; cpu = cpu->next ) {
+      retval = _papi_hwd[cidx]->init_thread( cpu->context[cidx] );
+      if ( retval != PAPI_OK ) break;
+      if ( cpu->next == _papi_hwi_cpu_head ) break;
+   }
+
+   _papi_hwi_unlock( CPUS_LOCK );
+
+   return retval;
+}
+
 int
 _papi_hwi_shutdown_cpu( CpuInfo_t *cpu )
 {
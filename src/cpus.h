@@ -19,6 +19,7 @@ typedef struct _CpuInfo
 
 int _papi_hwi_initialize_cpu( CpuInfo_t **dest, unsigned int cpu_num );
 int _papi_hwi_shutdown_cpu( CpuInfo_t *cpu );
+int _papi_hwi_init_cpu_component( int cidx );
 int _papi_hwi_lookup_or_create_cpu( CpuInfo_t ** here, unsigned int cpu_num );
 
 #endif
@@ -0,0 +1,84 @@
+/* This test checks adding a list of events at once with
+   PAPI_add_named_events(), including partial success when
+   one of the names cannot be added.
+  */
+
+#include "papi_test.h"
+
+int
+main( int argc, char **argv )
+{
+	int retval;
+	int EventSet = PAPI_NULL;
+	long long values[2];
+	char *event_names[] = {"PAPI_TOT_CYC","PAPI_TOT_INS"};
+	char *bad_names[] = {"PAPI_TOT_INS","NOT_A_REAL_EVENT","PAPI_TOT_CYC"};
+
+	/* Set TESTS_QUIET variable */
+	tests_quiet( argc, argv );
+
+	/* Init the PAPI library */
+	retval = PAPI_library_init( PAPI_VER_CURRENT );
+	if ( retval != PAPI_VER_CURRENT ) {
+	   test_fail( __FILE__, __LINE__, "PAPI_library_init", retval );
+	}
+
+	/* Create an empty event set */
+	retval = PAPI_create_eventset( &EventSet );
+	if ( retval != PAPI_OK ) {
+	   test_fail( __FILE__, __LINE__, "PAPI_create_eventset", retval );
+	}
+
+	/* add both events with one call */
+	retval = PAPI_add_named_events( EventSet, event_names, 2 );
+	if ( retval != PAPI_OK ) {
+	   if ( retval == PAPI_ENOEVNT || retval > 0 ) {
+	      test_skip( __FILE__, __LINE__, "PAPI_add_named_events", retval );
+	   }
+	   test_fail( __FILE__, __LINE__, "PAPI_add_named_events", retval );
+	}
+
+	if ( PAPI_num_events( EventSet ) != 2 ) {
+	   test_fail( __FILE__, __LINE__, "wrong number of events", 0 );
+	}
+
+	retval = PAPI_start( EventSet );
+	if ( retval != PAPI_OK ) {
+	   test_fail( __FILE__, __LINE__, "PAPI_start", retval );
+	}
+
+	do_flops( NUM_FLOPS );
+
+	retval = PAPI_stop( EventSet, values );
+	if ( retval != PAPI_OK ) {
+	   test_fail( __FILE__, __LINE__, "PAPI_stop", retval );
+	}
+
+	if ( !TESTS_QUIET ) {
+	   printf( "%-12s : \t%lld\n", event_names[0], values[0] );
+	   printf( "%-12s : \t%lld\n", event_names[1], values[1] );
+	}
+
+	if ( ( values[0] <= 0 ) || ( values[1] < NUM_FLOPS ) ) {
+	   test_fail( __FILE__, __LINE__, "validation", 0 );
+	}
+
+	retval = PAPI_cleanup_eventset( EventSet );
+	if ( retval != PAPI_OK ) {
+	   test_fail( __FILE__, __LINE__, "PAPI_cleanup_eventset", retval );
+	}
+
+	/* only the events before the bad name get added */
+	retval = PAPI_add_named_events( EventSet, bad_names, 3 );
+	if ( retval != 1 ) {
+	   test_fail( __FILE__, __LINE__, "PAPI_add_named_events partial", retval );
+	}
+
+	if ( PAPI_num_events( EventSet ) != 1 ) {
+	   test_fail( __FILE__, __LINE__, "wrong number of events", 0 );
+	}
+
+	test_pass( __FILE__, NULL, 0 );
+
+	return 0;
+}
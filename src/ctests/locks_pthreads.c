@@ -54,6 +54,7 @@ main( int argc, char **argv )
 	int rc, i, nthr;
 	int retval;
 	const PAPI_hw_info_t *hwinfo = NULL;
+	PAPI_lock_stats_t stats;
 
 	/* Set TESTS_QUIET variable */
 	tests_quiet( argc, argv );	
@@ -98,6 +99,18 @@ main( int argc, char **argv )
 	if ( nthr * num_iters != count )
 		test_fail( __FILE__, __LINE__, "Thread Locks", 1 );
 
+	/* Every PAPI_lock() above has to show up in the statistics */
+	retval = PAPI_get_lock_stats( PAPI_USR1_LOCK, &stats );
+	if ( retval == PAPI_OK ) {
+		printf( "%s: acquired %lld, contended %lld, sleeps %lld, "
+				"waited %lld ns\n", stats.name, stats.acquired,
+				stats.contended, stats.sleeps, stats.wait_ns );
+		if ( stats.acquired < ( long long ) nthr * ( num_iters + 10000 ) )
+			test_fail( __FILE__, __LINE__, "PAPI_get_lock_stats", 1 );
+	} else if ( retval != PAPI_ENOSUPP ) {
+		test_fail( __FILE__, __LINE__, "PAPI_get_lock_stats", retval );
+	}
+
 	test_pass( __FILE__, NULL, 0 );
 	exit( 1 );
 }
@@ -0,0 +1,108 @@
+/*
+* File:    multiplex_accuracy.c
+* Mods:    <your name here>
+*          <your email address>
+*/
+
+/* This file performs the following test: software multiplexing with the
+   adaptive schedule, read back with PAPI_read_mpx().
+
+- Multiplex as many non-derived presets as we can, PAPI_MULTIPLEX_ADAPTIVE
+  with every event getting at least 5% of the slices
+- Start eventset, do work, stop eventset
+- Check every count agrees with what it was extrapolated from
+*/
+
+#include "papi_test.h"
+
+#define MAX_EVENTS 16
+
+int
+main( int argc, char **argv )
+{
+	int retval, i, j = 0, EventSet = PAPI_NULL;
+	long long values[MAX_EVENTS];
+	PAPI_mpx_value_t mpx[MAX_EVENTS];
+	PAPI_event_info_t pset;
+	PAPI_option_t opt;
+
+	tests_quiet( argc, argv );	/* Set TESTS_QUIET variable */
+
+	retval = PAPI_library_init( PAPI_VER_CURRENT );
+	if ( retval != PAPI_VER_CURRENT )
+		test_fail( __FILE__, __LINE__, "PAPI_library_init", retval );
+
+	init_multiplex(  );
+
+	retval = PAPI_create_eventset( &EventSet );
+	if ( retval != PAPI_OK )
+		test_fail( __FILE__, __LINE__, "PAPI_create_eventset", retval );
+
+	retval = PAPI_assign_eventset_component( EventSet, 0 );
+	if ( retval != PAPI_OK )
+		test_fail( __FILE__, __LINE__, "PAPI_assign_eventset_component",
+				   retval );
+
+	memset( &opt, 0x0, sizeof ( opt ) );
+	opt.multiplex.eventset = EventSet;
+	opt.multiplex.flags = PAPI_MULTIPLEX_ADAPTIVE;
+	opt.multiplex.min_share = 5;
+	retval = PAPI_set_opt( PAPI_MULTIPLEX, &opt );
+	if ( retval == PAPI_ENOSUPP )
+		test_skip( __FILE__, __LINE__, "Multiplex not supported", 1 );
+	else if ( retval != PAPI_OK )
+		test_fail( __FILE__, __LINE__, "PAPI_set_opt", retval );
+
+	i = PAPI_PRESET_MASK;
+	do {
+		if ( ( PAPI_get_event_info( i, &pset ) == PAPI_OK ) && pset.count &&
+			 ( strcmp( pset.derived, "NOT_DERIVED" ) == 0 ) ) {
+			if ( PAPI_add_event( EventSet, ( int ) pset.event_code ) !=
+				 PAPI_OK )
+				break;
+			j++;
+		}
+	} while ( ( PAPI_enum_event( &i, PAPI_PRESET_ENUM_AVAIL ) == PAPI_OK ) &&
+			  ( j < MAX_EVENTS ) );
+
+	if ( j < 2 )
+		test_skip( __FILE__, __LINE__, "Not enough events", 0 );
+
+	if ( ( retval = PAPI_start( EventSet ) ) != PAPI_OK )
+		test_fail( __FILE__, __LINE__, "PAPI_start", retval );
+
+	do_stuff(  );
+	do_stuff(  );
+
+	if ( ( retval = PAPI_stop( EventSet, values ) ) != PAPI_OK )
+		test_fail( __FILE__, __LINE__, "PAPI_stop", retval );
+
+	if ( ( retval = PAPI_read_mpx( EventSet, mpx ) ) != PAPI_OK )
+		test_fail( __FILE__, __LINE__, "PAPI_read_mpx", retval );
+
+	if ( !TESTS_QUIET ) {
+		printf( "Test case: adaptive multiplexing accuracy\n" );
+		printf( "%-12s %14s %14s %14s %14s %8s %12s\n", "event", "value",
+				"raw", "enabled", "running", "scale", "std error" );
+	}
+
+	for ( i = 0; i < j; i++ ) {
+		if ( !TESTS_QUIET )
+			printf( "%-12d %14lld %14lld %14lld %14lld %8.2f %12.0f\n", i,
+					mpx[i].value, mpx[i].raw, mpx[i].enabled, mpx[i].running,
+					mpx[i].scale, mpx[i].std_error );
+
+		if ( mpx[i].value != values[i] )
+			test_fail( __FILE__, __LINE__, "value differs from PAPI_stop", 1 );
+		if ( ( mpx[i].running < 0 ) || ( mpx[i].running > mpx[i].enabled ) )
+			test_fail( __FILE__, __LINE__, "running outside enabled", 1 );
+		if ( ( mpx[i].running > 0 ) && ( mpx[i].scale < 1.0 ) )
+			test_fail( __FILE__, __LINE__, "scale below 1", 1 );
+		if ( ( mpx[i].running == mpx[i].enabled ) &&
+			 ( mpx[i].std_error != 0.0 ) )
+			test_fail( __FILE__, __LINE__, "error on an exact count", 1 );
+	}
+
+	test_pass( __FILE__, NULL, 0 );
+	exit( 1 );
+}
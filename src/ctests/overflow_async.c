@@ -0,0 +1,135 @@
+/*
+* File:    overflow_async.c
+* Mods:    <your name here>
+*          <your email address>
+*/
+
+/* This file performs the following test: overflows queued with
+   PAPI_OVERFLOW_ASYNC and taken by a second thread that waits on
+   the PAPI_overflow_fd() descriptor.
+
+- Set up asynchronous overflow on the eventset
+- Start a consumer thread
+- Start eventset, do flops, stop eventset
+- Take the rest of the queue and check every overflow was seen
+*/
+
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "papi_test.h"
+
+static int EventSet = PAPI_NULL;
+static volatile int done = 0;
+static int total = 0;			/* overflows taken from the queue */
+static long long lost = 0;
+
+static int
+take_overflows( void )
+{
+	PAPI_overflow_event_t ev;
+	int retval;
+
+	while ( ( retval = PAPI_overflow_next( EventSet, &ev ) ) == 1 ) {
+		if ( ev.EventSet != EventSet || ev.overflow_vector == 0 )
+			test_fail( __FILE__, __LINE__, "PAPI_overflow_next", 1 );
+		lost = ev.lost;
+		total++;
+	}
+	return retval;
+}
+
+static void *
+consumer( void *arg )
+{
+	struct pollfd pfd;
+	unsigned long long count;
+	ssize_t ret;
+
+	( void ) arg;
+
+	if ( PAPI_overflow_fd( EventSet, &pfd.fd ) != PAPI_OK )
+		pfd.fd = -1;
+	pfd.events = POLLIN;
+
+	while ( !done ) {
+		if ( pfd.fd >= 0 ) {
+			if ( poll( &pfd, 1, 100 ) <= 0 )
+				continue;
+			ret = read( pfd.fd, &count, sizeof ( count ) );
+			( void ) ret;
+		} else {
+			usleep( 1000 );
+		}
+		if ( take_overflows(  ) != PAPI_OK )
+			test_fail( __FILE__, __LINE__, "PAPI_overflow_next", 1 );
+	}
+	return NULL;
+}
+
+int
+main( int argc, char **argv )
+{
+	long long values[1];
+	int PAPI_event, retval;
+	pthread_t tid;
+
+	tests_quiet( argc, argv );	/* Set TESTS_QUIET variable */
+
+	retval = PAPI_library_init( PAPI_VER_CURRENT );
+	if ( retval != PAPI_VER_CURRENT )
+		test_fail( __FILE__, __LINE__, "PAPI_library_init", retval );
+
+	if ( PAPI_query_event( PAPI_TOT_INS ) == PAPI_OK )
+		PAPI_event = PAPI_TOT_INS;
+	else if ( PAPI_query_event( PAPI_TOT_CYC ) == PAPI_OK )
+		PAPI_event = PAPI_TOT_CYC;
+	else
+		test_skip( __FILE__, __LINE__, "PAPI_query_event", PAPI_ENOEVNT );
+
+	if ( ( retval = PAPI_create_eventset( &EventSet ) ) != PAPI_OK )
+		test_fail( __FILE__, __LINE__, "PAPI_create_eventset", retval );
+
+	if ( ( retval = PAPI_add_event( EventSet, PAPI_event ) ) != PAPI_OK )
+		test_fail( __FILE__, __LINE__, "PAPI_add_event", retval );
+
+	retval = PAPI_overflow( EventSet, PAPI_event, THRESHOLD,
+							PAPI_OVERFLOW_ASYNC, NULL );
+	if ( retval != PAPI_OK )
+		test_fail( __FILE__, __LINE__, "PAPI_overflow", retval );
+
+	if ( pthread_create( &tid, NULL, consumer, NULL ) != 0 )
+		test_fail( __FILE__, __LINE__, "pthread_create", PAPI_ESYS );
+
+	if ( ( retval = PAPI_start( EventSet ) ) != PAPI_OK )
+		test_fail( __FILE__, __LINE__, "PAPI_start", retval );
+
+	do_flops( NUM_FLOPS * 10 );
+
+	if ( ( retval = PAPI_stop( EventSet, values ) ) != PAPI_OK )
+		test_fail( __FILE__, __LINE__, "PAPI_stop", retval );
+
+	done = 1;
+	pthread_join( tid, NULL );
+
+	/* the consumer is gone, so this thread may take what is left */
+	if ( take_overflows(  ) != PAPI_OK )
+		test_fail( __FILE__, __LINE__, "PAPI_overflow_next", 1 );
+
+	if ( !TESTS_QUIET ) {
+		printf( "Test case: asynchronous overflow delivery\n" );
+		printf( "Count: %lld, overflows: %d, lost: %lld\n", values[0],
+				total, lost );
+	}
+
+	if ( total == 0 )
+		test_fail( __FILE__, __LINE__, "No overflows queued", 1 );
+
+	if ( ( retval = PAPI_overflow( EventSet, PAPI_event, 0,
+								   PAPI_OVERFLOW_ASYNC, NULL ) ) != PAPI_OK )
+		test_fail( __FILE__, __LINE__, "PAPI_overflow", retval );
+
+	test_pass( __FILE__, NULL, 0 );
+	exit( 1 );
+}
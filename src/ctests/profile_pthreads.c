@@ -1,4 +1,6 @@
 /* This file performs the following test: profile for pthreads */
+/* Every other thread has its samples collected by the background */
+/* drain thread (PAPI_PROFIL_DRAIN) instead of the signal handler. */
 
 #include <pthread.h>
 #include "papi_test.h"
@@ -15,7 +17,7 @@ void *
 Thread( void *arg )
 {
 	int retval, num_tests = 1, i;
-	int EventSet1 = PAPI_NULL, mask1, PAPI_event;
+	int EventSet1 = PAPI_NULL, mask1, PAPI_event, profflags;
 	int num_events1;
 	long long **values;
 	long long elapsed_us, elapsed_cyc;
@@ -42,12 +44,16 @@ Thread( void *arg )
 		   PAPI_event_code_to_name( PAPI_event, event_name ) ) != PAPI_OK )
 		test_fail( __FILE__, __LINE__, "PAPI_event_code_to_name", retval );
 
+	profflags = PAPI_PROFIL_POSIX;
+	if ( ( *( int * ) arg / FLOPS ) % 2 == 0 )
+		profflags |= PAPI_PROFIL_DRAIN;
+
 	elapsed_us = PAPI_get_real_usec(  );
 
 	elapsed_cyc = PAPI_get_real_cyc(  );
 
 	retval = PAPI_profil( profbuf, length, my_start, 65536,
-						  EventSet1, PAPI_event, THR, PAPI_PROFIL_POSIX );
+						  EventSet1, PAPI_event, THR, profflags );
 	if ( retval )
 		test_fail( __FILE__, __LINE__, "PAPI_profil", retval );
 
@@ -87,7 +93,8 @@ Thread( void *arg )
 		printf( "Thread %#x Real cycles : \t%lld\n", ( int ) pthread_self(  ),
 				elapsed_cyc );
 
-		printf( "Test case: PAPI_profil() for pthreads\n" );
+		printf( "Test case: PAPI_profil() for pthreads%s\n",
+				( profflags & PAPI_PROFIL_DRAIN ) ? ", drain thread" : "" );
 		printf( "----Profile buffer for Thread %#x---\n",
 				( int ) pthread_self(  ) );
 		for ( i = 0; i < ( int ) length; i++ ) {
@@ -0,0 +1,90 @@
+/*
+* File:    sparse_profile.c
+* Mods:    <your name here>
+*          <your email address>
+*/
+
+/* This file performs the following test: profiling the whole text segment
+   into a PAPI_PROFIL_SPARSE hash table that is much smaller than a dense
+   buffer for the same region would be. */
+
+#include "papi_test.h"
+#include "prof_utils.h"
+
+#define SPARSE_ENTRIES 4096
+
+int
+main( int argc, char **argv )
+{
+	int i, num_tests = 6, mask, used = 0;
+	unsigned long long samples = 0;
+	int retval;
+	const PAPI_exe_info_t *prginfo;
+	caddr_t start, end;
+	PAPI_profil_bucket_t *table;
+
+	prof_init( argc, argv, &prginfo );
+
+	mask = prof_events( num_tests );
+	start = prginfo->address_info.text_start;
+	end = prginfo->address_info.text_end;
+	if ( start > end )
+		test_fail( __FILE__, __LINE__, "Profile length < 0!", 0 );
+
+	prof_print_address
+		( "Test case sparse_profile: hash table profiling with PAPI_PROFIL_SPARSE.\n",
+		  prginfo );
+	prof_print_prof_info( start, end, THRESHOLD, event_name );
+
+	table = calloc( SPARSE_ENTRIES, sizeof ( PAPI_profil_bucket_t ) );
+	if ( table == NULL )
+		test_fail( __FILE__, __LINE__, "calloc", PAPI_ENOMEM );
+
+	if ( ( retval =
+		   PAPI_profil( table, SPARSE_ENTRIES * sizeof ( PAPI_profil_bucket_t ),
+						start, FULL_SCALE, EventSet, PAPI_event, THRESHOLD,
+						PAPI_PROFIL_POSIX | PAPI_PROFIL_SPARSE ) ) != PAPI_OK )
+		test_fail( __FILE__, __LINE__, "PAPI_profil", retval );
+
+	if ( ( retval = PAPI_start( EventSet ) ) != PAPI_OK )
+		test_fail( __FILE__, __LINE__, "PAPI_start", retval );
+
+	do_flops( getenv( "NUM_ITERS" ) ? atoi( getenv( "NUM_ITERS" ) ) :
+			  NUM_ITERS );
+
+	if ( ( retval = PAPI_stop( EventSet, values[0] ) ) != PAPI_OK )
+		test_fail( __FILE__, __LINE__, "PAPI_stop", retval );
+
+	if ( ( retval =
+		   PAPI_profil( table, SPARSE_ENTRIES * sizeof ( PAPI_profil_bucket_t ),
+						start, FULL_SCALE, EventSet, PAPI_event, 0,
+						PAPI_PROFIL_POSIX | PAPI_PROFIL_SPARSE ) ) != PAPI_OK )
+		test_fail( __FILE__, __LINE__, "PAPI_profil", retval );
+
+	for ( i = 0; i < SPARSE_ENTRIES; i++ ) {
+		if ( table[i].count == 0 )
+			continue;
+		if ( !TESTS_QUIET )
+			printf( "%#-16lx%llu\n",
+					( unsigned long ) start + 2 * ( unsigned long ) table[i].index,
+					table[i].count );
+		samples += table[i].count;
+		used++;
+	}
+
+	if ( !TESTS_QUIET ) {
+		printf( TAB1, event_name, ( values[0] )[0] );
+		printf( "%llu samples in %d of %d entries\n", samples, used,
+				SPARSE_ENTRIES );
+	}
+
+	remove_test_events( &EventSet, mask );
+	free( table );
+
+	if ( samples == 0 )
+		test_fail( __FILE__, __LINE__, "No information in buffers", 1 );
+
+	test_pass( __FILE__, values, num_tests );
+
+	exit( 1 );
+}
@@ -26,6 +26,11 @@ vendors did in the kernel extensions or performance libraries. */
 #include "extras.h"
 #include "threads.h"
 
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
+
 #if (!defined(HAVE_FFSLL) || defined(__bgp__))
 int ffsll( long long lli );
 #endif
@@ -88,6 +93,45 @@ profil_increment( long long value,
 }
 
 
+/* Add a sample to a PAPI_PROFIL_SPARSE profile.  The buffer is an   */
+/* open addressing hash table of PAPI_profil_bucket_t, keyed by bucket */
+/* index with linear probing; unused entries have a count of 0.  If    */
+/* the table is full the sample is dropped.                            */
+static void
+sparse_profil( PAPI_sprofil_t * prof, unsigned long indx, int flags,
+			   long long excess, long long threshold )
+{
+	PAPI_profil_bucket_t *table = prof->pr_base;
+	unsigned long size = prof->pr_size / sizeof ( PAPI_profil_bucket_t );
+	unsigned long i, n;
+	int increment;
+
+	if ( size == 0 )
+		return;
+
+	i = ( unsigned long ) ( ( ( unsigned long long ) indx *
+							  0x9e3779b97f4a7c15ULL ) >> 32 ) % size;
+	for ( n = 0; n < size; n++ ) {
+		if ( table[i].count == 0 || table[i].index == indx )
+			break;
+		if ( ++i == size )
+			i = 0;
+	}
+	if ( n == size ) {
+		PRFDBG( "sparse profile table full, bucket %lu dropped\n", indx );
+		return;
+	}
+
+	increment = profil_increment( ( long long ) table[i].count, flags,
+								  excess, threshold );
+	if ( increment == 0 )
+		return;
+
+	table[i].index = indx;
+	table[i].count += ( unsigned long long ) increment;
+	PRFDBG( "sparse_profil() bucket %lu = %llu\n", indx, table[i].count );
+}
+
 static void
 posix_profil( caddr_t address, PAPI_sprofil_t * prof,
 			  int flags, long long excess, long long threshold )
@@ -119,8 +163,12 @@ posix_profil( caddr_t address, PAPI_sprofil_t * prof,
 
 	/* confirm addresses within specified range */
 	if ( address >= prof->pr_off ) {
+		/* sparse profiles have no upper bound */
+		if ( flags & PAPI_PROFIL_SPARSE ) {
+			sparse_profil( prof, indx, flags, excess, threshold );
+		}
 		/* test first for 16-bit buckets; this should be the fast case */
-		if ( flags & PAPI_PROFIL_BUCKET_16 ) {
+		else if ( flags & PAPI_PROFIL_BUCKET_16 ) {
 			if ( ( indx * sizeof ( short ) ) < prof->pr_size ) {
 				buf16 = prof->pr_base;
 				buf16[indx] =
@@ -173,7 +221,9 @@ _papi_hwi_dispatch_profile( EventSetInfo_t * ESI, caddr_t pc,
 
 	PRFDBG( "handled IP %p\n", pc );
 
-	sprof = profile->prof[profile_index];
+	/* PAPI_PROFIL_PRIVATE counts into this EventSet's own copy */
+	sprof = profile->priv[profile_index] ? profile->priv[profile_index] :
+		profile->prof[profile_index];
 	count = profile->count[profile_index];
 
 	for ( i = 0; i < count; i++ ) {
@@ -191,6 +241,202 @@ _papi_hwi_dispatch_profile( EventSetInfo_t * ESI, caddr_t pc,
 				  profile->threshold[profile_index] );
 }
 
+/* PAPI_PROFIL_PRIVATE: every EventSet (and so every thread) counts into
+   private copies of its profile buffers, which are added to the user's
+   buffers under a lock.  This keeps threads that share a buffer from
+   losing each other's increments and from bouncing its cache lines around.
+   The descriptors and the buckets of all regions share one allocation. */
+
+int
+_papi_hwi_alloc_private_profile( EventSetInfo_t * ESI, int profile_index )
+{
+	EventSetProfileInfo_t *profile = &ESI->profile;
+	PAPI_sprofil_t *prof = profile->prof[profile_index];
+	PAPI_sprofil_t *priv;
+	int count = profile->count[profile_index];
+	size_t size, offset;
+	int i;
+
+	size = sizeof ( PAPI_sprofil_t ) * ( size_t ) count;
+	for ( i = 0; i < count; i++ )
+		size += ( ( size_t ) prof[i].pr_size + 7 ) & ~( size_t ) 7;
+
+	priv = papi_calloc( 1, size );
+	if ( priv == NULL )
+		return PAPI_ENOMEM;
+
+	offset = sizeof ( PAPI_sprofil_t ) * ( size_t ) count;
+	for ( i = 0; i < count; i++ ) {
+		priv[i] = prof[i];
+		priv[i].pr_base = ( char * ) priv + offset;
+		offset += ( ( size_t ) prof[i].pr_size + 7 ) & ~( size_t ) 7;
+	}
+
+	profile->priv[profile_index] = priv;
+	PRFDBG( "%zu bytes of private buckets for profile %d\n", size,
+			profile_index );
+	return PAPI_OK;
+}
+
+void
+_papi_hwi_free_private_profile( EventSetInfo_t * ESI, int profile_index )
+{
+	if ( ESI->profile.priv[profile_index] ) {
+		papi_free( ESI->profile.priv[profile_index] );
+		ESI->profile.priv[profile_index] = NULL;
+	}
+}
+
+/* Add the private buckets to the user's and clear them.  The bucket
+   count is rounded up the same way posix_profil() checks pr_size.  The
+   plain loops are written so the compiler can vectorize them; they are
+   only safe once the EventSet is stopped.  While it runs, the overflow handler of the
+   same thread may interrupt us at any point, so each bucket is taken with
+   an atomic exchange instead. */
+
+#define MERGE_BUCKETS( type, dst, src, n, running )			\
+	do {								\
+		type *_d = ( type * ) ( dst );				\
+		type *_s = ( type * ) ( src );				\
+		size_t _k;						\
+		if ( running ) {					\
+			for ( _k = 0; _k < ( n ); _k++ )		\
+				_d[_k] = ( type ) ( _d[_k] +		\
+					__sync_lock_test_and_set( &_s[_k], 0 ) ); \
+		} else {						\
+			for ( _k = 0; _k < ( n ); _k++ ) {		\
+				_d[_k] = ( type ) ( _d[_k] + _s[_k] );	\
+				_s[_k] = 0;				\
+			}						\
+		}							\
+	} while ( 0 )
+
+void
+_papi_hwi_merge_private_profile( EventSetInfo_t * ESI, int profile_index,
+				 int running )
+{
+	EventSetProfileInfo_t *profile = &ESI->profile;
+	PAPI_sprofil_t *prof = profile->prof[profile_index];
+	PAPI_sprofil_t *priv = profile->priv[profile_index];
+	int i;
+
+	if ( priv == NULL )
+		return;
+
+	_papi_hwi_lock( INTERNAL_LOCK );
+	for ( i = 0; i < profile->count[profile_index]; i++ ) {
+		if ( profile->flags & PAPI_PROFIL_BUCKET_16 )
+			MERGE_BUCKETS( unsigned short, prof[i].pr_base, priv[i].pr_base,
+						   ( prof[i].pr_size + sizeof ( short ) - 1 ) /
+						   sizeof ( short ), running );
+		else if ( profile->flags & PAPI_PROFIL_BUCKET_32 )
+			MERGE_BUCKETS( unsigned int, prof[i].pr_base, priv[i].pr_base,
+						   ( prof[i].pr_size + sizeof ( int ) - 1 ) /
+						   sizeof ( int ), running );
+		else
+			MERGE_BUCKETS( unsigned long long, prof[i].pr_base,
+						   priv[i].pr_base,
+						   ( prof[i].pr_size + sizeof ( long long ) - 1 ) /
+						   sizeof ( long long ), running );
+	}
+	_papi_hwi_unlock( INTERNAL_LOCK );
+}
+
+/* PAPI_OVERFLOW_ASYNC: instead of calling the handler in signal context,
+   overflows are queued for an application thread that takes them with
+   PAPI_overflow_next(), optionally waiting on an eventfd first.  Pushing
+   only stores into the ring and writes the eventfd, both async-signal-safe. */
+
+int
+_papi_hwi_alloc_overflow_queue( EventSetInfo_t * ESI )
+{
+	_papi_overflow_queue_t *queue;
+
+	if ( ESI->overflow.queue )
+		return PAPI_OK;
+
+	queue = papi_calloc( 1, sizeof ( _papi_overflow_queue_t ) );
+	if ( queue == NULL )
+		return PAPI_ENOMEM;
+
+#if defined(__linux__)
+	queue->fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+	if ( queue->fd < 0 )
+		OVFDBG( "eventfd failed, overflows can only be polled\n" );
+#else
+	queue->fd = -1;
+#endif
+
+	ESI->overflow.queue = queue;
+	return PAPI_OK;
+}
+
+void
+_papi_hwi_free_overflow_queue( EventSetInfo_t * ESI )
+{
+	if ( ESI->overflow.queue == NULL )
+		return;
+
+	if ( ESI->overflow.queue->fd >= 0 )
+		close( ESI->overflow.queue->fd );
+	papi_free( ESI->overflow.queue );
+	ESI->overflow.queue = NULL;
+}
+
+static void
+overflow_queue_push( EventSetInfo_t * ESI, caddr_t address,
+					 long long overflow_vector )
+{
+	_papi_overflow_queue_t *queue = ESI->overflow.queue;
+	PAPI_overflow_event_t *event;
+	unsigned long head = queue->head;
+	unsigned long long one = 1;
+	ssize_t ret;
+
+	if ( head - queue->tail >= PAPI_OVERFLOW_QUEUE_SIZE ) {
+		queue->lost++;
+		return;
+	}
+
+	event = &queue->events[head & ( PAPI_OVERFLOW_QUEUE_SIZE - 1 )];
+	event->EventSet = ESI->EventSetIndex;
+	event->address = ( void * ) address;
+	event->overflow_vector = overflow_vector;
+	event->time = _papi_os_vector.get_real_nsec(  );
+
+	/* the entry has to be visible before the consumer can see it */
+	__sync_synchronize(  );
+	queue->head = head + 1;
+
+	if ( queue->fd >= 0 ) {
+		ret = write( queue->fd, &one, sizeof ( one ) );
+		( void ) ret;
+	}
+}
+
+/* Returns 1 if an overflow was stored in event, 0 if the queue is empty */
+int
+_papi_hwi_overflow_queue_next( EventSetInfo_t * ESI,
+							   PAPI_overflow_event_t * event )
+{
+	_papi_overflow_queue_t *queue = ESI->overflow.queue;
+	unsigned long tail = queue->tail;
+
+	if ( tail == queue->head )
+		return 0;
+
+	/* do not read the entry before seeing the head that published it */
+	__sync_synchronize(  );
+	*event = queue->events[tail & ( PAPI_OVERFLOW_QUEUE_SIZE - 1 )];
+	event->lost = queue->lost;
+
+	/* and finish reading before the producer may reuse it */
+	__sync_synchronize(  );
+	queue->tail = tail + 1;
+
+	return 1;
+}
+
 /* if isHardware is true, then the processor is using hardware overflow,
    else it is using software overflow. Use this parameter instead of 
    _papi_hwi_system_info.supports_hw_overflow is in CRAY some processors
@@ -340,6 +586,8 @@ _papi_hwi_dispatch_overflow_signal( void *papiContext, caddr_t address,
 					overflow_vector ^= ( long long ) 1 << i;
 				}
 				/* do not use overflow_vector after this place */
+			} else if ( ESI->overflow.flags & PAPI_OVERFLOW_ASYNC ) {
+				overflow_queue_push( ESI, address, overflow_vector );
 			} else {
 				ESI->overflow.handler( ESI->EventSetIndex, ( void * ) address,
 									   overflow_vector, ctx->ucontext );
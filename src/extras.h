@@ -11,6 +11,14 @@ int _papi_hwi_dispatch_overflow_signal( void *papiContext, caddr_t address,
 					ThreadInfo_t ** master, int cidx );
 void _papi_hwi_dispatch_profile( EventSetInfo_t * ESI, caddr_t address,
 				 long long over, int profile_index );
+int _papi_hwi_alloc_overflow_queue( EventSetInfo_t * ESI );
+void _papi_hwi_free_overflow_queue( EventSetInfo_t * ESI );
+int _papi_hwi_overflow_queue_next( EventSetInfo_t * ESI,
+				   PAPI_overflow_event_t * event );
+int _papi_hwi_alloc_private_profile( EventSetInfo_t * ESI, int profile_index );
+void _papi_hwi_free_private_profile( EventSetInfo_t * ESI, int profile_index );
+void _papi_hwi_merge_private_profile( EventSetInfo_t * ESI, int profile_index,
+				      int running );
 
 
 #endif /* EXTRAS_H */
@@ -88,6 +88,7 @@ const hwi_describe_t _papi_def[] = {
 
 	{PAPI_MULTIPLEX_DEFAULT, "PAPI_MULTIPLEX_DEFAULT", NULL},
 	{PAPI_MULTIPLEX_FORCE_SW, "PAPI_MULTIPLEX_FORCE_SW", NULL},
+	{PAPI_MULTIPLEX_ADAPTIVE, "PAPI_MULTIPLEX_ADAPTIVE", NULL},
 
 	{PAPI_DEBUG, "PAPI_DEBUG", NULL},
 	{PAPI_MULTIPLEX, "PAPI_MULTIPLEX", NULL},
@@ -183,7 +184,8 @@ const hwi_describe_t _papi_def[] = {
     /*21 */ {PAPI_EINVAL_DOM, "PAPI_EINVAL_DOM", "EventSet domain is not supported for the operation"},
     /*22 */ {PAPI_EATTR, "PAPI_EATTR", "Invalid or missing event attributes"},
     /*23 */ {PAPI_ECOUNT, "PAPI_ECOUNT", "Too many events or attributes"},
-    /*24 */ {PAPI_ECOMBO, "PAPI_ECOMBO", "Bad combination of features"}
+    /*24 */ {PAPI_ECOMBO, "PAPI_ECOMBO", "Bad combination of features"},
+    /*25 */ {PAPI_EDELAY_INIT, "PAPI_EDELAY_INIT", "Component not initialized until first used"}
 
 };
 
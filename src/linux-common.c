@@ -11,6 +11,8 @@
 #include <stdio.h>
 #include <errno.h>
 #include <syscall.h>
+#include <time.h>
+#include <linux/futex.h>
 #include <sys/utsname.h>
 #include <sys/time.h>
 
@@ -31,7 +33,7 @@ PAPI_os_info_t _papi_os_info;
 #if defined(USE_PTHREAD_MUTEXES)
 pthread_mutex_t _papi_hwd_lock_data[PAPI_MAX_LOCK];
 #else
-volatile unsigned int _papi_hwd_lock_data[PAPI_MAX_LOCK];
+_papi_hwd_lock_t _papi_hwd_lock_data[PAPI_MAX_LOCK];
 #endif
 
 
@@ -43,13 +45,125 @@ static int _linux_init_locks(void) {
 #if defined(USE_PTHREAD_MUTEXES)
        pthread_mutex_init(&_papi_hwd_lock_data[i],NULL);
 #else
-       _papi_hwd_lock_data[i] = MUTEX_OPEN;
+       memset( &_papi_hwd_lock_data[i], 0, sizeof ( _papi_hwd_lock_t ) );
+       _papi_hwd_lock_data[i].lock = MUTEX_OPEN;
 #endif
    }
 
    return PAPI_OK;
 }
 
+#if !defined(USE_PTHREAD_MUTEXES)
+
+#if !defined(__sparc__)
+
+/* How long to spin on a held lock before going to sleep.  Critical */
+/* sections in PAPI are short, so a waiter normally gets the lock   */
+/* while spinning; threads that don't are better off in the kernel  */
+/* than burning the core the owner may need.                        */
+
+#define LOCK_SPIN_ROUNDS	10
+#define LOCK_MAX_BACKOFF	1024
+
+static inline void
+lock_cpu_relax( void )
+{
+#if defined(__i386__)||defined(__x86_64__)
+   __asm__ __volatile__ ( "pause" ::: "memory" );
+#elif defined(__aarch64__)
+   __asm__ __volatile__ ( "yield" ::: "memory" );
+#elif defined(__powerpc__)
+   __asm__ __volatile__ ( "or 27,27,27" ::: "memory" );
+#else
+   __asm__ __volatile__ ( "" ::: "memory" );
+#endif
+}
+
+static inline long long
+lock_time_ns( void )
+{
+   struct timespec ts;
+
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return ( long long ) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Take a lock that was found held.  Returns with the lock held. */
+
+void
+_papi_hwd_lock_slow( _papi_hwd_lock_t *l )
+{
+   unsigned int c;
+   int i, spin, backoff = 1;
+   long long start;
+   unsigned long long sleeps = 0;
+
+   start = lock_time_ns(  );
+
+   /* spin with exponential backoff, only trying the atomic */
+   /* when the lock looks free so the line isn't bounced    */
+   for ( spin = 0; spin < LOCK_SPIN_ROUNDS; spin++ ) {
+      for ( i = 0; i < backoff; i++ ) {
+	 lock_cpu_relax(  );
+      }
+      if ( backoff < LOCK_MAX_BACKOFF ) {
+	 backoff <<= 1;
+      }
+      if ( ( l->lock == MUTEX_OPEN ) &&
+	   ( __sync_val_compare_and_swap( &l->lock, MUTEX_OPEN,
+					  MUTEX_CLOSED ) == MUTEX_OPEN ) ) {
+	 goto acquired;
+      }
+   }
+
+   /* Park.  Mark the lock contended so the owner wakes us up; */
+   /* if it was open we own it now, conservatively contended.  */
+   while ( 1 ) {
+      c = l->lock;
+      if ( __sync_val_compare_and_swap( &l->lock, c,
+					MUTEX_CONTENDED ) != c ) {
+	 continue;
+      }
+      if ( c == MUTEX_OPEN ) {
+	 break;
+      }
+      syscall( __NR_futex, &l->lock, FUTEX_WAIT_PRIVATE,
+	       MUTEX_CONTENDED, NULL, NULL, 0 );
+      sleeps++;
+   }
+
+acquired:
+   /* we own the lock, the statistics are ours to update */
+   l->contended++;
+   l->sleeps += sleeps;
+   l->wait_ns += ( unsigned long long ) ( lock_time_ns(  ) - start );
+}
+
+/* Called by the owner when releasing a lock someone may sleep on. */
+
+void
+_papi_hwd_lock_wake( _papi_hwd_lock_t *l )
+{
+   l->lock = MUTEX_OPEN;
+   __sync_synchronize(  );
+   syscall( __NR_futex, &l->lock, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0 );
+}
+
+#endif
+
+/* The counters are read without the lock, a snapshot is good enough */
+
+void
+_papi_hwd_lock_stats( int lck, PAPI_lock_stats_t *stats )
+{
+   stats->acquired = ( long long ) _papi_hwd_lock_data[lck].acquired;
+   stats->contended = ( long long ) _papi_hwd_lock_data[lck].contended;
+   stats->sleeps = ( long long ) _papi_hwd_lock_data[lck].sleeps;
+   stats->wait_ns = ( long long ) _papi_hwd_lock_data[lck].wait_ns;
+}
+
+#endif
+
 
 int
 _linux_detect_hypervisor(char *virtual_vendor_name) {
@@ -730,6 +844,10 @@ _papi_hwi_init_os(void) {
    /* Get Linux-specific system info */
    _linux_get_system_info( &_papi_hwi_system_info );
 
+   /* Time with the TSC if the kernel says how; else the vector's timers */
+   tsc_timer_setup(  );
+   taskclock_timer_setup(  );
+
    return PAPI_OK;
 }
 
@@ -787,5 +905,7 @@ papi_os_vector_t _papi_os_vector = {
   .get_virt_nsec =   _linux_get_virt_nsec_gettime,
 #endif
 
+  .shutdown_thread = _linux_shutdown_thread_timers,
+
 
 };
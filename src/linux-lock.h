@@ -25,99 +25,34 @@ do                                                 \
 
 #else
 
-extern volatile unsigned int _papi_hwd_lock_data[PAPI_MAX_LOCK];
+/* Each lock sits on a cache line of its own, together with its    */
+/* statistics, so threads hammering one lock don't slow down users */
+/* of the others and bumping the counters costs no extra misses.   */
+
+#define PAPI_LOCK_CACHE_LINE 128
+
+typedef struct {
+   volatile unsigned int lock;		/* MUTEX_OPEN/CLOSED/CONTENDED */
+   unsigned int pad;
+   /* statistics, only updated by the owner of the lock */
+   unsigned long long acquired;		/* times the lock was taken */
+   unsigned long long contended;	/* times it was found held */
+   unsigned long long sleeps;		/* times a waiter parked in the kernel */
+   unsigned long long wait_ns;		/* total time spent waiting for it */
+} __attribute__ ( ( aligned( PAPI_LOCK_CACHE_LINE ) ) ) _papi_hwd_lock_t;
+
+extern _papi_hwd_lock_t _papi_hwd_lock_data[PAPI_MAX_LOCK];
 #define MUTEX_OPEN 0
 #define MUTEX_CLOSED 1
+#define MUTEX_CONTENDED 2
 
-/********/
-/* ia64 */
-/********/
-
-#if defined(__ia64__)
-#ifdef __INTEL_COMPILER
-#define _papi_hwd_lock(lck) { while(_InterlockedCompareExchange_acq(&_papi_hwd_lock_data[lck],MUTEX_CLOSED,MUTEX_OPEN) != MUTEX_OPEN) { ; } }
-#define _papi_hwd_unlock(lck) { _InterlockedExchange((volatile int *)&_papi_hwd_lock_data[lck], MUTEX_OPEN); }
-#else  /* GCC */
-#define _papi_hwd_lock(lck)			 			      \
-   { int res = 0;							      \
-    do {								      \
-      __asm__ __volatile__ ("mov ar.ccv=%0;;" :: "r"(MUTEX_OPEN));            \
-      __asm__ __volatile__ ("cmpxchg4.acq %0=[%1],%2,ar.ccv" : "=r"(res) : "r"(&_papi_hwd_lock_data[lck]), "r"(MUTEX_CLOSED) : "memory");				      \
-    } while (res != MUTEX_OPEN); }
-
-#define _papi_hwd_unlock(lck) {  __asm__ __volatile__ ("st4.rel [%0]=%1" : : "r"(&_papi_hwd_lock_data[lck]), "r"(MUTEX_OPEN) : "memory"); }
-#endif
-
-/***********/
-/* x86     */
-/***********/
-
-#elif defined(__i386__)||defined(__x86_64__)
-#define  _papi_hwd_lock(lck)                    \
-do                                              \
-{                                               \
-   unsigned int res = 0;                        \
-   do {                                         \
-      __asm__ __volatile__ ("lock ; " "cmpxchg %1,%2" : "=a"(res) : "q"(MUTEX_CLOSED), "m"(_papi_hwd_lock_data[lck]), "0"(MUTEX_OPEN) : "memory");  \
-   } while(res != (unsigned int)MUTEX_OPEN);   \
-} while(0)
-#define  _papi_hwd_unlock(lck)                  \
-do                                              \
-{                                               \
-   unsigned int res = 0;                       \
-   __asm__ __volatile__ ("xchg %0,%1" : "=r"(res) : "m"(_papi_hwd_lock_data[lck]), "0"(MUTEX_OPEN) : "memory");                                \
-} while(0)
-
-/***************/
-/* power       */
-/***************/
-
-#elif defined(__powerpc__)
-
-/*
- * These functions are slight modifications of the functions in
- * /usr/include/asm-ppc/system.h.
- *
- *  We can't use the ones in system.h directly because they are defined
- *  only when __KERNEL__ is defined.
- */
-
-static __inline__ unsigned long
-papi_xchg_u32( volatile void *p, unsigned long val )
-{
-	unsigned long prev;
-
-	__asm__ __volatile__( "\n\
-        sync \n\
-1:      lwarx   %0,0,%2 \n\
-        stwcx.  %3,0,%2 \n\
-        bne-    1b \n\
-        isync":"=&r"( prev ), "=m"( *( volatile unsigned long * ) p )
-						  :"r"( p ), "r"( val ),
-						  "m"( *( volatile unsigned long * ) p )
-						  :"cc", "memory" );
-
-	return prev;
-}
+#define PAPI_HWD_LOCK_STATS 1
+extern void _papi_hwd_lock_stats( int lck, PAPI_lock_stats_t *stats );
 
-#define  _papi_hwd_lock(lck)                          \
-do {                                                    \
-  unsigned int retval;                                 \
-  do {                                                  \
-  retval = papi_xchg_u32(&_papi_hwd_lock_data[lck],MUTEX_CLOSED);  \
-  } while(retval != (unsigned int)MUTEX_OPEN);	        \
-} while(0)
-#define  _papi_hwd_unlock(lck)                          \
-do {                                                    \
-  unsigned int retval;                                 \
-  retval = papi_xchg_u32(&_papi_hwd_lock_data[lck],MUTEX_OPEN); \
-} while(0)
+#if defined(__sparc__)
 
-/*****************/
-/* SPARC         */
-/*****************/
+/* No compare and swap on older sparcs, keep the plain spin lock. */
 
-#elif defined(__sparc__)
 static inline void
 __raw_spin_lock( volatile unsigned int *lock )
 {
@@ -131,101 +66,44 @@ __raw_spin_unlock( volatile unsigned int *lock )
 	__asm__ __volatile__( "stb %%g0, [%0]"::"r"( lock ):"memory" );
 }
 
-#define  _papi_hwd_lock(lck) __raw_spin_lock(&_papi_hwd_lock_data[lck]);
-#define  _papi_hwd_unlock(lck) __raw_spin_unlock(&_papi_hwd_lock_data[lck])
-
-/*******************/
-/* ARM             */
-/*******************/
-
-#elif defined(__arm__)
-
-#if 0
-
-/* OLD CODE FROM VINCE BELOW */
+#define  _papi_hwd_lock(lck) __raw_spin_lock(&_papi_hwd_lock_data[lck].lock);
+#define  _papi_hwd_unlock(lck) __raw_spin_unlock(&_papi_hwd_lock_data[lck].lock)
 
-/* FIXME */
-/* not sure if this even works            */
-/* also the various flavors of ARM        */
-/* have differing levels of atomic        */
-/* instruction support.  A proper         */
-/* implementation needs to handle this :( */
-
-#warning "WARNING!  Verify mutexes work on ARM!"
-
-/*
- * For arm/gcc, 0 is clear, 1 is set.
- */
-#define MUTEX_SET(tsl) ({      \
-  int __r;                     \
-  asm volatile(                \
-  "swpb   %0, %1, [%2]\n\t"    \
-  "eor    %0, %0, #1\n\t"      \
-  : "=&r" (__r)                \
-  : "r" (1), "r" (tsl)         \
-  );                           \
-  __r & 1;                     \
-    })
-
-#define  _papi_hwd_lock(lck) MUTEX_SET(lck)
-#define  _papi_hwd_unlock(lck) (*(volatile int *)(lck) = 0)
-#endif
-
-/* NEW CODE FROM PHIL */
+#else
 
-static inline int __arm_papi_spin_lock (volatile unsigned int *lock)
-{
-  unsigned int val;
+/* Everywhere else the lock is a futex.  MUTEX_CONTENDED tells the  */
+/* owner that somebody may be asleep on it and has to be woken.     */
+/* Taking a free lock is a single compare and swap; a held lock is  */
+/* spun on for a while with exponential backoff, then waited for in */
+/* the kernel, see _papi_hwd_lock_slow() in linux-common.c.         */
 
-  do
-    asm volatile ("swp %0, %1, [%2]"
-		  : "=r" (val)
-		  : "0" (1), "r" (lock)
-		  : "memory");
-  while (val != 0);
+extern void _papi_hwd_lock_slow( _papi_hwd_lock_t *l );
+extern void _papi_hwd_lock_wake( _papi_hwd_lock_t *l );
 
-  return 0;
-}
-#define _papi_hwd_lock(lck)   { rmb(); __arm_papi_spin_lock(&_papi_hwd_lock_data[lck]); rmb(); }
-#define _papi_hwd_unlock(lck) { rmb(); _papi_hwd_lock_data[lck] = 0; rmb(); }
-
-#elif defined(__mips__)
-static inline void __raw_spin_lock(volatile unsigned int *lock)
+static inline void
+_papi_hwd_lock_acquire( _papi_hwd_lock_t *l )
 {
-  unsigned int tmp;
-		__asm__ __volatile__(
-		"       .set    noreorder       # __raw_spin_lock       \n"
-		"1:     ll      %1, %2                                  \n"
-		"       bnez    %1, 1b                                  \n"
-		"        li     %1,  1                                   \n"
-		"       sc      %1, %0                                  \n"
-		"       beqzl   %1, 1b                                  \n"
-		"        nop                                            \n"
-		"       sync                                            \n"
-		"       .set    reorder                                 \n"
-		: "=m" (*lock), "=&r" (tmp)
-		: "m" (*lock)
-		: "memory");
+   if ( __sync_val_compare_and_swap( &l->lock, MUTEX_OPEN,
+				     MUTEX_CLOSED ) != MUTEX_OPEN ) {
+      _papi_hwd_lock_slow( l );
+   }
+   l->acquired++;
 }
 
-static inline void __raw_spin_unlock(volatile unsigned int *lock)
+static inline void
+_papi_hwd_lock_release( _papi_hwd_lock_t *l )
 {
-	__asm__ __volatile__(
-	"       .set    noreorder       # __raw_spin_unlock     \n"
-	"       sync                                            \n"
-	"       sw      $0, %0                                  \n"
-	"       .set\treorder                                   \n"
-	: "=m" (*lock)
-	: "m" (*lock)
-	: "memory");
+   /* CLOSED -> OPEN, nobody to wake */
+   if ( __sync_fetch_and_sub( &l->lock, 1 ) != MUTEX_CLOSED ) {
+      _papi_hwd_lock_wake( l );
+   }
 }
-#define  _papi_hwd_lock(lck) __raw_spin_lock(&_papi_hwd_lock_data[lck]);
-#define  _papi_hwd_unlock(lck) __raw_spin_unlock(&_papi_hwd_lock_data[lck])
-#else
 
-#error "_papi_hwd_lock/unlock undefined!"
-#endif
+#define  _papi_hwd_lock(lck) _papi_hwd_lock_acquire(&_papi_hwd_lock_data[lck])
+#define  _papi_hwd_unlock(lck) _papi_hwd_lock_release(&_papi_hwd_lock_data[lck])
 
 #endif
 
 #endif /* defined(USE_PTHREAD_MUTEXES) */
+
+#endif
@@ -18,6 +18,7 @@
 
 #include <fcntl.h>
 #include "linux-common.h"
+#include "linux-timer.h"
 
 #include <sys/time.h>
 #include <sys/resource.h>
@@ -252,6 +253,403 @@ get_cycles( void )
 #endif
 
 
+/************************************************/
+/* TSC timer calibrated by perf_event           */
+/************************************************/
+
+/* The first page of a perf event's mmap holds what the kernel itself  */
+/* uses to turn the TSC into nanoseconds (time_mult, time_shift and    */
+/* time_zero), and the kernel only offers it when the TSC is stable.   */
+/* With it a timestamp is an rdtsc and a multiply, no system call and  */
+/* no guessing at the clock frequency.                                 */
+
+#if !defined(HAVE_MMTIMER) && (defined(__i386__)||defined(__x86_64__)) && \
+    defined(PEINCLUDE) && defined(__NR_perf_event_open)
+
+#define HAVE_TSC_TIMER
+#include PEINCLUDE
+#include <sys/mman.h>
+#include <pthread.h>
+
+/* Calibration: TSC time and CLOCK_MONOTONIC must agree this well */
+#define TSC_CHECK_NSEC 200000LL
+#define TSC_CHECK_PPM 10000LL
+
+static volatile struct perf_event_mmap_page *tsc_page = NULL;
+
+/* what the OS vector had before, for when the TSC cannot be used */
+static int tsc_saved = 0;
+static long long ( *tsc_saved_nsec ) ( void );
+static long long ( *tsc_saved_usec ) ( void );
+static long long ( *tsc_saved_cycles ) ( void );
+
+static inline long long
+tsc_nsec( void )
+{
+	volatile struct perf_event_mmap_page *pc = tsc_page;
+	unsigned long long cyc, quot, rem, zero;
+	unsigned int seq, mult, shift;
+
+	do {
+		seq = pc->lock;
+		asm volatile( "":::"memory" );
+		cyc = ( unsigned long long ) get_cycles(  );
+		mult = pc->time_mult;
+		shift = pc->time_shift;
+		zero = pc->time_zero;
+		asm volatile( "":::"memory" );
+	} while ( pc->lock != seq );
+
+	quot = cyc >> shift;
+	rem = cyc & ( ( 1ULL << shift ) - 1 );
+	return ( long long ) ( zero + quot * mult + ( ( rem * mult ) >> shift ) );
+}
+
+static long long
+monotonic_nsec( void )
+{
+	struct timespec foo;
+
+	clock_gettime( CLOCK_MONOTONIC, &foo );
+	return ( long long ) foo.tv_sec * 1000000000LL + foo.tv_nsec;
+}
+
+long long
+_linux_get_real_nsec_tsc( void )
+{
+	return tsc_nsec(  );
+}
+
+long long
+_linux_get_real_usec_tsc( void )
+{
+	return tsc_nsec(  ) / 1000;
+}
+
+long long
+_linux_get_real_cycles_tsc( void )
+{
+	return get_cycles(  );
+}
+
+/* Map the page of a never enabled event, and unless check is 0 make */
+/* sure the conversion agrees with the kernel's clock over a while.  */
+static int
+tsc_timer_map( int check )
+{
+	struct perf_event_attr attr;
+	volatile struct perf_event_mmap_page *pc;
+	long long t0, t1, m0, m1, diff;
+	void *addr;
+	int fd;
+
+	memset( &attr, 0, sizeof ( attr ) );
+	attr.type = PERF_TYPE_SOFTWARE;
+	attr.size = sizeof ( attr );
+	attr.config = PERF_COUNT_SW_CPU_CLOCK;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	fd = syscall( __NR_perf_event_open, &attr, 0, -1, -1, 0 );
+	if ( fd < 0 ) {
+		SUBDBG( "no perf event for the TSC timer: %s\n", strerror( errno ) );
+		return PAPI_ENOSUPP;
+	}
+
+	/* The mapping keeps the event alive after the close */
+	addr = mmap( NULL, ( size_t ) getpagesize(  ), PROT_READ, MAP_SHARED,
+				 fd, 0 );
+	close( fd );
+	if ( addr == MAP_FAILED )
+		return PAPI_ENOSUPP;
+
+	pc = ( volatile struct perf_event_mmap_page * ) addr;
+	if ( !pc->cap_user_time || !pc->cap_user_time_zero ) {
+		SUBDBG( "kernel does not export TSC conversion\n" );
+		munmap( addr, ( size_t ) getpagesize(  ) );
+		return PAPI_ENOSUPP;
+	}
+	tsc_page = pc;
+
+	if ( check ) {
+		t0 = tsc_nsec(  );
+		m0 = monotonic_nsec(  );
+		do {
+			m1 = monotonic_nsec(  );
+		} while ( m1 - m0 < TSC_CHECK_NSEC );
+		t1 = tsc_nsec(  );
+
+		diff = ( t1 - t0 ) - ( m1 - m0 );
+		if ( diff < 0 )
+			diff = -diff;
+		if ( ( t1 <= t0 ) ||
+			 ( diff * 1000000LL > ( m1 - m0 ) * TSC_CHECK_PPM ) ) {
+			SUBDBG( "TSC timer off by %lld ns in %lld ns, not used\n", diff,
+					m1 - m0 );
+			tsc_page = NULL;
+			munmap( addr, ( size_t ) getpagesize(  ) );
+			return PAPI_ENOSUPP;
+		}
+		SUBDBG( "TSC timer: mult %u shift %u, off by %lld ns in %lld ns\n",
+				pc->time_mult, pc->time_shift, diff, m1 - m0 );
+	}
+
+	_papi_os_vector.get_real_nsec = _linux_get_real_nsec_tsc;
+	_papi_os_vector.get_real_usec = _linux_get_real_usec_tsc;
+	_papi_os_vector.get_real_cycles = _linux_get_real_cycles_tsc;
+
+	return PAPI_OK;
+}
+
+static void
+tsc_timer_restore( void )
+{
+	tsc_page = NULL;
+	_papi_os_vector.get_real_nsec = tsc_saved_nsec;
+	_papi_os_vector.get_real_usec = tsc_saved_usec;
+	_papi_os_vector.get_real_cycles = tsc_saved_cycles;
+}
+
+static void taskclock_close( ThreadInfo_t * thread );
+
+/* perf never copies its mmap pages into a child; the TSC is the */
+/* same one though, so there is no need to check it again        */
+static void
+tsc_timer_atfork_child( void )
+{
+	ThreadInfo_t *thread = _papi_hwi_lookup_thread( 0 );
+
+	/* the inherited task-clock counts the parent's thread */
+	if ( thread != NULL )
+		taskclock_close( thread );
+
+	if ( tsc_page == NULL )
+		return;
+	tsc_timer_restore(  );
+	tsc_timer_map( 0 );
+}
+
+int
+tsc_timer_setup( void )
+{
+	if ( !tsc_saved ) {
+		tsc_saved_nsec = _papi_os_vector.get_real_nsec;
+		tsc_saved_usec = _papi_os_vector.get_real_usec;
+		tsc_saved_cycles = _papi_os_vector.get_real_cycles;
+		pthread_atfork( NULL, NULL, tsc_timer_atfork_child );
+		tsc_saved = 1;
+	}
+
+	if ( tsc_page != NULL )
+		return PAPI_OK;
+
+	tsc_timer_restore(  );
+	return tsc_timer_map( 1 );
+}
+
+/************************************************/
+/* task-clock virtual time                      */
+/************************************************/
+
+/* A task-clock event counts the nanoseconds its thread has been on a */
+/* cpu.  Its mmap page holds the count as of the kernel's last update */
+/* of the page, and the TSC conversion gives the time since then, so  */
+/* a running thread reads its own virtual time without a system call. */
+/* That relies on the kernel updating the page whenever the thread is */
+/* scheduled in, which is checked once; where it does not, the count  */
+/* is read() instead.  Each thread opens its event on first use and   */
+/* keeps it in its ThreadInfo_t.                                      */
+
+/* a stale page would count this nap as cpu time */
+#define TASKCLOCK_CHECK_NSEC 2000000L
+
+static int taskclock_page_ok = -1;	/* -1 until checked */
+
+static long long
+taskclock_read_page( ThreadInfo_t * thread )
+{
+	volatile struct perf_event_mmap_page *pc = thread->virt_page;
+	unsigned long long cyc, quot, rem, offset;
+	unsigned int seq, mult, shift;
+	long long count;
+
+	do {
+		seq = pc->lock;
+		asm volatile( "":::"memory" );
+		count = pc->offset;
+		cyc = ( unsigned long long ) get_cycles(  );
+		mult = pc->time_mult;
+		shift = pc->time_shift;
+		offset = pc->time_offset;
+		asm volatile( "":::"memory" );
+	} while ( pc->lock != seq );
+
+	quot = cyc >> shift;
+	rem = cyc & ( ( 1ULL << shift ) - 1 );
+	return count + ( long long ) ( offset + quot * mult +
+								   ( ( rem * mult ) >> shift ) );
+}
+
+static long long
+taskclock_read_fd( ThreadInfo_t * thread )
+{
+	long long count;
+
+	if ( read( thread->virt_fd - 1, &count, sizeof ( count ) ) !=
+		 sizeof ( count ) )
+		return -1;
+	return count;
+}
+
+static void
+taskclock_close( ThreadInfo_t * thread )
+{
+	if ( thread->virt_page != NULL )
+		munmap( thread->virt_page, ( size_t ) getpagesize(  ) );
+	if ( thread->virt_fd > 0 )
+		close( thread->virt_fd - 1 );
+	thread->virt_page = NULL;
+	thread->virt_fd = 0;
+}
+
+static void
+taskclock_open( ThreadInfo_t * thread )
+{
+	struct perf_event_attr attr;
+	struct timespec nap = { 0, TASKCLOCK_CHECK_NSEC };
+	volatile struct perf_event_mmap_page *pc;
+	long long page, count;
+	void *addr;
+	int fd;
+
+	memset( &attr, 0, sizeof ( attr ) );
+	attr.type = PERF_TYPE_SOFTWARE;
+	attr.size = sizeof ( attr );
+	attr.config = PERF_COUNT_SW_TASK_CLOCK;
+	attr.exclude_hv = 1;
+
+	/* The count starts at 0, carry on from the thread's cpu time */
+	thread->virt_base = _linux_get_virt_nsec_gettime(  );
+	fd = syscall( __NR_perf_event_open, &attr, 0, -1, -1, 0 );
+	if ( fd < 0 ) {
+		SUBDBG( "no task-clock for thread %ld: %s\n", thread->tid,
+				strerror( errno ) );
+		thread->virt_fd = -1;
+		return;
+	}
+	thread->virt_fd = fd + 1;
+
+	if ( taskclock_page_ok == 0 )
+		return;
+
+	addr = mmap( NULL, ( size_t ) getpagesize(  ), PROT_READ, MAP_SHARED,
+				 fd, 0 );
+	if ( addr == MAP_FAILED )
+		return;
+	pc = ( volatile struct perf_event_mmap_page * ) addr;
+	if ( !pc->cap_user_time ) {
+		munmap( addr, ( size_t ) getpagesize(  ) );
+		return;
+	}
+	thread->virt_page = addr;
+
+	if ( taskclock_page_ok < 0 ) {
+		nanosleep( &nap, NULL );
+		page = taskclock_read_page( thread );
+		count = taskclock_read_fd( thread );
+		taskclock_page_ok = ( count >= 0 ) &&
+			( page - count < TASKCLOCK_CHECK_NSEC / 2 );
+		SUBDBG( "task-clock page %lld, read() %lld: %s\n", page, count,
+				taskclock_page_ok ? "reading the page" : "using read()" );
+		if ( !taskclock_page_ok ) {
+			munmap( addr, ( size_t ) getpagesize(  ) );
+			thread->virt_page = NULL;
+		}
+	}
+}
+
+long long
+_linux_get_virt_nsec_taskclock( void )
+{
+	ThreadInfo_t *thread = _papi_hwi_lookup_thread( 0 );
+	long long now;
+
+	/* threads PAPI does not know about get the thread cpu clock */
+	if ( thread == NULL )
+		return _linux_get_virt_nsec_gettime(  );
+
+	if ( thread->virt_fd == 0 )
+		taskclock_open( thread );
+	if ( thread->virt_fd < 0 )
+		return _linux_get_virt_nsec_gettime(  );
+
+	if ( thread->virt_page != NULL )
+		now = taskclock_read_page( thread );
+	else
+		now = taskclock_read_fd( thread );
+	if ( now < 0 )
+		return _linux_get_virt_nsec_gettime(  );
+
+	now += thread->virt_base;
+	if ( now < thread->virt_last )
+		now = thread->virt_last;
+	thread->virt_last = now;
+
+	return now;
+}
+
+long long
+_linux_get_virt_usec_taskclock( void )
+{
+	return _linux_get_virt_nsec_taskclock(  ) / 1000;
+}
+
+long long
+_linux_get_virt_cycles_taskclock( void )
+{
+	return _linux_get_virt_nsec_taskclock(  ) *
+		( long long ) _papi_hwi_system_info.hw_info.cpu_max_mhz / 1000;
+}
+
+int
+_linux_shutdown_thread_timers( ThreadInfo_t * thread )
+{
+	taskclock_close( thread );
+	return PAPI_OK;
+}
+
+int
+taskclock_timer_setup( void )
+{
+	struct perf_event_attr attr;
+	int fd;
+
+	/* Only take over virtual time if there is a task-clock to be had */
+	memset( &attr, 0, sizeof ( attr ) );
+	attr.type = PERF_TYPE_SOFTWARE;
+	attr.size = sizeof ( attr );
+	attr.config = PERF_COUNT_SW_TASK_CLOCK;
+	attr.exclude_hv = 1;
+	attr.disabled = 1;
+
+	fd = syscall( __NR_perf_event_open, &attr, 0, -1, -1, 0 );
+	if ( fd < 0 )
+		return PAPI_ENOSUPP;
+	close( fd );
+
+	_papi_os_vector.get_virt_nsec = _linux_get_virt_nsec_taskclock;
+	_papi_os_vector.get_virt_usec = _linux_get_virt_usec_taskclock;
+	_papi_os_vector.get_virt_cycles = _linux_get_virt_cycles_taskclock;
+
+	return PAPI_OK;
+}
+
+#else
+int tsc_timer_setup( void ) { return PAPI_ENOSUPP; }
+int taskclock_timer_setup( void ) { return PAPI_ENOSUPP; }
+int _linux_shutdown_thread_timers( ThreadInfo_t *thread ) { ( void ) thread; return PAPI_OK; }
+#endif
 
 
 
@@ -292,9 +690,9 @@ _linux_get_real_usec_gettime( void )
 
    struct timespec foo;
 #ifdef HAVE_CLOCK_GETTIME_REALTIME_HR
-   syscall( __NR_clock_gettime, CLOCK_REALTIME_HR, &foo );
+   clock_gettime( CLOCK_REALTIME_HR, &foo );
 #else
-   syscall( __NR_clock_gettime, CLOCK_REALTIME, &foo );
+   clock_gettime( CLOCK_REALTIME, &foo );
 #endif
    retval = ( long long ) foo.tv_sec * ( long long ) 1000000;
    retval += ( long long ) ( foo.tv_nsec / 1000 );
@@ -395,7 +793,7 @@ _linux_get_virt_usec_gettime( void )
 
     struct timespec foo;
 
-    syscall( __NR_clock_gettime, CLOCK_THREAD_CPUTIME_ID, &foo );
+    clock_gettime( CLOCK_THREAD_CPUTIME_ID, &foo );
     retval = ( long long ) foo.tv_sec * ( long long ) 1000000;
     retval += ( long long ) foo.tv_nsec / 1000;
 	
@@ -485,9 +883,9 @@ _linux_get_real_nsec_gettime( void )
 
    struct timespec foo;
 #ifdef HAVE_CLOCK_GETTIME_REALTIME_HR
-   syscall( __NR_clock_gettime, CLOCK_REALTIME_HR, &foo );
+   clock_gettime( CLOCK_REALTIME_HR, &foo );
 #else
-   syscall( __NR_clock_gettime, CLOCK_REALTIME, &foo );
+   clock_gettime( CLOCK_REALTIME, &foo );
 #endif
    retval = ( long long ) foo.tv_sec * ( long long ) 1000000000;
    retval += ( long long ) ( foo.tv_nsec );
@@ -508,7 +906,7 @@ _linux_get_virt_nsec_gettime( void )
 
     struct timespec foo;
 
-    syscall( __NR_clock_gettime, CLOCK_THREAD_CPUTIME_ID, &foo );
+    clock_gettime( CLOCK_THREAD_CPUTIME_ID, &foo );
     retval = ( long long ) foo.tv_sec * ( long long ) 1000000000;
     retval += ( long long ) foo.tv_nsec ;
 	
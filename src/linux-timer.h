@@ -13,5 +13,8 @@ long long _linux_get_real_nsec_gettime( void );
 long long _linux_get_virt_nsec_gettime( void );
 
 int mmtimer_setup(void);
+int tsc_timer_setup(void);
+int taskclock_timer_setup(void);
+int _linux_shutdown_thread_timers( ThreadInfo_t *thread );
 int init_proc_thread_timer( hwd_context_t *thr_ctx );
 
@@ -36,6 +36,7 @@
 #include "extras.h"
 #include "sw_multiplex.h"
 #include "papi_hl.h"
+#include "papi_trace.h"
 
 /*******************************/
 /* BEGIN EXTERNAL DECLARATIONS */
@@ -87,6 +88,7 @@ valid_component( int cidx )
 {
 	if ( _papi_hwi_invalid_cmp( cidx ) )
 		return ( PAPI_ENOCMP );
+	_papi_hwi_init_component( cidx );
 	return ( cidx );
 }
 
@@ -480,6 +482,12 @@ PAPI_set_thr_specific( int tag, void *ptr )
  *	It must be called before any low level PAPI functions can be used. 
  *	If your application is making use of threads PAPI_thread_init must also be 
  *	called prior to making any calls to the library other than PAPI_library_init() . 
+ *
+ *	Only the first component is initialized here; the others are registered
+ *	and report PAPI_EDELAY_INIT as their disabled state until they are first 
+ *	used: an event name lookup that reaches them, PAPI_enum_cmp_event(),
+ *	PAPI_get_component_info(), PAPI_get_cmp_opt() or 
+ *	PAPI_assign_eventset_component().
  *	@par Examples:
  *	@code
  *		int retval;
@@ -698,7 +706,7 @@ PAPI_query_event( int EventCode )
 		if ( EventCode < 0 || EventCode >= PAPI_MAX_PRESET_EVENTS )
 			papi_return( PAPI_ENOTPRESET );
 
-		if ( _papi_hwi_presets[EventCode].count )
+		if ( _papi_hwi_resolve_preset( EventCode ) == PAPI_OK )
 		        papi_return (PAPI_OK);
 		else
 			return PAPI_ENOEVNT;
@@ -783,6 +791,8 @@ PAPI_query_named_event( char *EventName )
  *	This includes versioning information, preset and native event 
  *	information, and more. 
  *	For full details, see @ref PAPI_component_info_t. 
+ *	A component not used yet is initialized by this call, so the 
+ *	information is complete and disabled tells whether it works.
  *
  *	@par Examples:
  *	@code
@@ -807,8 +817,8 @@ PAPI_get_component_info( int cidx )
 	APIDBG( "Entry: Component Index %d\n", cidx);
 	if ( _papi_hwi_invalid_cmp( cidx ) )
 		return ( NULL );
-	else
-		return ( &( _papi_hwd[cidx]->cmp_info ) );
+	_papi_hwi_init_component( cidx );
+	return ( &( _papi_hwd[cidx]->cmp_info ) );
 }
 
 /* PAPI_get_event_info:
@@ -1186,7 +1196,7 @@ PAPI_enum_event( int *EventCode, int modifier )
 				return ( PAPI_ENOEVNT );	/* NULL pointer terminates list */
 			}
 			if ( modifier & PAPI_PRESET_ENUM_AVAIL ) {
-				if ( _papi_hwi_presets[i].count == 0 )
+				if ( _papi_hwi_resolve_preset( i ) != PAPI_OK )
 					continue;
 			}
 			*EventCode = ( int ) ( i | PAPI_PRESET_MASK );
@@ -1375,6 +1385,8 @@ PAPI_enum_cmp_event( int *EventCode, int modifier, int cidx )
 		return PAPI_ENOCMP;
 	}
 
+	_papi_hwi_init_component( cidx );
+
 	if (_papi_hwd[cidx]->cmp_info.disabled) {
 	  return PAPI_ENOCMP;
 	}
@@ -1392,7 +1404,7 @@ PAPI_enum_cmp_event( int *EventCode, int modifier, int cidx )
 				return ( PAPI_ENOEVNT );	/* NULL pointer terminates list */
 			}
 			if ( modifier & PAPI_PRESET_ENUM_AVAIL ) {
-				if ( _papi_hwi_presets[i].count == 0 )
+				if ( _papi_hwi_resolve_preset( i ) != PAPI_OK )
 					continue;
 			}
 			*EventCode = ( int ) ( i | PAPI_PRESET_MASK );
@@ -1899,6 +1911,88 @@ PAPI_add_named_event( int EventSet, char *EventName )
 	return ret;   // do not use papi_return here because if there was an error PAPI_add_event already reported it
 }
 
+/** @class PAPI_add_named_events
+ *	@brief Add an array of named hardware events to a PAPI event set.
+ *
+ *	The names are resolved with PAPI_event_name_to_code and the events
+ *	are added exactly like PAPI_add_events does, so the component only
+ *	has to set up its counters once for the whole list.
+ *
+ *	@par C Interface:
+ *	\#include <papi.h> @n
+ *	int PAPI_add_named_events( int EventSet, char **EventNames, int number );
+ *
+ *	@param[in] EventSet
+ *		An integer handle for a PAPI Event Set as created by PAPI_create_eventset.
+ *	@param[in] *EventNames
+ *		An array of event names, such as PAPI_TOT_INS or a native event.
+ *	@param[in] number
+ *		An integer indicating the number of events in the array *EventNames.
+ *		Like PAPI_add_events, this can partially succeed.
+ *
+ *	@retval Positive-Integer
+ *		The number of consecutive elements that succeeded before the error.
+ *	@retval PAPI_EINVAL
+ *		One or more of the arguments is invalid.
+ *	@retval PAPI_ENOEVST
+ *		The event set specified does not exist.
+ *	@retval PAPI_EISRUN
+ *		The event set is currently counting events.
+ *	@retval PAPI_ECNFLCT
+ *		The underlying counter hardware can not count this event and other events
+ *		in the event set simultaneously.
+ *	@retval PAPI_ENOEVNT
+ *		The event name could not be resolved or the event is not available.
+ *
+ *	@par Example:
+ *	@code
+ *	char *names[] = { "PAPI_TOT_INS", "PAPI_TOT_CYC" };
+ *	if ( PAPI_add_named_events( EventSet, names, 2 ) != PAPI_OK )
+ *	handle_error( 1 );
+ *	@endcode
+ *
+ *	@see PAPI_add_events @n
+ *	PAPI_add_named_event @n
+ *	PAPI_event_name_to_code
+ */
+int
+PAPI_add_named_events( int EventSet, char **EventNames, int number )
+{
+	APIDBG( "Entry: EventSet: %d, EventNames: %p, number: %d\n", EventSet, EventNames, number);
+	int i, ret = PAPI_OK, resolved;
+	int *codes;
+
+	if ( ( EventNames == NULL ) || ( number <= 0 ) )
+		papi_return( PAPI_EINVAL );
+
+	codes = papi_malloc( sizeof ( int ) * ( size_t ) number );
+	if ( codes == NULL )
+		papi_return( PAPI_ENOMEM );
+
+	/* Resolve everything we can up front */
+	for ( resolved = 0; resolved < number; resolved++ ) {
+		ret = PAPI_event_name_to_code( EventNames[resolved], &codes[resolved] );
+		if ( ret != PAPI_OK )
+			break;
+	}
+
+	if ( resolved == 0 ) {
+		papi_free( codes );
+		APIDBG("EXIT: return: %d\n", ret);
+		return ret;   // PAPI_event_name_to_code already reported it
+	}
+
+	i = PAPI_add_events( EventSet, codes, resolved );
+	papi_free( codes );
+
+	/* the list stopped at a name we could not resolve */
+	if ( ( i == PAPI_OK ) && ( resolved < number ) )
+		i = resolved;
+
+	APIDBG("EXIT: return: %d\n", i);
+	return i;
+}
+
 /**  @class PAPI_remove_named_event
  *   @brief removes a named hardware event from a PAPI event set. 
  *
@@ -2149,7 +2243,8 @@ PAPI_start( int EventSet )
 	   call John May's code. */
 
 	if ( _papi_hwi_is_sw_multiplex( ESI ) ) {
-	   retval = MPX_start( ESI->multiplex.mpx_evset );
+	   retval = MPX_start( ESI->multiplex.mpx_evset, ESI->multiplex.flags,
+			       ESI->multiplex.min_share );
 	   if ( retval != PAPI_OK ) {
 	      papi_return( retval );
 	   }
@@ -2324,7 +2419,7 @@ PAPI_stop( int EventSet, long long *values )
    APIDBG("Entry: EventSet: %d, values: %p\n", EventSet, values);
 	EventSetInfo_t *ESI;
 	hwd_context_t *context;
-	int cidx, retval;
+	int cidx, retval, i;
 
 	ESI = _papi_hwi_lookup_EventSet( EventSet );
 	if ( ESI == NULL )
@@ -2390,6 +2485,14 @@ PAPI_stop( int EventSet, long long *values )
 		}
 	}
 
+	/* No more samples can arrive, add up the private profile buckets */
+
+	if ( ( ESI->state & PAPI_PROFILING ) &&
+		 ( ESI->profile.flags & PAPI_PROFIL_PRIVATE ) ) {
+		for ( i = 0; i < ESI->profile.event_counter; i++ )
+			_papi_hwi_merge_private_profile( ESI, i, 0 );
+	}
+
 	/* Update the state of this EventSet */
 
 	ESI->state ^= PAPI_RUNNING;
@@ -2701,6 +2804,102 @@ PAPI_read_ts( int EventSet, long long *values, long long *cycles )
 	return PAPI_OK;
 }
 
+/** @class PAPI_read_mpx
+ *  @brief Read hardware counters along with how accurate multiplexed counts are.
+ *
+ *  @par C Interface:
+ *  \#include <papi.h> @n
+ *  int PAPI_read_mpx( int EventSet, PAPI_mpx_value_t *values );
+ *
+ *  PAPI_read_mpx() reads the counters like PAPI_read(), and for each event 
+ *  also returns what the count was extrapolated from: the count actually 
+ *  seen, the time the EventSet was counting (enabled), the part of it the 
+ *  event was on a counter (running), the scale factor enabled / running 
+ *  and an estimated standard error of the count.  The error comes from 
+ *  how much the rate of the event varied between the slices it was 
+ *  measured in, and is negative until there are two of them.
+ *
+ *  For kernel multiplexing the times are in nanoseconds and a slice is 
+ *  the stretch between two reads; for PAPI's own multiplexing the times 
+ *  are in cycles and the raw count and running time leave out the slice 
+ *  in progress.  When the EventSet is not multiplexed every count is 
+ *  exact: raw equals value, scale is 1.0 and the times and error are 0.  
+ *  For a derived event the fields other than value describe its first 
+ *  native event.
+ *
+ *  @param[in] EventSet
+ *     -- an integer handle for a PAPI Event Set as created 
+ *        by PAPI_create_eventset()
+ *  @param[out] *values 
+ *     -- an array of PAPI_num_events(EventSet) PAPI_mpx_value_t
+ *
+ *  @retval PAPI_EINVAL 
+ *	    values is NULL.
+ *  @retval PAPI_ESYS 
+ *	    A system or C library call failed inside PAPI, see the 
+ *          errno variable.
+ *  @retval PAPI_ENOEVST 
+ *	    The event set specified does not exist. 
+ *  @retval PAPI_ECMP 
+ *	    The component multiplexes in the kernel but cannot tell how.
+ *
+ * @see PAPI_read 
+ * @see PAPI_set_multiplex 
+ */
+int
+PAPI_read_mpx( int EventSet, PAPI_mpx_value_t *values )
+{
+	APIDBG( "Entry: EventSet: %d, values: %p\n", EventSet, values);
+	EventSetInfo_t *ESI;
+	hwd_context_t *context;
+	long long *counts;
+	int i, pos, cidx, retval = PAPI_OK;
+
+	ESI = _papi_hwi_lookup_EventSet( EventSet );
+	if ( ESI == NULL )
+		papi_return( PAPI_ENOEVST );
+
+	cidx = valid_ESI_component( ESI );
+	if ( cidx < 0 )
+		papi_return( cidx );
+
+	if ( values == NULL )
+		papi_return( PAPI_EINVAL );
+
+	if ( _papi_hwi_is_sw_multiplex( ESI ) )
+		papi_return( MPX_read_mpx( ESI->multiplex.mpx_evset, values ) );
+
+	counts = ( long long * ) papi_malloc( ( size_t ) ESI->NumberOfEvents *
+										  sizeof ( long long ) );
+	if ( counts == NULL )
+		papi_return( PAPI_ENOMEM );
+
+	if ( ESI->state & PAPI_RUNNING ) {
+		/* get the context we should use for this event set */
+		context = _papi_hwi_get_context( ESI, NULL );
+		retval = _papi_hwi_read( context, ESI, counts );
+	} else {
+		memcpy( counts, ESI->sw_stop,
+				( size_t ) ESI->NumberOfEvents * sizeof ( long long ) );
+	}
+
+	for ( i = 0; ( retval == PAPI_OK ) && ( i < ESI->NumberOfEvents ); i++ ) {
+		values[i].value = values[i].raw = counts[i];
+		values[i].enabled = values[i].running = 0;
+		values[i].scale = 1.0;
+		values[i].std_error = 0.0;
+
+		/* The component kept what the last read scaled by */
+		pos = ESI->EventInfoArray[i].pos[0];
+		if ( ( ESI->state & PAPI_MULTIPLEXING ) && ( pos >= 0 ) )
+			retval = _papi_hwd[cidx]->read_mpx( ESI->ctl_state, pos,
+												&values[i] );
+	}
+
+	papi_free( counts );
+	papi_return( retval );
+}
+
 /**	@class PAPI_accum
  *	@brief Accumulate and reset counters in an EventSet.
  *	
@@ -3419,7 +3618,9 @@ PAPI_set_multiplex( int EventSet )
  *					specified in ptr->debug.level. The debug handler is specified in 
  *					ptr->debug.handler. For further information regarding debug states and
  *					the behavior of the handler, see PAPI_set_debug.
- * PAPI_MULTIPLEX	Enable specified EventSet for multiplexing.
+ * PAPI_MULTIPLEX	Enable specified EventSet for multiplexing. With PAPI_MULTIPLEX_ADAPTIVE
+ *					in ptr->multiplex.flags, slices go to the events whose rate varies most,
+ *					each getting at least ptr->multiplex.min_share percent of them.
  * PAPI_DEF_ITIMER	Set the type of itimer used in software multiplexing, overflowing 
  *					and profiling.
  * PAPI_DEF_MPX_NS	Set the sampling time slice in nanoseconds for multiplexing and overflow.
@@ -3449,7 +3650,7 @@ PAPI_set_multiplex( int EventSet )
  * <tr><td>PAPI_DEFGRN</td><td>Set default counting granularity. Requires a component index.</td></tr>
  * <tr><td>PAPI_DEBUG</td><td>Set the PAPI debug state and the debug handler. The debug state is specified in ptr->debug.level. The debug handler is specified in ptr->debug.handler. 
  *			For further information regarding debug states and the behavior of the handler, see PAPI_set_debug.</td></tr>
- * <tr><td>PAPI_MULTIPLEX</td><td>Enable specified EventSet for multiplexing.</td></tr>
+ * <tr><td>PAPI_MULTIPLEX</td><td>Enable specified EventSet for multiplexing. With PAPI_MULTIPLEX_ADAPTIVE in ptr->multiplex.flags, slices go to the events whose rate varies most, each getting at least ptr->multiplex.min_share percent of them.</td></tr>
  * <tr><td>xPAPI_DEF_ITIMER</td><td>Set the type of itimer used in software multiplexing, overflowing and profiling.</td></tr>
  * <tr><td>PAPI_DEF_MPX_NS</td><td>Set the sampling time slice in nanoseconds for multiplexing and overflow.</td></tr>
  * <tr><td>PAPI_DEF_ITIMER_NS</td><td>See PAPI_DEF_MPX_NS.</td></tr>
@@ -3667,11 +3868,19 @@ PAPI_set_opt( int option, PAPI_option_t * ptr )
 
 		if ( ptr->multiplex.ns < 0 )
 			papi_return( PAPI_EINVAL );
+		internal.multiplex.min_share = 0;
+		if ( ptr->multiplex.flags & PAPI_MULTIPLEX_ADAPTIVE ) {
+			if ( ( ptr->multiplex.min_share < 0 ) ||
+				 ( ptr->multiplex.min_share > 100 ) )
+				papi_return( PAPI_EINVAL );
+			internal.multiplex.min_share = ptr->multiplex.min_share;
+		}
 		internal.multiplex.ESI = ESI;
 		internal.multiplex.ns = ( unsigned long ) ptr->multiplex.ns;
 		internal.multiplex.flags = ptr->multiplex.flags;
 		if ( ( _papi_hwd[cidx]->cmp_info.kernel_multiplex ) &&
-			 ( ( ptr->multiplex.flags & PAPI_MULTIPLEX_FORCE_SW ) == 0 ) ) {
+			 ( ( ptr->multiplex.flags &
+				 ( PAPI_MULTIPLEX_FORCE_SW | PAPI_MULTIPLEX_ADAPTIVE ) ) == 0 ) ) {
 			/* get the context we should use for this event set */
 			context = _papi_hwi_get_context( ESI, NULL );
 			retval = _papi_hwd[cidx]->ctl( context, PAPI_MULTIPLEX, &internal );
@@ -4223,6 +4432,7 @@ PAPI_get_opt( int option, PAPI_option_t * ptr )
 			papi_return( PAPI_ENOEVST );
 		ptr->multiplex.ns = ESI->multiplex.ns;
 		ptr->multiplex.flags = ESI->multiplex.flags;
+		ptr->multiplex.min_share = ESI->multiplex.min_share;
 		return ( ESI->state & PAPI_MULTIPLEXING ) != 0;
 	}
 	case PAPI_PRELOAD:
@@ -4348,6 +4558,8 @@ PAPI_get_cmp_opt( int option, PAPI_option_t * ptr, int cidx )
      return PAPI_ECMP;
   }
 
+  _papi_hwi_init_component( cidx );
+
 	switch ( option ) {
 		/* For now, MAX_HWCTRS and MAX CTRS are identical.
 		   At some future point, they may map onto different values.
@@ -4531,6 +4743,7 @@ again:
 	for ( i=0 ; i<user_defined_events_count ; i++) {
 		papi_free (user_defined_events[i].symbol);
 		papi_free (user_defined_events[i].postfix);
+		papi_free (user_defined_events[i].postfix_prog);
 		papi_free (user_defined_events[i].long_descr);
 		papi_free (user_defined_events[i].short_descr);
 		papi_free (user_defined_events[i].note);
@@ -4544,6 +4757,7 @@ again:
 
 	/* Shutdown the entire component */
 	_papi_hwi_shutdown_highlevel(  );
+	_papi_hwi_shutdown_traces(  );
 	_papi_hwi_shutdown_global_internal(  );
 	_papi_hwi_shutdown_global_threads(  );
 	for( i = 0; i < papi_num_components; i++ ) {
@@ -4748,6 +4962,9 @@ PAPI_perror( char *msg )
  *	      Only one type of overflow is allowed per event set, so 
  *            setting one event to hardware overflow and another to forced 
  *            software overflow will result in an error being returned.
+ *	      Add PAPI_OVERFLOW_ASYNC to queue the overflows for 
+ *            @ref PAPI_overflow_next instead of calling the handler from 
+ *            the signal handler; the handler may then be NULL.
  *	@param[in] handler
  *	      -- pointer to the user supplied handler function to call upon 
  *            overflow 
@@ -4850,7 +5067,7 @@ PAPI_overflow( int EventSet, int EventCode, int threshold, int flags,
 	/* the first time to call PAPI_overflow function */
 
 	if ( !( ESI->state & PAPI_OVERFLOWING ) ) {
-		if ( handler == NULL ) {
+		if ( ( handler == NULL ) && !( flags & PAPI_OVERFLOW_ASYNC ) ) {
 			OVFDBG("NULL handler\n");
 			papi_return( PAPI_EINVAL );
 		}
@@ -4902,6 +5119,11 @@ PAPI_overflow( int EventSet, int EventCode, int threshold, int flags,
 			ESI->overflow.EventCode[i] = EventCode;
 			ESI->overflow.event_counter++;
 		}
+		if ( flags & PAPI_OVERFLOW_ASYNC ) {
+			retval = _papi_hwi_alloc_overflow_queue( ESI );
+			if ( retval != PAPI_OK )
+				papi_return( retval );
+		}
 		/* New or existing entry */
 		ESI->overflow.deadline[i] = threshold;
 		ESI->overflow.threshold[i] = threshold;
@@ -4952,6 +5174,344 @@ PAPI_overflow( int EventSet, int EventCode, int threshold, int flags,
 	return PAPI_OK;
 }
 
+/** @class PAPI_overflow_next
+ *	@brief Take the oldest overflow queued for a PAPI_OVERFLOW_ASYNC EventSet.
+ *
+ *	@par C Interface:
+ *	\#include <papi.h> @n
+ *	int PAPI_overflow_next( int EventSet, PAPI_overflow_event_t *event );
+ *
+ *	With PAPI_OVERFLOW_ASYNC, PAPI_overflow() does not call the handler 
+ *	when a counter overflows.  It queues the EventSet, address and 
+ *	overflow_vector the handler would have received, with a timestamp, 
+ *	and returns from the signal at once.  Any one thread may take the 
+ *	queued overflows, at its own pace and outside of signal context, so it 
+ *	is free to take locks, allocate memory or do I/O.  Only one thread may 
+ *	call PAPI_overflow_next() for an EventSet at a time.  The queue holds 
+ *	4096 overflows; the ones that do not fit are counted in the lost field.
+ *
+ *	@retval 1
+ *		an overflow was stored in event.
+ *	@retval PAPI_OK
+ *		the queue is empty.
+ *	@retval PAPI_EINVAL
+ *		the EventSet does not use PAPI_OVERFLOW_ASYNC, or event is NULL.
+ *	@retval PAPI_ENOEVST
+ *		the EventSet does not exist.
+ *
+ *	@par Example
+ *	@code
+ *	PAPI_overflow_event_t ev;
+ *	while ( PAPI_overflow_next( EventSet, &ev ) == 1 ) {
+ *	   printf( "%p %#llx at %lld\n", ev.address, ev.overflow_vector, ev.time );
+ *	}
+ *	@endcode
+ *
+ *	@see PAPI_overflow PAPI_overflow_fd
+ */
+int
+PAPI_overflow_next( int EventSet, PAPI_overflow_event_t *event )
+{
+	EventSetInfo_t *ESI;
+
+	ESI = _papi_hwi_lookup_EventSet( EventSet );
+	if ( ESI == NULL )
+		papi_return( PAPI_ENOEVST );
+
+	if ( ( event == NULL ) || ( ESI->overflow.queue == NULL ) )
+		papi_return( PAPI_EINVAL );
+
+	return _papi_hwi_overflow_queue_next( ESI, event );
+}
+
+/** @class PAPI_overflow_fd
+ *	@brief Get a file descriptor to wait on for PAPI_OVERFLOW_ASYNC overflows.
+ *
+ *	@par C Interface:
+ *	\#include <papi.h> @n
+ *	int PAPI_overflow_fd( int EventSet, int *fd );
+ *
+ *	The descriptor is a non-blocking eventfd that becomes readable when 
+ *	overflows are queued, so a consumer can wait for it with poll(), 
+ *	select() or epoll.  Read its 8 byte counter to reset it, then call 
+ *	PAPI_overflow_next() until the queue is empty; reading first makes 
+ *	sure no wakeup is missed.  The descriptor belongs to PAPI and is 
+ *	closed when the EventSet is cleaned up.
+ *
+ *	@retval PAPI_OK
+ *	@retval PAPI_EINVAL
+ *		the EventSet does not use PAPI_OVERFLOW_ASYNC, or fd is NULL.
+ *	@retval PAPI_ENOEVST
+ *		the EventSet does not exist.
+ *	@retval PAPI_ENOSUPP
+ *		there is no eventfd on this system; poll with PAPI_overflow_next().
+ *
+ *	@see PAPI_overflow PAPI_overflow_next
+ */
+int
+PAPI_overflow_fd( int EventSet, int *fd )
+{
+	EventSetInfo_t *ESI;
+
+	ESI = _papi_hwi_lookup_EventSet( EventSet );
+	if ( ESI == NULL )
+		papi_return( PAPI_ENOEVST );
+
+	if ( ( fd == NULL ) || ( ESI->overflow.queue == NULL ) )
+		papi_return( PAPI_EINVAL );
+
+	if ( ESI->overflow.queue->fd < 0 )
+		papi_return( PAPI_ENOSUPP );
+
+	*fd = ESI->overflow.queue->fd;
+	return PAPI_OK;
+}
+
+/* Look up the component position of an event for the sample calls */
+static int
+sample_event_position( EventSetInfo_t *ESI, int EventCode )
+{
+	int index;
+
+	index = _papi_hwi_lookup_EventCodeIndex( ESI, ( unsigned int ) EventCode );
+	if ( index < 0 ) {
+		return PAPI_ENOEVNT;
+	}
+
+	return ESI->EventInfoArray[index].pos[0];
+}
+
+/** @class PAPI_overflow_lost
+ *	@brief Get the number of overflows of an event the kernel dropped.
+ *
+ *	@par C Interface:
+ *	\#include <papi.h> @n
+ *	int PAPI_overflow_lost( int EventSet, int EventCode, long long *lost );
+ *
+ *	With hardware overflow the counter keeps running across overflows and 
+ *	the kernel records every overflow in a buffer, from which PAPI calls 
+ *	the handler or updates the profile.  If the buffer fills up faster 
+ *	than it is emptied, for example because the handler takes longer than 
+ *	the time between two overflows, the kernel drops overflows and only 
+ *	counts them.  The count starts at 0 whenever the EventSet is modified.
+ *
+ *	@retval PAPI_OK
+ *	@retval PAPI_EINVAL
+ *		the event does not use hardware overflow or profiling, or lost 
+ *		is NULL.
+ *	@retval PAPI_ENOEVST
+ *		the EventSet does not exist.
+ *	@retval PAPI_ENOEVNT
+ *		the event is not part of the EventSet.
+ *	@retval PAPI_ECMP
+ *		the component does not count lost overflows.
+ *
+ *	@see PAPI_overflow PAPI_profil
+ */
+int
+PAPI_overflow_lost( int EventSet, int EventCode, long long *lost )
+{
+	int cidx, pos;
+	EventSetInfo_t *ESI;
+
+	if ( lost == NULL )
+		papi_return( PAPI_EINVAL );
+
+	ESI = _papi_hwi_lookup_EventSet( EventSet );
+	if ( ESI == NULL )
+		papi_return( PAPI_ENOEVST );
+
+	cidx = valid_ESI_component( ESI );
+	if ( cidx < 0 )
+		papi_return( cidx );
+
+	pos = sample_event_position( ESI, EventCode );
+	if ( pos < 0 )
+		papi_return( pos );
+
+	papi_return( _papi_hwd[cidx]->overflow_lost( ESI->ctl_state, pos, lost ) );
+}
+
+/** @class PAPI_sample
+ *	@brief Record a sample every threshold events, to be read with PAPI_sample_next().
+ *
+ *	@par C Interface:
+ *	\#include <papi.h> @n
+ *	int PAPI_sample( int EventSet, int EventCode, int threshold, int fields );
+ *
+ *	@param EventSet
+ *		an integer handle to a PAPI event set as created by PAPI_create_eventset
+ *	@param EventCode
+ *		the event to sample on, it must have been added to the EventSet 
+ *		and can not be a derived event.
+ *	@param threshold
+ *		number of events between samples, 0 turns sampling off again.
+ *	@param fields
+ *		what to record in each sample, an OR of PAPI_SAMPLE_IP, 
+ *		PAPI_SAMPLE_TID, PAPI_SAMPLE_TIME, PAPI_SAMPLE_ADDR, PAPI_SAMPLE_CPU, 
+ *		PAPI_SAMPLE_PERIOD, PAPI_SAMPLE_READ and PAPI_SAMPLE_CALLCHAIN.
+ *
+ *	Unlike PAPI_overflow() and PAPI_profil() no signal is involved: the 
+ *	samples pile up in a buffer shared with the kernel and are collected 
+ *	whenever the program calls PAPI_sample_next().  Samples the buffer had no 
+ *	room for are counted in the lost field of the samples returned later. 
+ *	Changing the events in the EventSet turns sampling off.
+ *
+ *	@retval PAPI_EINVAL
+ *		threshold is negative, or fields is empty or has unknown bits.
+ *	@retval PAPI_ENOEVST
+ *		the EventSet does not exist.
+ *	@retval PAPI_EISRUN
+ *		the EventSet is running.
+ *	@retval PAPI_ENOEVNT
+ *		the event is not part of the EventSet.
+ *	@retval PAPI_ECNFLCT
+ *		the EventSet is set up for overflow or profiling, or multiplexed in 
+ *		software.
+ *	@retval PAPI_ECMP
+ *		the component does not support sampling.
+ *
+ *	@see PAPI_sample_next PAPI_sample_release PAPI_overflow
+ */
+int
+PAPI_sample( int EventSet, int EventCode, int threshold, int fields )
+{
+	APIDBG( "Entry: EventSet: %d, EventCode: %#x, threshold: %d, fields: %#x\n", EventSet, EventCode, threshold, fields);
+	int retval, cidx, index;
+	EventSetInfo_t *ESI;
+
+	ESI = _papi_hwi_lookup_EventSet( EventSet );
+	if ( ESI == NULL )
+		papi_return( PAPI_ENOEVST );
+
+	cidx = valid_ESI_component( ESI );
+	if ( cidx < 0 )
+		papi_return( cidx );
+
+	if ( ( ESI->state & PAPI_STOPPED ) != PAPI_STOPPED )
+		papi_return( PAPI_EISRUN );
+
+	if ( ( threshold < 0 ) || ( fields & ~PAPI_SAMPLE_ALL ) ||
+		 ( ( threshold > 0 ) && ( fields == 0 ) ) )
+		papi_return( PAPI_EINVAL );
+
+	if ( ( ESI->state & ( PAPI_OVERFLOWING | PAPI_PROFILING ) ) ||
+		 _papi_hwi_is_sw_multiplex( ESI ) )
+		papi_return( PAPI_ECNFLCT );
+
+	index = _papi_hwi_lookup_EventCodeIndex( ESI, ( unsigned int ) EventCode );
+	if ( index < 0 )
+		papi_return( PAPI_ENOEVNT );
+
+	if ( ESI->EventInfoArray[index].derived &&
+		 ( ESI->EventInfoArray[index].derived != DERIVED_CMPD ) )
+		papi_return( PAPI_EINVAL );
+
+	retval = _papi_hwd[cidx]->set_sample( ESI, index, threshold, fields );
+	papi_return( retval );
+}
+
+/** @class PAPI_sample_next
+ *	@brief Get the next sample record of an event set up with PAPI_sample().
+ *
+ *	@par C Interface:
+ *	\#include <papi.h> @n
+ *	int PAPI_sample_next( int EventSet, int EventCode, PAPI_sample_t *sample );
+ *
+ *	The record is decoded in place: the values and ips arrays point into 
+ *	the sample buffer itself, and the buffer space stays reserved until 
+ *	PAPI_sample_release() is called.  Only a record that wraps around the 
+ *	end of the buffer is copied, so the pointers in sample are only good 
+ *	until the next call to PAPI_sample_next() or PAPI_sample_release().
+ *	The EventSet may be running or stopped.
+ *
+ *	@retval 1
+ *		a sample was stored in sample.
+ *	@retval PAPI_OK
+ *		there are no more samples for now.
+ *	@retval PAPI_EINVAL
+ *		the event is not being sampled, or sample is NULL.
+ *	@retval PAPI_ENOEVST
+ *		the EventSet does not exist.
+ *	@retval PAPI_ENOEVNT
+ *		the event is not part of the EventSet.
+ *
+ *	@par Example
+ *	@code
+ *	PAPI_sample_t s;
+ *	while ( PAPI_sample_next( EventSet, PAPI_TOT_CYC, &s ) == 1 ) {
+ *	   printf( "%#llx at %llu\n", s.ip, s.time );
+ *	}
+ *	PAPI_sample_release( EventSet, PAPI_TOT_CYC );
+ *	@endcode
+ *
+ *	@see PAPI_sample PAPI_sample_release
+ */
+int
+PAPI_sample_next( int EventSet, int EventCode, PAPI_sample_t *sample )
+{
+	int cidx, pos;
+	EventSetInfo_t *ESI;
+
+	ESI = _papi_hwi_lookup_EventSet( EventSet );
+	if ( ESI == NULL )
+		papi_return( PAPI_ENOEVST );
+
+	cidx = valid_ESI_component( ESI );
+	if ( cidx < 0 )
+		papi_return( cidx );
+
+	if ( sample == NULL )
+		papi_return( PAPI_EINVAL );
+
+	pos = sample_event_position( ESI, EventCode );
+	if ( pos < 0 )
+		papi_return( pos );
+
+	return _papi_hwd[cidx]->sample_next( ESI->ctl_state, pos, sample );
+}
+
+/** @class PAPI_sample_release
+ *	@brief Give the sample records returned by PAPI_sample_next() back to the kernel.
+ *
+ *	@par C Interface:
+ *	\#include <papi.h> @n
+ *	int PAPI_sample_release( int EventSet, int EventCode );
+ *
+ *	Until this is called the kernel can not reuse the buffer space of the 
+ *	records returned so far, and once the buffer is full new samples are 
+ *	lost.  Pointers into the records are no longer valid afterwards.
+ *
+ *	@retval PAPI_EINVAL
+ *		the event is not being sampled.
+ *	@retval PAPI_ENOEVST
+ *		the EventSet does not exist.
+ *	@retval PAPI_ENOEVNT
+ *		the event is not part of the EventSet.
+ *
+ *	@see PAPI_sample PAPI_sample_next
+ */
+int
+PAPI_sample_release( int EventSet, int EventCode )
+{
+	int cidx, pos;
+	EventSetInfo_t *ESI;
+
+	ESI = _papi_hwi_lookup_EventSet( EventSet );
+	if ( ESI == NULL )
+		papi_return( PAPI_ENOEVST );
+
+	cidx = valid_ESI_component( ESI );
+	if ( cidx < 0 )
+		papi_return( cidx );
+
+	pos = sample_event_position( ESI, EventCode );
+	if ( pos < 0 )
+		papi_return( pos );
+
+	papi_return( _papi_hwd[cidx]->sample_release( ESI->ctl_state, pos ) );
+}
+
 /** @class PAPI_sprofil
  *	@brief Generate PC histogram data from multiple code regions where hardware counter overflow occurs.
  *
@@ -5002,6 +5562,16 @@ PAPI_overflow( int EventSet, int EventCode, int threshold, int flags,
  *	Each structure in the array defines the profiling parameters that are 
  *	normally passed to PAPI_profil(). 
  *	For more information on profiling, @ref PAPI_profil
+ *
+ *	With PAPI_PROFIL_SPARSE the buffer of each region is an open addressing 
+ *	hash table of PAPI_profil_bucket_t instead of an array of counts, and 
+ *	pr_size is its size in bytes.  Each used entry holds the number a bucket 
+ *	would have in a dense buffer and its count, unused entries have a count 
+ *	of 0.  Memory then grows with the number of distinct buckets hit rather 
+ *	than with the size of the region, so large text segments can be profiled 
+ *	at fine scale.  The table has to be zeroed before profiling starts and 
+ *	should be about twice as large as the number of buckets expected; once 
+ *	it is full further new buckets are dropped.
  *	@manonly
  *
  *	@endmanonly
@@ -5150,9 +5720,14 @@ PAPI_sprofil( PAPI_sprofil_t *prof, int profcnt, int EventSet,
 	 papi_return( PAPI_EINVAL );
       }
 
+      /* hand the private buckets over before the buffer is forgotten */
+      _papi_hwi_merge_private_profile( ESI, i, 0 );
+      _papi_hwi_free_private_profile( ESI, i );
+
       /* compact these arrays */
       while ( i < ESI->profile.event_counter - 1 ) {
          ESI->profile.prof[i] = ESI->profile.prof[i + 1];
+         ESI->profile.priv[i] = ESI->profile.priv[i + 1];
 	 ESI->profile.count[i] = ESI->profile.count[i + 1];
 	 ESI->profile.threshold[i] = ESI->profile.threshold[i + 1];
 	 ESI->profile.EventIndex[i] = ESI->profile.EventIndex[i + 1];
@@ -5160,6 +5735,7 @@ PAPI_sprofil( PAPI_sprofil_t *prof, int profcnt, int EventSet,
 	 i++;
       }
       ESI->profile.prof[i] = NULL;
+      ESI->profile.priv[i] = NULL;
       ESI->profile.count[i] = 0;
       ESI->profile.threshold[i] = 0;
       ESI->profile.EventIndex[i] = 0;
@@ -5188,10 +5764,21 @@ PAPI_sprofil( PAPI_sprofil_t *prof, int profcnt, int EventSet,
 	 ESI->profile.event_counter++;
 	 ESI->profile.EventCode[i] = EventCode;
       }
+      else {
+	 _papi_hwi_merge_private_profile( ESI, i, 0 );
+	 _papi_hwi_free_private_profile( ESI, i );
+      }
       ESI->profile.prof[i] = prof;
       ESI->profile.count[i] = profcnt;
       ESI->profile.threshold[i] = threshold;
       ESI->profile.EventIndex[i] = index;
+
+      if ( flags & PAPI_PROFIL_PRIVATE ) {
+	 retval = _papi_hwi_alloc_private_profile( ESI, i );
+	 if ( retval != PAPI_OK ) {
+	    papi_return( retval );
+	 }
+      }
    }
 
    APIDBG( "Profile event counter is %d\n", ESI->profile.event_counter );
@@ -5205,10 +5792,25 @@ PAPI_sprofil( PAPI_sprofil_t *prof, int profcnt, int EventSet,
    if ( flags &
 	~( PAPI_PROFIL_POSIX | PAPI_PROFIL_RANDOM | PAPI_PROFIL_WEIGHTED |
 	   PAPI_PROFIL_COMPRESS | PAPI_PROFIL_BUCKETS | PAPI_PROFIL_FORCE_SW |
-	   PAPI_PROFIL_INST_EAR | PAPI_PROFIL_DATA_EAR ) ) {
+	   PAPI_PROFIL_INST_EAR | PAPI_PROFIL_DATA_EAR | PAPI_PROFIL_DRAIN |
+	   PAPI_PROFIL_SPARSE | PAPI_PROFIL_PRIVATE ) ) {
       papi_return( PAPI_EINVAL );
    }
 
+   /* hash tables can not be added up bucket by bucket */
+   if ( ( flags & PAPI_PROFIL_SPARSE ) && ( flags & PAPI_PROFIL_PRIVATE ) ) {
+      papi_return( PAPI_EINVAL );
+   }
+
+   /* a sparse profile needs room for at least one hash table entry */
+   if ( flags & PAPI_PROFIL_SPARSE ) {
+      for( i = 0; i < profcnt; i++ ) {
+	 if ( prof[i].pr_size < sizeof ( PAPI_profil_bucket_t ) ) {
+	    papi_return( PAPI_EINVAL );
+	 }
+      }
+   }
+
    /* if we have kernel-based profiling, then we're just asking for 
       signals on interrupt. */
    /* if we don't have kernel-based profiling, then we're asking for 
@@ -5409,6 +6011,18 @@ PAPI_sprofil( PAPI_sprofil_t *prof, int profcnt, int EventSet,
  * @arg PAPI_PROFIL_BUCKET_32	Use unsigned int (32 bit) buckets.@n
  * @arg PAPI_PROFIL_BUCKET_64	Use unsigned long long (64 bit) buckets.@n
  * @arg PAPI_PROFIL_FORCE_SW	Force software overflow in profiling. @n
+ * @arg PAPI_PROFIL_DRAIN	Collect the samples in a background thread that 
+ *	wakes up once the kernel sample buffer is half full, instead of taking 
+ *	a signal on the profiled thread for every sample.  The histogram is 
+ *	only complete after PAPI_stop().  Ignored by components that do not 
+ *	sample in the kernel. @n
+ * @arg PAPI_PROFIL_SPARSE	The buffer is a hash table of PAPI_profil_bucket_t 
+ *	that only has entries for the buckets hit, see PAPI_sprofil(). @n
+ * @arg PAPI_PROFIL_PRIVATE	Count into a private copy of the buffer that 
+ *	belongs to the EventSet and add it to the buffer at PAPI_stop(), or 
+ *	earlier with PAPI_profil_merge().  Use it when threads profile into 
+ *	a shared buffer: they no longer lose each other's counts or contend 
+ *	for its cache lines.  Can not be combined with PAPI_PROFIL_SPARSE. @n
  *
  * @par Example
  * @code
@@ -5506,6 +6120,63 @@ PAPI_profil( void *buf, unsigned bufsiz, caddr_t offset,
 	papi_return( PAPI_sprofil( NULL, 0, EventSet, EventCode, 0, flags ) );
 }
 
+/** @class PAPI_profil_merge
+ *  @brief Add the private buckets of a PAPI_PROFIL_PRIVATE profile to the profile buffers.
+ *
+ * @par C Interface:
+ * \#include <papi.h> @n
+ * int PAPI_profil_merge( int EventSet );
+ *
+ * @param EventSet
+ *    -- an integer handle for a PAPI Event Set as created by 
+ *       PAPI_create_eventset()
+ *
+ * @retval PAPI_OK 
+ * @retval PAPI_EINVAL 
+ *	   The EventSet is not profiling.
+ * @retval PAPI_ENOEVST 
+ *	   The EventSet specified does not exist.
+ * @retval PAPI_EISRUN 
+ *	   The EventSet is running and either belongs to another thread or 
+ *	   uses PAPI_PROFIL_DRAIN.
+ *
+ *	With PAPI_PROFIL_PRIVATE the samples of an EventSet are counted in 
+ *	buckets of its own, which PAPI_stop() adds to the buffers given to 
+ *	PAPI_profil() or PAPI_sprofil().  PAPI_profil_merge() does the same 
+ *	without stopping, so a thread can publish its histogram while it keeps 
+ *	profiling.  A running EventSet can only be merged by the thread that 
+ *	runs it.  The call does nothing for profiles without PAPI_PROFIL_PRIVATE.
+ *
+ * @see PAPI_profil PAPI_sprofil PAPI_stop
+ */
+int
+PAPI_profil_merge( int EventSet )
+{
+	APIDBG( "Entry: EventSet: %d\n", EventSet );
+	EventSetInfo_t *ESI;
+	int running, i;
+
+	ESI = _papi_hwi_lookup_EventSet( EventSet );
+	if ( ESI == NULL )
+		papi_return( PAPI_ENOEVST );
+
+	if ( !( ESI->state & PAPI_PROFILING ) )
+		papi_return( PAPI_EINVAL );
+
+	/* While running, the buckets may only be written by our own signal
+	   handler, which can not run concurrently with us */
+	running = ( ESI->state & PAPI_RUNNING ) ? 1 : 0;
+	if ( running &&
+		 ( ( ESI->profile.flags & PAPI_PROFIL_DRAIN ) ||
+		   ( ESI->master != _papi_hwi_lookup_thread( 0 ) ) ) )
+		papi_return( PAPI_EISRUN );
+
+	for ( i = 0; i < ESI->profile.event_counter; i++ )
+		_papi_hwi_merge_private_profile( ESI, i, running );
+
+	return PAPI_OK;
+}
+
 /* This function sets the low level default granularity
    for all newly manufactured eventsets. The first function
    preserves API compatibility and assumes component 0;
@@ -5852,10 +6523,32 @@ PAPI_add_events( int EventSet, int *Events, int number )
 {
 	APIDBG( "Entry: EventSet: %d, Events: %p, number: %d\n", EventSet, Events, number);
 	int i, retval;
+	EventSetInfo_t *ESI;
 
 	if ( ( Events == NULL ) || ( number <= 0 ) )
 		papi_return( PAPI_EINVAL );
 
+	ESI = _papi_hwi_lookup_EventSet( EventSet );
+	if ( ESI == NULL )
+		papi_return( PAPI_ENOEVST );
+
+	if ( ESI->state & PAPI_RUNNING )
+		papi_return( PAPI_EISRUN );
+
+	/* Try to add the whole list with a single component update.  */
+	/* If that fails, nothing was added; go one event at a time so */
+	/* we can report how far we got.                               */
+	if ( number > 1 ) {
+		for ( i = 0; i < number; i++ ) {
+			if ( ( ( Events[i] & PAPI_PRESET_MASK ) == 0 ) &&
+				 ( Events[i] & PAPI_NATIVE_MASK ) == 0 )
+				break;
+		}
+		if ( ( i == number ) &&
+			 ( _papi_hwi_add_events( ESI, Events, number ) == PAPI_OK ) )
+			return ( PAPI_OK );
+	}
+
 	for ( i = 0; i < number; i++ ) {
 		retval = PAPI_add_event( EventSet, Events[i] );
 		if ( retval != PAPI_OK ) {
@@ -6434,6 +7127,56 @@ PAPI_unlock( int lck )
 	papi_return( _papi_hwi_unlock( lck ) );
 }
 
+/** @class PAPI_get_lock_stats
+ *	@brief Get contention statistics for one of the PAPI locks.
+ *
+ *	@par C Interface:
+ *	\#include <papi.h> @n
+ *	int PAPI_get_lock_stats( int lck, PAPI_lock_stats_t *stats );
+ *
+ *	@param lck
+ *		index of the lock, from 0.  PAPI_USR1_LOCK and PAPI_USR2_LOCK are 
+ *		the user locks, the locks PAPI uses internally follow them.
+ *	@param stats
+ *		filled with the name of the lock, how often it was taken, how 
+ *		often it was found held, how often a waiter went to sleep and 
+ *		how long threads waited for it in total.
+ *
+ *	@retval PAPI_EINVAL
+ *		lck is not a valid lock, or stats is NULL.  Looping from 0 until 
+ *		PAPI_EINVAL lists all the locks.
+ *	@retval PAPI_ENOSUPP
+ *		the locks of this platform don't keep statistics.
+ *
+ *	The counters are only updated while PAPI is in threaded mode, see 
+ *	PAPI_thread_init(); without it no locks are taken.
+ *
+ *	@see PAPI_lock PAPI_thread_init
+ */
+int
+PAPI_get_lock_stats( int lck, PAPI_lock_stats_t *stats )
+{
+	static const char *lock_names[PAPI_MAX_LOCK] = {
+		"PAPI_USR1_LOCK", "PAPI_USR2_LOCK", "INTERNAL_LOCK",
+		"MULTIPLEX_LOCK", "THREADS_LOCK", "HIGHLEVEL_LOCK", "MEMORY_LOCK",
+		"COMPONENT_LOCK", "GLOBAL_LOCK", "CPUS_LOCK", "NAMELIB_LOCK",
+		"PRESETS_LOCK"
+	};
+
+	if ( ( lck < 0 ) || ( lck >= PAPI_MAX_LOCK ) || ( stats == NULL ) )
+		papi_return( PAPI_EINVAL );
+
+#if defined(PAPI_HWD_LOCK_STATS)
+	_papi_hwd_lock_stats( lck, stats );
+	strncpy( stats->name, lock_names[lck], sizeof ( stats->name ) );
+	stats->name[sizeof ( stats->name ) - 1] = '\0';
+	return PAPI_OK;
+#else
+	( void ) lock_names;
+	papi_return( PAPI_ENOSUPP );
+#endif
+}
+
 /**	@class PAPI_is_initialized
  *	@brief check for initialization
  *	@retval PAPI_NOT_INITED
@@ -6620,14 +7363,10 @@ int  PAPI_get_component_index(char *name)
 	APIDBG( "Entry: name: %s\n", name);
   int cidx;
 
-  const PAPI_component_info_t *cinfo;
-
+  /* the name is known without initializing the component */
   for(cidx=0;cidx<papi_num_components;cidx++) {
 
-     cinfo=PAPI_get_component_info(cidx); 
-     if (cinfo==NULL) return PAPI_ENOCMP;
-
-     if (!strcmp(name,cinfo->name)) {
+     if (!strcmp(name,_papi_hwd[cidx]->cmp_info.name)) {
         return cidx;
      }
   }
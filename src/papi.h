@@ -273,7 +273,8 @@ failure.
 #define PAPI_EATTR		-22    /**< Invalid or missing event attributes */
 #define PAPI_ECOUNT		-23    /**< Too many events or attributes */
 #define PAPI_ECOMBO		-24    /**< Bad combination of features */
-#define PAPI_NUM_ERRORS	 25    /**< Number of error messages specified in this API */
+#define PAPI_EDELAY_INIT	-25    /**< Component not initialized until first used */
+#define PAPI_NUM_ERRORS	 26    /**< Number of error messages specified in this API */
 
 #define PAPI_NOT_INITED		0
 #define PAPI_LOW_LEVEL_INITED 	1       /* Low level has called library init */
@@ -399,6 +400,9 @@ All of the functions in the PerfAPI should use the following set of constants.
 #define PAPI_PROFIL_FORCE_SW  0x40       /**< Force Software overflow in profiling */
 #define PAPI_PROFIL_DATA_EAR  0x80       /**< Use data address register profiling */
 #define PAPI_PROFIL_INST_EAR  0x100      /**< Use instruction address register profiling */
+#define PAPI_PROFIL_DRAIN     0x200      /**< Empty the sample buffers in a background thread, not in the signal handler */
+#define PAPI_PROFIL_SPARSE    0x400      /**< The buffer is a hash table of PAPI_profil_bucket_t, see PAPI_sprofil() */
+#define PAPI_PROFIL_PRIVATE   0x800      /**< Count into private buckets, added to the buffer by PAPI_stop() or PAPI_profil_merge() */
 #define PAPI_PROFIL_BUCKETS   (PAPI_PROFIL_BUCKET_16 | PAPI_PROFIL_BUCKET_32 | PAPI_PROFIL_BUCKET_64)
 /** @} */
 
@@ -406,6 +410,20 @@ All of the functions in the PerfAPI should use the following set of constants.
    @{ */
 #define PAPI_OVERFLOW_FORCE_SW 0x40	/**< Force using Software */
 #define PAPI_OVERFLOW_HARDWARE 0x80	/**< Using Hardware */
+#define PAPI_OVERFLOW_ASYNC    0x100	/**< Queue overflows for PAPI_overflow_next() instead of calling the handler */
+/** @} */
+
+/* @defgroup sample_defns Sample record fields, see PAPI_sample()
+   @{ */
+#define PAPI_SAMPLE_IP        0x1     /**< Instruction pointer */
+#define PAPI_SAMPLE_TID       0x2     /**< Process and thread id */
+#define PAPI_SAMPLE_TIME      0x4     /**< Timestamp */
+#define PAPI_SAMPLE_ADDR      0x8     /**< Data address, where the event provides one */
+#define PAPI_SAMPLE_CPU       0x10    /**< Cpu the sample was taken on */
+#define PAPI_SAMPLE_PERIOD    0x20    /**< Number of events since the last sample */
+#define PAPI_SAMPLE_READ      0x40    /**< Values of the events in the group */
+#define PAPI_SAMPLE_CALLCHAIN 0x80    /**< Call chain */
+#define PAPI_SAMPLE_ALL       0xff
 /** @} */
 
 /** @internal 
@@ -413,6 +431,7 @@ All of the functions in the PerfAPI should use the following set of constants.
   * @{ */
 #define PAPI_MULTIPLEX_DEFAULT	0x0	/**< Use whatever method is available, prefer kernel of course. */
 #define PAPI_MULTIPLEX_FORCE_SW 0x1	/**< Force PAPI multiplexing instead of kernel */
+#define PAPI_MULTIPLEX_ADAPTIVE 0x2	/**< PAPI multiplexing, giving more slices to events whose rate varies most */
 /** @} */
 
 /** @internal 
@@ -559,6 +578,60 @@ read the documentation carefully.  */
      void **data;
    } PAPI_all_thr_spec_t;
 
+	/** @ingroup papi_data_structures
+	 *  statistics of one of the PAPI locks, see PAPI_get_lock_stats() */
+	typedef struct _papi_lock_stats {
+     char name[PAPI_MIN_STR_LEN];  /**< name of the lock */
+     long long acquired;           /**< times the lock was taken */
+     long long contended;          /**< times it was found held by another thread */
+     long long sleeps;             /**< times a waiter went to sleep in the kernel */
+     long long wait_ns;            /**< total time threads waited for it, in ns */
+   } PAPI_lock_stats_t;
+
+	/** @ingroup papi_data_structures
+	 *  one sample record, see PAPI_sample_next().
+	 *  Only the fields requested with PAPI_sample() are filled in. */
+	typedef struct _papi_sample {
+     int fields;                   /**< PAPI_SAMPLE_* fields present */
+     int nr_values;                /**< number of entries in values */
+     int nr_ips;                   /**< number of entries in ips */
+     unsigned int pid;             /**< PAPI_SAMPLE_TID */
+     unsigned int tid;
+     unsigned int cpu;             /**< PAPI_SAMPLE_CPU */
+     unsigned long long ip;        /**< PAPI_SAMPLE_IP */
+     unsigned long long time;      /**< PAPI_SAMPLE_TIME */
+     unsigned long long addr;      /**< PAPI_SAMPLE_ADDR */
+     unsigned long long period;    /**< PAPI_SAMPLE_PERIOD */
+     unsigned long long time_enabled; /**< PAPI_SAMPLE_READ, when multiplexed */
+     unsigned long long time_running;
+     const unsigned long long *values; /**< PAPI_SAMPLE_READ, event values */
+     const unsigned long long *ips;    /**< PAPI_SAMPLE_CALLCHAIN, innermost first */
+     long long lost;               /**< samples the kernel dropped so far */
+   } PAPI_sample_t;
+
+	/** @ingroup papi_data_structures
+	 *  one overflow queued with PAPI_OVERFLOW_ASYNC, see PAPI_overflow_next() */
+	typedef struct _papi_overflow_event {
+     int EventSet;                 /**< EventSet that overflowed */
+     void *address;                /**< program counter at the overflow */
+     long long overflow_vector;    /**< counters that overflowed, as for the handler */
+     long long time;               /**< PAPI_get_real_nsec() at the overflow */
+     long long lost;               /**< overflows dropped so far because the queue was full */
+   } PAPI_overflow_event_t;
+
+	/** @ingroup papi_data_structures
+	 *  how a multiplexed count was arrived at, see PAPI_read_mpx().
+	 *  Times are nanoseconds for kernel multiplexing and cycles for
+	 *  PAPI's own. */
+	typedef struct _papi_mpx_value {
+     long long value;              /**< count as PAPI_read() returns it */
+     long long raw;                /**< count actually seen while the event was on a counter */
+     long long enabled;            /**< time the EventSet has been counting */
+     long long running;            /**< part of enabled the event was on a counter */
+     double scale;                 /**< enabled / running, 1.0 when not multiplexed */
+     double std_error;             /**< estimated standard error of value, < 0 until known */
+   } PAPI_mpx_value_t;
+
   typedef void (*PAPI_overflow_handler_t) (int EventSet, void *address,
                                 long long overflow_vector, void *context);
 
@@ -572,6 +645,13 @@ read the documentation carefully.  */
   #endif
 #endif
 
+	/** @ingroup papi_data_structures
+	 *  entry of a PAPI_PROFIL_SPARSE profile buffer */
+   typedef struct _papi_profil_bucket {
+      unsigned long long index;  /**< bucket number, as it would be in a dense buffer */
+      unsigned long long count;  /**< samples in the bucket, 0 if the entry is unused */
+   } PAPI_profil_bucket_t;
+
 	/** @ingroup papi_data_structures */
    typedef struct _papi_sprofil {
       void *pr_base;          /**< buffer base */
@@ -824,6 +904,7 @@ typedef char* PAPI_user_defined_events_file_t;
       int eventset;
       int ns;
       int flags;
+      int min_share;	/**< With PAPI_MULTIPLEX_ADAPTIVE, least percentage of slices each event gets */
    } PAPI_multiplex_option_t;
 
    /** @ingroup papi_data_structures 
@@ -1022,6 +1103,7 @@ enum {
    int   PAPI_add_event(int EventSet, int Event); /**< add single PAPI preset or native hardware event to an event set */
    int   PAPI_add_named_event(int EventSet, char *EventName); /**< add an event by name to a PAPI event set */
    int   PAPI_add_events(int EventSet, int *Events, int number); /**< add array of PAPI preset or native hardware events to an event set */
+   int   PAPI_add_named_events(int EventSet, char **EventNames, int number); /**< add array of named PAPI preset or native hardware events to an event set */
    int   PAPI_assign_eventset_component(int EventSet, int cidx); /**< assign a component index to an existing but empty eventset */
    int   PAPI_attach(int EventSet, unsigned long tid); /**< attach specified event set to a specific process or thread id */
    int   PAPI_cleanup_eventset(int EventSet); /**< remove all PAPI events from an event set */
@@ -1045,6 +1127,7 @@ enum {
    long long PAPI_get_real_usec(void); /**< return the total number of microseconds since some arbitrary starting point */
    const PAPI_shlib_info_t *PAPI_get_shared_lib_info(void); /**< get information about the shared libraries used by the process */
    int   PAPI_get_thr_specific(int tag, void **ptr); /**< return a pointer to a thread specific stored data structure */
+   int   PAPI_get_lock_stats(int lck, PAPI_lock_stats_t *stats); /**< get the contention statistics of one of the PAPI locks */
    int   PAPI_get_overflow_event_index(int Eventset, long long overflow_vector, int *array, int *number); /**< # decomposes an overflow_vector into an event index array */
    long long PAPI_get_virt_cyc(void); /**< return the process cycles since some arbitrary starting point */
    long long PAPI_get_virt_nsec(void); /**< return the process nanoseconds since some arbitrary starting point */
@@ -1059,6 +1142,9 @@ enum {
     int   PAPI_num_events(int EventSet); /**< return the number of events in an event set */
    int   PAPI_overflow(int EventSet, int EventCode, int threshold,
                      int flags, PAPI_overflow_handler_t handler); /**< set up an event set to begin registering overflows */
+   int   PAPI_overflow_next(int EventSet, PAPI_overflow_event_t *event); /**< take the oldest overflow queued with PAPI_OVERFLOW_ASYNC */
+   int   PAPI_overflow_fd(int EventSet, int *fd); /**< get a file descriptor that becomes readable when overflows are queued */
+   int   PAPI_overflow_lost(int EventSet, int EventCode, long long *lost); /**< number of overflow samples the kernel dropped for an event */
    void   PAPI_perror(char *msg ); /**< Print a PAPI error message */
    int   PAPI_profil(void *buf, unsigned bufsiz, caddr_t offset, 
 					 unsigned scale, int EventSet, int EventCode, 
@@ -1067,11 +1153,18 @@ enum {
    int   PAPI_query_named_event(char *EventName); /**< query if a named PAPI event exists */
    int   PAPI_read(int EventSet, long long * values); /**< read hardware events from an event set with no reset */
    int   PAPI_read_ts(int EventSet, long long * values, long long *cyc); /**< read from an eventset with a real-time cycle timestamp */
+   int   PAPI_read_mpx(int EventSet, PAPI_mpx_value_t *values); /**< read an eventset along with how accurate its multiplexed counts are */
    int   PAPI_register_thread(void); /**< inform PAPI of the existence of a new thread */
    int   PAPI_remove_event(int EventSet, int EventCode); /**< remove a hardware event from a PAPI event set */
    int   PAPI_remove_named_event(int EventSet, char *EventName); /**< remove a named event from a PAPI event set */
    int   PAPI_remove_events(int EventSet, int *Events, int number); /**< remove an array of hardware events from a PAPI event set */
    int   PAPI_reset(int EventSet); /**< reset the hardware event counts in an event set */
+   int   PAPI_sample(int EventSet, int EventCode, int threshold, int fields); /**< record a sample every threshold events */
+   int   PAPI_sample_next(int EventSet, int EventCode, PAPI_sample_t *sample); /**< get the next sample record, without copying it */
+   int   PAPI_sample_release(int EventSet, int EventCode); /**< hand the sample records returned so far back */
+   int   PAPI_sample_trace_open(const char *path, int *trace); /**< create a binary trace file for samples */
+   int   PAPI_sample_trace_write(int trace, int EventSet, int EventCode); /**< move the pending samples of an event into a trace */
+   int   PAPI_sample_trace_close(int trace); /**< finish a trace file */
    int   PAPI_set_debug(int level); /**< set the current debug level for PAPI */
    int   PAPI_set_cmp_domain(int domain, int cidx); /**< set the component specific default execution domain for new event sets */
    int   PAPI_set_domain(int domain); /**< set the default execution domain for new event sets  */
@@ -1082,6 +1175,7 @@ enum {
    int   PAPI_set_thr_specific(int tag, void *ptr); /**< save a pointer as a thread specific stored data structure */
    void  PAPI_shutdown(void); /**< finish using PAPI and free all related resources */
    int   PAPI_sprofil(PAPI_sprofil_t * prof, int profcnt, int EventSet, int EventCode, int threshold, int flags); /**< generate hardware counter profiles from multiple code regions */
+   int   PAPI_profil_merge(int EventSet); /**< add the private buckets of a PAPI_PROFIL_PRIVATE profile to the profile buffers */
    int   PAPI_start(int EventSet); /**< start counting hardware events in an event set */
    int   PAPI_state(int EventSet, int *status); /**< return the counting state of an event set */
    int   PAPI_stop(int EventSet, long long * values); /**< stop counting hardware events in an event set and return current events */
@@ -592,7 +592,8 @@ const hwi_describe_t _papi_hwi_err[PAPI_NUM_ERRORS] = {
     /*21 */ {PAPI_EINVAL_DOM, "PAPI_EINVAL_DOM", "EventSet domain is not supported for the operation"},
     /*22 */ {PAPI_EATTR, "PAPI_EATTR", "Invalid or missing event attributes"},
     /*23 */ {PAPI_ECOUNT, "PAPI_ECOUNT", "Too many events or attributes"},
-    /*24 */ {PAPI_ECOMBO, "PAPI_ECOMBO", "Bad combination of features"}
+    /*24 */ {PAPI_ECOMBO, "PAPI_ECOMBO", "Bad combination of features"},
+    /*25 */ {PAPI_EDELAY_INIT, "PAPI_EDELAY_INIT", "Component not initialized until first used"}
 };
 #endif
 
@@ -1,19 +1,233 @@
 #!/bin/sh
 #
-#	Transform the papi_events.csv file into a static table.
+#	Compile the papi_events.csv file into static tables.
 #
-#	tr "\r" "\n" |		# convert CR to LF
-#	tr -s "\n" |		# convert LFLF to LF
-#	tr "\"" "'" |		# convert " to '
-#	sed 's/^/"/' | \	# insert " at beginning of line
-#	sed 's/$/\\n\"/'	# insert LF" at end of line
+#	Every CPU line becomes an entry of papi_preset_pmus that names the
+#	slice of papi_preset_defs its PRESET lines compiled to; consecutive
+#	CPU lines share the PRESET lines following them.  The PRESET lines
+#	are split and trimmed here, their derived type checked and infix
+#	formulas turned into postfix, so that papi_preset.c is only left with
+#	looking up the event names -- and that only for the presets used.
 #
-# print "#define STATIC_PAPI_EVENTS_TABLE 1"
-echo "static char *papi_events_table ="
-cat $1 | \
-	tr "\r" "\n" |
-	tr -s "\n" |
-	tr "\"" "'" |
-	sed 's/^/"/' | \
-	sed 's/$/\\n\"/'
-echo ";"
+#	Malformed lines are reported on stderr and left out of the tables,
+#	like papi_load_derived_events() ignores them when it reads a file.
+#
+tr "\r" "\n" < $1 | awk '
+function warn(msg) {
+	printf( "papi_events_table.sh: %s at line %d -- ignoring\n", msg, NR ) > "/dev/stderr"
+}
+
+function trim(s) {
+	sub( /^[ \t]+/, "", s )
+	sub( /[ \t]+$/, "", s )
+	return s
+}
+
+# as trim_note() in papi_preset.c: drop paired delimiters around a value
+function unquote(s,   a, b) {
+	s = trim( s )
+	if ( length( s ) > 0 && index( punct, substr( s, 1, 1 ) ) ) {
+		a = substr( s, 1, 1 )
+		b = substr( s, length( s ), 1 )
+		if ( a == b || ( a == "(" && b == ")" ) || ( a == "<" && b == ">" ) ||
+		     ( a == "{" && b == "}" ) || ( a == "[" && b == "]" ) )
+			s = substr( s, 2, length( s ) - 2 )
+	}
+	return s
+}
+
+# split on commas, skipping empty fields as strtok does; a field that
+# starts with a quote runs to the closing quote, commas and all
+function split_fields(line, f,   n, i, c, cur, q) {
+	n = 0
+	cur = ""
+	q = ""
+	for ( i = 1; i <= length( line ); i++ ) {
+		c = substr( line, i, 1 )
+		if ( q != "" ) {
+			cur = cur c
+			if ( c == q ) q = ""
+			continue
+		}
+		if ( c == "," ) {
+			if ( cur != "" ) f[++n] = cur
+			cur = ""
+			continue
+		}
+		if ( ( c == "\"" || c == sq ) && cur ~ /^[ \t]*$/ ) q = c
+		cur = cur c
+	}
+	if ( cur != "" ) f[++n] = cur
+	return n
+}
+
+function priority(c) {
+	if ( c == "+" || c == "-" ) return 1
+	if ( c == "*" || c == "/" || c == "%" ) return 2
+	return 0
+}
+
+# same conversion as infix_to_postfix() in papi_preset.c
+function infix_to_postfix(s,   out, stack, top, tok) {
+	out = ""
+	top = 0
+	gsub( /[ \t]/, "", s )
+	while ( s != "" ) {
+		if ( match( s, /^[-+*\/%()]/ ) ) {
+			tok = substr( s, 1, 1 )
+		} else {
+			match( s, /^[^-+*\/%()]+/ )
+			tok = substr( s, 1, RLENGTH )
+		}
+		s = substr( s, length( tok ) + 1 )
+		if ( tok == "(" ) {
+			stack[++top] = tok
+		} else if ( tok == ")" ) {
+			while ( top > 0 && stack[top] != "(" ) out = out stack[top--] "|"
+			if ( top > 0 ) top--
+		} else if ( priority( tok ) ) {
+			while ( top > 0 && priority( stack[top] ) >= priority( tok ) )
+				out = out stack[top--] "|"
+			stack[++top] = tok
+		} else {
+			gsub( /"/, "", tok )
+			out = out tok "|"
+		}
+	}
+	while ( top > 0 ) out = out stack[top--] "|"
+	return out
+}
+
+function cstr(s) {
+	if ( s == "" ) return "NULL"
+	gsub( /\\/, "\\\\", s )
+	gsub( /"/, "\\\"", s )
+	return "\"" s "\""
+}
+
+# the PRESET lines since the last CPU line belong to every CPU of the group
+function close_group(   i) {
+	for ( i = group_pmu; i < npmus; i++ ) {
+		pmu_first[i] = group_def
+		pmu_count[i] = ndefs - group_def
+	}
+	group_pmu = npmus
+	group_def = ndefs
+	found = 0
+}
+
+BEGIN {
+	sq = sprintf( "%c", 39 )
+	punct = "!\"#$%&()*+,-./:;<=>?@[\\]^_`{|}~" sq
+	max_terms = 8		# PAPI_EVENTS_IN_DERIVED_EVENT
+	derived = " NOT_DERIVED DERIVED_ADD DERIVED_PS DERIVED_ADD_PS DERIVED_CMPD DERIVED_SUB DERIVED_POSTFIX DERIVED_INFIX "
+	npmus = ndefs = group_pmu = group_def = found = 0
+}
+
+{
+	split( "", f )
+	n = split_fields( $0, f )
+	t = trim( f[1] )
+	if ( t == "" || substr( t, 1, 1 ) == "#" ) next
+	t = toupper( t )
+
+	if ( t == "CPU" ) {
+		if ( found ) close_group()
+		name = trim( f[2] )
+		if ( name == "" ) {
+			warn( "Expected name after CPU token" )
+			next
+		}
+		type = trim( f[3] )
+		if ( type == "" ) {
+			type = -1
+		} else if ( type !~ /^[-+]?[0-9]/ ) {
+			warn( "Invalid qualifier " type " for CPU " name )
+			next
+		}
+		pmu_name[npmus] = name
+		pmu_type[npmus] = type + 0
+		npmus++
+		next
+	}
+
+	if ( t != "PRESET" && t != "EVENT" ) {
+		warn( "Unrecognized token " t )
+		next
+	}
+
+	# like the run time parser, events before any CPU line are not for anybody
+	if ( npmus == group_pmu ) next
+	found = 1
+
+	sym = trim( f[2] )
+	if ( sym == "" ) {
+		warn( "Expected name after PRESET token" )
+		next
+	}
+	der = toupper( trim( f[3] ) )
+	if ( der == "" || index( derived, " " der " " ) == 0 ) {
+		warn( "Invalid derived name " der " for " sym )
+		next
+	}
+
+	i = 4
+	postfix = ""
+	if ( der == "DERIVED_POSTFIX" || der == "DERIVED_INFIX" ) {
+		postfix = trim( f[i++] )
+		if ( postfix == "" ) {
+			warn( "Expected Operation string after derived type " der )
+			next
+		}
+		if ( der == "DERIVED_INFIX" ) {
+			postfix = infix_to_postfix( postfix )
+			der = "DERIVED_POSTFIX"
+		}
+	}
+
+	terms = ""
+	nterms = 0
+	for ( ; i <= n && nterms < max_terms; i++ ) {
+		t = trim( f[i] )
+		u = toupper( t )
+		if ( t == "" || u == "NOTE" || u == "LDESC" || u == "SDESC" ) break
+		terms = terms ( nterms++ ? ", " : "" ) cstr( t )
+	}
+	if ( nterms == 0 ) {
+		warn( "Expected PFM event after DERIVED token for " sym )
+		next
+	}
+
+	sdesc = ldesc = note = ""
+	for ( ; i < n; i += 2 ) {
+		t = toupper( trim( f[i] ) )
+		v = unquote( f[i + 1] )
+		if ( t == "" || v == "" ) break
+		if ( t == "SDESC" ) sdesc = v
+		if ( t == "LDESC" ) ldesc = v
+		if ( t == "NOTE" ) note = v
+	}
+
+	def[ndefs++] = sprintf( "\t{%s, %s, %s,\n\t {%s},\n\t %s, %s, %s},",
+		cstr( sym ), der, cstr( postfix ), terms,
+		cstr( sdesc ), cstr( ldesc ), cstr( note ) )
+}
+
+END {
+	close_group()
+
+	print "/* Generated from papi_events.csv by papi_events_table.sh, do not edit */"
+	print ""
+	print "static const hwi_preset_def_t papi_preset_defs[] = {"
+	for ( i = 0; i < ndefs; i++ ) print def[i]
+	print "\t{NULL, NOT_DERIVED, NULL, {NULL}, NULL, NULL, NULL}"
+	print "};"
+	print ""
+	print "static const hwi_preset_pmu_t papi_preset_pmus[] = {"
+	for ( i = 0; i < npmus; i++ )
+		printf( "\t{%s, %d, %d, %d},\n", cstr( pmu_name[i] ), pmu_type[i],
+			pmu_first[i], pmu_count[i] )
+	print "\t{NULL, -1, 0, 0}"
+	print "};"
+}
+'
@@ -47,6 +47,8 @@
 /* Advanced definitons */
 static int default_debug_handler( int errorCode );
 static long long handle_derived( EventInfo_t * evi, long long *from );
+static void free_native_names( void );
+static int get_postfix_prog( hwi_presets_t *event, hwi_postfix_prog_t **prog );
 
 /* Global definitions used by other files */
 int init_level = PAPI_NOT_INITED;
@@ -69,6 +71,7 @@ struct native_event_info {
   int component_event;
   int ntv_idx;
   char *evt_name;
+  int hash_next;     /* next entry in the same hash bucket, -1 at the end */
 };
 
 
@@ -77,6 +80,50 @@ static struct native_event_info *_papi_native_events=NULL;
 static int num_native_events=0;
 static int num_native_chunks=0;
 
+/* Hash buckets over _papi_native_events, keyed by component, component  */
+/* event and name.  Each bucket holds the index of its first entry + 1   */
+/* (0 is an empty bucket).  Entries are only ever added, under           */
+/* INTERNAL_LOCK, and are complete before they are linked in, so lookups */
+/* do not need the lock.                                                 */
+#define NATIVE_EVENT_HASHSIZE 8192
+static volatile int native_event_hash[NATIVE_EVENT_HASHSIZE];
+
+/* Hashed index of event names to event codes, used by               */
+/* _papi_hwi_native_name_to_code().  It holds two kinds of entries:   */
+/*  - names that were resolved before, exactly as they were passed    */
+/*    in, mapped to their papi event code;                            */
+/*  - for components without ntv_name_to_code, every event name the   */
+/*    component enumerates, mapped to the component event code.  These */
+/*    are added the first time a name is looked up in the component.  */
+/* Like native_event_hash, entries are only added under INTERNAL_LOCK */
+/* and are read without it.  They are freed at shutdown.              */
+#define NATIVE_NAME_HASHSIZE 4096
+
+struct native_name_info {
+  struct native_name_info *next;
+  int cidx;          /* -1 for resolved names */
+  int code;
+  char name[1];
+};
+
+static struct native_name_info *volatile native_name_hash[NATIVE_NAME_HASHSIZE];
+static char *native_name_indexed=NULL;  /* per component, enumerated yet? */
+static int native_name_indexed_size=0;
+
+/* FNV-1a, optionally ignoring case */
+static unsigned int
+native_name_hash_value( const char *name, int nocase )
+{
+  unsigned int hash = 2166136261U;
+
+  while ( *name ) {
+     hash ^= (unsigned char)( nocase ? tolower( (unsigned char)*name ) : *name );
+     hash *= 16777619U;
+     name++;
+  }
+  return hash;
+}
+
 char **_papi_errlist= NULL;
 static int num_error_chunks = 0;
 
@@ -314,6 +361,7 @@ _papi_hwi_find_native_event(int cidx, int event, const char *event_name) {
   INTDBG("ENTER: cidx: %x, event: %#x, event_name: %s\n", cidx, event, event_name);
 
   int i;
+  unsigned int bucket;
 
   // if no event name passed in, it can not be found
   if (event_name == NULL) {
@@ -321,12 +369,9 @@ _papi_hwi_find_native_event(int cidx, int event, const char *event_name) {
 		return PAPI_ENOEVNT;
   }
 
-  for(i=0;i<num_native_events;i++) {
-  	// if we have have not set up this event name yet, look at next
-  	if (_papi_native_events[i].evt_name == NULL) {
-  		continue;
-  	}
+  bucket = ( native_name_hash_value(event_name, 0) ^ (unsigned int)event ^ (unsigned int)cidx ) % NATIVE_EVENT_HASHSIZE;
 
+  for(i=native_event_hash[bucket]-1; i>=0; i=_papi_native_events[i].hash_next) {
   	// is this entry for the correct component and event code
   	if ((_papi_native_events[i].cidx==cidx) &&
 	(_papi_native_events[i].component_event==event)) {
@@ -365,6 +410,7 @@ _papi_hwi_add_native_event(int cidx, int ntv_event, int ntv_idx, const char *eve
   _papi_native_events[num_native_events].cidx=cidx;
   _papi_native_events[num_native_events].component_event=ntv_event;
   _papi_native_events[num_native_events].ntv_idx=ntv_idx;
+  _papi_native_events[num_native_events].hash_next=-1;
   if (event_name != NULL) {
 	  _papi_native_events[num_native_events].evt_name=strdup(event_name);
   } else {
@@ -372,6 +418,15 @@ _papi_hwi_add_native_event(int cidx, int ntv_event, int ntv_idx, const char *eve
   }
   new_native_event=num_native_events|PAPI_NATIVE_MASK;
 
+  // events without a name can not be looked up, leave them out of the hash
+  if (_papi_native_events[num_native_events].evt_name != NULL) {
+	  unsigned int bucket = ( native_name_hash_value(event_name, 0) ^ (unsigned int)ntv_event ^ (unsigned int)cidx ) % NATIVE_EVENT_HASHSIZE;
+	  _papi_native_events[num_native_events].hash_next=native_event_hash[bucket]-1;
+	  // make sure the entry is complete before lookups can see it
+	  __sync_synchronize();
+	  native_event_hash[bucket]=num_native_events+1;
+  }
+
   num_native_events++;
 
 native_alloc_early_out:
@@ -501,6 +556,7 @@ _papi_hwi_init_errors(void) {
     _papi_hwi_add_error("Invalid or missing event attributes");
     _papi_hwi_add_error("Too many events or attributes");
     _papi_hwi_add_error("Bad combination of features");
+    _papi_hwi_add_error("Component not initialized until first used");
 }
 
 int
@@ -782,7 +838,7 @@ _papi_hwi_assign_eventset( EventSetInfo_t *ESI, int cidx )
 					   sizeof ( int ) * 3 ) * ( size_t ) max_counters );
 
    ESI->profile.prof = ( PAPI_sprofil_t ** )
-		papi_malloc( ( sizeof ( PAPI_sprofil_t * ) * ( size_t ) max_counters +
+		papi_malloc( ( sizeof ( PAPI_sprofil_t * ) * ( size_t ) max_counters * 2 +
 					   ( size_t ) max_counters * sizeof ( int ) * 4 ) );
 
    /* If any of these allocations failed, free things up and fail */
@@ -821,6 +877,9 @@ _papi_hwi_assign_eventset( EventSetInfo_t *ESI, int cidx )
    /* Carve up the profile block into separate arrays */
    ptr = ( char * ) ESI->profile.prof +
 		( sizeof ( PAPI_sprofil_t * ) * max_counters );
+   ESI->profile.priv = ( PAPI_sprofil_t ** ) ptr;
+   memset( ptr, 0, sizeof ( PAPI_sprofil_t * ) * max_counters );
+   ptr += sizeof ( PAPI_sprofil_t * ) * max_counters;
    ESI->profile.count = ( int * ) ptr;
    ptr += sizeof ( int ) * max_counters;
    ESI->profile.threshold = ( int * ) ptr;
@@ -834,6 +893,7 @@ _papi_hwi_assign_eventset( EventSetInfo_t *ESI, int cidx )
    for ( i = 0; i < max_counters; i++ ) {
        ESI->EventInfoArray[i].event_code=( unsigned int ) PAPI_NULL;
        ESI->EventInfoArray[i].ops = NULL;
+       ESI->EventInfoArray[i].prog = NULL;
        ESI->EventInfoArray[i].derived=NOT_DERIVED;
        for ( j = 0; j < PAPI_EVENTS_IN_DERIVED_EVENT; j++ ) {
 	   ESI->EventInfoArray[i].pos[j] = PAPI_NULL;
@@ -1264,6 +1324,13 @@ add_native_events( EventSetInfo_t *ESI, unsigned int *nevt,
 
    INTDBG("added_events: %d\n", added_events);
 
+   /* _papi_hwi_add_events() tells the component about the whole */
+   /* batch at once when it is done.                              */
+   if ( ( added_events ) && ( ESI->update_deferred ) ) {
+      INTDBG( "EXIT: component update deferred\n" );
+      return 1;
+   }
+
    /* if we added events we need to tell the component so it */
    /* can add them too.                                      */
    if ( added_events ) {
@@ -1318,6 +1385,7 @@ _papi_hwi_add_event( EventSetInfo_t * ESI, int EventCode )
 
     int i, j, thisindex, remap, retval = PAPI_OK;
     int cidx;
+    hwi_postfix_prog_t *prog = NULL;
 
     cidx=_papi_hwi_component_index( EventCode );
     if (cidx<0) return PAPI_ENOCMP;
@@ -1361,6 +1429,7 @@ _papi_hwi_add_event( EventSetInfo_t * ESI, int EventCode )
 	  }
 
 	  /* count the number of native events in this preset */
+	  _papi_hwi_resolve_preset( preset_index );
 	  count = ( int ) _papi_hwi_presets[preset_index].count;
 
 	  /* Check if event exists */
@@ -1381,6 +1450,14 @@ _papi_hwi_add_event( EventSetInfo_t * ESI, int EventCode )
 	     }
 	  }
 
+	  /* Compile the formula before touching the EventSet */
+	  if ( _papi_hwi_presets[preset_index].derived_int == DERIVED_POSTFIX ) {
+	     retval = get_postfix_prog( &_papi_hwi_presets[preset_index], &prog );
+	     if ( retval != PAPI_OK ) {
+		return retval;
+	     }
+	  }
+
 	  /* Try to add the preset. */
 
 	  remap = add_native_events( ESI,
@@ -1397,6 +1474,7 @@ _papi_hwi_add_event( EventSetInfo_t * ESI, int EventCode )
 				  _papi_hwi_presets[preset_index].derived_int;
 	     ESI->EventInfoArray[thisindex].ops =
 				  _papi_hwi_presets[preset_index].postfix;
+	     ESI->EventInfoArray[thisindex].prog = prog;
              ESI->NumberOfEvents++;
 	     _papi_hwi_map_events_to_native( ESI );
 	     
@@ -1454,6 +1532,12 @@ _papi_hwi_add_event( EventSetInfo_t * ESI, int EventCode )
 		   }
 		 }
 
+		 if ( user_defined_events[index].derived_int == DERIVED_POSTFIX ) {
+		   retval = get_postfix_prog( &user_defined_events[index], &prog );
+		   if ( retval != PAPI_OK )
+			 return retval;
+		 }
+
 		 remap = add_native_events( ESI,
 			 user_defined_events[index].code,
 			 count, &ESI->EventInfoArray[thisindex] );
@@ -1464,6 +1548,7 @@ _papi_hwi_add_event( EventSetInfo_t * ESI, int EventCode )
 		   ESI->EventInfoArray[thisindex].event_code = (unsigned int) EventCode;
 		   ESI->EventInfoArray[thisindex].derived = user_defined_events[index].derived_int;
 		   ESI->EventInfoArray[thisindex].ops = user_defined_events[index].postfix;
+		   ESI->EventInfoArray[thisindex].prog = prog;
            ESI->NumberOfEvents++;
 		   _papi_hwi_map_events_to_native( ESI );
 		 }
@@ -1504,6 +1589,95 @@ _papi_hwi_add_event( EventSetInfo_t * ESI, int EventCode )
     return retval;
 }
 
+/* Add a list of events, telling the component about all of them with a */
+/* single update_control_state() call instead of one per event.         */
+/*                                                                      */
+/* Either all events are added, or none are and the EventSet is left    */
+/* as it was.  The caller is expected to fall back to adding the events */
+/* one at a time if it needs to know which event could not be added.    */
+int
+_papi_hwi_add_events( EventSetInfo_t * ESI, int *EventCodes, int number )
+{
+   INTDBG("ENTER: ESI: %p (%d), EventCodes: %p, number: %d\n", ESI, ESI->EventSetIndex, EventCodes, number);
+
+   int i, retval = PAPI_OK, retval2, native_count;
+   hwd_context_t *context = NULL;
+
+   /* Overflow has to be re-established after every change and software */
+   /* multiplexing keeps its own lists, nothing to batch there.          */
+   if ( ( _papi_hwi_is_sw_multiplex( ESI ) ) ||
+	( ESI->state & PAPI_OVERFLOWING ) ) {
+      for( i = 0; i < number; i++ ) {
+	 retval = _papi_hwi_add_event( ESI, EventCodes[i] );
+	 if ( retval != PAPI_OK ) break;
+      }
+      if ( i == number ) return PAPI_OK;
+
+      while ( i > 0 ) {
+	 i--;
+	 _papi_hwi_remove_event( ESI, EventCodes[i] );
+      }
+      return retval;
+   }
+
+   native_count = ESI->NativeCount;
+
+   ESI->update_deferred = 1;
+   for( i = 0; i < number; i++ ) {
+      retval = _papi_hwi_add_event( ESI, EventCodes[i] );
+      if ( retval != PAPI_OK ) {
+	 INTDBG( "adding EventCodes[%d]: %#x failed: %d\n", i, EventCodes[i], retval );
+	 break;
+      }
+   }
+
+   /* Commit the new native events to the component */
+   if ( ( i == number ) && ( ESI->NativeCount != native_count ) ) {
+      context = _papi_hwi_get_context( ESI, NULL );
+
+      if ( _papi_hwd[ESI->CmpIdx]->allocate_registers( ESI ) == PAPI_OK ) {
+	 retval = _papi_hwd[ESI->CmpIdx]->update_control_state( ESI->ctl_state,
+		  ESI->NativeInfoArray,
+		  ESI->NativeCount,
+		  context);
+      } else {
+	 retval = PAPI_EMISC;
+      }
+   }
+
+   if ( retval == PAPI_OK ) {
+      ESI->update_deferred = 0;
+      _papi_hwi_map_events_to_native( ESI );
+      INTDBG( "EXIT: PAPI_OK\n" );
+      return PAPI_OK;
+   }
+
+   /* Take the batch back out; the native events that were there */
+   /* before keep their slots, so only the component needs redoing */
+   /* if it already saw the new ones.                              */
+   while ( i > 0 ) {
+      i--;
+      _papi_hwi_remove_event( ESI, EventCodes[i] );
+   }
+   ESI->update_deferred = 0;
+
+   if ( context ) {
+      retval2 = _papi_hwd[ESI->CmpIdx]->update_control_state( ESI->ctl_state,
+		ESI->NativeInfoArray,
+		ESI->NativeCount,
+		context);
+      if ( retval2 != PAPI_OK ) {
+	 PAPIERROR("update_control_state failed to re-establish working events!" );
+	 INTDBG( "EXIT: update_control_state returned: %d\n", retval2);
+	 return retval2;
+      }
+      _papi_hwi_map_events_to_native( ESI );
+   }
+
+   INTDBG( "EXIT: %d\n", retval );
+   return retval;
+}
+
 static int
 remove_native_events( EventSetInfo_t *ESI, int *nevt, int size )
 {
@@ -1578,7 +1752,7 @@ remove_native_events( EventSetInfo_t *ESI, int *nevt, int size )
       clear the now empty slots, reinitialize the index, and update the count.
       Then send the info down to the component to update the hwd control structure. */
 	retval = PAPI_OK;
-	if ( zero ) {
+	if ( ( zero ) && ( !ESI->update_deferred ) ) {
       /* get the context we should use for this event set */
       context = _papi_hwi_get_context( ESI, NULL );
 		retval = _papi_hwd[ESI->CmpIdx]->update_control_state( ESI->ctl_state,
@@ -1666,6 +1840,7 @@ _papi_hwi_remove_event( EventSetInfo_t * ESI, int EventCode )
 	for ( j = 0; j < PAPI_EVENTS_IN_DERIVED_EVENT; j++ )
 		array[thisindex].pos[j] = PAPI_NULL;
 	array[thisindex].ops = NULL;
+	array[thisindex].prog = NULL;
 	array[thisindex].derived = NOT_DERIVED;
 	ESI->NumberOfEvents--;
 
@@ -1725,6 +1900,40 @@ _papi_hwi_read( hwd_context_t * context, EventSetInfo_t * ESI,
 	return PAPI_OK;
 }
 
+/* Estimated standard error of a multiplexed count.  n and m2 describe
+ * the spread of the event's rate over the slices it was measured in
+ * (Welford's running sums); the count is off by the time it was not
+ * running times the error of the mean rate.  Returns -1.0 until two
+ * slices have been seen.  libpapi does not link libm, so the square
+ * root is a few rounds of Newton's method from above. */
+double
+_papi_hwi_mpx_std_error( long long n, double m2, long long enabled,
+						 long long running )
+{
+	double var, x, next;
+	int i;
+
+	if ( running >= enabled )
+		return 0.0;
+	if ( n < 2 )
+		return -1.0;
+
+	/* variance of the mean rate */
+	var = m2 / ( double ) ( n - 1 ) / ( double ) n;
+	if ( var <= 0.0 )
+		return 0.0;
+
+	x = ( var > 1.0 ) ? var : 1.0;
+	for ( i = 0; i < 100; i++ ) {
+		next = 0.5 * ( x + var / x );
+		if ( next >= x )
+			break;
+		x = next;
+	}
+
+	return x * ( double ) ( enabled - running );
+}
+
 int
 _papi_hwi_cleanup_eventset( EventSetInfo_t * ESI )
 {
@@ -1770,6 +1979,7 @@ _papi_hwi_cleanup_eventset( EventSetInfo_t * ESI )
 	  ESI->EventInfoArray[i].pos[j] = PAPI_NULL;
       }
       ESI->EventInfoArray[i].ops = NULL;
+      ESI->EventInfoArray[i].prog = NULL;
       ESI->EventInfoArray[i].derived = NOT_DERIVED;
    }
 
@@ -1812,9 +2022,14 @@ _papi_hwi_cleanup_eventset( EventSetInfo_t * ESI )
 	
    if ( ESI->overflow.deadline )
       papi_free( ESI->overflow.deadline );
+
+   _papi_hwi_free_overflow_queue( ESI );
 	
-   if ( ESI->profile.prof )
+   if ( ESI->profile.prof ) {
+      for ( i = 0; i < ESI->profile.event_counter; i++ )
+	 _papi_hwi_free_private_profile( ESI, i );
       papi_free( ESI->profile.prof );
+   }
 
    ESI->ctl_state = NULL;
    ESI->sw_stop = NULL;
@@ -1844,6 +2059,10 @@ _papi_hwi_convert_eventset_to_multiplex( _papi_int_multiplex_t * mpx )
 	EventSetInfo_t *ESI = mpx->ESI;
 	int flags = mpx->flags;
 
+	/* Only PAPI's own multiplexing can schedule adaptively */
+	if ( flags & PAPI_MULTIPLEX_ADAPTIVE )
+		flags |= PAPI_MULTIPLEX_FORCE_SW;
+
 	/* If there are any events in the EventSet, 
 	   convert them to multiplex events */
 
@@ -1889,6 +2108,8 @@ _papi_hwi_convert_eventset_to_multiplex( _papi_int_multiplex_t * mpx )
 	if ( _papi_hwd[ESI->CmpIdx]->cmp_info.kernel_multiplex &&
 		 ( flags & PAPI_MULTIPLEX_FORCE_SW ) )
 		ESI->multiplex.flags = PAPI_MULTIPLEX_FORCE_SW;
+	ESI->multiplex.flags |= flags & PAPI_MULTIPLEX_ADAPTIVE;
+	ESI->multiplex.min_share = mpx->min_share;
 	ESI->multiplex.ns = ( int ) mpx->ns;
 
 	return ( PAPI_OK );
@@ -1898,16 +2119,47 @@ _papi_hwi_convert_eventset_to_multiplex( _papi_int_multiplex_t * mpx )
 
 int papi_num_components = ( sizeof ( _papi_hwd ) / sizeof ( *_papi_hwd ) ) - 1;
 
+/* Set once _papi_hwi_init_global() is done; until then lookups only see */
+/* the components initialized so far and never wake up the others.      */
+static volatile int delay_init_ready = 0;
+
+static int
+init_component( int cidx )
+{
+	int retval;
+
+	retval = _papi_hwd[cidx]->init_component( cidx );
+
+	/* Do some sanity checking */
+	if (retval==PAPI_OK) {
+	   if (_papi_hwd[cidx]->cmp_info.num_cntrs >
+	       _papi_hwd[cidx]->cmp_info.num_mpx_cntrs) {
+	      fprintf(stderr,"Warning!  num_cntrs %d is more than num_mpx_cntrs %d for component %s\n",
+		      _papi_hwd[cidx]->cmp_info.num_cntrs,
+		      _papi_hwd[cidx]->cmp_info.num_mpx_cntrs,
+		      _papi_hwd[cidx]->cmp_info.name);
+	   }
+	}
+	return retval;
+}
+
 /*
- * Routine that initializes all available components.
+ * Routine that registers all available components.
  * A component is available if a pointer to its info vector
  * appears in the NULL terminated_papi_hwd table.
+ *
+ * Only the first component, which presets and eventsets default to,
+ * is initialized here.  The rest are marked PAPI_EDELAY_INIT, which
+ * every caller already skips as disabled, and are initialized by
+ * _papi_hwi_init_component() the first time they are asked for.
  */
 int
 _papi_hwi_init_global( void )
 {
         int retval, i = 0;
 
+	delay_init_ready = 0;
+
 	retval = _papi_hwi_innoculate_os_vector( &_papi_os_vector );
 	if ( retval != PAPI_OK ) {
 	   return retval;
@@ -1922,27 +2174,72 @@ _papi_hwi_init_global( void )
 
 	   /* We can be disabled by user before init */
 	   if (!_papi_hwd[i]->cmp_info.disabled) {
-	      retval = _papi_hwd[i]->init_component( i );
-	      _papi_hwd[i]->cmp_info.disabled=retval;
-
-	      /* Do some sanity checking */
-	      if (retval==PAPI_OK) {
-		if (_papi_hwd[i]->cmp_info.num_cntrs >
-		    _papi_hwd[i]->cmp_info.num_mpx_cntrs) {
-		  fprintf(stderr,"Warning!  num_cntrs %d is more than num_mpx_cntrs %d for component %s\n",
-                        _papi_hwd[i]->cmp_info.num_cntrs,
-                        _papi_hwd[i]->cmp_info.num_mpx_cntrs,
-                        _papi_hwd[i]->cmp_info.name);
-		}
-
+	      if ( i == 0 ) {
+		 _papi_hwd[i]->cmp_info.disabled = init_component( i );
+	      } else {
+		 _papi_hwd[i]->cmp_info.disabled = PAPI_EDELAY_INIT;
+		 strcpy( _papi_hwd[i]->cmp_info.disabled_reason,
+			 "Initialized on first use" );
 	      }
 	   }
 
 	   i++;
 	}
+
+	delay_init_ready = 1;
 	return PAPI_OK;
 }
 
+/*
+ * Initialize a component _papi_hwi_init_global() only registered.
+ * The threads and cpus already known to PAPI get their context for it
+ * set up before the component is published as enabled, so code that
+ * sees it enabled never finds a context that was not initialized.
+ *
+ * Components must not look up events of other components from their
+ * init_component, that would take GLOBAL_LOCK a second time.
+ */
+int
+_papi_hwi_init_component( int cidx )
+{
+	int retval;
+
+	if ( _papi_hwi_invalid_cmp( cidx ) )
+	   return PAPI_ENOCMP;
+
+	if ( _papi_hwd[cidx]->cmp_info.disabled != PAPI_EDELAY_INIT ||
+	     !delay_init_ready )
+	   return PAPI_OK;
+
+	_papi_hwi_lock( GLOBAL_LOCK );
+
+	/* someone else got here first */
+	if ( _papi_hwd[cidx]->cmp_info.disabled != PAPI_EDELAY_INIT ) {
+	   _papi_hwi_unlock( GLOBAL_LOCK );
+	   return PAPI_OK;
+	}
+
+	INTDBG( "Initializing component %d (%s) on first use\n", cidx,
+		_papi_hwd[cidx]->cmp_info.name );
+
+	_papi_hwd[cidx]->cmp_info.disabled_reason[0] = '\0';
+	retval = init_component( cidx );
+	if ( retval == PAPI_OK ) {
+	   retval = _papi_hwi_init_thread_component( cidx );
+	   if ( retval == PAPI_OK )
+	      retval = _papi_hwi_init_cpu_component( cidx );
+	   if ( retval != PAPI_OK )
+	      _papi_hwd[cidx]->shutdown_component(  );
+	}
+
+	__sync_synchronize(  );
+	_papi_hwd[cidx]->cmp_info.disabled = retval;
+
+	_papi_hwi_unlock( GLOBAL_LOCK );
+
+	return retval;
+}
+
 /* Machine info struct initialization using defaults */
 /* See _papi_mdi definition in papi_internal.h       */
 
@@ -1973,10 +2270,14 @@ _papi_hwi_init_global_internal( void )
 void
 _papi_hwi_shutdown_global_internal( void )
 {
+	delay_init_ready = 0;
+
 	_papi_hwi_cleanup_all_presets(  );
 
 	_papi_hwi_cleanup_errors( );
 
+	free_native_names( );
+
 	_papi_hwi_lock( INTERNAL_LOCK );
 
 	papi_free(  _papi_hwi_system_info.global_eventset_map.dataSlotArray );
@@ -2060,91 +2361,158 @@ handle_derived_add_ps( int *position, long long *from )
 	return ( units_per_second( tmp, from[position[0]] ) );
 }
 
-/* this function implement postfix calculation, it reads in a string where I use:
+/* this function compiles a postfix formula, it reads in a string where I use:
       |      as delimiter
       N2     indicate No. 2 native event in the derived preset
-      +, -, *, /, %  as operator
+      +, -, *, /  as operator
       #      as MHZ(million hz) got from  _papi_hwi_system_info.hw_info.cpu_max_mhz*1000000.0
+      any other token is ignored
+
+  The formula is compiled once, the first time the event is added to an
+  EventSet, so reads do not have to parse it.
 
   Haihang (you@cs.utk.edu)
-*/ 
-static long long
-_papi_hwi_postfix_calc( EventInfo_t * evi, long long *hw_counter )
+*/
+static int
+_papi_hwi_postfix_compile( hwi_presets_t *event )
 {
-	INTDBG("ENTER: evi: %p, evi->ops: %p (%s), evi->pos[0]: %d, evi->pos[1]: %d, hw_counter: %p (%lld %lld)\n", evi, evi->ops, evi->ops, evi->pos[0], evi->pos[1], hw_counter, hw_counter[0], hw_counter[1]);
-	char *point = evi->ops, operand[16];
-	double stack[PAPI_EVENTS_IN_DERIVED_EVENT];
-	int i, top = 0;
+	INTDBG("ENTER: event: %s, postfix: %s\n", event->symbol, event->postfix);
+	char *point = event->postfix;
+	hwi_postfix_prog_t *prog;
+	hwi_postfix_op_t *op;
+	int len = 0, top = 0;
+
+	if ( point == NULL ) {
+		INTDBG("EXIT: no formula\n");
+		return PAPI_EINVAL;
+	}
 
-	memset(&stack,0,PAPI_EVENTS_IN_DERIVED_EVENT*sizeof(double));
+	/* there can't be more operations than delimited tokens */
+	prog = papi_malloc( sizeof ( hwi_postfix_prog_t ) +
+			    ( strlen( point ) / 2 + 1 ) * sizeof ( hwi_postfix_op_t ) );
+	if ( prog == NULL ) {
+		return PAPI_ENOMEM;
+	}
 
 	while ( *point != '\0' ) {
 		if ( *point == '|' ) {	/* ignore leading and consecutive '|' characters */
 			point++;
-		} else if ( *point == 'N' ) {	/* to get count for each native event */
-			i = 0;
-			point++;
-			do {
-				operand[i] = *point;
-				point++;
-				i++;
-			} while ( *point != '|' );
-			operand[i] = '\0';
-			stack[top] = ( double ) hw_counter[evi->pos[atoi( operand )]];
+			continue;
+		}
+
+		op = &prog->op[len];
+		if ( *point == 'N' ) {	/* count of a native event */
+			op->op = POSTFIX_COUNTER;
+			op->arg = atoi( point + 1 );
+			if ( ( op->arg < 0 ) || ( op->arg >= PAPI_EVENTS_IN_DERIVED_EVENT ) ) {
+				break;
+			}
 			top++;
-			point++;
-		} else if ( *point == '#' ) {	/* to get mhz, ignore the rest char's */
-			stack[top] = _papi_hwi_system_info.hw_info.cpu_max_mhz * 1000000.0;
+		} else if ( *point == '#' ) {	/* mhz */
+			op->op = POSTFIX_CONST;
+			op->value = _papi_hwi_system_info.hw_info.cpu_max_mhz * 1000000.0;
 			top++;
-			do {
-				point++;
-			} while ( *point != '|' );
-			point++;
-		} else if ( isdigit( *point ) ) {	/* to get integer, I suppose only integer will be used, 
-											   no error check here, please only use integer */
-			i = 0;
-			do {
-				operand[i] = *point;
-				point++;
-				i++;
-			} while ( *point != '|' );
-			operand[i] = '\0';
-			stack[top] = atoi( operand );
+		} else if ( isdigit( *point ) ) {	/* only integers are supported */
+			op->op = POSTFIX_CONST;
+			op->value = atoi( point );
 			top++;
-			point++;
-		} else if ( *point == '+' ) {	/* + calculation */
-			stack[top - 2] += stack[top - 1];
+		} else if ( ( *point == '+' ) || ( *point == '-' ) ||
+			    ( *point == '*' ) || ( *point == '/' ) ) {
+			op->op = ( *point == '+' ) ? POSTFIX_ADD :
+				 ( *point == '-' ) ? POSTFIX_SUB :
+				 ( *point == '*' ) ? POSTFIX_MUL : POSTFIX_DIV;
+			if ( top < 2 ) {
+				break;
+			}
 			top--;
-			do {
-				point++;
-			} while ( *point != '|' );
+		} else {
+			op = NULL;		/* do nothing */
+		}
+
+		if ( top > PAPI_EVENTS_IN_DERIVED_EVENT ) {
+			break;
+		}
+		if ( op != NULL ) {
+			len++;
+		}
+
+		/* skip to the next token */
+		while ( ( *point != '|' ) && ( *point != '\0' ) ) {
 			point++;
-		} else if ( *point == '-' ) {	/* - calculation */
-			stack[top - 2] -= stack[top - 1];
+		}
+	}
+
+	if ( *point != '\0' ) {
+		PAPIERROR( "Invalid postfix formula for %s: %s",
+			   event->symbol, event->postfix );
+		papi_free( prog );
+		return PAPI_EINVAL;
+	}
+
+	prog->len = len;
+	/* readers check postfix_prog without the lock */
+	__sync_synchronize();
+	event->postfix_prog = prog;
+
+	INTDBG("EXIT: %d operations\n", len);
+	return PAPI_OK;
+}
+
+/* Get the compiled postfix formula of a preset or user defined event, */
+/* compiling it if this is the first time the event is added.          */
+static int
+get_postfix_prog( hwi_presets_t *event, hwi_postfix_prog_t **prog )
+{
+	int retval = PAPI_OK;
+
+	if ( event->postfix_prog == NULL ) {
+		_papi_hwi_lock( INTERNAL_LOCK );
+		if ( event->postfix_prog == NULL ) {
+			retval = _papi_hwi_postfix_compile( event );
+		}
+		_papi_hwi_unlock( INTERNAL_LOCK );
+	}
+
+	*prog = event->postfix_prog;
+	return retval;
+}
+
+/* this function evaluates a compiled postfix formula */
+static long long
+_papi_hwi_postfix_calc( EventInfo_t * evi, long long *hw_counter )
+{
+	INTDBG("ENTER: evi: %p, evi->ops: %p (%s), evi->pos[0]: %d, evi->pos[1]: %d, hw_counter: %p (%lld %lld)\n", evi, evi->ops, evi->ops, evi->pos[0], evi->pos[1], hw_counter, hw_counter[0], hw_counter[1]);
+	const hwi_postfix_op_t *op = evi->prog->op;
+	const hwi_postfix_op_t *end = op + evi->prog->len;
+	double stack[PAPI_EVENTS_IN_DERIVED_EVENT];
+	int top = 0;
+
+	stack[0] = 0.0;
+
+	for ( ; op < end; op++ ) {
+		switch ( op->op ) {
+		case POSTFIX_COUNTER:
+			stack[top++] = ( double ) hw_counter[evi->pos[op->arg]];
+			break;
+		case POSTFIX_CONST:
+			stack[top++] = op->value;
+			break;
+		case POSTFIX_ADD:
 			top--;
-			do {
-				point++;
-			} while ( *point != '|' );
-			point++;
-		} else if ( *point == '*' ) {	/* * calculation */
-			stack[top - 2] *= stack[top - 1];
+			stack[top - 1] += stack[top];
+			break;
+		case POSTFIX_SUB:
 			top--;
-			do {
-				point++;
-			} while ( *point != '|' );
-			point++;
-		} else if ( *point == '/' ) {	/* / calculation */
-			stack[top - 2] /= stack[top - 1];
+			stack[top - 1] -= stack[top];
+			break;
+		case POSTFIX_MUL:
 			top--;
-			do {
-				point++;
-			} while ( *point != '|' );
-			point++;
-		} else {			 /* do nothing */
-			do {
-				point++;
-			} while ( *point != '|' );
-			point++;
+			stack[top - 1] *= stack[top];
+			break;
+		case POSTFIX_DIV:
+			top--;
+			stack[top - 1] /= stack[top];
+			break;
 		}
 	}
 	INTDBG("EXIT: stack[0]: %lld\n", (long long)stack[0]);
@@ -2256,6 +2624,8 @@ _papi_hwi_get_preset_event_info( int EventCode, PAPI_event_info_t * info )
 	unsigned int j;
 
 	if ( _papi_hwi_presets[i].symbol ) {	/* if the event is in the preset table */
+	   _papi_hwi_resolve_preset( i );
+
       // since we are setting the whole structure to zero the strncpy calls below will 
       // be leaving NULL terminates strings as long as they copy 1 less byte than the 
       // buffer size of the field.
@@ -2396,6 +2766,147 @@ _papi_hwi_query_native_event( unsigned int EventCode )
    return (ret);
 }
 
+/* Find a name in the name index.  cidx is -1 for names that were */
+/* resolved before, those have to match exactly.                   */
+static struct native_name_info *
+find_native_name( int cidx, const char *name )
+{
+   struct native_name_info *entry;
+   int nocase = ( cidx >= 0 );
+   unsigned int bucket;
+
+   bucket = ( native_name_hash_value( name, nocase ) ^ ( unsigned int ) cidx ) % NATIVE_NAME_HASHSIZE;
+
+   for( entry = native_name_hash[bucket]; entry != NULL; entry = entry->next ) {
+      if ( entry->cidx != cidx ) continue;
+      if ( nocase ? ( strcasecmp( entry->name, name ) == 0 ) :
+		    ( strcmp( entry->name, name ) == 0 ) ) {
+	 return entry;
+      }
+   }
+   return NULL;
+}
+
+/* Add a name to the name index, keeping the first entry for a name. */
+static void
+add_native_name( int cidx, const char *name, int code )
+{
+   struct native_name_info *entry;
+   int nocase = ( cidx >= 0 );
+   unsigned int bucket;
+
+   _papi_hwi_lock( INTERNAL_LOCK );
+
+   if ( find_native_name( cidx, name ) != NULL ) {
+      _papi_hwi_unlock( INTERNAL_LOCK );
+      return;
+   }
+
+   entry = malloc( sizeof ( struct native_name_info ) + strlen( name ) );
+   if ( entry == NULL ) {
+      /* not fatal, the name just has to be looked up the slow way */
+      _papi_hwi_unlock( INTERNAL_LOCK );
+      return;
+   }
+   entry->cidx = cidx;
+   entry->code = code;
+   strcpy( entry->name, name );
+
+   bucket = ( native_name_hash_value( name, nocase ) ^ ( unsigned int ) cidx ) % NATIVE_NAME_HASHSIZE;
+   entry->next = native_name_hash[bucket];
+   /* make sure the entry is complete before lookups can see it */
+   __sync_synchronize();
+   native_name_hash[bucket] = entry;
+
+   _papi_hwi_unlock( INTERNAL_LOCK );
+}
+
+/* Remember a name that resolved to a papi event code, both as it was */
+/* passed in and qualified with the component that knew the event.    */
+static void
+add_resolved_native_name( int cidx, const char *full_name, const char *name, int code )
+{
+   char qualified[PAPI_HUGE_STR_LEN];
+
+   add_native_name( -1, full_name, code );
+
+   if ( snprintf( qualified, sizeof ( qualified ), "%s:::%s",
+		  _papi_hwd[cidx]->cmp_info.short_name, name ) < ( int ) sizeof ( qualified ) ) {
+      add_native_name( -1, qualified, code );
+   }
+}
+
+/* Enumerate the events of a component without ntv_name_to_code into */
+/* the name index, the first time a name is looked up there.         */
+static int
+index_native_names( int cidx )
+{
+   char name[PAPI_HUGE_STR_LEN];
+   unsigned int i = 0;
+   char *indexed;
+   int retval;
+
+   if ( ( cidx < native_name_indexed_size ) && ( native_name_indexed[cidx] ) ) {
+      return PAPI_OK;
+   }
+
+   retval = _papi_hwd[cidx]->ntv_enum_events( &i, PAPI_ENUM_FIRST );
+   if ( retval != PAPI_OK ) {
+      return retval;
+   }
+
+   do {
+      // save event code so components can get it with call to: _papi_hwi_get_papi_event_code()
+      _papi_hwi_set_papi_event_code(i, 0);
+      if ( _papi_hwd[cidx]->ntv_code_to_name( i, name, sizeof ( name ) ) != PAPI_OK ) {
+	 break;
+      }
+      add_native_name( cidx, name, ( int ) i );
+   } while ( _papi_hwd[cidx]->ntv_enum_events( &i, PAPI_ENUM_EVENTS ) == PAPI_OK );
+
+   _papi_hwi_lock( INTERNAL_LOCK );
+   if ( cidx >= native_name_indexed_size ) {
+      indexed = realloc( native_name_indexed, ( size_t ) papi_num_components );
+      if ( indexed != NULL ) {
+	 memset( indexed + native_name_indexed_size, 0,
+		 ( size_t ) ( papi_num_components - native_name_indexed_size ) );
+	 native_name_indexed = indexed;
+	 native_name_indexed_size = papi_num_components;
+      }
+   }
+   if ( cidx < native_name_indexed_size ) {
+      native_name_indexed[cidx] = 1;
+   }
+   _papi_hwi_unlock( INTERNAL_LOCK );
+
+   INTDBG( "indexed event names of component %d\n", cidx );
+   return PAPI_OK;
+}
+
+/* Free the name index, called at shutdown */
+static void
+free_native_names( void )
+{
+   struct native_name_info *entry, *next;
+   int i;
+
+   _papi_hwi_lock( INTERNAL_LOCK );
+
+   for( i = 0; i < NATIVE_NAME_HASHSIZE; i++ ) {
+      for( entry = native_name_hash[i]; entry != NULL; entry = next ) {
+	 next = entry->next;
+	 free( entry );
+      }
+      native_name_hash[i] = NULL;
+   }
+
+   free( native_name_indexed );
+   native_name_indexed = NULL;
+   native_name_indexed_size = 0;
+
+   _papi_hwi_unlock( INTERNAL_LOCK );
+}
+
 /* Converts an ASCII name into a native event code usable by other routines
    Returns code = 0 and PAPI_OK if name not found.
    This allows for sparse native event arrays */
@@ -2405,16 +2916,23 @@ _papi_hwi_native_name_to_code( char *in, int *out )
     INTDBG("ENTER: in: %s, out: %p\n", in, out);
 
     int retval = PAPI_ENOEVNT;
-    char name[PAPI_HUGE_STR_LEN];	   /* make sure it's big enough */
-    unsigned int i;
     int cidx;
     char *full_event_name;
+    struct native_name_info *entry;
 
     if (in == NULL) {
 		INTDBG("EXIT: PAPI_EINVAL\n");
     	return PAPI_EINVAL;
     }
 
+    // names we resolved before do not need to go back to the components
+    entry = find_native_name( -1, in );
+    if (entry != NULL) {
+		*out = entry->code;
+		INTDBG("EXIT: PAPI_OK  event: %s code: %#x (cached)\n", in, *out);
+		return PAPI_OK;
+    }
+
     full_event_name = strdup(in);
 
 	in = _papi_hwi_strip_component_prefix(in);
@@ -2422,6 +2940,13 @@ _papi_hwi_native_name_to_code( char *in, int *out )
 	// look in each component
     for(cidx=0; cidx < papi_num_components; cidx++) {
 
+       // a component prefix names the owner, other components are not woken up for it
+       if (_papi_hwd[cidx]->cmp_info.disabled == PAPI_EDELAY_INIT) {
+          if (strstr(full_event_name, ":::") != NULL &&
+              is_supported_by_component(cidx, full_event_name) == 0) continue;
+          _papi_hwi_init_component(cidx);
+       }
+
        if (_papi_hwd[cidx]->cmp_info.disabled) continue;
 
        // if this component does not support the pmu which defines this event, no need to call it
@@ -2440,6 +2965,7 @@ _papi_hwi_native_name_to_code( char *in, int *out )
 			retval = _papi_hwd[cidx]->ntv_name_to_code( in, ( unsigned * ) out );
 			if (retval==PAPI_OK) {
 				*out = _papi_hwi_native_to_eventcode(cidx, *out, -1, in);
+				add_resolved_native_name(cidx, full_event_name, in, *out);
 				free (full_event_name);
 				INTDBG("EXIT: PAPI_OK  event: %s code: %#x\n", in, *out);
 				return PAPI_OK;
@@ -2449,39 +2975,27 @@ _papi_hwi_native_name_to_code( char *in, int *out )
 			retval = PAPI_ECMP;
 		}
 
-		/* If not implemented, work around */
+		/* If not implemented, work around by looking the name up */
+		/* in the names this component enumerates                  */
 		if ( retval==PAPI_ECMP) {
-			i = 0;
-			retval = _papi_hwd[cidx]->ntv_enum_events( &i, PAPI_ENUM_FIRST );
+			retval = index_native_names( cidx );
 			if (retval != PAPI_OK) {
 				free (full_event_name);
 				INTDBG("EXIT: retval: %d\n", retval);
 				return retval;
 			}
 
-//			_papi_hwi_lock( INTERNAL_LOCK );
-
-			do {
+			entry = find_native_name( cidx, in );
+			if ( entry != NULL ) {
 				// save event code so components can get it with call to: _papi_hwi_get_papi_event_code()
-				_papi_hwi_set_papi_event_code(i, 0);
-				retval = _papi_hwd[cidx]->ntv_code_to_name(i, name, sizeof(name));
-				/* printf("%#x\nname =|%s|\ninput=|%s|\n", i, name, in); */
-				if ( retval == PAPI_OK && in != NULL) {
-					if ( strcasecmp( name, in ) == 0 ) {
-						*out = _papi_hwi_native_to_eventcode(cidx, i, -1, name);
-						free (full_event_name);
-						INTDBG("EXIT: PAPI_OK, event: %s, code: %#x\n", in, *out);
-						return PAPI_OK;
-					}
-					retval = PAPI_ENOEVNT;
-				} else {
-					*out = 0;
-					retval = PAPI_ENOEVNT;
-					break;
-				}
-			} while ( ( _papi_hwd[cidx]->ntv_enum_events( &i, PAPI_ENUM_EVENTS ) == PAPI_OK ) );
-
-//			_papi_hwi_unlock( INTERNAL_LOCK );
+				_papi_hwi_set_papi_event_code(entry->code, 0);
+				*out = _papi_hwi_native_to_eventcode(cidx, entry->code, -1, entry->name);
+				add_resolved_native_name(cidx, full_event_name, in, *out);
+				free (full_event_name);
+				INTDBG("EXIT: PAPI_OK, event: %s, code: %#x\n", in, *out);
+				return PAPI_OK;
+			}
+			retval = PAPI_ENOEVNT;
 		}
     }
 
@@ -2634,7 +3148,7 @@ _papi_hwi_is_sw_multiplex(EventSetInfo_t *ESI)
    /* Does the component support kernel multiplexing */
    if ( _papi_hwd[ESI->CmpIdx]->cmp_info.kernel_multiplex ) {
       /* Have we forced software multiplexing */
-      if ( ESI->multiplex.flags == PAPI_MULTIPLEX_FORCE_SW ) {
+      if ( ESI->multiplex.flags & PAPI_MULTIPLEX_FORCE_SW ) {
 	 return 1;
       }
       /* Nope, using hardware multiplexing */
@@ -92,6 +92,7 @@ extern char **_papi_errlist;
 #define GLOBAL_LOCK          	PAPI_NUM_LOCK+6	/* papi.c for global variable (static and non) initialization/shutdown */
 #define CPUS_LOCK		PAPI_NUM_LOCK+7	/* cpus.c */
 #define NAMELIB_LOCK            PAPI_NUM_LOCK+8 /* papi_pfm4_events.c */
+#define PRESETS_LOCK            PAPI_NUM_LOCK+9 /* papi_preset.c */
 
 /* extras related */
 
@@ -132,10 +133,28 @@ typedef struct _EventSetGranularityInfo {
    int granularity;
 } EventSetGranularityInfo_t;
 
+/** @internal
+ *  Overflows of a PAPI_OVERFLOW_ASYNC EventSet.  The overflow handler of
+ *  the thread running the EventSet is the only producer and the thread
+ *  calling PAPI_overflow_next() the only consumer, so head and tail each
+ *  have a single writer and live on separate cache lines. */
+#define PAPI_OVERFLOW_QUEUE_SIZE 4096	/* entries, a power of 2 */
+
+typedef struct _papi_overflow_queue {
+   volatile unsigned long head;     /**< next entry to fill, producer */
+   char pad1[64 - sizeof ( unsigned long )];
+   volatile unsigned long tail;     /**< next entry to take, consumer */
+   char pad2[64 - sizeof ( unsigned long )];
+   volatile long long lost;         /**< overflows dropped on a full queue */
+   int fd;                          /**< eventfd written on every push, or -1 */
+   PAPI_overflow_event_t events[PAPI_OVERFLOW_QUEUE_SIZE];
+} _papi_overflow_queue_t;
+
 typedef struct _EventSetOverflowInfo {
    int flags;
    int event_counter;
    PAPI_overflow_handler_t handler;
+   _papi_overflow_queue_t *queue;   /**< with PAPI_OVERFLOW_ASYNC */
    long long *deadline;
    int *threshold;
    int *EventIndex;
@@ -158,6 +177,8 @@ typedef struct _EventSetInheritInfo
 /** @internal */
 typedef struct _EventSetProfileInfo {
    PAPI_sprofil_t **prof;
+   PAPI_sprofil_t **priv;  /**< Private copies of prof with PAPI_PROFIL_PRIVATE,
+                                otherwise NULL */
    int *count;     /**< Number of buffers */
    int *threshold;
    int *EventIndex;
@@ -178,6 +199,7 @@ typedef struct _EventInfo {
    unsigned int event_code;     /**< Preset or native code for this event as passed to PAPI_add_event() */
    int pos[PAPI_EVENTS_IN_DERIVED_EVENT];   /**< position in the counter array for this events components */
    char *ops;                   /**< operation string of preset (points into preset event struct) */
+   hwi_postfix_prog_t *prog;    /**< ops compiled for DERIVED_POSTFIX (points into preset event struct) */
    int derived;                 /**< Counter derivation command used for derived events */
 } EventInfo_t;
 
@@ -225,6 +247,15 @@ typedef struct _masterevent {
    long long prev_total_c;
    long long count_estimate;
    double rate_estimate;
+   /** Per-slice rate statistics for the adaptive schedule */
+   long long slices;
+   double rate_mean;
+   double rate_m2;
+   /** Slices given to this event, and slices decided, while active */
+   long long runs;
+   long long ticks;
+   /** Least percentage of slices this event must get */
+   int min_share;
    struct _threadlist *mythr;
    struct _masterevent *next;
 } MasterEvent;
@@ -242,6 +273,11 @@ typedef struct _threadlist {
    MasterEvent *cur_event;
    /** List of multiplexing events for this thread */
    MasterEvent *head;
+   /** Number of running EventSets that asked for adaptive slices */
+   int adaptive;
+   /** Set once timer is this thread's own multiplex timer */
+   int has_timer;
+   timer_t timer;
    /** Pointer to next thread */
    struct _threadlist *next;
 } Threadlist;
@@ -292,6 +328,10 @@ typedef struct _EventSetInfo {
   
   int NativeCount;             /**< Number of native events in 
                                     NativeInfoArray */
+
+  int update_deferred;         /**< Set while a batch of events is added;
+                                    the component control state is only
+                                    updated once, at the end */
   
   NativeInfo_t *NativeInfoArray;  /**< Info about each native event in 
                                        the set */
@@ -331,6 +371,7 @@ typedef struct _papi_int_cpu {
 
 typedef struct _papi_int_multiplex {
    int flags;
+   int min_share;
    unsigned long ns;
    EventSetInfo_t *ESI;
 } _papi_int_multiplex_t;
@@ -459,12 +500,16 @@ int _papi_hwi_lookup_EventCodeIndex( const EventSetInfo_t * ESI,
 int _papi_hwi_remove_EventSet( EventSetInfo_t * ESI );
 void _papi_hwi_map_events_to_native( EventSetInfo_t *ESI);
 int _papi_hwi_add_event( EventSetInfo_t * ESI, int EventCode );
+int _papi_hwi_add_events( EventSetInfo_t * ESI, int *EventCodes, int number );
 int _papi_hwi_remove_event( EventSetInfo_t * ESI, int EventCode );
 int _papi_hwi_read( hwd_context_t * context, EventSetInfo_t * ESI,
 		    long long *values );
+double _papi_hwi_mpx_std_error( long long n, double m2, long long enabled,
+				long long running );
 int _papi_hwi_cleanup_eventset( EventSetInfo_t * ESI );
 int _papi_hwi_convert_eventset_to_multiplex( _papi_int_multiplex_t * mpx );
 int _papi_hwi_init_global( void );
+int _papi_hwi_init_component( int cidx );
 int _papi_hwi_init_global_internal( void );
 int _papi_hwi_init_os(void);
 void _papi_hwi_init_errors(void);
@@ -0,0 +1,615 @@
+/*
+* File:    papi_libpfm4_cache.c
+*
+* On-disk catalog of the native events the libpfm4 components have
+* resolved, so later processes on the same machine can skip libpfm4.
+*
+* The cache is off unless PAPI_EVENT_CACHE names a directory.  Each
+* component keeps one file there per key; the key covers everything
+* that can change what an event name resolves to: the PAPI and libpfm4
+* builds, the CPU, the kernel, the PMUs libpfm4 detected and the PMUs
+* in sysfs.  The file is laid out to be used straight from a read-only
+* mapping: a header, the key, a hash of the event names and the events
+* themselves, with their strings in one table at the end.  A file whose
+* key or layout does not check out is ignored and rewritten.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+
+#include "papi.h"
+#include "papi_internal.h"
+#include "papi_vector.h"
+
+#include "papi_libpfm4_events.h"
+
+#include "perfmon/pfmlib.h"
+#include "perfmon/pfmlib_perf_event.h"
+
+#define CACHE_MAGIC   "PAPIEVC"
+#define CACHE_FORMAT  1
+#define CACHE_NONE    0xffffffffU	/* string offset of a missing string */
+#define CACHE_ALIGN(x) ( ( (x) + 7 ) & ~( (uint64_t) 7 ) )
+
+#define SYSFS_PMUS    "/sys/bus/event_source/devices"
+
+struct cache_header {
+   char magic[8];
+   uint32_t format;
+   uint32_t key_len;		/* including the terminating nul */
+   uint64_t file_len;
+   uint32_t num_events;
+   uint32_t num_buckets;
+   uint64_t key_off;
+   uint64_t bucket_off;
+   uint64_t event_off;
+   uint64_t string_off;
+   uint64_t string_len;
+};
+
+struct cache_event {
+   uint32_t name;		/* offsets into the string table */
+   uint32_t pmu;
+   uint32_t base_name;
+   uint32_t mask_string;
+   uint32_t event_description;
+   uint32_t mask_description;
+   uint32_t pmu_plus_name;
+   int32_t libpfm4_idx;
+   int32_t cpu;
+   int32_t next;		/* next event in the same bucket */
+   perf_event_attr_t attr;
+};
+
+/* a string that grows as it is appended to */
+struct cache_buf {
+   char *s;
+   size_t len;
+   size_t size;
+};
+
+static int
+buf_add( struct cache_buf *buf, const char *data, size_t len )
+{
+   char *s;
+   size_t size;
+
+   if ( buf->len + len + 1 > buf->size ) {
+      size = buf->size ? buf->size : 4096;
+      while ( buf->len + len + 1 > size ) size *= 2;
+      s = realloc( buf->s, size );
+      if ( s == NULL ) return PAPI_ENOMEM;
+      buf->s = s;
+      buf->size = size;
+   }
+   memcpy( buf->s + buf->len, data, len );
+   buf->len += len;
+   buf->s[buf->len] = '\0';
+   return PAPI_OK;
+}
+
+static int
+buf_printf( struct cache_buf *buf, const char *fmt, ... )
+{
+   char line[PAPI_HUGE_STR_LEN];
+   va_list ap;
+   int len;
+
+   va_start( ap, fmt );
+   len = vsnprintf( line, sizeof ( line ), fmt, ap );
+   va_end( ap );
+   if ( len < 0 ) return PAPI_EINVAL;
+   if ( len >= ( int ) sizeof ( line ) ) len = sizeof ( line ) - 1;
+   return buf_add( buf, line, ( size_t ) len );
+}
+
+static uint64_t
+hash64( const char *s, size_t len )
+{
+   uint64_t hash = 14695981039346656037ULL;
+
+   while ( len-- ) {
+      hash ^= ( unsigned char ) *s++;
+      hash *= 1099511628211ULL;
+   }
+   return hash;
+}
+
+static unsigned int
+hash_name( const char *name )
+{
+   unsigned int hash = 2166136261U;
+
+   while ( *name ) {
+      hash ^= ( unsigned char ) *name++;
+      hash *= 16777619U;
+   }
+   return hash;
+}
+
+/** @class  build_key
+ *  @brief  describe everything an event's resolution depends on
+ *
+ *  The PMUs in sysfs are listed by name and perf_event type number,
+ *  sorted so the key does not depend on directory order.
+ */
+
+static int
+build_key( papi_vector_t *my_vector, struct native_event_table_t *event_table,
+	   struct cache_buf *key )
+{
+   PAPI_hw_info_t *hw = &_papi_hwi_system_info.hw_info;
+   struct dirent **pmus;
+   struct utsname uts;
+   pfm_pmu_info_t pinfo;
+   char path[PATH_MAX], type[64];
+   const char *force;
+   int i, n, fd;
+   ssize_t len;
+
+   buf_printf( key, "papi %#x libpfm4 %#x/%#x build %s %s\n",
+	       PAPI_VERSION, LIBPFM_VERSION, pfm_get_version(  ),
+	       __DATE__, __TIME__ );
+   buf_printf( key, "event %d attr %d\n", ( int ) sizeof ( struct cache_event ),
+	       ( int ) sizeof ( perf_event_attr_t ) );
+   buf_printf( key, "component %s type %d\n", my_vector->cmp_info.name,
+	       event_table->pmu_type );
+   buf_printf( key, "cpu %s|%s|%d/%d/%d\n", hw->vendor_string,
+	       hw->model_string, hw->cpuid_family, hw->cpuid_model,
+	       hw->cpuid_stepping );
+
+   if ( uname( &uts ) == 0 )
+      buf_printf( key, "kernel %s %s\n", uts.release, uts.version );
+
+   force = getenv( "LIBPFM_FORCE_PMU" );
+   if ( force != NULL )
+      buf_printf( key, "force %s\n", force );
+
+   for ( i = 0; i < PFM_PMU_MAX; i++ ) {
+      memset( &pinfo, 0, sizeof ( pfm_pmu_info_t ) );
+      pinfo.size = sizeof ( pfm_pmu_info_t );
+      if ( pfm_get_pmu_info( i, &pinfo ) != PFM_SUCCESS ) continue;
+      if ( !pinfo.is_present || pinfo.name == NULL ) continue;
+      buf_printf( key, "pfm %d %s %d %d\n", i, pinfo.name, pinfo.type,
+		  pinfo.nevents );
+   }
+
+   n = scandir( SYSFS_PMUS, &pmus, NULL, alphasort );
+   for ( i = 0; i < n; i++ ) {
+      if ( pmus[i]->d_name[0] != '.' ) {
+	 snprintf( path, sizeof ( path ), "%s/%s/type", SYSFS_PMUS,
+		   pmus[i]->d_name );
+	 len = 0;
+	 fd = open( path, O_RDONLY );
+	 if ( fd >= 0 ) {
+	    len = read( fd, type, sizeof ( type ) - 1 );
+	    close( fd );
+	 }
+	 type[len > 0 ? len : 0] = '\0';
+	 type[strcspn( type, "\n" )] = '\0';
+	 buf_printf( key, "sysfs %s %s\n", pmus[i]->d_name, type );
+      }
+      free( pmus[i] );
+   }
+   if ( n >= 0 ) free( pmus );
+
+   return key->s == NULL ? PAPI_ENOMEM : PAPI_OK;
+}
+
+/* whether len bytes at off are inside the file, without overflowing */
+static int
+in_file( uint64_t off, uint64_t len, uint64_t file_len )
+{
+   return off <= file_len && len <= file_len - off;
+}
+
+static const char *
+cache_string( const struct cache_header *hdr, const char *map, uint32_t off )
+{
+   if ( off == CACHE_NONE || off >= hdr->string_len ) return NULL;
+   return map + hdr->string_off + off;
+}
+
+/** @class  map_cache
+ *  @brief  map the cache file read-only if it is one for this key
+ *
+ *  Only the layout is checked here, strings and chains are bounds
+ *  checked as they are used.
+ */
+
+static int
+map_cache( struct native_event_table_t *event_table, const char *key,
+	   size_t key_len )
+{
+   const struct cache_header *hdr;
+   struct stat st;
+   void *map;
+   int fd;
+
+   fd = open( event_table->cache.path, O_RDONLY );
+   if ( fd < 0 ) return PAPI_ENOEVNT;
+
+   if ( fstat( fd, &st ) < 0 || st.st_size < ( off_t ) sizeof ( *hdr ) ) {
+      close( fd );
+      return PAPI_ENOEVNT;
+   }
+
+   map = mmap( NULL, ( size_t ) st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+   close( fd );
+   if ( map == MAP_FAILED ) return PAPI_ESYS;
+
+   hdr = map;
+   if ( memcmp( hdr->magic, CACHE_MAGIC, sizeof ( CACHE_MAGIC ) ) ||
+	hdr->format != CACHE_FORMAT ||
+	hdr->file_len != ( uint64_t ) st.st_size ||
+	hdr->key_len != key_len + 1 ||
+	!in_file( hdr->key_off, hdr->key_len, hdr->file_len ) ||
+	memcmp( ( char * ) map + hdr->key_off, key, key_len + 1 ) ||
+	hdr->num_buckets == 0 ||
+	!in_file( hdr->bucket_off, ( uint64_t ) hdr->num_buckets * 4,
+		  hdr->file_len ) ||
+	!in_file( hdr->event_off, ( uint64_t ) hdr->num_events *
+		  sizeof ( struct cache_event ), hdr->file_len ) ||
+	hdr->string_len == 0 ||
+	!in_file( hdr->string_off, hdr->string_len, hdr->file_len ) ||
+	( ( char * ) map )[hdr->string_off + hdr->string_len - 1] != '\0' ) {
+      SUBDBG( "Cache %s is stale\n", event_table->cache.path );
+      munmap( map, ( size_t ) st.st_size );
+      return PAPI_ENOEVNT;
+   }
+
+   event_table->cache.map = map;
+   event_table->cache.map_len = ( size_t ) st.st_size;
+   return PAPI_OK;
+}
+
+/** @class  find_cached_event
+ *  @brief  index of the named event in a mapped cache, or -1
+ */
+
+static int
+find_cached_event( const char *map, const char *name )
+{
+   const struct cache_header *hdr = ( const struct cache_header * ) map;
+   const uint32_t *buckets = ( const uint32_t * ) ( map + hdr->bucket_off );
+   const struct cache_event *events =
+      ( const struct cache_event * ) ( map + hdr->event_off );
+   const char *evt_name;
+   uint32_t i, steps;
+
+   i = buckets[hash_name( name ) % hdr->num_buckets];
+   for ( steps = 0; i < hdr->num_events && steps < hdr->num_events; steps++ ) {
+      evt_name = cache_string( hdr, map, events[i].name );
+      if ( evt_name != NULL && !strcmp( evt_name, name ) ) return ( int ) i;
+      i = ( uint32_t ) events[i].next;
+   }
+   return -1;
+}
+
+/***********************************************************/
+/* Exported functions                                      */
+/***********************************************************/
+
+/** @class  _papi_libpfm4_cache_open
+ *  @brief  find the cache file for this component and map it
+ *
+ *  @param[in] my_vector
+ *        -- vector of the component the event table belongs to
+ *  @param[in] event_table
+ *        -- native event table struct, its PMUs already detected
+ *
+ *  @retval PAPI_OK  Always; without a usable file events are resolved
+ *                   by libpfm4 as usual and the file written later
+ */
+
+int
+_papi_libpfm4_cache_open( papi_vector_t *my_vector,
+			  struct native_event_table_t *event_table )
+{
+   struct cache_buf key = { NULL, 0, 0 };
+   char path[PATH_MAX];
+   const char *dir;
+
+   memset( &event_table->cache, 0, sizeof ( event_table->cache ) );
+
+   dir = getenv( "PAPI_EVENT_CACHE" );
+   if ( dir == NULL || dir[0] == '\0' ) return PAPI_OK;
+
+   if ( build_key( my_vector, event_table, &key ) != PAPI_OK ) {
+      free( key.s );
+      return PAPI_OK;
+   }
+
+   snprintf( path, sizeof ( path ), "%s/%s-%016llx.cache", dir,
+	     my_vector->cmp_info.short_name,
+	     ( unsigned long long ) hash64( key.s, key.len ) );
+   event_table->cache.path = strdup( path );
+   event_table->cache.key = key.s;
+
+   if ( event_table->cache.path == NULL ||
+	map_cache( event_table, key.s, key.len ) != PAPI_OK ) {
+      /* nothing to read, the first event resolved gets it written */
+      SUBDBG( "No usable cache at %s\n", path );
+   }
+
+   return PAPI_OK;
+}
+
+/** @class  _papi_libpfm4_cache_lookup
+ *  @brief  fill in a native event from the cache
+ *
+ *  @param[in] name
+ *        -- name of the event, as it would be given to libpfm4
+ *  @param[out] ntv_evt
+ *        -- event to fill in, strings are allocated as libpfm4 would
+ *  @param[in] event_table
+ *        -- native event table struct
+ *
+ *  @retval PAPI_OK       The event was in the cache
+ *  @retval PAPI_ENOEVNT  It has to be resolved by libpfm4
+ *
+ *  Must be called with NAMELIB_LOCK held, like the rest of the
+ *  native event table updates.
+ */
+
+int
+_papi_libpfm4_cache_lookup( const char *name, struct native_event_t *ntv_evt,
+			    struct native_event_table_t *event_table )
+{
+   const char *map = event_table->cache.map;
+   const struct cache_header *hdr;
+   const struct cache_event *evt;
+   const char *pmu, *base_name, *mask_string, *descr, *mask_descr,
+      *pmu_plus_name;
+   int i;
+
+   if ( map == NULL ) return PAPI_ENOEVNT;
+
+   i = find_cached_event( map, name );
+   if ( i < 0 ) return PAPI_ENOEVNT;
+
+   hdr = ( const struct cache_header * ) map;
+   evt = ( const struct cache_event * ) ( map + hdr->event_off ) + i;
+
+   pmu = cache_string( hdr, map, evt->pmu );
+   base_name = cache_string( hdr, map, evt->base_name );
+   mask_string = cache_string( hdr, map, evt->mask_string );
+   descr = cache_string( hdr, map, evt->event_description );
+   mask_descr = cache_string( hdr, map, evt->mask_description );
+   pmu_plus_name = cache_string( hdr, map, evt->pmu_plus_name );
+   if ( pmu == NULL || base_name == NULL || mask_string == NULL ||
+	descr == NULL || pmu_plus_name == NULL )
+      return PAPI_ENOEVNT;
+
+   ntv_evt->allocated_name = strdup( name );
+   ntv_evt->pmu = strdup( pmu );
+   ntv_evt->base_name = strdup( base_name );
+   ntv_evt->mask_string = strdup( mask_string );
+   ntv_evt->event_description = strdup( descr );
+   ntv_evt->mask_description = mask_descr ? strdup( mask_descr ) : NULL;
+   ntv_evt->pmu_plus_name = strdup( pmu_plus_name );
+   ntv_evt->libpfm4_idx = evt->libpfm4_idx;
+   ntv_evt->cpu = evt->cpu;
+   memcpy( &ntv_evt->attr, &evt->attr, sizeof ( perf_event_attr_t ) );
+
+   SUBDBG( "Found %s in the cache, libpfm4_idx: %#x\n", name,
+	   ntv_evt->libpfm4_idx );
+   return PAPI_OK;
+}
+
+/* append a string to the table, returning its offset */
+static uint32_t
+add_string( struct cache_buf *strings, const char *s )
+{
+   uint32_t off;
+
+   if ( s == NULL ) return CACHE_NONE;
+   off = ( uint32_t ) strings->len;
+   if ( buf_add( strings, s, strlen( s ) + 1 ) != PAPI_OK ) return CACHE_NONE;
+   return off;
+}
+
+/* add an event unless one by that name is there already */
+static void
+add_event( struct cache_event *events, uint32_t *num_events, uint32_t *buckets,
+	   uint32_t num_buckets, struct cache_buf *strings,
+	   const struct native_event_t *ntv_evt )
+{
+   struct cache_event *evt;
+   uint32_t bucket, i;
+
+   bucket = hash_name( ntv_evt->allocated_name ) % num_buckets;
+   for ( i = buckets[bucket]; i != CACHE_NONE; i = ( uint32_t ) events[i].next ) {
+      if ( !strcmp( strings->s + events[i].name, ntv_evt->allocated_name ) )
+	 return;
+   }
+
+   evt = &events[*num_events];
+   memset( evt, 0, sizeof ( *evt ) );
+   evt->name = add_string( strings, ntv_evt->allocated_name );
+   evt->pmu = add_string( strings, ntv_evt->pmu );
+   evt->base_name = add_string( strings, ntv_evt->base_name );
+   evt->mask_string = add_string( strings, ntv_evt->mask_string );
+   evt->event_description = add_string( strings, ntv_evt->event_description );
+   evt->mask_description = add_string( strings, ntv_evt->mask_description );
+   evt->pmu_plus_name = add_string( strings, ntv_evt->pmu_plus_name );
+   if ( evt->name == CACHE_NONE ) return;
+   evt->libpfm4_idx = ntv_evt->libpfm4_idx;
+   evt->cpu = ntv_evt->cpu;
+   memcpy( &evt->attr, &ntv_evt->attr, sizeof ( perf_event_attr_t ) );
+
+   evt->next = ( int32_t ) buckets[bucket];
+   buckets[bucket] = *num_events;
+   ( *num_events )++;
+}
+
+/** @class  _papi_libpfm4_cache_save
+ *  @brief  write out the events resolved since the cache was read
+ *
+ *  @param[in] event_table
+ *        -- native event table struct
+ *
+ *  @retval PAPI_OK       The cache is up to date (or there is none)
+ *  @retval PAPI_ENOMEM   No memory to build the file
+ *  @retval PAPI_ESYS     The file could not be written
+ *
+ *  The new file holds the events of the table plus those of the old
+ *  file, is written under a name of its own and then renamed over the
+ *  old one, so processes racing to write it leave a complete file and
+ *  readers keep the one they mapped.
+ */
+
+int
+_papi_libpfm4_cache_save( struct native_event_table_t *event_table )
+{
+   const char *map = event_table->cache.map;
+   const struct cache_header *old = ( const struct cache_header * ) map;
+   struct native_event_t ntv_evt;
+   struct cache_header hdr;
+   struct cache_event *events;
+   struct cache_buf strings = { NULL, 0, 0 };
+   uint32_t *buckets, num_events = 0, num_buckets = 64, max_events, i;
+   char tmp[PATH_MAX];
+   size_t key_len;
+   int fd, retval = PAPI_OK;
+
+   if ( event_table->cache.path == NULL || !event_table->cache.stale )
+      return PAPI_OK;
+
+   max_events = ( uint32_t ) event_table->num_native_events;
+   if ( map != NULL ) max_events += old->num_events;
+   while ( num_buckets < max_events ) num_buckets *= 2;
+
+   events = calloc( max_events ? max_events : 1, sizeof ( *events ) );
+   buckets = malloc( num_buckets * sizeof ( *buckets ) );
+   if ( events == NULL || buckets == NULL ) {
+      retval = PAPI_ENOMEM;
+      goto out;
+   }
+   for ( i = 0; i < num_buckets; i++ ) buckets[i] = CACHE_NONE;
+
+   /* so the string table is never empty, even without events */
+   add_string( &strings, "" );
+
+   for ( i = 0; i < ( uint32_t ) event_table->num_native_events; i++ ) {
+      /* events libpfm4 could not encode are marked, and not kept */
+      if ( event_table->native_events[i].allocated_name == NULL ||
+	   event_table->native_events[i].attr.config == 0xFFFFFF )
+	 continue;
+      add_event( events, &num_events, buckets, num_buckets, &strings,
+		 &event_table->native_events[i] );
+   }
+
+   for ( i = 0; map != NULL && i < old->num_events; i++ ) {
+      const struct cache_event *evt =
+	 ( const struct cache_event * ) ( map + old->event_off ) + i;
+
+      ntv_evt.allocated_name = ( char * ) cache_string( old, map, evt->name );
+      if ( ntv_evt.allocated_name == NULL ) continue;
+      ntv_evt.pmu = ( char * ) cache_string( old, map, evt->pmu );
+      ntv_evt.base_name = ( char * ) cache_string( old, map, evt->base_name );
+      ntv_evt.mask_string = ( char * ) cache_string( old, map, evt->mask_string );
+      ntv_evt.event_description =
+	 ( char * ) cache_string( old, map, evt->event_description );
+      ntv_evt.mask_description =
+	 ( char * ) cache_string( old, map, evt->mask_description );
+      ntv_evt.pmu_plus_name =
+	 ( char * ) cache_string( old, map, evt->pmu_plus_name );
+      ntv_evt.libpfm4_idx = evt->libpfm4_idx;
+      ntv_evt.cpu = evt->cpu;
+      memcpy( &ntv_evt.attr, &evt->attr, sizeof ( perf_event_attr_t ) );
+      add_event( events, &num_events, buckets, num_buckets, &strings,
+		 &ntv_evt );
+   }
+
+   if ( strings.s == NULL ) {
+      retval = PAPI_ENOMEM;
+      goto out;
+   }
+
+   key_len = strlen( event_table->cache.key ) + 1;
+
+   memset( &hdr, 0, sizeof ( hdr ) );
+   memcpy( hdr.magic, CACHE_MAGIC, sizeof ( CACHE_MAGIC ) );
+   hdr.format = CACHE_FORMAT;
+   hdr.key_len = ( uint32_t ) key_len;
+   hdr.num_events = num_events;
+   hdr.num_buckets = num_buckets;
+   hdr.key_off = CACHE_ALIGN( sizeof ( hdr ) );
+   hdr.bucket_off = CACHE_ALIGN( hdr.key_off + key_len );
+   hdr.event_off = CACHE_ALIGN( hdr.bucket_off + num_buckets * sizeof ( *buckets ) );
+   hdr.string_off = hdr.event_off + num_events * sizeof ( *events );
+   hdr.string_len = strings.len;
+   hdr.file_len = hdr.string_off + hdr.string_len;
+
+   snprintf( tmp, sizeof ( tmp ), "%s.%d", event_table->cache.path,
+	     ( int ) getpid(  ) );
+   fd = open( tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+   if ( fd < 0 ) {
+      SUBDBG( "Could not create %s\n", tmp );
+      retval = PAPI_ESYS;
+      goto out;
+   }
+
+   if ( pwrite( fd, &hdr, sizeof ( hdr ), 0 ) != sizeof ( hdr ) ||
+	pwrite( fd, event_table->cache.key, key_len, ( off_t ) hdr.key_off ) !=
+	( ssize_t ) key_len ||
+	pwrite( fd, buckets, num_buckets * sizeof ( *buckets ),
+		( off_t ) hdr.bucket_off ) !=
+	( ssize_t ) ( num_buckets * sizeof ( *buckets ) ) ||
+	pwrite( fd, events, num_events * sizeof ( *events ),
+		( off_t ) hdr.event_off ) !=
+	( ssize_t ) ( num_events * sizeof ( *events ) ) ||
+	pwrite( fd, strings.s, strings.len, ( off_t ) hdr.string_off ) !=
+	( ssize_t ) strings.len ) {
+      retval = PAPI_ESYS;
+   }
+
+   if ( close( fd ) < 0 ) retval = PAPI_ESYS;
+
+   if ( retval == PAPI_OK && rename( tmp, event_table->cache.path ) < 0 )
+      retval = PAPI_ESYS;
+   if ( retval != PAPI_OK ) {
+      SUBDBG( "Could not write %s\n", event_table->cache.path );
+      unlink( tmp );
+      goto out;
+   }
+
+   SUBDBG( "Wrote %d events to %s\n", num_events, event_table->cache.path );
+   event_table->cache.stale = 0;
+
+ out:
+   free( strings.s );
+   free( buckets );
+   free( events );
+   return retval;
+}
+
+/** @class  _papi_libpfm4_cache_close
+ *  @brief  save anything new and let go of the cache
+ *
+ *  @param[in] event_table
+ *        -- native event table struct
+ */
+
+void
+_papi_libpfm4_cache_close( struct native_event_table_t *event_table )
+{
+   _papi_libpfm4_cache_save( event_table );
+
+   if ( event_table->cache.map != NULL )
+      munmap( ( void * ) event_table->cache.map, event_table->cache.map_len );
+   free( event_table->cache.path );
+   free( event_table->cache.key );
+   memset( &event_table->cache, 0, sizeof ( event_table->cache ) );
+}
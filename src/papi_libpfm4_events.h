@@ -21,6 +21,7 @@ struct native_event_t {
   char *pmu_plus_name;
   int cpu;
   int users;
+  int name_next;                /* next event in the same name_hash bucket */
   perf_event_attr_t attr;
 };
 
@@ -28,12 +29,26 @@ struct native_event_t {
 #define PMU_TYPE_UNCORE 2
 #define PMU_TYPE_OS     4
 
+/* on-disk catalog of resolved events, see papi_libpfm4_cache.c */
+struct native_event_cache_t {
+   char *path;                  /* NULL when there is no cache */
+   char *key;                   /* what the file has to have been made for */
+   const char *map;             /* read-only mapping of a valid cache file */
+   size_t map_len;
+   int stale;                   /* events were resolved the file lacks */
+};
+
 struct native_event_table_t {
    struct native_event_t *native_events;
    int num_native_events;
    int allocated_native_events;
    pfm_pmu_info_t default_pmu;
    int pmu_type;
+   int *code_to_idx;            /* papi event code -> native_events index */
+   int code_to_idx_size;
+   int *name_hash;              /* allocated_name hash -> first native_events index */
+   int name_hash_size;
+   struct native_event_cache_t cache;
 };
 
 
@@ -43,4 +58,11 @@ int _papi_libpfm4_error( int pfm_error );
 int _papi_libpfm4_shutdown(void);
 int _papi_libpfm4_init(papi_vector_t *my_vector);
 
+int _papi_libpfm4_cache_open(papi_vector_t *my_vector,
+                             struct native_event_table_t *event_table);
+int _papi_libpfm4_cache_lookup(const char *name, struct native_event_t *ntv_evt,
+                               struct native_event_table_t *event_table);
+int _papi_libpfm4_cache_save(struct native_event_table_t *event_table);
+void _papi_libpfm4_cache_close(struct native_event_table_t *event_table);
+
 #endif // _PAPI_LIBPFM4_EVENTS_H
@@ -27,6 +27,7 @@ extern hwi_presets_t user_defined_events[];
 extern int user_defined_events_count;
 
 static int papi_load_derived_events (char *pmu_str, int pmu_type, int cidx, int preset_flag);
+static void resolve_preset( hwi_presets_t *preset );
 
 
 /* This routine copies values from a dense 'findem' array of events 
@@ -122,6 +123,10 @@ _papi_hwi_cleanup_all_presets( void )
 	       papi_free( _papi_hwi_presets[preset_index].postfix );
 	       _papi_hwi_presets[preset_index].postfix = NULL;
 	    }
+	    if ( _papi_hwi_presets[preset_index].postfix_prog != NULL ) {
+	       papi_free( _papi_hwi_presets[preset_index].postfix_prog );
+	       _papi_hwi_presets[preset_index].postfix_prog = NULL;
+	    }
 	    if ( _papi_hwi_presets[preset_index].note != NULL ) {
 	       papi_free( _papi_hwi_presets[preset_index].note );
 	       _papi_hwi_presets[preset_index].note = NULL;
@@ -129,6 +134,8 @@ _papi_hwi_cleanup_all_presets( void )
 	    for(j=0; j<_papi_hwi_presets[preset_index].count;j++) {
 	       papi_free(_papi_hwi_presets[preset_index].name[j]);
 	    }
+	    _papi_hwi_presets[preset_index].count = 0;
+	    _papi_hwi_presets[preset_index].def = NULL;
 	}
 	
 	for(cidx=0;cidx<papi_num_components;cidx++) {
@@ -636,6 +643,15 @@ check_derived_events(char *target, int derived_type, hwi_presets_t* results, hwi
 
 		INTDBG("Found a match\n");
 
+		// builtin presets only look up their own terms once something needs them
+		if ( search[j].def != NULL ) {
+			resolve_preset( &search[j] );
+			if ( search[j].count == 0 ) {
+				INTDBG("EXIT: returned: 0, %s is not available\n", target);
+				return 0;
+			}
+		}
+
 		// derived formulas need to be adjusted based on what kind of derived event we are processing
 		// the derived type passed to this function is the type of the new event being defined (not the events it is based on)
 		// when we get here the formula must be in reverse polish notation (RPN) format
@@ -761,13 +777,168 @@ is_event(char *event_name, int derived_type, hwi_presets_t* results, int token_i
 	return 0;
 }
 
-/* Static version of the events file. */
+/* Static version of the events file, compiled by papi_events_table.sh */
 #if defined(STATIC_PAPI_EVENTS_TABLE)
 #include "papi_events_table.h"
 #else
-static char *papi_events_table = NULL;
+static const hwi_preset_def_t papi_preset_defs[] = {
+	{NULL, NOT_DERIVED, NULL, {NULL}, NULL, NULL, NULL}
+};
+static const hwi_preset_pmu_t papi_preset_pmus[] = {
+	{NULL, -1, 0, 0}
+};
 #endif
 
+/* marks the preset resolve_preset() is working on */
+static const hwi_preset_def_t preset_resolving;
+
+/* copy the pmu identifier, stripping commas if found */
+static void
+copy_pmu_name( char *pmu_name, char *pmu_str )
+{
+	while (*pmu_str) {
+		if (*pmu_str != ',')
+			*pmu_name++ = *pmu_str;
+		pmu_str++;
+	}
+	*pmu_name = '\0';
+}
+
+/* Take the presets of this pmu from the compiled table.  Only the symbols
+   and descriptions are set up here, the event names are looked up by
+   resolve_preset() the first time the preset is queried or added. */
+static int
+load_builtin_presets( char *pmu_str, int pmu_type, int cidx )
+{
+	SUBDBG("ENTER: pmu_str: %s, pmu_type: %d, cidx: %d\n", pmu_str, pmu_type, cidx);
+
+	char pmu_name[PAPI_MIN_STR_LEN];
+	const hwi_preset_pmu_t *pmu;
+	const hwi_preset_def_t *def;
+	hwi_presets_t *preset;
+	int i, res_idx, last_first = -1;
+
+	copy_pmu_name(pmu_name, pmu_str);
+
+	for (pmu = papi_preset_pmus; pmu->name != NULL; pmu++) {
+		if (strcasecmp(pmu->name, pmu_name) != 0)
+			continue;
+		if ((pmu->type != -1) && (pmu->type != pmu_type)) {
+			SUBDBG("Additional qualifier match failed %d vs %d.\n", pmu_type, pmu->type);
+			continue;
+		}
+		/* several names of the same pmu share their events */
+		if (pmu->first == last_first)
+			continue;
+		last_first = pmu->first;
+
+		SUBDBG("Using %d builtin events of PMU %s.\n", pmu->count, pmu->name);
+
+		for (i = pmu->first; i < pmu->first + pmu->count; i++) {
+			def = &papi_preset_defs[i];
+
+			if ((res_idx = find_event_index(_papi_hwi_presets, PAPI_MAX_PRESET_EVENTS, (char *)def->symbol)) < 0) {
+				PAPIERROR("No room left for event %s -- ignoring", def->symbol);
+				continue;
+			}
+
+			preset = &_papi_hwi_presets[res_idx];
+			preset->def = def;
+			preset->count = 0;
+			if (def->short_descr != NULL)
+				preset->short_descr = (char *)def->short_descr;
+			if (def->long_descr != NULL)
+				preset->long_descr = (char *)def->long_descr;
+
+			_papi_hwd[cidx]->cmp_info.num_preset_events++;
+		}
+	}
+
+	SUBDBG("EXIT: PAPI_OK\n");
+	return PAPI_OK;
+}
+
+/* Look up the terms of a preset loaded from the compiled table.  The
+   entry only becomes visible once complete: readers check def first and
+   count after it, so def is cleared last.  Presets with a term that can
+   not be found are left with a count of 0, they are not available. */
+static void
+resolve_preset( hwi_presets_t *preset )
+{
+	const hwi_preset_def_t *def = preset->def;
+	hwi_presets_t tmp;
+	unsigned int i;
+	int invalid_event = 0;
+
+	/* a preset made of itself, or already done */
+	if ((def == NULL) || (def == &preset_resolving))
+		return;
+
+	SUBDBG("ENTER: %s\n", preset->symbol);
+
+	preset->def = &preset_resolving;
+
+	memset(&tmp, 0, sizeof(tmp));
+	tmp.symbol = preset->symbol;
+	tmp.derived_int = def->derived;
+	if (def->postfix != NULL)
+		tmp.postfix = papi_strdup(def->postfix);
+
+	for (i = 0; (i < PAPI_EVENTS_IN_DERIVED_EVENT) && (def->term[i] != NULL) &&
+			(tmp.count < PAPI_EVENTS_IN_DERIVED_EVENT); i++) {
+		// show that we do not have an event code yet (the component may create one and update this info)
+		_papi_hwi_set_papi_event_code(-1, -1);
+
+		if (is_event((char *)def->term[i], tmp.derived_int, &tmp, i) == 0) {
+			PAPIERROR("Error finding event %s, it is used in derived event %s", def->term[i], preset->symbol);
+			invalid_event = 1;
+			break;
+		}
+	}
+
+	if (invalid_event) {
+		for (i = 0; i < tmp.count; i++)
+			papi_free(tmp.name[i]);
+		if (tmp.postfix != NULL)
+			papi_free(tmp.postfix);
+		memset(&tmp, 0, sizeof(tmp));
+	}
+
+	/* preset code list must be PAPI_NULL terminated */
+	if (tmp.count < PAPI_EVENTS_IN_DERIVED_EVENT)
+		tmp.code[tmp.count] = PAPI_NULL;
+
+	preset->derived_int = tmp.derived_int;
+	preset->postfix = tmp.postfix;
+	memcpy(preset->code, tmp.code, sizeof(preset->code));
+	memcpy(preset->name, tmp.name, sizeof(preset->name));
+	if ((def->note != NULL) && !invalid_event)
+		preset->note = papi_strdup(def->note);
+
+	__sync_synchronize();
+	preset->count = tmp.count;
+	__sync_synchronize();
+	preset->def = NULL;
+
+	SUBDBG("EXIT: %s has %d terms\n", preset->symbol, preset->count);
+}
+
+/* Make sure a preset from the compiled table has its native terms.
+   Returns PAPI_OK, or PAPI_ENOEVNT if the preset is not available. */
+int
+_papi_hwi_resolve_preset( int preset_index )
+{
+	hwi_presets_t *preset = &_papi_hwi_presets[preset_index];
+
+	if ( preset->def != NULL ) {
+		_papi_hwi_lock( PRESETS_LOCK );
+		resolve_preset( preset );
+		_papi_hwi_unlock( PRESETS_LOCK );
+	}
+
+	return preset->count ? PAPI_OK : PAPI_ENOEVNT;
+}
+
 int _papi_load_preset_table(char *pmu_str, int pmu_type, int cidx) {
 	SUBDBG("ENTER: pmu_str: %s, pmu_type: %d, cidx: %d\n", pmu_str, pmu_type, cidx);
 
@@ -1069,8 +1240,8 @@ papi_load_derived_events (char *pmu_str, int pmu_type, int cidx, int preset_flag
 			event_file_path = tmpn;
 		}
 		/* if no valid environment variable, look for built-in table */
-		else if (papi_events_table) {
-			event_table_ptr = papi_events_table;
+		else if (papi_preset_pmus[0].name != NULL) {
+			return load_builtin_presets(pmu_str, pmu_type, cidx);
 		}
 		/* if no env var and no built-in, search for default file */
 		else {
@@ -1112,14 +1283,7 @@ papi_load_derived_events (char *pmu_str, int pmu_type, int cidx, int preset_flag
 		return PAPI_ESYS;
 	}
 
-	/* copy the pmu identifier, stripping commas if found */
-	tmpn = pmu_name;
-	while (*pmu_str) {
-		if (*pmu_str != ',')
-			*tmpn++ = *pmu_str;
-		pmu_str++;
-	}
-	*tmpn = '\0';
+	copy_pmu_name(pmu_name, pmu_str);
 
 	/* at this point we have either a valid file pointer or built-in table pointer */
 	while (get_event_line(line, event_file, &event_table_ptr)) {
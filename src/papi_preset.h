@@ -18,6 +18,30 @@ typedef struct hwi_search {
    char *note;                          /**< optional developer notes for this event */
 } hwi_search_t;
 
+/** operations of a compiled derived postfix formula
+ *	@internal */
+#define POSTFIX_COUNTER  1   /**< push the count of native term N<arg> */
+#define POSTFIX_CONST    2   /**< push value (numbers and the # MHz term) */
+#define POSTFIX_ADD      3
+#define POSTFIX_SUB      4
+#define POSTFIX_MUL      5
+#define POSTFIX_DIV      6
+
+/** one step of a compiled derived postfix formula
+ *	@internal */
+typedef struct hwi_postfix_op {
+   int op;            /**< POSTFIX_* operation */
+   int arg;           /**< native term number for POSTFIX_COUNTER */
+   double value;      /**< value pushed by POSTFIX_CONST */
+} hwi_postfix_op_t;
+
+/** derived postfix formula compiled the first time the event is added
+ *	@internal */
+typedef struct hwi_postfix_prog {
+   int len;                   /**< number of operations */
+   hwi_postfix_op_t op[1];    /**< len operations follow */
+} hwi_postfix_prog_t;
+
 /** collected text and data info for all preset events 
  *	@internal */
 typedef struct hwi_presets {  
@@ -29,11 +53,34 @@ typedef struct hwi_presets {
    unsigned int count;
    unsigned int event_type;
    char *postfix;
+   hwi_postfix_prog_t *postfix_prog;  /**< postfix compiled for reads */
    unsigned int code[PAPI_MAX_INFO_TERMS];
    char *name[PAPI_MAX_INFO_TERMS];
    char *note;
+   const struct hwi_preset_def *def;  /**< builtin definition whose terms are not resolved yet */
 } hwi_presets_t;
 
+/** preset definition papi_events_table.sh compiled from papi_events.csv
+ *	@internal */
+typedef struct hwi_preset_def {
+   const char *symbol;        /**< name of the preset event; i.e. PAPI_TOT_INS, etc. */
+   int derived;               /**< Derived type code, infix is already postfix */
+   const char *postfix;       /**< formula for DERIVED_POSTFIX, else NULL */
+   const char *term[PAPI_EVENTS_IN_DERIVED_EVENT];  /**< names of the events it is made of */
+   const char *short_descr;   /**< descriptions and note overriding the defaults, or NULL */
+   const char *long_descr;
+   const char *note;
+} hwi_preset_def_t;
+
+/** pmu the compiled preset definitions first .. first + count - 1 apply to
+ *	@internal */
+typedef struct hwi_preset_pmu {
+   const char *name;          /**< pmu name of the CPU line */
+   int type;                  /**< pmu type qualifier, -1 matches on the name alone */
+   int first;
+   int count;
+} hwi_preset_pmu_t;
+
 
 /** This is a general description structure definition for various parameter lists 
  *	@internal */   
@@ -49,6 +96,7 @@ int _papi_hwi_setup_all_presets( hwi_search_t * findem, int cidx);
 int _papi_hwi_cleanup_all_presets( void );
 int _xml_papi_hwi_setup_all_presets( char *arch);
 int _papi_load_preset_table( char *name, int type, int cidx );
+int _papi_hwi_resolve_preset( int preset_index );
 
 extern hwi_presets_t _papi_hwi_presets[PAPI_MAX_PRESET_EVENTS];
 
@@ -0,0 +1,412 @@
+/****************************/
+/* THIS IS OPEN SOURCE CODE */
+/****************************/
+
+/**
+* @file		papi_trace.c
+* @brief Streams the samples collected with PAPI_sample() into compact
+*  binary trace files, see papi_trace.h for the file layout and
+*  utils/sample_report.c for a reader.
+*
+*  Samples are packed into a chunk in memory as they are decoded and each
+*  chunk goes out with a single write() once it is full, so the cost per
+*  sample is little more than copying it.
+*/
+
+#include "papi.h"
+#include "papi_internal.h"
+#include "papi_memory.h"
+#include "papi_trace.h"
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define PAPI_MAX_TRACES 64
+
+/** \internal
+ * An open trace file
+ */
+typedef struct _PapiTrace
+{
+	int fd;                           /**< the trace file */
+	papi_trace_header_t header;       /**< written out at close */
+	unsigned int event_codes[PAPI_TRACE_MAX_EVENTS]; /**< codes of header.events */
+	long long lost[PAPI_TRACE_MAX_EVENTS]; /**< samples dropped, per event */
+	unsigned char *chunk;             /**< chunk being filled */
+	uint32_t used;                    /**< bytes used in chunk */
+	uint64_t last_time;               /**< time of the last record */
+} PapiTrace_t;
+
+static PapiTrace_t *traces[PAPI_MAX_TRACES];
+
+static int
+write_all( int fd, const void *buf, size_t len, off_t offset )
+{
+	const char *p = buf;
+	ssize_t ret;
+
+	while ( len ) {
+		ret = pwrite( fd, p, len, offset );
+		if ( ret < 0 ) {
+			if ( errno == EINTR )
+				continue;
+			PAPIERROR( "write to sample trace failed: %s", strerror( errno ) );
+			return PAPI_ESYS;
+		}
+		p += ret;
+		offset += ret;
+		len -= ( size_t ) ret;
+	}
+	return PAPI_OK;
+}
+
+static void
+reset_chunk( PapiTrace_t *t )
+{
+	papi_trace_chunk_t *chunk = ( papi_trace_chunk_t * ) t->chunk;
+
+	memset( chunk, 0, sizeof ( *chunk ) );
+	chunk->magic = PAPI_TRACE_CHUNK_MAGIC;
+	chunk->min_ip = ~( uint64_t ) 0;
+	t->used = sizeof ( *chunk );
+}
+
+/* Write the chunk out, padded to its full size */
+static int
+flush_chunk( PapiTrace_t *t )
+{
+	papi_trace_chunk_t *chunk = ( papi_trace_chunk_t * ) t->chunk;
+	off_t offset;
+	int retval;
+
+	if ( chunk->nr_records == 0 )
+		return PAPI_OK;
+
+	chunk->size = t->used;
+	memset( t->chunk + t->used, 0, t->header.chunk_size - t->used );
+
+	offset = PAPI_TRACE_HEADER_SIZE +
+		( off_t ) t->header.nr_chunks * t->header.chunk_size;
+	retval = write_all( t->fd, t->chunk, t->header.chunk_size, offset );
+	if ( retval != PAPI_OK )
+		return retval;
+
+	t->header.nr_chunks++;
+	reset_chunk( t );
+
+	return PAPI_OK;
+}
+
+/* Find the slot of an event in the trace header, adding it if needed */
+static int
+trace_event_index( PapiTrace_t *t, int EventCode )
+{
+	unsigned int i;
+	int retval;
+
+	for ( i = 0; i < t->header.nr_events; i++ ) {
+		if ( t->event_codes[i] == ( unsigned int ) EventCode )
+			return ( int ) i;
+	}
+
+	if ( i == PAPI_TRACE_MAX_EVENTS )
+		return PAPI_ECOUNT;
+
+	retval = PAPI_event_code_to_name( EventCode, t->header.events[i] );
+	if ( retval != PAPI_OK )
+		return retval;
+
+	t->event_codes[i] = ( unsigned int ) EventCode;
+	t->header.nr_events++;
+
+	return ( int ) i;
+}
+
+/* Append one sample to the current chunk */
+static int
+append_sample( PapiTrace_t *t, const PAPI_sample_t *sample, int event )
+{
+	papi_trace_chunk_t *chunk = ( papi_trace_chunk_t * ) t->chunk;
+	papi_trace_record_t *rec;
+	unsigned int nr_ips = ( unsigned int ) sample->nr_ips;
+	uint32_t size;
+	int retval;
+
+	/* A call chain that does not fit into a chunk is cut short */
+	if ( nr_ips > ( t->header.chunk_size - sizeof ( *chunk ) -
+			sizeof ( *rec ) ) / sizeof ( uint64_t ) ) {
+		nr_ips = ( t->header.chunk_size - sizeof ( *chunk ) -
+			   sizeof ( *rec ) ) / sizeof ( uint64_t );
+	}
+	if ( nr_ips > 0xffff )
+		nr_ips = 0xffff;
+	size = ( uint32_t ) ( sizeof ( *rec ) + nr_ips * sizeof ( uint64_t ) );
+
+	/* Start a new chunk if this one is full, or the time delta */
+	/* does not fit into the record.                            */
+	if ( chunk->nr_records &&
+		 ( ( t->used + size > t->header.chunk_size ) ||
+		   ( sample->time < t->last_time ) ||
+		   ( sample->time - t->last_time > UINT32_MAX ) ) ) {
+		retval = flush_chunk( t );
+		if ( retval != PAPI_OK )
+			return retval;
+	}
+
+	if ( chunk->nr_records == 0 ) {
+		chunk->start_time = sample->time;
+		t->last_time = sample->time;
+	}
+
+	rec = ( papi_trace_record_t * ) ( t->chunk + t->used );
+	rec->time_delta = ( uint32_t ) ( sample->time - t->last_time );
+	rec->event = ( uint16_t ) event;
+	rec->nr_ips = ( uint16_t ) nr_ips;
+	rec->tid = sample->tid;
+	rec->cpu = sample->cpu;
+	rec->ip = sample->ip;
+	rec->period = sample->period;
+	if ( nr_ips )
+		memcpy( rec + 1, sample->ips, nr_ips * sizeof ( uint64_t ) );
+
+	t->used += size;
+	t->last_time = sample->time;
+
+	chunk->nr_records++;
+	chunk->end_time = sample->time;
+	if ( sample->ip < chunk->min_ip )
+		chunk->min_ip = sample->ip;
+	if ( sample->ip > chunk->max_ip )
+		chunk->max_ip = sample->ip;
+
+	t->header.nr_records++;
+
+	return PAPI_OK;
+}
+
+static PapiTrace_t *
+lookup_trace( int trace )
+{
+	if ( ( trace < 0 ) || ( trace >= PAPI_MAX_TRACES ) )
+		return NULL;
+	return traces[trace];
+}
+
+static int
+close_trace( PapiTrace_t *t )
+{
+	unsigned int i;
+	int retval;
+
+	retval = flush_chunk( t );
+
+	t->header.lost = 0;
+	for ( i = 0; i < t->header.nr_events; i++ )
+		t->header.lost += ( uint64_t ) t->lost[i];
+
+	if ( retval == PAPI_OK )
+		retval = write_all( t->fd, &t->header, sizeof ( t->header ), 0 );
+
+	if ( close( t->fd ) && ( retval == PAPI_OK ) )
+		retval = PAPI_ESYS;
+
+	papi_free( t->chunk );
+	papi_free( t );
+
+	return retval;
+}
+
+/** @class PAPI_sample_trace_open
+ *	@brief Create a binary trace file for samples.
+ *
+ *	@par C Interface:
+ *	\#include <papi.h> @n
+ *	int PAPI_sample_trace_open( const char *path, int *trace );
+ *
+ *	@param path
+ *		the file to write, it is created or truncated.
+ *	@param trace
+ *		returns the handle of the trace.
+ *
+ *	The samples of events set up with PAPI_sample() are added with
+ *	PAPI_sample_trace_write(); the file is only complete after
+ *	PAPI_sample_trace_close().  papi_sample_report reads it.
+ *
+ *	@retval PAPI_EINVAL
+ *		path or trace is NULL.
+ *	@retval PAPI_ESYS
+ *		the file could not be created, errno has the details.
+ *	@retval PAPI_ENOMEM
+ *		out of memory, or too many traces open.
+ *
+ *	@see PAPI_sample_trace_write PAPI_sample_trace_close PAPI_sample
+ */
+int
+PAPI_sample_trace_open( const char *path, int *trace )
+{
+	PapiTrace_t *t;
+	int i;
+
+	if ( ( path == NULL ) || ( trace == NULL ) )
+		return PAPI_EINVAL;
+
+	t = papi_calloc( 1, sizeof ( PapiTrace_t ) );
+	if ( t == NULL )
+		return PAPI_ENOMEM;
+
+	t->chunk = papi_malloc( PAPI_TRACE_CHUNK_SIZE );
+	if ( t->chunk == NULL ) {
+		papi_free( t );
+		return PAPI_ENOMEM;
+	}
+
+	t->fd = open( path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 );
+	if ( t->fd < 0 ) {
+		papi_free( t->chunk );
+		papi_free( t );
+		return PAPI_ESYS;
+	}
+
+	memcpy( t->header.magic, PAPI_TRACE_MAGIC, sizeof ( t->header.magic ) );
+	t->header.version = PAPI_TRACE_VERSION;
+	t->header.header_size = PAPI_TRACE_HEADER_SIZE;
+	t->header.chunk_size = PAPI_TRACE_CHUNK_SIZE;
+	reset_chunk( t );
+
+	/* Reserve the header, it is filled in at close */
+	if ( ftruncate( t->fd, PAPI_TRACE_HEADER_SIZE ) ) {
+		close( t->fd );
+		papi_free( t->chunk );
+		papi_free( t );
+		return PAPI_ESYS;
+	}
+
+	_papi_hwi_lock( INTERNAL_LOCK );
+	for ( i = 0; i < PAPI_MAX_TRACES; i++ ) {
+		if ( traces[i] == NULL ) {
+			traces[i] = t;
+			break;
+		}
+	}
+	_papi_hwi_unlock( INTERNAL_LOCK );
+
+	if ( i == PAPI_MAX_TRACES ) {
+		close( t->fd );
+		papi_free( t->chunk );
+		papi_free( t );
+		return PAPI_ENOMEM;
+	}
+
+	*trace = i;
+	return PAPI_OK;
+}
+
+/** @class PAPI_sample_trace_write
+ *	@brief Move the pending samples of an event into a trace file.
+ *
+ *	@par C Interface:
+ *	\#include <papi.h> @n
+ *	int PAPI_sample_trace_write( int trace, int EventSet, int EventCode );
+ *
+ *	Takes every sample PAPI_sample_next() has for the event, appends it
+ *	to the trace and hands the sample buffer back with
+ *	PAPI_sample_release().  Call it often enough to keep the kernel
+ *	buffer from filling up, from the thread that owns the EventSet.  A
+ *	trace must not be written by two threads at the same time; give
+ *	each thread its own trace instead.
+ *
+ *	Fields not requested with PAPI_sample() are recorded as zero.  The
+ *	first PAPI_TRACE_MAX_EVENTS different events can go into a trace.
+ *
+ *	@retval >=0
+ *		the number of samples written.
+ *	@retval PAPI_EINVAL
+ *		trace is not open, or the event is not being sampled.
+ *	@retval PAPI_ECOUNT
+ *		the trace has no room for another event.
+ *	@retval PAPI_ESYS
+ *		the file could not be written.
+ *
+ *	@see PAPI_sample_trace_open PAPI_sample_next
+ */
+int
+PAPI_sample_trace_write( int trace, int EventSet, int EventCode )
+{
+	PapiTrace_t *t;
+	PAPI_sample_t sample;
+	int event, retval, count = 0;
+
+	t = lookup_trace( trace );
+	if ( t == NULL )
+		return PAPI_EINVAL;
+
+	event = trace_event_index( t, EventCode );
+	if ( event < 0 )
+		return event;
+
+	while ( ( retval = PAPI_sample_next( EventSet, EventCode, &sample ) ) == 1 ) {
+		retval = append_sample( t, &sample, event );
+		if ( retval != PAPI_OK )
+			return retval;
+		t->lost[event] = sample.lost;
+		count++;
+	}
+	if ( retval < 0 )
+		return retval;
+
+	retval = PAPI_sample_release( EventSet, EventCode );
+	if ( retval != PAPI_OK )
+		return retval;
+
+	return count;
+}
+
+/** @class PAPI_sample_trace_close
+ *	@brief Finish a trace file.
+ *
+ *	@par C Interface:
+ *	\#include <papi.h> @n
+ *	int PAPI_sample_trace_close( int trace );
+ *
+ *	Writes out the samples still buffered and the file header.  Traces
+ *	still open at PAPI_shutdown() are closed there.
+ *
+ *	@retval PAPI_EINVAL
+ *		trace is not open.
+ *	@retval PAPI_ESYS
+ *		the file could not be written.
+ *
+ *	@see PAPI_sample_trace_open
+ */
+int
+PAPI_sample_trace_close( int trace )
+{
+	PapiTrace_t *t;
+
+	_papi_hwi_lock( INTERNAL_LOCK );
+	t = lookup_trace( trace );
+	if ( t != NULL )
+		traces[trace] = NULL;
+	_papi_hwi_unlock( INTERNAL_LOCK );
+
+	if ( t == NULL )
+		return PAPI_EINVAL;
+
+	return close_trace( t );
+}
+
+/* Close the traces the program left open */
+void
+_papi_hwi_shutdown_traces( void )
+{
+	int i;
+
+	for ( i = 0; i < PAPI_MAX_TRACES; i++ ) {
+		if ( traces[i] != NULL ) {
+			close_trace( traces[i] );
+			traces[i] = NULL;
+		}
+	}
+}
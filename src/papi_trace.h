@@ -0,0 +1,70 @@
+/**
+ * @file    papi_trace.h
+ * @brief   Layout of the sample trace files written by PAPI_sample_trace_write().
+ *
+ * A trace is a PAPI_TRACE_HEADER_SIZE byte header followed by chunks of
+ * exactly chunk_size bytes, so chunk i starts at
+ * PAPI_TRACE_HEADER_SIZE + i * chunk_size and a reader can mmap the file
+ * and jump to any chunk.  Each chunk starts with a papi_trace_chunk_t that
+ * covers the time and address range of its records, so whole chunks can
+ * be skipped without looking at the records.
+ *
+ * A record is a papi_trace_record_t followed by nr_ips 64 bit call chain
+ * entries.  Records are 8 byte aligned and never cross a chunk.  The time
+ * of a record is the time of the previous record in the chunk (start_time
+ * for the first one) plus time_delta.
+ *
+ * All fields are in the byte order of the machine that wrote the trace.
+ */
+
+#ifndef PAPI_TRACE_H
+#define PAPI_TRACE_H
+
+#include <stdint.h>
+
+#define PAPI_TRACE_MAGIC        "PAPITRC1"
+#define PAPI_TRACE_VERSION      1
+#define PAPI_TRACE_HEADER_SIZE  4096
+#define PAPI_TRACE_CHUNK_SIZE   ( 1024 * 1024 )
+#define PAPI_TRACE_CHUNK_MAGIC  0x4b4e4843	/* "CHNK" */
+#define PAPI_TRACE_MAX_EVENTS   30
+#define PAPI_TRACE_NAME_LEN     128
+
+typedef struct {
+	char magic[8];              /* PAPI_TRACE_MAGIC */
+	uint32_t version;           /* PAPI_TRACE_VERSION */
+	uint32_t header_size;       /* PAPI_TRACE_HEADER_SIZE */
+	uint32_t chunk_size;        /* size of every chunk */
+	uint32_t nr_chunks;         /* chunks following the header */
+	uint32_t nr_events;         /* entries used in events[] */
+	uint32_t pad;
+	uint64_t nr_records;        /* records in all chunks */
+	uint64_t lost;              /* samples the kernel dropped */
+	char events[PAPI_TRACE_MAX_EVENTS][PAPI_TRACE_NAME_LEN]; /* event names */
+} papi_trace_header_t;
+
+typedef struct {
+	uint32_t magic;             /* PAPI_TRACE_CHUNK_MAGIC */
+	uint32_t nr_records;        /* records in this chunk */
+	uint32_t size;              /* bytes used, including this header */
+	uint32_t pad;
+	uint64_t start_time;        /* time of the first record */
+	uint64_t end_time;          /* time of the last record */
+	uint64_t min_ip;            /* lowest ip of the records */
+	uint64_t max_ip;            /* highest ip of the records */
+	uint64_t reserved[2];
+} papi_trace_chunk_t;
+
+typedef struct {
+	uint32_t time_delta;        /* time since the previous record */
+	uint16_t event;             /* index into the header events[] */
+	uint16_t nr_ips;            /* call chain entries after the record */
+	uint32_t tid;
+	uint32_t cpu;
+	uint64_t ip;
+	uint64_t period;
+} papi_trace_record_t;
+
+void _papi_hwi_shutdown_traces( void );
+
+#endif /* PAPI_TRACE_H */
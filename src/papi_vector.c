@@ -160,6 +160,24 @@ _papi_hwi_innoculate_vector( papi_vector_t * v )
 	if ( !v->set_profile )
 		v->set_profile =
 			( int ( * )( EventSetInfo_t *, int, int ) ) vec_int_dummy;
+	if ( !v->set_sample )
+		v->set_sample =
+			( int ( * )( EventSetInfo_t *, int, int, int ) ) vec_int_dummy;
+	if ( !v->sample_next )
+		v->sample_next =
+			( int ( * )( hwd_control_state_t *, int, PAPI_sample_t * ) )
+			vec_int_dummy;
+	if ( !v->sample_release )
+		v->sample_release =
+			( int ( * )( hwd_control_state_t *, int ) ) vec_int_dummy;
+	if ( !v->overflow_lost )
+		v->overflow_lost =
+			( int ( * )( hwd_control_state_t *, int, long long * ) )
+			vec_int_dummy;
+	if ( !v->read_mpx )
+		v->read_mpx =
+			( int ( * )( hwd_control_state_t *, int, PAPI_mpx_value_t * ) )
+			vec_int_dummy;
 
 	if ( !v->set_domain )
 		v->set_domain =
@@ -227,6 +245,10 @@ _papi_hwi_innoculate_os_vector( papi_os_vector_t * v )
 	if ( !v->get_dmem_info )
 		v->get_dmem_info = ( int ( * )( PAPI_dmem_info_t * ) ) vec_int_dummy;
 
+	if ( !v->shutdown_thread )
+		v->shutdown_thread =
+			( int ( * )( ThreadInfo_t * ) ) vec_int_ok_dummy;
+
 	return PAPI_OK;
 }
 
@@ -322,6 +344,16 @@ vector_print_table( papi_vector_t * v, int print_func )
 						  print_func );
 	vector_print_routine( ( void * ) v->set_profile, "_papi_hwd_set_profile",
 						  print_func );
+	vector_print_routine( ( void * ) v->set_sample, "_papi_hwd_set_sample",
+						  print_func );
+	vector_print_routine( ( void * ) v->sample_next, "_papi_hwd_sample_next",
+						  print_func );
+	vector_print_routine( ( void * ) v->sample_release,
+						  "_papi_hwd_sample_release", print_func );
+	vector_print_routine( ( void * ) v->overflow_lost,
+						  "_papi_hwd_overflow_lost", print_func );
+	vector_print_routine( ( void * ) v->read_mpx, "_papi_hwd_read_mpx",
+						  print_func );
 	vector_print_routine( ( void * ) v->set_domain, "_papi_hwd_set_domain",
 						  print_func );
 	vector_print_routine( ( void * ) v->ntv_enum_events,
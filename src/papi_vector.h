@@ -39,6 +39,11 @@ typedef struct papi_vectors {
     int		(*ctl)			(hwd_context_t *, int , _papi_int_option_t *);	/**< */
     int		(*set_overflow)		(EventSetInfo_t *, int, int);				/**< */
     int		(*set_profile)		(EventSetInfo_t *, int, int);				/**< */
+    int		(*set_sample)		(EventSetInfo_t *, int, int, int);			/**< */
+    int		(*sample_next)		(hwd_control_state_t *, int, PAPI_sample_t *);	/**< */
+    int		(*sample_release)	(hwd_control_state_t *, int);				/**< */
+    int		(*overflow_lost)	(hwd_control_state_t *, int, long long *);	/**< */
+    int		(*read_mpx)		(hwd_control_state_t *, int, PAPI_mpx_value_t *);	/**< */
     int		(*set_domain)		(hwd_control_state_t *, int);				/**< */
     int		(*ntv_enum_events)	(unsigned int *, int);						/**< */
     int		(*ntv_name_to_code)	(char *, unsigned int *);					/**< */
@@ -68,6 +73,7 @@ typedef struct papi_os_vectors {
   int         (*get_system_info)      (papi_mdi_t * mdi);       /**< */
   int         (*get_memory_info)      (PAPI_hw_info_t *, int);  /**< */
   int         (*get_dmem_info)        (PAPI_dmem_info_t *);     /**< */
+  int         (*shutdown_thread)      (ThreadInfo_t *);         /**< */
 } papi_os_vector_t;
 
 extern papi_os_vector_t _papi_os_vector;
@@ -133,6 +133,11 @@ for advertising or product endorsement purposes.
 
 #define MPX_MINCYC 25000
 
+/* Floor on the squared coefficient of variation of an event's
+ * per-slice rate, so perfectly steady events still get slices
+ * now and then under the adaptive schedule. */
+#define MPX_ADAPT_MINCV2 1.0e-6
+
 /* Globals for this file. */
 
 /** List of threads that are multiplexing. */
@@ -147,6 +152,21 @@ static unsigned int randomseed;
 #include <errno.h>
 #include <unistd.h> 
 #include <assert.h>
+#include <signal.h>
+#include <time.h>
+
+/* Each thread rotates its counters on its own CPU time timer, which
+ * signals only that thread and carries its Threadlist along.  Without
+ * it one process wide itimer drives all threads. */
+#if defined(__linux__) && defined(SIGEV_THREAD_ID)
+#include <sys/syscall.h>
+#define MPX_THREAD_TIMERS
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+/** Set when timer_create() failed once, to stop trying */
+static int thread_timers_broken = 0;
+#endif
 
 static sigset_t sigreset;
 static struct itimerval itime;
@@ -174,7 +194,7 @@ static void mpx_delete_events( MPX_EventSet * );
 static void mpx_delete_one_event( MPX_EventSet * mpx_events, int Event );
 static int mpx_insert_events( MPX_EventSet *, int *event_list, int num_events,
 							  int domain, int granularity );
-static void mpx_handler( int signal );
+static void mpx_handler( int signal, siginfo_t * info, void *uc );
 
 inline_static void
 mpx_hold( void )
@@ -218,8 +238,58 @@ mpx_init_timers( int interval )
 	sigaddset( &sigreset, _papi_os_info.itimer_sig );
 }
 
+#ifdef MPX_THREAD_TIMERS
+/* Arm the multiplex timer of thread t, the calling thread */
 static int
-mpx_startup_itimer( void )
+mpx_startup_thread_timer( Threadlist * t )
+{
+	struct sigevent sev;
+	struct itimerspec its;
+
+	if ( thread_timers_broken )
+		return PAPI_ESYS;
+
+	if ( !t->has_timer ) {
+		memset( &sev, 0, sizeof ( sev ) );
+		sev.sigev_notify = SIGEV_THREAD_ID;
+		sev.sigev_signo = _papi_os_info.itimer_sig;
+		sev.sigev_value.sival_ptr = t;
+		sev.sigev_notify_thread_id = ( pid_t ) syscall( SYS_gettid );
+
+		if ( timer_create( CLOCK_THREAD_CPUTIME_ID, &sev, &t->timer ) == -1 ) {
+			MPXDBG( "timer_create errno %d, using setitimer\n", errno );
+			thread_timers_broken = 1;
+			return PAPI_ESYS;
+		}
+		t->has_timer = 1;
+	}
+
+	its.it_interval.tv_sec = itime.it_interval.tv_sec;
+	its.it_interval.tv_nsec = itime.it_interval.tv_usec * 1000;
+	its.it_value.tv_sec = itime.it_value.tv_sec;
+	its.it_value.tv_nsec = itime.it_value.tv_usec * 1000;
+
+	if ( timer_settime( t->timer, 0, &its, NULL ) == -1 ) {
+		PAPIERROR( "timer_settime start errno %d", errno );
+		return PAPI_ESYS;
+	}
+	return PAPI_OK;
+}
+
+static void
+mpx_shutdown_thread_timer( Threadlist * t )
+{
+	static const struct itimerspec stop = { {0, 0}, {0, 0} };
+
+	if ( t->has_timer ) {
+		if ( timer_settime( t->timer, 0, &stop, NULL ) == -1 )
+			PAPIERROR( "timer_settime stop errno %d", errno );
+	}
+}
+#endif
+
+static int
+mpx_startup_itimer( Threadlist * t )
 {
 	struct sigaction sigact;
 
@@ -227,14 +297,21 @@ mpx_startup_itimer( void )
 
 	MPXDBG( "PID %d\n", getpid(  ) );
 	memset( &sigact, 0, sizeof ( sigact ) );
-	sigact.sa_flags = SA_RESTART;
-	sigact.sa_handler = mpx_handler;
+	sigact.sa_flags = SA_RESTART | SA_SIGINFO;
+	sigact.sa_sigaction = mpx_handler;
 
 	if ( sigaction( _papi_os_info.itimer_sig, &sigact, NULL ) == -1 ) {
 		PAPIERROR( "sigaction start errno %d", errno );
 		return PAPI_ESYS;
 	}
 
+#ifdef MPX_THREAD_TIMERS
+	if ( mpx_startup_thread_timer( t ) == PAPI_OK )
+		return PAPI_OK;
+#else
+	( void ) t;
+#endif
+
 	if ( setitimer( _papi_os_info.itimer_num, &itime, NULL ) == -1 ) {
 		sigaction( _papi_os_info.itimer_sig, &oaction, NULL );
 		PAPIERROR( "setitimer start errno %d", errno );
@@ -253,9 +330,24 @@ mpx_restore_signal( void )
 	}
 }
 
+/* Stop the timer driving thread t, or all timers if t is NULL */
 static void
-mpx_shutdown_itimer( void )
+mpx_shutdown_itimer( Threadlist * t )
 {
+#ifdef MPX_THREAD_TIMERS
+	Threadlist *u;
+
+	if ( t != NULL && t->has_timer ) {
+		mpx_shutdown_thread_timer( t );
+		return;
+	}
+	if ( t == NULL ) {
+		for ( u = tlist; u != NULL; u = u->next )
+			mpx_shutdown_thread_timer( u );
+	}
+#else
+	( void ) t;
+#endif
 	MPXDBG( "setitimer off\n" );
 	if ( _papi_os_info.itimer_num != PAPI_NULL ) {
 		if ( setitimer( _papi_os_info.itimer_num,
@@ -342,6 +434,8 @@ mpx_add_event( MPX_EventSet ** mpx_events, int EventCode, int domain,
 
 		t->head = NULL;
 		t->cur_event = NULL;
+		t->adaptive = 0;
+		t->has_timer = 0;
 		t->next = tlist;
 		tlist = t;
 		MPXDBG( "New head is at %p(%lu).\n", tlist,
@@ -440,9 +534,89 @@ int _PNE_PM_RUN_CYC;
 #define SCALE_EVENT PAPI_TOT_CYC
 #endif
 
+/* Running mean and sum of squared deviations (Welford) of the
+ * rate an event showed over each slice long enough to trust. */
+static void
+mpx_update_rate_stats( MasterEvent * mev, double rate )
+{
+	double delta;
+
+	mev->slices++;
+	delta = rate - mev->rate_mean;
+	mev->rate_mean += delta / ( double ) mev->slices;
+	mev->rate_m2 += delta * ( rate - mev->rate_mean );
+}
+
+/* How much one more slice would shrink the relative variance of
+ * the event's extrapolated count: cv^2/n - cv^2/(n+1).  Always
+ * handing the next slice to the largest gain ends up giving each
+ * event slices in proportion to its coefficient of variation. */
+static double
+mpx_slice_gain( MasterEvent * mev )
+{
+	double n = ( double ) mev->slices, cv2;
+
+	/* Not enough slices yet to know; measure it first */
+	if ( mev->slices < 2 )
+		return 1.0e30;
+
+	if ( mev->rate_mean > 0.0 ) {
+		cv2 = mev->rate_m2 / ( n - 1.0 ) /
+			( mev->rate_mean * mev->rate_mean );
+		if ( cv2 < MPX_ADAPT_MINCV2 )
+			cv2 = MPX_ADAPT_MINCV2;
+	} else
+		cv2 = MPX_ADAPT_MINCV2;
+
+	return cv2 / ( n * ( n + 1.0 ) );
+}
+
+/* Pick the event for the next slice of an adaptive thread.  An active
+ * event that has fallen a whole slice behind its min_share is taken
+ * first, the one furthest behind winning; otherwise the largest
+ * mpx_slice_gain().  The walk starts after cur_event, so ties (and
+ * the initial measuring of every event) go round robin. */
+static MasterEvent *
+mpx_adaptive_next( MasterEvent * head, MasterEvent * cur_event )
+{
+	MasterEvent *mev, *best = NULL, *starved = NULL;
+	long long deficit, worst = 99;
+	double gain, best_gain = -1.0;
+
+	mev = ( cur_event->next == NULL ) ? head : cur_event->next;
+	for ( ;; ) {
+		if ( mev->active ) {
+			mev->ticks++;
+			deficit = ( long long ) mev->min_share * mev->ticks -
+				100 * mev->runs;
+			if ( deficit > worst ) {
+				worst = deficit;
+				starved = mev;
+			}
+			gain = mpx_slice_gain( mev );
+			if ( gain > best_gain ) {
+				best_gain = gain;
+				best = mev;
+			}
+		}
+		if ( mev == cur_event )
+			break;
+		mev = ( mev->next == NULL ) ? head : mev->next;
+	}
+
+	if ( starved != NULL )
+		best = starved;
+	if ( best == NULL )
+		return cur_event;
+
+	best->runs++;
+	MPXDBG( "adaptive: next event %p, slices %lld gain %g%s\n", best,
+			best->slices, best_gain, starved ? " (min share)" : "" );
+	return best;
+}
 
 static void
-mpx_handler( int signal )
+mpx_handler( int signal, siginfo_t * info, void *uc )
 {
 	int retval;
 	MasterEvent *mev, *head;
@@ -460,9 +634,23 @@ mpx_handler( int signal )
 #endif
 
 	signal = signal;		 /* unused */
+	( void ) uc;
 
 	MPXDBG( "Handler in thread\n" );
 
+#ifdef MPX_THREAD_TIMERS
+	/* The timer of a thread only ever signals that thread, and says
+	 * whose it is: no lookup, no lock, nobody else to tell. */
+	if ( ( info != NULL ) && ( info->si_code == SI_TIMER ) &&
+		 ( info->si_value.sival_ptr != NULL ) ) {
+		me = ( Threadlist * ) info->si_value.sival_ptr;
+		head = me->head;
+		goto rotate;
+	}
+#else
+	( void ) info;
+#endif
+
 	/* This handler can be invoked either when a timer expires
 	 * or when another thread in this handler responding to the
 	 * timer signals other threads.  We have to distinguish
@@ -530,6 +718,9 @@ mpx_handler( int signal )
 
 	/* See if this thread has an active event list */
 	head = get_my_threads_master_event_list(  );
+#ifdef MPX_THREAD_TIMERS
+  rotate:
+#endif
 	if ( head != NULL ) {
 
 		/* Get the thread header for this master event set.  It's
@@ -570,6 +761,8 @@ mpx_handler( int signal )
 					if ( cycles >= MPX_MINCYC ) {	/* Only update current rate on a decent slice */
 						cur_event->rate_estimate =
 							( double ) counts[0] / ( double ) cycles;
+						mpx_update_rate_stats( cur_event,
+											   cur_event->rate_estimate );
 					}
 					cur_event->count_estimate +=
 						( long long ) ( ( double ) total_cycles *
@@ -584,6 +777,8 @@ mpx_handler( int signal )
 					 */
 					if ( cycles >= MPX_MINCYC ) {
 						cur_event->cycles += 1;
+						mpx_update_rate_stats( cur_event,
+											   ( double ) counts[0] );
 					} else {
 						cur_event->count -= counts[0];
 					}
@@ -605,7 +800,10 @@ mpx_handler( int signal )
 			 * but only after considerating all the other
 			 * possible events.
 			 */
-			if ( ( retval != PAPI_OK ) ||
+			if ( me->adaptive && ( retval == PAPI_OK ) &&
+				 ( cycles >= MPX_MINCYC ) ) {
+				me->cur_event = mpx_adaptive_next( head, cur_event );
+			} else if ( ( retval != PAPI_OK ) ||
 				 ( ( retval == PAPI_OK ) && ( cycles >= MPX_MINCYC ) ) ) {
 				for ( mev =
 					  ( cur_event->next == NULL ) ? head : cur_event->next;
@@ -689,7 +887,7 @@ MPX_add_events( MPX_EventSet ** mpx_events, int *event_list, int num_events,
 }
 
 int
-MPX_start( MPX_EventSet * mpx_events )
+MPX_start( MPX_EventSet * mpx_events, int flags, int min_share )
 {
 	int retval = PAPI_OK;
 	int i;
@@ -721,12 +919,19 @@ MPX_start( MPX_EventSet * mpx_events )
 	/* Make all events in this set active, and for those
 	 * already active, get the current count and cycles.
 	 */
+	if ( !( flags & PAPI_MULTIPLEX_ADAPTIVE ) )
+		min_share = 0;
+
 	for ( i = 0; i < mpx_events->num_events; i++ ) {
 		MasterEvent *mev = mpx_events->mev[i];
 
 		if ( mev->active++ ) {
+			/* Shared with another running set: the larger share holds */
+			if ( mev->min_share < min_share )
+				mev->min_share = min_share;
 			mpx_events->start_values[i] = mev->count_estimate;
 			mpx_events->start_hc[i] = mev->cycles;
+			mpx_events->start_raw[i] = mev->count;
 
 			/* If this happens to be the currently-running
 			 * event, add in the current amounts from this
@@ -766,10 +971,14 @@ MPX_start( MPX_EventSet * mpx_events )
 			mpx_events->start_values[i] = 0;
 			mpx_events->stop_values[i] = 0;
 			mpx_events->start_hc[i] = mev->cycles = 0;
+			mpx_events->start_raw[i] = 0;
 			mev->count_estimate = 0;
 			mev->rate_estimate = 0.0;
 			mev->prev_total_c = current_thread_mpx_c;
 			mev->count = 0;
+			mev->slices = mev->runs = mev->ticks = 0;
+			mev->rate_mean = mev->rate_m2 = 0.0;
+			mev->min_share = min_share;
 		}
 		/* Adjust start value to include events and cycles
 		 * counted previously for this event set.
@@ -777,6 +986,8 @@ MPX_start( MPX_EventSet * mpx_events )
 	}
 
 	mpx_events->status = MPX_RUNNING;
+	mpx_events->adaptive = ( flags & PAPI_MULTIPLEX_ADAPTIVE ) != 0;
+	t->adaptive += mpx_events->adaptive;
 
 	/* Start first counter if one isn't already running */
 	if ( t->cur_event == NULL ) {
@@ -814,7 +1025,7 @@ MPX_start( MPX_EventSet * mpx_events )
 
 	mpx_release(  );
 
-	retval = mpx_startup_itimer(  );
+	retval = mpx_startup_itimer( t );
 
 	return retval;
 }
@@ -856,6 +1067,8 @@ MPX_read( MPX_EventSet * mpx_events, long long *values, int called_by_stop )
 			else {
 				mpx_events->stop_values[i] = mev->count;
 			}
+			mpx_events->stop_raw[i] = mev->count;
+			mpx_events->stop_hc[i] = mev->cycles;
 #ifdef MPX_NONDECR_HYBRID
 			/* If we are called from MPX_stop() then      */
                         /* adjust the final values based on the       */
@@ -933,6 +1146,44 @@ MPX_read( MPX_EventSet * mpx_events, long long *values, int called_by_stop )
 	return PAPI_OK;
 }
 
+/* MPX_read() plus what each count was extrapolated from.  enabled is
+ * the cycles the set has been running, running the cycles of the
+ * completed slices the event had; the error estimate comes from the
+ * per-slice rates the handler collects for the adaptive schedule. */
+int
+MPX_read_mpx( MPX_EventSet * mpx_events, PAPI_mpx_value_t * values )
+{
+	int i, retval;
+	long long counts[PAPI_MAX_SW_MPX_EVENTS];
+
+	retval = MPX_read( mpx_events, counts, 0 );
+	if ( retval != PAPI_OK )
+		return retval;
+
+	mpx_hold(  );
+	for ( i = 0; i < mpx_events->num_events; i++ ) {
+		MasterEvent *mev = mpx_events->mev[i];
+		PAPI_mpx_value_t *v = &values[i];
+
+		v->value = counts[i];
+		v->raw = mpx_events->stop_raw[i] - mpx_events->start_raw[i];
+		v->enabled = mpx_events->stop_c - mpx_events->start_c;
+		if ( mev->is_a_rate ) {
+			/* cycles holds the number of slices, nothing to scale */
+			v->running = v->enabled;
+		} else {
+			v->running = mpx_events->stop_hc[i] - mpx_events->start_hc[i];
+		}
+		v->scale = ( v->running > 0 ) ?
+			( double ) v->enabled / ( double ) v->running : 0.0;
+		v->std_error = _papi_hwi_mpx_std_error( mev->slices, mev->rate_m2,
+												v->enabled, v->running );
+	}
+	mpx_release(  );
+
+	return PAPI_OK;
+}
+
 int
 MPX_reset( MPX_EventSet * mpx_events )
 {
@@ -958,7 +1209,8 @@ MPX_reset( MPX_EventSet * mpx_events )
 		} else {
 			mpx_events->start_values[i] += values[i];
 		}
-		mpx_events->start_hc[i] = mev->cycles;
+		mpx_events->start_hc[i] = mpx_events->stop_hc[i] = mev->cycles;
+		mpx_events->start_raw[i] = mpx_events->stop_raw[i] = mev->count;
 	}
 
 	/* Set the start time for this set to the current cycle count */
@@ -1006,6 +1258,8 @@ MPX_stop( MPX_EventSet * mpx_events, long long *values )
 	/* Get this threads data structure */
 	thr = head->mythr;
 	cur_event = thr->cur_event;
+	thr->adaptive -= mpx_events->adaptive;
+	mpx_events->adaptive = 0;
 
 	/* This would be a good spot to "hold" the counter and then restart
 	 * it at the end, but PAPI_start resets counters so it is not possible
@@ -1050,7 +1304,7 @@ MPX_stop( MPX_EventSet * mpx_events, long long *values )
 				retval = PAPI_start( thr->cur_event->papi_event );
 				assert( retval == PAPI_OK );
 			} else {
-				mpx_shutdown_itimer(  );
+				mpx_shutdown_itimer( thr );
 			}
 		}
 	}
@@ -1102,7 +1356,7 @@ void
 MPX_shutdown( void )
 {
 	MPXDBG( "%d\n", getpid(  ) );
-	mpx_shutdown_itimer(  );
+	mpx_shutdown_itimer( NULL );
 	mpx_restore_signal(  );
 
 	if ( tlist ) {
@@ -1110,6 +1364,10 @@ MPX_shutdown( void )
 
 		while(t!=NULL) {
 		   next=t->next;
+#ifdef MPX_THREAD_TIMERS
+		   if ( t->has_timer )
+		      timer_delete( t->timer );
+#endif
 		   papi_free( t );
 		   t = next;			
 		}
@@ -1162,7 +1420,7 @@ mpx_init( int interval_ns )
 #endif
 	tlist = NULL;
 	mpx_hold(  );
-	mpx_shutdown_itimer(  );
+	mpx_shutdown_itimer( NULL );
 	mpx_init_timers( interval_ns / 1000 );
 
 	return ( PAPI_OK );
@@ -1215,6 +1473,9 @@ mpx_insert_events( MPX_EventSet *mpx_events, int *event_list,
 		   mev->prev_total_c = mev->count = mev->cycles = 0;
 		   mev->rate_estimate = 0.0;
 		   mev->count_estimate = 0;
+		   mev->slices = mev->runs = mev->ticks = 0;
+		   mev->rate_mean = mev->rate_m2 = 0.0;
+		   mev->min_share = 0;
 		   mev->is_a_rate = 0;
 		   mev->papi_event = PAPI_NULL;
 			
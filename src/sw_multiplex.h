@@ -15,6 +15,8 @@ typedef enum
 
 typedef struct _MPX_EventSet {
   MPX_status status;
+  /** Set while this EventSet counts towards its thread's adaptive schedule */
+  int adaptive;
   /** Pointer to this thread's structure */
   struct _threadlist *mythr;
   /** Pointers to this EventSet's MPX entries in the master list for this thread */
@@ -26,12 +28,17 @@ typedef struct _MPX_EventSet {
   long long start_values[PAPI_MAX_SW_MPX_EVENTS];
   long long stop_values[PAPI_MAX_SW_MPX_EVENTS];
   long long start_hc[PAPI_MAX_SW_MPX_EVENTS];
+  /** Counts and cycles of the completed slices, as of start and last read */
+  long long start_raw[PAPI_MAX_SW_MPX_EVENTS];
+  long long stop_raw[PAPI_MAX_SW_MPX_EVENTS];
+  long long stop_hc[PAPI_MAX_SW_MPX_EVENTS];
 } MPX_EventSet;
 
 typedef struct EventSetMultiplexInfo {
   MPX_EventSet *mpx_evset;
   int ns;
   int flags;
+  int min_share;
 } EventSetMultiplexInfo_t;
 
 int mpx_check( int EventSet );
@@ -46,6 +53,7 @@ int MPX_cleanup( MPX_EventSet ** mpx_events );
 void MPX_shutdown( void );
 int MPX_reset( MPX_EventSet * mpx_events );
 int MPX_read( MPX_EventSet * mpx_events, long long *values, int called_by_stop );
-int MPX_start( MPX_EventSet * mpx_events );
+int MPX_read_mpx( MPX_EventSet * mpx_events, PAPI_mpx_value_t * values );
+int MPX_start( MPX_EventSet * mpx_events, int flags, int min_share );
 
 #endif /* MULTIPLEX_H */
@@ -37,6 +37,21 @@ volatile ThreadInfo_t *_papi_hwi_thread_head;
 THREAD_LOCAL_STORAGE_KEYWORD ThreadInfo_t *_papi_hwi_my_thread;
 #endif
 
+/* threads hashed by tid, read by _papi_hwi_lookup_thread() without a lock */
+
+ThreadInfo_t *volatile _papi_hwi_thread_hash[PAPI_THREAD_HASH_SIZE];
+
+/* Lookups in flight, counted per epoch.  A removed thread is retired  */
+/* instead of freed; once no lookup of the previous epoch is left, the */
+/* threads retired before the current epoch started can be freed and   */
+/* the epoch moves on.  Both lists are protected by THREADS_LOCK.      */
+
+volatile unsigned int _papi_hwi_thread_epoch;
+volatile int _papi_hwi_thread_readers[2];
+
+static ThreadInfo_t *retired_threads;		/* retired in this epoch */
+static ThreadInfo_t *retired_threads_prev;	/* retired in the previous one */
+
 /* Function that returns and unsigned long thread identifier */
 
 unsigned long ( *_papi_hwi_thread_id_fn ) ( void );
@@ -161,7 +176,74 @@ allocate_thread( int tid )
 }
 
 static void
-free_thread( ThreadInfo_t ** thread )
+free_retired_threads( ThreadInfo_t * list )
+{
+	ThreadInfo_t *next;
+
+	while ( list != NULL ) {
+		next = list->next;
+		THRDBG( "Releasing retired thread at %p\n", list );
+		papi_free( list );
+		list = next;
+	}
+}
+
+/* Hand a removed thread over for freeing once no lookup can see it.
+   THREADS_LOCK must be held. */
+
+static void
+retire_thread( ThreadInfo_t * thread )
+{
+	unsigned int epoch = _papi_hwi_thread_epoch;
+
+	thread->next = retired_threads;
+	retired_threads = thread;
+
+	/* Lookups that started before the current epoch are gone, so */
+	/* whatever was retired before it can't be referenced anymore */
+	if ( _papi_hwi_thread_readers[( epoch + 1 ) & 1] == 0 ) {
+		free_retired_threads( retired_threads_prev );
+		retired_threads_prev = retired_threads;
+		retired_threads = NULL;
+		__sync_synchronize(  );
+		_papi_hwi_thread_epoch = epoch + 1;
+	}
+}
+
+/* THREADS_LOCK must be held for the following two */
+
+static void
+hash_thread( ThreadInfo_t * entry )
+{
+	unsigned int h = _papi_hwi_thread_hash_fn( entry->tid );
+
+	entry->hash_next = _papi_hwi_thread_hash[h];
+	/* make the entry visible only once it is complete */
+	__sync_synchronize(  );
+	_papi_hwi_thread_hash[h] = entry;
+}
+
+static void
+unhash_thread( ThreadInfo_t * entry )
+{
+	ThreadInfo_t *volatile *link;
+
+	/* entry->hash_next is left alone, a lookup standing on */
+	/* entry must still be able to walk past it             */
+	for ( link = &_papi_hwi_thread_hash[_papi_hwi_thread_hash_fn( entry->tid )];
+	      *link != NULL; link = &( *link )->hash_next ) {
+		if ( *link == entry ) {
+			*link = entry->hash_next;
+			break;
+		}
+	}
+}
+
+/* published is set for threads that have been in the hash, those */
+/* have to wait for lookups that may still be reading them         */
+
+static void
+free_thread( ThreadInfo_t ** thread, int published )
 {
 	int i;
 	THRDBG( "Freeing thread %ld at %p\n", ( *thread )->tid, *thread );
@@ -177,8 +259,14 @@ free_thread( ThreadInfo_t ** thread )
 	if ( ( *thread )->running_eventset )
 		papi_free( ( *thread )->running_eventset );
 
-	memset( *thread, 0x00, sizeof ( ThreadInfo_t ) );
-	papi_free( *thread );
+	if ( published ) {
+		_papi_hwi_lock( THREADS_LOCK );
+		retire_thread( *thread );
+		_papi_hwi_unlock( THREADS_LOCK );
+	} else {
+		memset( *thread, 0x00, sizeof ( ThreadInfo_t ) );
+		papi_free( *thread );
+	}
 	*thread = NULL;
 }
 
@@ -205,6 +293,8 @@ insert_thread( ThreadInfo_t * entry, int tid )
 
 	_papi_hwi_thread_head = entry;
 
+	hash_thread( entry );
+
 	THRDBG( "_papi_hwi_thread_head now thread %ld at %p\n",
 			_papi_hwi_thread_head->tid, _papi_hwi_thread_head );
 
@@ -243,9 +333,12 @@ remove_thread( ThreadInfo_t * entry )
 	if ( tmp != entry ) {
 		THRDBG( "Thread %ld at %p was not found in the thread list!\n",
 				entry->tid, entry );
+		_papi_hwi_unlock( THREADS_LOCK );
 		return ( PAPI_EBUG );
 	}
 
+	unhash_thread( entry );
+
 	/* Only 1 element in list */
 
 	if ( prev == tmp ) {
@@ -292,7 +385,7 @@ _papi_hwi_initialize_thread( ThreadInfo_t ** dest, int tid )
 	    if (_papi_hwd[i]->cmp_info.disabled) continue;
 	    retval = _papi_hwd[i]->init_thread( thread->context[i] );
 	    if ( retval ) {
-	       free_thread( &thread );
+	       free_thread( &thread, 0 );
 	       *dest = NULL;
 	       return retval;
 	    }
@@ -367,10 +460,15 @@ _papi_hwi_set_thread_id_fn( unsigned long ( *id_fn ) ( void ) )
 
 	THRDBG( "Set new thread id function to %p\n", id_fn );
 
+	/* the tid changes, so does the hash bucket */
+	_papi_hwi_lock( THREADS_LOCK );
+	unhash_thread( ( ThreadInfo_t * ) _papi_hwi_thread_head );
 	if ( id_fn )
 		_papi_hwi_thread_head->tid = ( *_papi_hwi_thread_id_fn ) (  );
 	else
 		_papi_hwi_thread_head->tid = ( unsigned long ) getpid(  );
+	hash_thread( ( ThreadInfo_t * ) _papi_hwi_thread_head );
+	_papi_hwi_unlock( THREADS_LOCK );
 
 	THRDBG( "New master tid is %ld\n", _papi_hwi_thread_head->tid );
 #else
@@ -442,7 +540,8 @@ _papi_hwi_shutdown_thread( ThreadInfo_t * thread, int force_shutdown )
 		   retval = _papi_hwd[i]->shutdown_thread( thread->context[i]);
 		   if ( retval != PAPI_OK ) failure = retval;
 		}
-		free_thread( &thread );
+		_papi_os_vector.shutdown_thread( thread );
+		free_thread( &thread, 1 );
 		return ( failure );
 	}
 
@@ -520,6 +619,14 @@ _papi_hwi_shutdown_global_threads( void )
 	_papi_hwi_thread_kill_fn = NULL;
 #endif
 
+	/* nobody can be looking threads up anymore */
+	_papi_hwi_lock( THREADS_LOCK );
+	free_retired_threads( retired_threads_prev );
+	free_retired_threads( retired_threads );
+	retired_threads_prev = NULL;
+	retired_threads = NULL;
+	_papi_hwi_unlock( THREADS_LOCK );
+
 	return err;
 }
 
@@ -550,6 +657,30 @@ _papi_hwi_init_global_threads( void )
 	return ( retval );
 }
 
+/* Set up the context of a component initialized after these threads were */
+int
+_papi_hwi_init_thread_component( int cidx )
+{
+	int retval = PAPI_OK;
+	ThreadInfo_t *foo = NULL;
+
+	_papi_hwi_lock( THREADS_LOCK );
+
+	for ( foo = ( ThreadInfo_t * ) _papi_hwi_thread_head; foo != NULL;
+		  foo = foo->next ) {
+		retval = _papi_hwd[cidx]->init_thread( foo->context[cidx] );
+		if ( retval != PAPI_OK )
+			break;
+
+		if ( foo->next == _papi_hwi_thread_head )
+			break;
+	}
+
+	_papi_hwi_unlock( THREADS_LOCK );
+
+	return ( retval );
+}
+
 int
 _papi_hwi_gather_all_thrspec_data( int tag, PAPI_all_thr_spec_t * where )
 {
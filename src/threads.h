@@ -25,11 +25,16 @@ typedef struct _ThreadInfo
 	unsigned long int tid;
 	unsigned long int allocator_tid;
 	struct _ThreadInfo *next;
+	struct _ThreadInfo *volatile hash_next;  /* next thread in the same tid hash bucket */
 	hwd_context_t **context;
 	void *thread_storage[PAPI_MAX_TLS];
 	EventSetInfo_t **running_eventset;
 	EventSetInfo_t *from_esi;          /* ESI used for last update this control state */
 	int wants_signal;
+	int virt_fd;                       /* task-clock event fd + 1, 0 until first use, -1 if none */
+	void *virt_page;                   /* its mmap page, NULL if not read from user space */
+	long long virt_base;               /* thread cpu time when the event was opened */
+	long long virt_last;               /* last virtual time handed out */
 } ThreadInfo_t;
 
 /** The list of threads, gets initialized to master process with TID of getpid() 
@@ -43,6 +48,30 @@ extern volatile ThreadInfo_t *_papi_hwi_thread_head;
 extern THREAD_LOCAL_STORAGE_KEYWORD ThreadInfo_t *_papi_hwi_my_thread;
 #endif
 
+/** Threads hashed by tid, for lookups without THREADS_LOCK.
+ *  Threads are added and removed under THREADS_LOCK; a removed thread
+ *  is only freed once no lookup that could still see it is running.
+ *  Lookups announce themselves in _papi_hwi_thread_readers for the
+ *  current _papi_hwi_thread_epoch, see threads.c.
+ *	@internal */
+
+#define PAPI_THREAD_HASH_BITS 10
+#define PAPI_THREAD_HASH_SIZE ( 1 << PAPI_THREAD_HASH_BITS )
+
+extern ThreadInfo_t *volatile _papi_hwi_thread_hash[PAPI_THREAD_HASH_SIZE];
+extern volatile unsigned int _papi_hwi_thread_epoch;
+extern volatile int _papi_hwi_thread_readers[2];
+
+inline_static unsigned int
+_papi_hwi_thread_hash_fn( unsigned long int tid )
+{
+	/* pthread ids are aligned pointers, use the high bits of a */
+	/* multiplicative hash so they spread over the buckets      */
+	return ( unsigned int ) ( ( ( unsigned long long ) tid *
+				    0x9E3779B97F4A7C15ULL ) >>
+				  ( 64 - PAPI_THREAD_HASH_BITS ) );
+}
+
 /** Function that returns an unsigned long int thread identifier 
  *	@internal */
 
@@ -55,6 +84,7 @@ extern int ( *_papi_hwi_thread_kill_fn ) ( int, int );
 
 extern int _papi_hwi_initialize_thread( ThreadInfo_t ** dest, int tid );
 extern int _papi_hwi_init_global_threads( void );
+extern int _papi_hwi_init_thread_component( int cidx );
 extern int _papi_hwi_shutdown_thread( ThreadInfo_t * thread, int force );
 extern int _papi_hwi_shutdown_global_threads( void );
 extern int _papi_hwi_broadcast_signal( unsigned int mytid );
@@ -93,6 +123,7 @@ _papi_hwi_lookup_thread( int custom_tid )
 {
 
 	unsigned long int tid;
+	unsigned int epoch;
 	ThreadInfo_t *tmp;
 
 
@@ -115,28 +146,32 @@ _papi_hwi_lookup_thread( int custom_tid )
 	}
 	THRDBG( "Threads initialized, looking for thread %#lx\n", tid );
 
-	_papi_hwi_lock( THREADS_LOCK );
+	/* Announce this lookup in the current epoch, so threads it may */
+	/* still see are not freed under it.  If the epoch moved on     */
+	/* while doing that, announce it in the new one.                */
+	do {
+		epoch = _papi_hwi_thread_epoch;
+		__sync_fetch_and_add( &_papi_hwi_thread_readers[epoch & 1], 1 );
+		if ( epoch == _papi_hwi_thread_epoch )
+			break;
+		__sync_fetch_and_sub( &_papi_hwi_thread_readers[epoch & 1], 1 );
+	} while ( 1 );
 
-	tmp = ( ThreadInfo_t * ) _papi_hwi_thread_head;
-	while ( tmp != NULL ) {
+	for ( tmp = _papi_hwi_thread_hash[_papi_hwi_thread_hash_fn( tid )];
+	      tmp != NULL; tmp = tmp->hash_next ) {
 		THRDBG( "Examining thread tid %#lx at %p\n", tmp->tid, tmp );
 		if ( tmp->tid == tid )
 			break;
-		tmp = tmp->next;
-		if ( tmp == _papi_hwi_thread_head ) {
-			tmp = NULL;
-			break;
-		}
 	}
 
+	__sync_fetch_and_sub( &_papi_hwi_thread_readers[epoch & 1], 1 );
+
 	if ( tmp ) {
-		_papi_hwi_thread_head = tmp;
 		THRDBG( "Found thread %ld at %p\n", tid, tmp );
 	} else {
 		THRDBG( "Did not find tid %ld\n", tid );
 	}
 
-	_papi_hwi_unlock( THREADS_LOCK );
 	return ( tmp );
 
 }
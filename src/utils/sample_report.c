@@ -0,0 +1,363 @@
+/* This file summarizes the sample trace files written by PAPI_sample_trace_write() */
+/** file sample_report.c
+  * @brief papi_sample_report utility.
+  *	@page papi_sample_report
+  *	@section  NAME
+  *		papi_sample_report - shows where the samples of a PAPI sample trace fell.
+  *
+  *	@section Synopsis
+  *		papi_sample_report [-e event] [-g bytes] [-s symfile] [-t start:end] [-n lines] [-h] tracefile
+  *
+  *	@section Description
+  *		papi_sample_report is a PAPI utility program that reads a trace
+  *		written with PAPI_sample_trace_write() and counts the samples per
+  *		address range, or per function when given a symbol list.  The
+  *		trace is mapped, not read, and chunks outside of the requested time
+  *		range are skipped using their index, so very large traces can be
+  *		looked at piecewise.
+  *
+  *	@section Options
+  *	<ul>
+  *		<li>-e event	Only count the samples of this event.
+  *		<li>-g bytes	Size of the address ranges samples are counted in, default 64.
+  *		<li>-s symfile	Count per function, symfile is the output of nm -n on the program.
+  *		<li>-t start:end	Only count samples taken in this time range (ns).
+  *		<li>-n lines	Number of lines to print, default 20, 0 for all.
+  *		<li>-h	Display help information about this utility.
+  *	</ul>
+  *
+  *	@section Bugs
+  *		There are no known bugs in this utility.
+  *		If you find a bug, it should be reported to the
+  *		PAPI Mailing List at <ptools-perfapi@ptools.org>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "papi_trace.h"
+
+#define UNKNOWN_KEY ( ~( uint64_t ) 0 )
+
+typedef struct {
+	uint64_t addr;
+	char *name;
+} symbol_t;
+
+typedef struct {
+	uint64_t key;
+	uint64_t count;
+} bucket_t;
+
+static symbol_t *symbols;
+static size_t num_symbols;
+
+static bucket_t *buckets;
+static size_t num_buckets, used_buckets;
+
+static void
+print_help( void )
+{
+	printf( "This is the PAPI sample report utility program.\n" );
+	printf( "It shows where the samples of a PAPI sample trace fell.\n" );
+	printf( "Usage:\n\n" );
+	printf( "    papi_sample_report [options] tracefile\n\n" );
+	printf( "Options:\n\n" );
+	printf( "  -e event      only count the samples of this event\n" );
+	printf( "  -g bytes      size of the address ranges, default 64\n" );
+	printf( "  -s symfile    count per function, symfile is from nm -n\n" );
+	printf( "  -t start:end  only count samples in this time range (ns)\n" );
+	printf( "  -n lines      number of lines to print, default 20, 0 for all\n" );
+	printf( "  -h            print this help message\n" );
+	printf( "\n" );
+}
+
+static int
+symbol_cmp( const void *a, const void *b )
+{
+	const symbol_t *x = a, *y = b;
+
+	return ( x->addr > y->addr ) - ( x->addr < y->addr );
+}
+
+/* Read the text symbols of an nm listing */
+static int
+read_symbols( const char *file )
+{
+	char line[BUFSIZ], name[BUFSIZ], type;
+	unsigned long long addr;
+	size_t max = 0;
+	FILE *fff;
+
+	fff = fopen( file, "r" );
+	if ( fff == NULL ) {
+		perror( file );
+		return -1;
+	}
+
+	while ( fgets( line, sizeof ( line ), fff ) ) {
+		if ( sscanf( line, "%llx %c %s", &addr, &type, name ) != 3 )
+			continue;
+		if ( ( type != 't' ) && ( type != 'T' ) &&
+			 ( type != 'w' ) && ( type != 'W' ) )
+			continue;
+		if ( num_symbols == max ) {
+			max = max ? max * 2 : 1024;
+			symbols = realloc( symbols, max * sizeof ( symbol_t ) );
+			if ( symbols == NULL ) {
+				fclose( fff );
+				return -1;
+			}
+		}
+		symbols[num_symbols].addr = addr;
+		symbols[num_symbols].name = strdup( name );
+		num_symbols++;
+	}
+	fclose( fff );
+
+	qsort( symbols, num_symbols, sizeof ( symbol_t ), symbol_cmp );
+
+	return 0;
+}
+
+/* Index of the function an address is in, UNKNOWN_KEY if none */
+static uint64_t
+find_symbol( uint64_t ip )
+{
+	size_t lo = 0, hi = num_symbols;
+
+	while ( lo < hi ) {
+		size_t mid = lo + ( hi - lo ) / 2;
+		if ( symbols[mid].addr <= ip )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo ? lo - 1 : UNKNOWN_KEY;
+}
+
+static bucket_t *
+find_bucket( uint64_t key )
+{
+	size_t i;
+
+	i = ( size_t ) ( ( key * 0x9e3779b97f4a7c15ULL ) >> 20 ) &
+		( num_buckets - 1 );
+	while ( buckets[i].count && ( buckets[i].key != key ) )
+		i = ( i + 1 ) & ( num_buckets - 1 );
+
+	return &buckets[i];
+}
+
+static void
+count_sample( uint64_t key )
+{
+	bucket_t *b, *old;
+	size_t i, old_num;
+
+	/* keep the table at most half full */
+	if ( 2 * ( used_buckets + 1 ) > num_buckets ) {
+		old = buckets;
+		old_num = num_buckets;
+		num_buckets = num_buckets ? num_buckets * 2 : 4096;
+		buckets = calloc( num_buckets, sizeof ( bucket_t ) );
+		if ( buckets == NULL ) {
+			fprintf( stderr, "Out of memory\n" );
+			exit( 1 );
+		}
+		for ( i = 0; i < old_num; i++ ) {
+			if ( old[i].count )
+				*find_bucket( old[i].key ) = old[i];
+		}
+		free( old );
+	}
+
+	b = find_bucket( key );
+	if ( b->count == 0 ) {
+		b->key = key;
+		used_buckets++;
+	}
+	b->count++;
+}
+
+static int
+bucket_cmp( const void *a, const void *b )
+{
+	const bucket_t *x = a, *y = b;
+
+	if ( x->count != y->count )
+		return ( x->count < y->count ) - ( x->count > y->count );
+	return ( x->key > y->key ) - ( x->key < y->key );
+}
+
+int
+main( int argc, char **argv )
+{
+	const char *event = NULL, *symfile = NULL, *file = NULL;
+	unsigned long long start = 0, end = UNKNOWN_KEY;
+	uint64_t granularity = 64, total = 0, skipped = 0, time, key;
+	const papi_trace_header_t *header;
+	const papi_trace_chunk_t *chunk;
+	const papi_trace_record_t *rec;
+	const unsigned char *base, *p, *chunk_end;
+	int event_index = -1, lines = 20;
+	unsigned int c, i, r;
+	struct stat st;
+	int fd;
+
+	for ( i = 1; i < ( unsigned int ) argc; i++ ) {
+		if ( !strcmp( argv[i], "-e" ) && ( i + 1 < ( unsigned int ) argc ) )
+			event = argv[++i];
+		else if ( !strcmp( argv[i], "-g" ) && ( i + 1 < ( unsigned int ) argc ) )
+			granularity = strtoull( argv[++i], NULL, 0 );
+		else if ( !strcmp( argv[i], "-s" ) && ( i + 1 < ( unsigned int ) argc ) )
+			symfile = argv[++i];
+		else if ( !strcmp( argv[i], "-n" ) && ( i + 1 < ( unsigned int ) argc ) )
+			lines = atoi( argv[++i] );
+		else if ( !strcmp( argv[i], "-t" ) && ( i + 1 < ( unsigned int ) argc ) ) {
+			if ( sscanf( argv[++i], "%llu:%llu", &start, &end ) != 2 ) {
+				print_help(  );
+				exit( 1 );
+			}
+		} else if ( ( argv[i][0] != '-' ) && ( file == NULL ) )
+			file = argv[i];
+		else {
+			print_help(  );
+			exit( 1 );
+		}
+	}
+
+	if ( ( file == NULL ) || ( granularity == 0 ) ) {
+		print_help(  );
+		exit( 1 );
+	}
+
+	if ( symfile && read_symbols( symfile ) ) {
+		exit( 1 );
+	}
+
+	fd = open( file, O_RDONLY );
+	if ( ( fd < 0 ) || fstat( fd, &st ) ) {
+		perror( file );
+		exit( 1 );
+	}
+	if ( st.st_size < PAPI_TRACE_HEADER_SIZE ) {
+		fprintf( stderr, "%s is not a PAPI sample trace\n", file );
+		exit( 1 );
+	}
+
+	base = mmap( NULL, ( size_t ) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	if ( base == MAP_FAILED ) {
+		perror( "mmap" );
+		exit( 1 );
+	}
+	close( fd );
+	madvise( ( void * ) base, ( size_t ) st.st_size, MADV_SEQUENTIAL );
+
+	header = ( const papi_trace_header_t * ) base;
+	if ( memcmp( header->magic, PAPI_TRACE_MAGIC, sizeof ( header->magic ) ) ||
+		 ( header->version != PAPI_TRACE_VERSION ) ||
+		 ( header->nr_events > PAPI_TRACE_MAX_EVENTS ) ||
+		 ( header->header_size + ( uint64_t ) header->nr_chunks *
+		   header->chunk_size > ( uint64_t ) st.st_size ) ) {
+		fprintf( stderr, "%s is not a complete PAPI sample trace\n", file );
+		exit( 1 );
+	}
+
+	if ( event ) {
+		for ( i = 0; i < header->nr_events; i++ ) {
+			if ( !strcmp( header->events[i], event ) )
+				event_index = ( int ) i;
+		}
+		if ( event_index < 0 ) {
+			fprintf( stderr, "%s has no samples of %s\n", file, event );
+			exit( 1 );
+		}
+	}
+
+	for ( c = 0; c < header->nr_chunks; c++ ) {
+		p = base + header->header_size + ( size_t ) c * header->chunk_size;
+		chunk = ( const papi_trace_chunk_t * ) p;
+		if ( ( chunk->magic != PAPI_TRACE_CHUNK_MAGIC ) ||
+			 ( chunk->size > header->chunk_size ) ) {
+			fprintf( stderr, "chunk %u is corrupt, skipping it\n", c );
+			continue;
+		}
+
+		/* the chunk index lets us skip whole chunks */
+		if ( ( chunk->end_time < start ) || ( chunk->start_time > end ) ) {
+			skipped += chunk->nr_records;
+			continue;
+		}
+
+		chunk_end = p + chunk->size;
+		p += sizeof ( *chunk );
+		time = chunk->start_time;
+		for ( r = 0; r < chunk->nr_records; r++ ) {
+			rec = ( const papi_trace_record_t * ) p;
+			if ( p + sizeof ( *rec ) > chunk_end )
+				break;
+			p += sizeof ( *rec ) + rec->nr_ips * sizeof ( uint64_t );
+			time += rec->time_delta;
+
+			if ( ( time < start ) || ( time > end ) ||
+				 ( ( event_index >= 0 ) && ( rec->event != event_index ) ) ) {
+				skipped++;
+				continue;
+			}
+
+			if ( symfile )
+				key = find_symbol( rec->ip );
+			else
+				key = rec->ip - rec->ip % granularity;
+			count_sample( key );
+			total++;
+		}
+	}
+
+	printf( "Trace          : %s\n", file );
+	printf( "Events         :" );
+	for ( i = 0; i < header->nr_events; i++ )
+		printf( " %s", header->events[i] );
+	printf( "\n" );
+	printf( "Samples        : %llu in %u chunks, %llu lost\n",
+			( unsigned long long ) header->nr_records, header->nr_chunks,
+			( unsigned long long ) header->lost );
+	printf( "Counted        : %llu, %llu filtered out\n\n",
+			( unsigned long long ) total, ( unsigned long long ) skipped );
+
+	if ( total == 0 )
+		return 0;
+
+	/* compact the table and sort it by count */
+	for ( i = 0, r = 0; i < num_buckets; i++ ) {
+		if ( buckets[i].count )
+			buckets[r++] = buckets[i];
+	}
+	qsort( buckets, used_buckets, sizeof ( bucket_t ), bucket_cmp );
+
+	printf( "%12s %7s  %s\n", "samples", "%", symfile ? "function" : "address range" );
+	for ( i = 0; i < used_buckets; i++ ) {
+		if ( lines && ( i == ( unsigned int ) lines ) )
+			break;
+		printf( "%12llu %6.2f%%  ", ( unsigned long long ) buckets[i].count,
+				100.0 * ( double ) buckets[i].count / ( double ) total );
+		if ( buckets[i].key == UNKNOWN_KEY )
+			printf( "[unknown]\n" );
+		else if ( symfile )
+			printf( "%s\n", symbols[buckets[i].key].name );
+		else
+			printf( "%#llx-%#llx\n", ( unsigned long long ) buckets[i].key,
+					( unsigned long long ) ( buckets[i].key + granularity - 1 ) );
+	}
+
+	munmap( ( void * ) base, ( size_t ) st.st_size );
+
+	return 0;
+}